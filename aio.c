@@ -0,0 +1,374 @@
+#include "aio.h"
+#include "threadpool.h"
+#include <errno.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif
+
+/**
+ * Reads the rest of a read that came back short, or all of it, with pread.
+ * Returns 1 on success and 0 on failure or at the end of the file.
+ */
+static int finish_read(AsyncRead *read, size_t done) {
+    ssize_t n;
+
+    while (done < read->size) {
+        n = pread(read->fd, read->buffer + done, read->size - done,
+                (off_t) (read->offset + done));
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n <= 0) {
+            return 0;
+        }
+        done += (size_t) n;
+    }
+    return 1;
+}
+
+/**
+ * Records the outcome of a read and wakes its submitter if it was the last
+ * one of the batch. The lock must be held.
+ */
+static void complete(AsyncReader *reader, AsyncRead *read, int result) {
+    read->result = result;
+    if (--read->batch->remaining == 0) {
+        pthread_cond_broadcast(&reader->done);
+    }
+}
+
+/**
+ * Pool task performing one read when there is no ring.
+ */
+static void read_task(void *arg) {
+    AsyncRead *read = (AsyncRead *) arg;
+    AsyncReader *reader = read->reader;
+    int result = finish_read(read, 0);
+
+    pthread_mutex_lock(&reader->lock);
+    complete(reader, read, result);
+    pthread_mutex_unlock(&reader->lock);
+}
+
+#ifdef HAVE_IO_URING
+/**
+ * Thin wrappers around the io_uring system calls, which libc does not
+ * provide.
+ */
+static int ring_setup(unsigned int entries, struct io_uring_params *params) {
+    return (int) syscall(__NR_io_uring_setup, entries, params);
+}
+
+static int ring_enter(int ring, unsigned int submit, unsigned int wait,
+        unsigned int flags) {
+    return (int) syscall(__NR_io_uring_enter, ring, submit, wait, flags,
+            NULL, 0);
+}
+
+/**
+ * Sets up the ring and maps its queues into the reader. Returns 1 on success
+ * and 0 if the kernel does not support or allow io_uring.
+ */
+static int ring_open(AsyncReader *reader) {
+    struct io_uring_params params;
+    unsigned char *sq, *cq;
+
+    memset(&params, 0, sizeof(params));
+    if ((reader->ring = ring_setup(AIO_RING_ENTRIES, &params)) < 0) {
+        return 0;
+    }
+    reader->sq_entries = params.sq_entries;
+    reader->cq_entries = params.cq_entries;
+    reader->sq_map_size = params.sq_off.array
+        + params.sq_entries * sizeof(unsigned int);
+    reader->cq_map_size = params.cq_off.cqes
+        + params.cq_entries * sizeof(struct io_uring_cqe);
+    reader->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        if (reader->cq_map_size > reader->sq_map_size) {
+            reader->sq_map_size = reader->cq_map_size;
+        }
+        reader->cq_map_size = 0;
+    }
+
+    reader->sq_map = mmap(NULL, reader->sq_map_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, reader->ring, IORING_OFF_SQ_RING);
+    reader->cq_map = reader->cq_map_size == 0 ? reader->sq_map
+        : mmap(NULL, reader->cq_map_size, PROT_READ | PROT_WRITE,
+                MAP_SHARED | MAP_POPULATE, reader->ring, IORING_OFF_CQ_RING);
+    reader->sqes = mmap(NULL, reader->sqes_size, PROT_READ | PROT_WRITE,
+            MAP_SHARED | MAP_POPULATE, reader->ring, IORING_OFF_SQES);
+    if (reader->sq_map == MAP_FAILED || reader->cq_map == MAP_FAILED
+            || reader->sqes == MAP_FAILED) {
+        if (reader->sq_map != MAP_FAILED) {
+            munmap(reader->sq_map, reader->sq_map_size);
+        }
+        if (reader->cq_map_size && reader->cq_map != MAP_FAILED) {
+            munmap(reader->cq_map, reader->cq_map_size);
+        }
+        if (reader->sqes != MAP_FAILED) {
+            munmap(reader->sqes, reader->sqes_size);
+        }
+        close(reader->ring);
+        reader->ring = -1;
+        return 0;
+    }
+
+    sq = (unsigned char *) reader->sq_map;
+    cq = (unsigned char *) reader->cq_map;
+    reader->sq_head = (unsigned int *) (sq + params.sq_off.head);
+    reader->sq_tail = (unsigned int *) (sq + params.sq_off.tail);
+    reader->sq_mask = (unsigned int *) (sq + params.sq_off.ring_mask);
+    reader->sq_array = (unsigned int *) (sq + params.sq_off.array);
+    reader->cq_head = (unsigned int *) (cq + params.cq_off.head);
+    reader->cq_tail = (unsigned int *) (cq + params.cq_off.tail);
+    reader->cq_mask = (unsigned int *) (cq + params.cq_off.ring_mask);
+    reader->cqes = cq + params.cq_off.cqes;
+    return 1;
+}
+
+/**
+ * Unmaps the queues and closes the ring.
+ */
+static void ring_close(AsyncReader *reader) {
+    munmap(reader->sq_map, reader->sq_map_size);
+    if (reader->cq_map_size) {
+        munmap(reader->cq_map, reader->cq_map_size);
+    }
+    munmap(reader->sqes, reader->sqes_size);
+    close(reader->ring);
+}
+
+/**
+ * Hands the queued entries to the kernel. The lock must be held. Returns 1
+ * on success and 0 on failure.
+ */
+static int ring_submit(AsyncReader *reader, unsigned int *queued) {
+    int n;
+
+    while (*queued > 0) {
+        n = ring_enter(reader->ring, *queued, 0, 0);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n <= 0) {
+            return 0;
+        }
+        reader->inflight += (unsigned int) n;
+        *queued -= (unsigned int) n;
+    }
+    return 1;
+}
+
+/**
+ * Completes every read whose completion has arrived. The lock must be held.
+ * A read that came back short is finished with pread.
+ */
+static void ring_drain(AsyncReader *reader) {
+    struct io_uring_cqe *cqes = (struct io_uring_cqe *) reader->cqes;
+    struct io_uring_cqe *cqe;
+    unsigned int head, tail;
+    AsyncRead *read;
+
+    head = *reader->cq_head;
+    tail = __atomic_load_n(reader->cq_tail, __ATOMIC_ACQUIRE);
+    while (head != tail) {
+        cqe = &cqes[head & *reader->cq_mask];
+        read = (AsyncRead *) (uintptr_t) cqe->user_data;
+        if (cqe->res < 0) {
+            complete(reader, read, finish_read(read, 0));
+        }
+        else {
+            complete(reader, read, finish_read(read, (size_t) cqe->res));
+        }
+        reader->inflight--;
+        head++;
+    }
+    __atomic_store_n(reader->cq_head, head, __ATOMIC_RELEASE);
+}
+
+/**
+ * Waits for completions as the thread reaping for everyone, or for the
+ * reaping thread to post them if another thread already is. The lock must be
+ * held; it is released while blocked in the kernel.
+ */
+static void ring_wait(AsyncReader *reader) {
+    if (reader->reaping) {
+        pthread_cond_wait(&reader->done, &reader->lock);
+        return;
+    }
+    reader->reaping = 1;
+    pthread_mutex_unlock(&reader->lock);
+    ring_enter(reader->ring, 0, 1, IORING_ENTER_GETEVENTS);
+    pthread_mutex_lock(&reader->lock);
+    ring_drain(reader);
+    reader->reaping = 0;
+    pthread_cond_broadcast(&reader->done);
+}
+
+/**
+ * Queues the reads as submission entries and submits them in one system
+ * call, then waits until the batch has completed, reaping completions for
+ * any other batches in flight along the way. Entries are submitted early
+ * only when the queue fills up, and submission waits for completions while
+ * as many reads are in flight as the completion queue can hold. Reads that
+ * cannot be submitted fall back to pread.
+ */
+static void ring_read_all(AsyncReader *reader, AsyncRead *reads, int n,
+        AsyncBatch *batch) {
+    struct io_uring_sqe *sqes = (struct io_uring_sqe *) reader->sqes;
+    struct io_uring_sqe *sqe;
+    unsigned int tail, index, queued = 0;
+    int i;
+
+    pthread_mutex_lock(&reader->lock);
+    for (i = 0; i < n; i++) {
+        while (reader->inflight + queued >= reader->cq_entries
+                || queued == reader->sq_entries) {
+            if (!ring_submit(reader, &queued)) {
+                break;
+            }
+            if (reader->inflight >= reader->cq_entries) {
+                ring_wait(reader);
+            }
+        }
+        if (queued == reader->sq_entries) {
+            complete(reader, &reads[i], finish_read(&reads[i], 0));
+            continue;
+        }
+
+        tail = *reader->sq_tail;
+        index = tail & *reader->sq_mask;
+        sqe = &sqes[index];
+        memset(sqe, 0, sizeof(*sqe));
+        sqe->opcode = IORING_OP_READ;
+        sqe->fd = reads[i].fd;
+        sqe->off = reads[i].offset;
+        sqe->addr = (unsigned long long) (uintptr_t) reads[i].buffer;
+        sqe->len = (unsigned int) reads[i].size;
+        sqe->user_data = (unsigned long long) (uintptr_t) &reads[i];
+        reader->sq_array[index] = index;
+        __atomic_store_n(reader->sq_tail, tail + 1, __ATOMIC_RELEASE);
+        queued++;
+    }
+    if (!ring_submit(reader, &queued)) {
+        // Take the unsubmitted entries back and read them directly.
+        tail = *reader->sq_tail;
+        while (queued > 0) {
+            tail--;
+            queued--;
+            index = reader->sq_array[tail & *reader->sq_mask];
+            complete(reader, (AsyncRead *) (uintptr_t) sqes[index].user_data,
+                    finish_read((AsyncRead *) (uintptr_t)
+                        sqes[index].user_data, 0));
+        }
+        __atomic_store_n(reader->sq_tail, tail, __ATOMIC_RELEASE);
+    }
+    while (batch->remaining > 0) {
+        ring_wait(reader);
+    }
+    pthread_mutex_unlock(&reader->lock);
+}
+#endif
+
+/**
+ * Creates a reader, using a ring if the build and the kernel support it and
+ * a pool of AIO_THREADS threads otherwise. Returns a pointer to the new
+ * reader, or NULL if memory allocation or thread creation fails.
+ */
+AsyncReader *aio_create(void) {
+    AsyncReader *reader;
+
+    if (!(reader = (AsyncReader *) calloc(1, sizeof(AsyncReader)))) {
+        return NULL;
+    }
+    reader->ring = -1;
+#ifdef HAVE_IO_URING
+    ring_open(reader);
+#endif
+    if (reader->ring < 0 && !(reader->pool = pool_create(AIO_THREADS))) {
+        free(reader);
+        return NULL;
+    }
+    pthread_mutex_init(&reader->lock, NULL);
+    pthread_cond_init(&reader->done, NULL);
+    return reader;
+}
+
+/**
+ * Destroys the reader, closing the ring or stopping the pool.
+ */
+void aio_destroy(AsyncReader *reader) {
+    if (!reader) {
+        return;
+    }
+#ifdef HAVE_IO_URING
+    if (reader->ring >= 0) {
+        ring_close(reader);
+    }
+#endif
+    pool_destroy(reader->pool);
+    pthread_mutex_destroy(&reader->lock);
+    pthread_cond_destroy(&reader->done);
+    free(reader);
+}
+
+/**
+ * Returns one if the reader submits reads through io_uring; zero otherwise.
+ */
+int aio_uses_ring(AsyncReader *reader) {
+    return reader && reader->ring >= 0;
+}
+
+/**
+ * Submits all of the given reads at once and waits until every one has
+ * completed. Reads that cannot be queued on the pool are done directly.
+ * Returns 1 if all succeeded and 0 otherwise.
+ */
+int aio_read_all(AsyncReader *reader, AsyncRead *reads, int n) {
+    AsyncBatch batch;
+    int i, ok;
+
+    if (!reader || n <= 0) {
+        return n == 0;
+    }
+    batch.remaining = n;
+    for (i = 0; i < n; i++) {
+        reads[i].result = 0;
+        reads[i].batch = &batch;
+        reads[i].reader = reader;
+    }
+
+#ifdef HAVE_IO_URING
+    if (reader->ring >= 0) {
+        ring_read_all(reader, reads, n, &batch);
+    }
+    else
+#endif
+    {
+        for (i = 0; i < n; i++) {
+            if (!pool_submit(reader->pool, read_task, &reads[i])) {
+                ok = finish_read(&reads[i], 0);
+                pthread_mutex_lock(&reader->lock);
+                complete(reader, &reads[i], ok);
+                pthread_mutex_unlock(&reader->lock);
+            }
+        }
+        pthread_mutex_lock(&reader->lock);
+        while (batch.remaining > 0) {
+            pthread_cond_wait(&reader->done, &reader->lock);
+        }
+        pthread_mutex_unlock(&reader->lock);
+    }
+
+    for (i = 0, ok = 1; i < n; i++) {
+        ok = ok && reads[i].result;
+    }
+    return ok;
+}
@@ -0,0 +1,100 @@
+#ifndef AIO_H
+#define AIO_H
+
+#include "threadpool.h"
+#include <pthread.h>
+#include <stddef.h>
+
+/*
+ * Number of submission queue entries of the ring, and of threads serving
+ * reads when there is no ring.
+ */
+#define AIO_RING_ENTRIES 128
+#define AIO_THREADS 8
+
+/**
+ * A batch of reads submitted together. Remaining counts the reads not yet
+ * completed; the submitter waits for it to reach zero.
+ */
+struct AsyncBatch {
+    int remaining;
+};
+
+typedef struct AsyncBatch AsyncBatch;
+
+/**
+ * One read of size bytes at the given file offset into the buffer. Result is
+ * set to 1 once all the bytes have been read and to 0 if the read fails.
+ */
+struct AsyncRead {
+    int fd;
+    unsigned char *buffer;
+    size_t size;
+    unsigned long long offset;
+    int result;
+    AsyncBatch *batch;
+    struct AsyncReader *reader;
+};
+
+typedef struct AsyncRead AsyncRead;
+
+/**
+ * Submits batches of reads and waits for them to complete. Reads go through
+ * an io_uring instance when the build has HAVE_IO_URING and the kernel
+ * allows it, and through a pool of threads calling pread otherwise. Either
+ * way the reads of a batch run concurrently, and batches submitted from
+ * different threads share the ring or the pool. With a ring, one waiting
+ * thread at a time reaps completions for everyone.
+ */
+struct AsyncReader {
+    int ring;
+    unsigned int *sq_head;
+    unsigned int *sq_tail;
+    unsigned int *sq_mask;
+    unsigned int *sq_array;
+    unsigned int *cq_head;
+    unsigned int *cq_tail;
+    unsigned int *cq_mask;
+    void *sqes;
+    void *cqes;
+    void *sq_map;
+    void *cq_map;
+    size_t sq_map_size;
+    size_t cq_map_size;
+    size_t sqes_size;
+    unsigned int sq_entries;
+    unsigned int cq_entries;
+    unsigned int inflight;
+    int reaping;
+    ThreadPool *pool;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+typedef struct AsyncReader AsyncReader;
+
+/**
+ * Creates a reader, setting up a ring if possible and a thread pool
+ * otherwise. Returns a pointer to the new reader, or NULL if the call fails.
+ */
+AsyncReader *aio_create(void);
+
+/**
+ * Destroys the reader. No batch may be in flight.
+ */
+void aio_destroy(AsyncReader *);
+
+/**
+ * Returns one if the reader submits reads through io_uring; zero if it uses
+ * threads.
+ */
+int aio_uses_ring(AsyncReader *);
+
+/**
+ * Submits all of the given reads at once and waits until every one has
+ * completed. Returns 1 if all succeeded and 0 otherwise; each read's result
+ * tells which.
+ */
+int aio_read_all(AsyncReader *, AsyncRead *, int);
+
+#endif
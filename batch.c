@@ -0,0 +1,381 @@
+#include "batch.h"
+#include "engine.h"
+#include "stats.h"
+#include "tokenizer.h"
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * A query waiting in the admission queue: its line, its number in the
+ * input and the time it was read.
+ */
+struct Admission {
+    char *line;
+    unsigned long number;
+    double arrival;
+};
+
+typedef struct Admission Admission;
+
+/**
+ * The state shared by the reader and the workers of a batch: a ring of
+ * admitted queries, the limits every query runs under and the outcome
+ * totals. Answers are written to standard out under the output lock.
+ */
+struct Batch {
+    IndexHandle *handle;
+    ThreadPool *pool;
+    SlowLog *log;
+    double deadline;
+    size_t budget;
+    Admission queue[BATCH_QUEUE_SIZE];
+    int head;
+    int count;
+    int closed;
+    pthread_mutex_t lock;
+    pthread_cond_t nonempty;
+    pthread_cond_t nonfull;
+    pthread_mutex_t output;
+    unsigned long answered;
+    unsigned long truncated;
+    unsigned long shed;
+};
+
+typedef struct Batch Batch;
+
+/**
+ * The answer to one query being written by a worker: the stream it is
+ * written to, the index the query runs on and a buffer the filenames are
+ * decoded into.
+ */
+struct Answer {
+    FILE *out;
+    Index *index;
+    char *name;
+    size_t namecap;
+    size_t printed;
+    unsigned long number;
+};
+
+typedef struct Answer Answer;
+
+/**
+ * Writes an answer to standard out in one piece, so that the answers of
+ * concurrent queries never interleave.
+ */
+static void publish(Batch *batch, const char *text, size_t size) {
+    pthread_mutex_lock(&batch->output);
+    fwrite(text, 1, size, stdout);
+    fflush(stdout);
+    pthread_mutex_unlock(&batch->output);
+}
+
+/**
+ * Sheds a query, telling the reader why it was not answered.
+ */
+static void shed(Batch *batch, unsigned long number, const char *reason) {
+    char text[128];
+    int size;
+
+    size = snprintf(text, sizeof(text), "[%lu] Rejected: %s.\n", number,
+            reason);
+    publish(batch, text, (size_t) size);
+    pthread_mutex_lock(&batch->lock);
+    batch->shed++;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Adds a query to the admission queue. While the queue is full the reader
+ * waits, for a query with a deadline only until that deadline. Returns 1 if
+ * the query was admitted and 0 if it was shed, in which case its line is
+ * freed.
+ */
+static int admit(Batch *batch, char *line, unsigned long number,
+        double arrival) {
+    struct timespec until;
+    double end = arrival + batch->deadline;
+    int ok = 1;
+
+    until.tv_sec = (time_t) end;
+    until.tv_nsec = (long) ((end - (double) until.tv_sec) * 1e9);
+    pthread_mutex_lock(&batch->lock);
+    while (ok && batch->count == BATCH_QUEUE_SIZE) {
+        if (batch->deadline > 0) {
+            ok = pthread_cond_timedwait(&batch->nonfull, &batch->lock,
+                    &until) != ETIMEDOUT;
+        }
+        else {
+            pthread_cond_wait(&batch->nonfull, &batch->lock);
+        }
+    }
+    if (ok) {
+        batch->queue[(batch->head + batch->count++) % BATCH_QUEUE_SIZE]
+            = (Admission) {line, number, arrival};
+        pthread_cond_signal(&batch->nonempty);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    if (!ok) {
+        free(line);
+        shed(batch, number, "too many queries are waiting");
+    }
+    return ok;
+}
+
+/**
+ * Takes the next query off the admission queue, waiting for one. Returns 1
+ * on success and 0 once the queue is closed and empty.
+ */
+static int take(Batch *batch, Admission *next) {
+    int ok;
+
+    pthread_mutex_lock(&batch->lock);
+    while (batch->count == 0 && !batch->closed) {
+        pthread_cond_wait(&batch->nonempty, &batch->lock);
+    }
+    if ((ok = batch->count > 0)) {
+        *next = batch->queue[batch->head];
+        batch->head = (batch->head + 1) % BATCH_QUEUE_SIZE;
+        batch->count--;
+        pthread_cond_signal(&batch->nonfull);
+    }
+    pthread_mutex_unlock(&batch->lock);
+    return ok;
+}
+
+/**
+ * Writes the filename of a resulting document, preceded by the result
+ * header if it is the first one. The argument is an Answer.
+ */
+static void write_doc(unsigned int doc, void *arg) {
+    Answer *answer = (Answer *) arg;
+
+    if (answer->printed++ == 0) {
+        fprintf(answer->out, "[%lu] Your search returned: \n",
+                answer->number);
+    }
+    doc_name(answer->index, doc, answer->name);
+    fprintf(answer->out, "'%s' ", answer->name);
+}
+
+/**
+ * Grows the answer's name buffer to hold the longest filename of its index.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+static int reserve_answer_name(Answer *answer) {
+    size_t size = answer->index->docs->maxlen + 1;
+    char *grown;
+
+    if (size <= answer->namecap) {
+        return 1;
+    }
+    else if (!(grown = (char *) realloc(answer->name, size))) {
+        return 0;
+    }
+    answer->name = grown;
+    answer->namecap = size;
+    return 1;
+}
+
+/**
+ * Evaluates a query on the index pinned in the given slot, notes it in the
+ * slow-query log and writes its answer, worded like the interactive
+ * searcher's.
+ */
+static void answer_query(Batch *batch, int slot, const Admission *query,
+        Answer *answer) {
+    QueryPlan *plan;
+    QueryTrace trace;
+    TokenizerT tk;
+    const char *first;
+    size_t len, count;
+    int count_only, truncated;
+
+    TKInit(&tk, " \t\n", query->line, strlen(query->line));
+    if (!TKNextSlice(&tk, &first, &len) || len != 2 || first[0] != 's'
+            || (first[1] != 'a' && first[1] != 'o')) {
+        fprintf(answer->out, "[%lu] That's not a valid input.\n",
+                query->number);
+        return;
+    }
+    answer->index = handle_pin(batch->handle, slot);
+    if (!(plan = plan_create(answer->index, &tk, first[1] == 'a',
+                    batch->budget, batch->deadline > 0
+                    ? query->arrival + batch->deadline : 0))) {
+        fprintf(answer->out, "[%lu] That's not a valid input.\n",
+                query->number);
+        handle_unpin(batch->handle, slot);
+        return;
+    }
+    trace.arrival = query->arrival;
+    trace.planned = stats_now();
+    plan->pool = batch->pool;
+    answer->printed = 0;
+    if (plan->count_only) {
+        count = plan_count(plan);
+    }
+    else {
+        count = reserve_answer_name(answer)
+            ? plan_run(plan, write_doc, answer) : (size_t) -1;
+    }
+    trace.finished = stats_now();
+    trace.results = count == (size_t) -1 ? 0 : count;
+    slowlog_note(batch->log, query->line, plan, &trace);
+    count_only = plan->count_only;
+    truncated = plan->truncated;
+    plan_destroy(plan);
+    handle_unpin(batch->handle, slot);
+    handle_reclaim(batch->handle);
+
+    if (count == (size_t) -1 || (count_only ? count
+                : answer->printed) == 0) {
+        fprintf(answer->out, truncated
+                ? "[%lu] No hits found before the search was stopped.\n"
+                : "[%lu] No hits found.\n", query->number);
+    }
+    else if (count_only) {
+        fprintf(answer->out, truncated
+                ? "[%lu] Your search matched at least %lu files before it "
+                "was stopped.\n" : "[%lu] Your search matched %lu files.\n",
+                query->number, (unsigned long) count);
+    }
+    else {
+        fprintf(answer->out, "\n");
+        if (truncated) {
+            fprintf(answer->out, "[%lu] The search was stopped early; more "
+                    "files may match.\n", query->number);
+        }
+    }
+    pthread_mutex_lock(&batch->lock);
+    batch->answered++;
+    batch->truncated += truncated;
+    pthread_mutex_unlock(&batch->lock);
+}
+
+/**
+ * Runs a worker: takes queries off the queue until it is closed, sheds
+ * those whose deadline passed while they waited, and answers the rest into
+ * a memory stream that is then published whole. The argument is the Batch.
+ */
+static void *serve(void *arg) {
+    Batch *batch = (Batch *) arg;
+    Admission query;
+    Answer answer;
+    char *text;
+    size_t size;
+    int slot = handle_register(batch->handle);
+
+    answer.name = NULL;
+    answer.namecap = 0;
+    while (take(batch, &query)) {
+        if (batch->deadline > 0
+                && stats_now() >= query.arrival + batch->deadline) {
+            shed(batch, query.number, "the query waited past its deadline");
+        }
+        else if (!(answer.out = open_memstream(&text, &size))) {
+            shed(batch, query.number, "out of memory");
+        }
+        else {
+            answer.number = query.number;
+            answer_query(batch, slot, &query, &answer);
+            fclose(answer.out);
+            publish(batch, text, size);
+            free(text);
+        }
+        free(query.line);
+    }
+    free(answer.name);
+    return NULL;
+}
+
+/**
+ * Answers the queries read line by line from a file with a number of worker
+ * threads. The reader lowercases each line, skips comments, handles q and
+ * reload itself and admits every other line as a query; the workers then
+ * answer or shed them.
+ * Once the input ends the queue is closed, the workers drain it, and the
+ * totals are reported on standard error. Returns 1 on success and 0 if the
+ * workers cannot be started.
+ */
+int batch_run(IndexHandle *handle, ThreadPool *pool, SlowLog *log, FILE *in,
+        int nworkers, int deadline_ms, size_t budget) {
+    Batch batch;
+    pthread_condattr_t attr;
+    pthread_t *workers;
+    char buffer[BATCH_LINE_SIZE], *line;
+    unsigned long number;
+    int i, started;
+
+    if (nworkers < 1 || nworkers > BATCH_MAX_WORKERS || !(workers =
+                (pthread_t *) malloc(nworkers * sizeof(pthread_t)))) {
+        return 0;
+    }
+    memset(&batch, 0, sizeof(batch));
+    batch.handle = handle;
+    batch.pool = pool;
+    batch.log = log;
+    batch.deadline = deadline_ms / 1000.0;
+    batch.budget = budget;
+    pthread_mutex_init(&batch.lock, NULL);
+    pthread_mutex_init(&batch.output, NULL);
+    pthread_condattr_init(&attr);
+    pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+    pthread_cond_init(&batch.nonfull, &attr);
+    pthread_condattr_destroy(&attr);
+    pthread_cond_init(&batch.nonempty, NULL);
+    for (started = 0; started < nworkers; started++) {
+        if (pthread_create(&workers[started], NULL, serve, &batch) != 0) {
+            fprintf(stderr, "search: Could not start batch workers.\n");
+            break;
+        }
+    }
+
+    number = 0;
+    while (started == nworkers && fgets(buffer, sizeof(buffer), in)) {
+        for (i = 0; buffer[i] != '\0'; i++) {
+            buffer[i] = tolower(buffer[i]);
+        }
+        if (strcmp(buffer, "q\n") == 0 || strcmp(buffer, "q") == 0) {
+            break;
+        }
+        else if (buffer[0] == '#') {
+            continue;
+        }
+        if (strcmp(buffer, "reload\n") == 0) {
+            if (!handle_reload(handle)) {
+                fprintf(stderr, "search: A reload is already in progress.\n");
+            }
+            continue;
+        }
+        number++;
+        if (!(line = strdup(buffer))) {
+            shed(&batch, number, "out of memory");
+        }
+        else {
+            admit(&batch, line, number, stats_now());
+        }
+    }
+
+    // Let the workers drain the queue.
+    pthread_mutex_lock(&batch.lock);
+    batch.closed = 1;
+    pthread_cond_broadcast(&batch.nonempty);
+    pthread_mutex_unlock(&batch.lock);
+    for (i = 0; i < started; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    if (started == nworkers) {
+        fprintf(stderr, "Batch: %lu answered, %lu stopped early, %lu shed.\n",
+                batch.answered, batch.truncated, batch.shed);
+    }
+    pthread_mutex_destroy(&batch.lock);
+    pthread_mutex_destroy(&batch.output);
+    pthread_cond_destroy(&batch.nonfull);
+    pthread_cond_destroy(&batch.nonempty);
+    free(workers);
+    return started == nworkers;
+}
@@ -0,0 +1,40 @@
+#ifndef BATCH_H
+#define BATCH_H
+
+#include "epoch.h"
+#include "slowlog.h"
+#include "threadpool.h"
+#include <stddef.h>
+#include <stdio.h>
+
+/*
+ * Number of queries the admission queue holds while they wait for a worker,
+ * and the longest query line read.
+ */
+#define BATCH_QUEUE_SIZE 64
+#define BATCH_LINE_SIZE 1024
+
+/*
+ * Most worker threads a batch runs: each claims a reader slot of the index
+ * handle, and the main thread holds one more.
+ */
+#define BATCH_MAX_WORKERS (EPOCH_MAX_READERS - 1)
+
+/**
+ * Answers the queries read line by line from a file with a number of worker
+ * threads, each of which pins the handle's index for its query and may split
+ * a large query on the pool (NULL for none). The reader admits queries to a
+ * bounded queue. Every query gets the given deadline in milliseconds,
+ * counted from when it is read, and cost budget in documents (zero for
+ * none); with a deadline, a query that cannot be admitted or is still
+ * queued by then is shed rather than answered, and otherwise a full queue
+ * makes the reader wait. Answers are printed whole, each line prefixed with
+ * the query's number, in the order they finish. Lines starting with '#' are
+ * comments, so a slow-query log can be replayed as input; the queries
+ * answered are themselves noted in the given log (NULL for none). Returns 1
+ * on success and 0 if the workers cannot be started.
+ */
+int batch_run(IndexHandle *, ThreadPool *, SlowLog *, FILE *, int, int,
+        size_t);
+
+#endif
@@ -0,0 +1,117 @@
+#include "bloom.h"
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Odd constants that spread a key's 32-bit hash into one bit position per
+ * word of its block.
+ */
+static const unsigned int SALTS[BLOOM_BLOCK_WORDS] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+/**
+ * Hashes a key to 64 bits: FNV-1a over its bytes followed by a finalizer,
+ * so that both halves of the result are well mixed.
+ */
+static unsigned long long hash_key(const char *key, size_t len) {
+    unsigned long long h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 0x100000001b3ULL;
+    }
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    h *= 0xc4ceb9fe1a85ec53ULL;
+    h ^= h >> 33;
+    return h;
+}
+
+/**
+ * Returns the first word of the block a hash selects, mapping its upper
+ * half onto the blocks by multiplication rather than division.
+ */
+static unsigned int *block_of(const Bloom *bloom, unsigned long long h) {
+    return bloom->words + BLOOM_BLOCK_WORDS
+        * (size_t) (((h >> 32) * bloom->nblocks) >> 32);
+}
+
+/**
+ * Creates an empty filter with BLOOM_BITS_PER_KEY bits for each of the given
+ * number of keys, in blocks aligned to cache lines. Returns a pointer to the
+ * new filter, or NULL if the call fails.
+ */
+Bloom *bloom_create(size_t count) {
+    Bloom *bloom;
+    void *words;
+    size_t bytes;
+
+    if (!(bloom = (Bloom *) malloc(sizeof(struct Bloom)))) {
+        return NULL;
+    }
+    bloom->nblocks = (count * BLOOM_BITS_PER_KEY + 32 * BLOOM_BLOCK_WORDS - 1)
+        / (32 * BLOOM_BLOCK_WORDS);
+    if (bloom->nblocks == 0) {
+        bloom->nblocks = 1;
+    }
+    bytes = bloom->nblocks * BLOOM_BLOCK_WORDS * sizeof(unsigned int);
+    if (posix_memalign(&words, 64, bytes) != 0) {
+        free(bloom);
+        return NULL;
+    }
+    memset(words, 0, bytes);
+    bloom->words = (unsigned int *) words;
+    return bloom;
+}
+
+/**
+ * Destroys the filter, freeing all associated memory.
+ */
+void bloom_destroy(Bloom *bloom) {
+    if (bloom) {
+        free(bloom->words);
+        free(bloom);
+    }
+}
+
+/**
+ * Adds a key to the filter by setting its bit in every word of its block.
+ */
+void bloom_add(Bloom *bloom, const char *key, size_t len) {
+    unsigned long long h = hash_key(key, len);
+    unsigned int *block = block_of(bloom, h);
+    int i;
+
+    for (i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        block[i] |= 1U << (((unsigned int) h * SALTS[i]) >> 27);
+    }
+}
+
+/**
+ * Returns zero if the key was certainly never added, and one if it may have
+ * been. The eight words are checked together, without an early exit, which
+ * lets the compiler vectorize the loop.
+ */
+int bloom_may_contain(const Bloom *bloom, const char *key, size_t len) {
+    unsigned long long h = hash_key(key, len);
+    const unsigned int *block = block_of(bloom, h);
+    unsigned int missing = 0;
+    int i;
+
+    for (i = 0; i < BLOOM_BLOCK_WORDS; i++) {
+        missing |= ~block[i] & (1U << (((unsigned int) h * SALTS[i]) >> 27));
+    }
+    return missing == 0;
+}
+
+/**
+ * Returns the number of bytes the filter occupies.
+ */
+size_t bloom_bytes(const Bloom *bloom) {
+    return bloom ? sizeof(struct Bloom)
+        + bloom->nblocks * BLOOM_BLOCK_WORDS * sizeof(unsigned int) : 0;
+}
@@ -0,0 +1,53 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include <stddef.h>
+
+/*
+ * Number of 32-bit words in a block, each of which gets one bit per key, and
+ * number of filter bits per key, which gives about a 1% false positive rate.
+ */
+#define BLOOM_BLOCK_WORDS 8
+#define BLOOM_BITS_PER_KEY 10
+
+/**
+ * A split block Bloom filter. A key's hash picks one block of eight 32-bit
+ * words, half a cache line, and sets one bit in each word, so a lookup
+ * touches a single block and computes its eight bits independently, with no
+ * branches. A filter answers "definitely absent" or "maybe present".
+ */
+struct Bloom {
+    unsigned int *words;
+    size_t nblocks;
+};
+
+typedef struct Bloom Bloom;
+
+/**
+ * Creates an empty filter sized for the given number of keys. Returns a
+ * pointer to the new filter, or NULL if the call fails.
+ */
+Bloom *bloom_create(size_t);
+
+/**
+ * Destroys the filter, freeing all associated memory.
+ */
+void bloom_destroy(Bloom *);
+
+/**
+ * Adds a key, given as a (pointer, length) view, to the filter.
+ */
+void bloom_add(Bloom *, const char *, size_t);
+
+/**
+ * Returns zero if the key, given as a (pointer, length) view, was certainly
+ * never added to the filter, and one if it may have been.
+ */
+int bloom_may_contain(const Bloom *, const char *, size_t);
+
+/**
+ * Returns the number of bytes the filter occupies.
+ */
+size_t bloom_bytes(const Bloom *);
+
+#endif
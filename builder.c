@@ -0,0 +1,212 @@
+#include "builder.h"
+#include "sort.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define BUILDER_INITIAL_CAPACITY 1024
+
+/**
+ * FNV-1a hash of a byte string.
+ */
+static size_t hash_term(const char *term, size_t len) {
+    size_t h = 2166136261u;
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        h = (h ^ (unsigned char) term[i]) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * Compares two terms given as (pointer, length) views, with the same sign
+ * conventions as strcmp.
+ */
+int termcmp(const char *t1, size_t len1, const char *t2, size_t len2) {
+    int c = memcmp(t1, t2, len1 < len2 ? len1 : len2);
+    if (c != 0) {
+        return c;
+    }
+    return len1 < len2 ? -1 : (len1 > len2 ? 1 : 0);
+}
+
+/**
+ * Creates an empty builder. Returns a pointer to the new builder, or NULL if
+ * the call fails.
+ */
+Builder *builder_create(void) {
+    Builder *builder = (Builder *) malloc(sizeof(struct Builder));
+    if (builder) {
+        builder->cap = BUILDER_INITIAL_CAPACITY;
+        builder->count = 0;
+        builder->table = (TermEntry *) calloc(builder->cap, sizeof(TermEntry));
+        builder->bytes = builder->cap * sizeof(TermEntry);
+        if (builder->table) {
+            return builder;
+        }
+        free(builder);
+    }
+    return NULL;
+}
+
+/**
+ * Destroys the builder, freeing all associated memory.
+ */
+void builder_destroy(Builder *builder) {
+    size_t i;
+
+    if (!builder) {
+        return;
+    }
+    for (i = 0; i < builder->cap; i++) {
+        free(builder->table[i].term);
+        free(builder->table[i].postings);
+    }
+    free(builder->table);
+    free(builder);
+}
+
+/**
+ * Empties the builder, freeing its terms and postings, so that it can be
+ * reused after its contents have been written out. The hash table goes back
+ * to its initial size, so that a reset builder holds as little as a new one.
+ */
+void builder_reset(Builder *builder) {
+    TermEntry *table;
+    size_t i;
+
+    if (!builder) {
+        return;
+    }
+    for (i = 0; i < builder->cap; i++) {
+        free(builder->table[i].term);
+        free(builder->table[i].postings);
+    }
+    table = (TermEntry *) calloc(BUILDER_INITIAL_CAPACITY, sizeof(TermEntry));
+    if (table) {
+        free(builder->table);
+        builder->table = table;
+        builder->cap = BUILDER_INITIAL_CAPACITY;
+    }
+    else {
+        memset(builder->table, 0, builder->cap * sizeof(TermEntry));
+    }
+    builder->count = 0;
+    builder->bytes = builder->cap * sizeof(TermEntry);
+}
+
+/**
+ * Doubles the size of the hash table, rehashing every entry. Returns 1 on
+ * success and 0 if memory allocation fails.
+ */
+static int grow_table(Builder *builder) {
+    TermEntry *table, *entry;
+    size_t cap, i, slot;
+
+    cap = builder->cap * 2;
+    if (!(table = (TermEntry *) calloc(cap, sizeof(TermEntry)))) {
+        return 0;
+    }
+    for (i = 0; i < builder->cap; i++) {
+        entry = &builder->table[i];
+        if (entry->term) {
+            slot = hash_term(entry->term, entry->len) & (cap - 1);
+            while (table[slot].term) {
+                slot = (slot + 1) & (cap - 1);
+            }
+            table[slot] = *entry;
+        }
+    }
+    free(builder->table);
+    builder->bytes += (cap - builder->cap) * sizeof(TermEntry);
+    builder->table = table;
+    builder->cap = cap;
+    return 1;
+}
+
+/**
+ * Records one occurrence of a term in the given document. If the term's last
+ * posting is for the same document its hit count is incremented; otherwise a
+ * posting is appended. The term is only copied the first time it is seen.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+int builder_add(Builder *builder, const char *term, size_t len,
+        unsigned int doc) {
+    TermEntry *entry;
+    Posting *grown;
+    size_t slot;
+
+    if (!builder || !term) {
+        return 0;
+    }
+    if (2 * (builder->count + 1) > builder->cap && !grow_table(builder)) {
+        return 0;
+    }
+
+    slot = hash_term(term, len) & (builder->cap - 1);
+    while ((entry = &builder->table[slot])->term != NULL
+            && (entry->len != len || memcmp(entry->term, term, len) != 0)) {
+        slot = (slot + 1) & (builder->cap - 1);
+    }
+
+    if (!entry->term) {
+        if (!(entry->term = (char *) malloc(len + 1))) {
+            return 0;
+        }
+        memcpy(entry->term, term, len);
+        entry->term[len] = '\0';
+        entry->len = len;
+        entry->postings = NULL;
+        entry->count = entry->cap = 0;
+        builder->count++;
+        builder->bytes += len + 1;
+    }
+    else if (entry->count > 0 && entry->postings[entry->count - 1].doc == doc) {
+        entry->postings[entry->count - 1].hits++;
+        return 1;
+    }
+
+    if (entry->count == entry->cap) {
+        grown = (Posting *) realloc(entry->postings, (entry->cap
+                    ? 2 * entry->cap : 1) * sizeof(Posting));
+        if (!grown) {
+            return 0;
+        }
+        builder->bytes += (entry->cap ? entry->cap : 1) * sizeof(Posting);
+        entry->postings = grown;
+        entry->cap = entry->cap ? 2 * entry->cap : 1;
+    }
+    entry->postings[entry->count].doc = doc;
+    entry->postings[entry->count].hits = 1;
+    entry->count++;
+    return 1;
+}
+
+/*
+ * Orders pointers to term entries by term.
+ */
+#define ENTRY_LESS(e1, e2) \
+    (termcmp((*(e1))->term, (*(e1))->len, (*(e2))->term, (*(e2))->len) < 0)
+
+DEFINE_SORT(sort_entries, TermEntry *, ENTRY_LESS)
+
+/**
+ * Returns a newly allocated array of pointers to the builder's entries,
+ * sorted by term, or NULL if memory allocation fails.
+ */
+TermEntry **builder_sorted(Builder *builder) {
+    TermEntry **entries;
+    size_t i, n;
+
+    if (!builder || !(entries = (TermEntry **) malloc((builder->count + 1)
+                    * sizeof(TermEntry *)))) {
+        return NULL;
+    }
+    for (i = 0, n = 0; i < builder->cap; i++) {
+        if (builder->table[i].term) {
+            entries[n++] = &builder->table[i];
+        }
+    }
+    sort_entries(entries, n);
+    return entries;
+}
@@ -0,0 +1,80 @@
+#ifndef BUILDER_H
+#define BUILDER_H
+
+#include <stddef.h>
+
+/**
+ * One entry of a postings list under construction: a document ID and the
+ * number of times the term occurs in that document.
+ */
+struct Posting {
+    unsigned int doc;
+    unsigned int hits;
+};
+
+typedef struct Posting Posting;
+
+/**
+ * A term and its postings list, sorted by document ID.
+ */
+struct TermEntry {
+    char *term;
+    size_t len;
+    Posting *postings;
+    int count;
+    int cap;
+};
+
+typedef struct TermEntry TermEntry;
+
+/**
+ * An in-memory partial index, mapping terms to postings lists through an
+ * open-addressing hash table. Documents must be added in increasing order of
+ * ID, so that each postings list is built by appending. The bytes field tracks
+ * the memory the builder holds.
+ */
+struct Builder {
+    TermEntry *table;
+    size_t cap;
+    size_t count;
+    size_t bytes;
+};
+
+typedef struct Builder Builder;
+
+/**
+ * Creates an empty builder. Returns a pointer to the new builder, or NULL if
+ * the call fails.
+ */
+Builder *builder_create(void);
+
+/**
+ * Destroys the builder, freeing all associated memory.
+ */
+void builder_destroy(Builder *);
+
+/**
+ * Empties the builder so that it can be reused.
+ */
+void builder_reset(Builder *);
+
+/**
+ * Records one occurrence of a term, given as a (pointer, length) view, in the
+ * given document. Returns 1 on success and 0 if memory allocation fails.
+ */
+int builder_add(Builder *, const char *, size_t, unsigned int);
+
+/**
+ * Returns a newly allocated array of pointers to the builder's entries,
+ * sorted by term, or NULL if memory allocation fails. The array holds the
+ * builder's count entries and is only valid until the builder changes.
+ */
+TermEntry **builder_sorted(Builder *);
+
+/**
+ * Compares two terms given as (pointer, length) views, with the same sign
+ * conventions as strcmp.
+ */
+int termcmp(const char *, size_t, const char *, size_t);
+
+#endif
@@ -0,0 +1,320 @@
+#include "aio.h"
+#include "cold.h"
+#include <fcntl.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Opens the postings of a binary index for reading on demand, caching at
+ * most about budget bytes of decoded lists. Returns a pointer to the new
+ * store, or NULL if the file cannot be opened or memory allocation fails.
+ * The positions array is freed in either case.
+ */
+ColdPostings *cold_open(const char *path, unsigned long long *positions,
+        int nterms, unsigned int ndocs, size_t budget) {
+    ColdPostings *cold;
+    int t;
+
+    if (!path || !positions || !(cold = (ColdPostings *) malloc(
+                    sizeof(ColdPostings)))) {
+        free(positions);
+        return NULL;
+    }
+    else if (!(cold->entries = (ColdEntry *) malloc((nterms ? nterms : 1)
+                    * sizeof(ColdEntry)))) {
+        free(positions);
+        free(cold);
+        return NULL;
+    }
+    else if ((cold->fd = open(path, O_RDONLY)) < 0) {
+        free(positions);
+        free(cold->entries);
+        free(cold);
+        return NULL;
+    }
+    else if (!(cold->io = aio_create())) {
+        close(cold->fd);
+        free(positions);
+        free(cold->entries);
+        free(cold);
+        return NULL;
+    }
+    for (t = 0; t < nterms; t++) {
+        cold->entries[t].docs = NULL;
+        cold->entries[t].count = 0;
+        cold->entries[t].prev = cold->entries[t].next = -1;
+        cold->entries[t].pins = 0;
+    }
+    cold->nterms = nterms;
+    cold->ndocs = ndocs;
+    cold->positions = positions;
+    cold->head = cold->tail = -1;
+    cold->resident = 0;
+    cold->budget = budget;
+    cold->hits = cold->misses = cold->evictions = 0;
+    pthread_mutex_init(&cold->lock, NULL);
+    return cold;
+}
+
+/**
+ * Closes the file and frees all associated memory.
+ */
+void cold_close(ColdPostings *cold) {
+    int t;
+
+    if (!cold) {
+        return;
+    }
+    for (t = 0; t < cold->nterms; t++) {
+        free(cold->entries[t].docs);
+    }
+    aio_destroy(cold->io);
+    close(cold->fd);
+    pthread_mutex_destroy(&cold->lock);
+    free(cold->entries);
+    free(cold->positions);
+    free(cold);
+}
+
+/**
+ * Removes a resident term from the recency list.
+ */
+static void unlink_entry(ColdPostings *cold, int t) {
+    ColdEntry *entry = &cold->entries[t];
+
+    if (entry->prev >= 0) {
+        cold->entries[entry->prev].next = entry->next;
+    }
+    else {
+        cold->head = entry->next;
+    }
+    if (entry->next >= 0) {
+        cold->entries[entry->next].prev = entry->prev;
+    }
+    else {
+        cold->tail = entry->prev;
+    }
+    entry->prev = entry->next = -1;
+}
+
+/**
+ * Puts a resident term at the front of the recency list.
+ */
+static void push_entry(ColdPostings *cold, int t) {
+    ColdEntry *entry = &cold->entries[t];
+
+    entry->prev = -1;
+    entry->next = cold->head;
+    if (cold->head >= 0) {
+        cold->entries[cold->head].prev = t;
+    }
+    else {
+        cold->tail = t;
+    }
+    cold->head = t;
+}
+
+/**
+ * Evicts the least recently used lists until the cache fits its budget or
+ * only pinned lists are left. Pinned lists are kept out of the recency list,
+ * so every list visited is evicted. The lock must be held.
+ */
+static void evict(ColdPostings *cold) {
+    int t;
+
+    while (cold->resident > cold->budget && (t = cold->tail) >= 0) {
+        unlink_entry(cold, t);
+        cold->resident -= cold->entries[t].count * sizeof(unsigned int);
+        free(cold->entries[t].docs);
+        cold->entries[t].docs = NULL;
+        cold->evictions++;
+    }
+}
+
+/**
+ * Pins a resident list, taking it out of the recency list while it is in
+ * use. The lock must be held.
+ */
+static void pin(ColdPostings *cold, int t) {
+    if (cold->entries[t].pins++ == 0) {
+        unlink_entry(cold, t);
+    }
+}
+
+/**
+ * Unpins a list, putting it back at the front of the recency list once no
+ * reader uses it. The lock must be held.
+ */
+static void unpin(ColdPostings *cold, int t) {
+    if (cold->entries[t].pins > 0 && --cold->entries[t].pins == 0) {
+        push_entry(cold, t);
+    }
+}
+
+/**
+ * Decodes the postings of a term read from the file: pairs of
+ * variable-length document ID deltas and hit counts. Returns the new list,
+ * or NULL if memory allocation fails or the postings are malformed.
+ */
+static unsigned int *decode_postings(ColdPostings *cold,
+        const unsigned char *bytes, size_t size, size_t count) {
+    unsigned long long value;
+    unsigned int *docs, doc;
+    size_t pos, i;
+    int field, shift;
+
+    if (!(docs = (unsigned int *) malloc((count ? count : 1)
+                    * sizeof(unsigned int)))) {
+        return NULL;
+    }
+    doc = 0;
+    pos = 0;
+    for (i = 0; i < count && pos < size; i++) {
+        for (field = 0; field < 2; field++) {
+            value = 0;
+            for (shift = 0; pos < size && shift < 64; shift += 7) {
+                value |= (unsigned long long) (bytes[pos] & 0x7f) << shift;
+                if (!(bytes[pos++] & 0x80)) {
+                    break;
+                }
+            }
+            if (field == 0) {
+                doc += (unsigned int) value;
+            }
+        }
+        if (doc >= cold->ndocs || (pos == size && bytes[pos - 1] & 0x80)) {
+            break;
+        }
+        docs[i] = doc;
+    }
+    if (i < count) {
+        free(docs);
+        return NULL;
+    }
+    return docs;
+}
+
+/**
+ * Makes a term's list resident, or drops it if another reader made the
+ * same list resident in the meantime, and pins it. The lock must be held.
+ * Returns the resident list.
+ */
+static const unsigned int *insert(ColdPostings *cold, int t,
+        unsigned int *docs, size_t count) {
+    ColdEntry *entry = &cold->entries[t];
+
+    if (entry->docs) {
+        free(docs);
+        pin(cold, t);
+    }
+    else {
+        entry->docs = docs;
+        entry->count = count;
+        entry->pins = 1;
+        cold->resident += count * sizeof(unsigned int);
+    }
+    return entry->docs;
+}
+
+/**
+ * Returns the pinned document IDs of the terms with the given ordinals. The
+ * resident lists are pinned first. The missing ones are then all submitted
+ * to the asynchronous reader at once, without holding the lock, so their
+ * reads overlap with each other and with other readers' reads. A single
+ * miss is read directly. Returns 1 on success and 0 if a read fails, in
+ * which case nothing stays pinned.
+ */
+int cold_fetch_many(ColdPostings *cold, const int *terms,
+        const size_t *counts, int n, const unsigned int **lists) {
+    AsyncRead *reads;
+    unsigned int *docs;
+    int *missing, i, j, nmissing, ok;
+
+    if (!(missing = (int *) malloc((n ? n : 1) * sizeof(int)))) {
+        return 0;
+    }
+    pthread_mutex_lock(&cold->lock);
+    for (i = 0, nmissing = 0; i < n; i++) {
+        if ((lists[i] = cold->entries[terms[i]].docs) != NULL) {
+            cold->hits++;
+            pin(cold, terms[i]);
+        }
+        else {
+            cold->misses++;
+            missing[nmissing++] = i;
+        }
+    }
+    pthread_mutex_unlock(&cold->lock);
+    if (nmissing == 0) {
+        free(missing);
+        return 1;
+    }
+
+    // Read the missing lists.
+    ok = (reads = (AsyncRead *) calloc(nmissing, sizeof(AsyncRead))) != NULL;
+    for (j = 0; ok && j < nmissing; j++) {
+        i = missing[j];
+        reads[j].fd = cold->fd;
+        reads[j].offset = cold->positions[terms[i]];
+        reads[j].size = (size_t) (cold->positions[terms[i] + 1]
+                - cold->positions[terms[i]]);
+        ok = (reads[j].buffer = (unsigned char *) malloc(reads[j].size
+                    ? reads[j].size : 1)) != NULL;
+    }
+    if (ok && nmissing == 1) {
+        ok = pread(cold->fd, reads[0].buffer, reads[0].size,
+                (off_t) reads[0].offset) == (ssize_t) reads[0].size;
+    }
+    else if (ok) {
+        ok = aio_read_all(cold->io, reads, nmissing);
+    }
+
+    // Decode them and make them resident.
+    for (j = 0; j < nmissing; j++) {
+        i = missing[j];
+        docs = ok ? decode_postings(cold, reads[j].buffer, reads[j].size,
+                counts[i]) : NULL;
+        ok = docs != NULL;
+        if (ok) {
+            pthread_mutex_lock(&cold->lock);
+            lists[i] = insert(cold, terms[i], docs, counts[i]);
+            pthread_mutex_unlock(&cold->lock);
+        }
+        if (reads) {
+            free(reads[j].buffer);
+        }
+    }
+    free(reads);
+
+    pthread_mutex_lock(&cold->lock);
+    for (i = 0; !ok && i < n; i++) {
+        if (lists[i]) {
+            unpin(cold, terms[i]);
+        }
+    }
+    evict(cold);
+    pthread_mutex_unlock(&cold->lock);
+    free(missing);
+    return ok;
+}
+
+/**
+ * Returns the pinned document IDs of the term with the given ordinal, or
+ * NULL if the read fails.
+ */
+const unsigned int *cold_fetch(ColdPostings *cold, int t, size_t count) {
+    const unsigned int *list;
+
+    return cold_fetch_many(cold, &t, &count, 1, &list) ? list : NULL;
+}
+
+/**
+ * Unpins a list returned by cold_fetch, then evicts lists if the cache went
+ * over its budget while it was pinned.
+ */
+void cold_release(ColdPostings *cold, int t) {
+    pthread_mutex_lock(&cold->lock);
+    unpin(cold, t);
+    evict(cold);
+    pthread_mutex_unlock(&cold->lock);
+}
@@ -0,0 +1,87 @@
+#ifndef COLD_H
+#define COLD_H
+
+#include "aio.h"
+#include <pthread.h>
+#include <stddef.h>
+
+/**
+ * A term's slot in the postings cache: its decoded document IDs and their
+ * number while they are resident, its neighbours in the recency list, and
+ * the number of readers currently using them. Pinned lists are not in the
+ * recency list, so they are never evicted.
+ */
+struct ColdEntry {
+    unsigned int *docs;
+    size_t count;
+    int prev;
+    int next;
+    int pins;
+};
+
+typedef struct ColdEntry ColdEntry;
+
+/**
+ * Postings left on disk in a binary index and read in on demand. Each
+ * term's postings occupy bytes positions[t] to positions[t + 1] of the file.
+ * Decoded lists are cached, most recently used first, and the least recently
+ * used unpinned lists are evicted whenever the cache holds more than the
+ * budget. Missing lists are read through an asynchronous reader. The cache
+ * is shared by all readers of the index.
+ */
+struct ColdPostings {
+    int fd;
+    AsyncReader *io;
+    int nterms;
+    unsigned int ndocs;
+    unsigned long long *positions;
+    ColdEntry *entries;
+    int head;
+    int tail;
+    size_t resident;
+    size_t budget;
+    unsigned long hits;
+    unsigned long misses;
+    unsigned long evictions;
+    pthread_mutex_t lock;
+};
+
+typedef struct ColdPostings ColdPostings;
+
+/**
+ * Opens the postings of a binary index for reading on demand. The positions
+ * array, nterms + 1 file offsets, is taken over by the store. Returns a
+ * pointer to the new store, or NULL if the call fails.
+ */
+ColdPostings *cold_open(const char *, unsigned long long *, int,
+        unsigned int, size_t);
+
+/**
+ * Closes the file and frees all associated memory.
+ */
+void cold_close(ColdPostings *);
+
+/**
+ * Returns the document IDs of the term with the given ordinal, of which
+ * there are the given number, reading them from disk if they are not
+ * resident. The list stays pinned in memory until cold_release is called.
+ * Returns NULL if the read fails or the postings are malformed.
+ */
+const unsigned int *cold_fetch(ColdPostings *, int, size_t);
+
+/**
+ * Returns the document IDs of the terms with the given ordinals, with the
+ * given numbers of them, in the given array. The lists missing from the
+ * cache are read concurrently. All stay pinned until cold_release is called
+ * for each term. Returns 1 on success and 0 if a read fails, in which case
+ * none is pinned.
+ */
+int cold_fetch_many(ColdPostings *, const int *, const size_t *, int,
+        const unsigned int **);
+
+/**
+ * Unpins a list returned by cold_fetch, making it eligible for eviction.
+ */
+void cold_release(ColdPostings *, int);
+
+#endif
@@ -0,0 +1,473 @@
+#include "dict.h"
+#include <stdlib.h>
+#include <string.h>
+
+#if defined(__GNUC__)
+#define CTZ(w) __builtin_ctz(w)
+#define PREFETCH(p) __builtin_prefetch(p)
+#else
+/**
+ * Returns the index of the lowest bit set in the word, which must not be 0.
+ */
+static int CTZ(unsigned int w) {
+    int n = 0;
+
+    for (; !(w & 1); w >>= 1) {
+        n++;
+    }
+    return n;
+}
+#define PREFETCH(p) ((void) (p))
+#endif
+
+/**
+ * Writes the value as a variable-length integer, seven bits per byte, and
+ * returns the number of bytes written.
+ */
+static size_t put_varint(unsigned char *out, size_t value) {
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+/**
+ * Reads a variable-length integer and advances the position past it.
+ */
+static size_t get_varint(const unsigned char **pos) {
+    const unsigned char *p = *pos;
+    size_t value = 0;
+    int shift = 0;
+
+    while (*p & 0x80) {
+        value |= (size_t) (*p++ & 0x7f) << shift;
+        shift += 7;
+    }
+    value |= (size_t) *p++ << shift;
+    *pos = p;
+    return value;
+}
+
+/**
+ * Returns the length of the common prefix of two byte strings.
+ */
+static size_t common_prefix(const unsigned char *s1, size_t len1,
+        const char *s2, size_t len2) {
+    size_t i, n = len1 < len2 ? len1 : len2;
+
+    for (i = 0; i < n && s1[i] == (unsigned char) s2[i]; i++)
+        ;
+    return i;
+}
+
+/**
+ * Decodes the next string of a block into term, which holds the previous
+ * string, and advances the position. Returns the length of the new string.
+ */
+static size_t decode_next(const unsigned char **pos, int first, char *term) {
+    size_t shared, suffix;
+
+    shared = first ? 0 : get_varint(pos);
+    suffix = get_varint(pos);
+    memcpy(term + shared, *pos, suffix);
+    *pos += suffix;
+    return shared + suffix;
+}
+
+/**
+ * Packs the first eight bytes of a string big-endian into an integer,
+ * padding shorter strings with zeros.
+ */
+static unsigned long long pack_prefix(const unsigned char *s, size_t len) {
+    unsigned long long prefix = 0;
+    size_t i;
+
+    for (i = 0; i < 8; i++) {
+        prefix = (prefix << 8) | (i < len ? s[i] : 0);
+    }
+    return prefix;
+}
+
+/**
+ * Fills the subtree rooted at heads[k] with the blocks' first strings in
+ * order, starting from the given block. Returns the block following the
+ * last one placed.
+ */
+static int fill_heads(Dict *dict, int block, int k) {
+    const unsigned char *pos;
+    size_t len;
+
+    if (k > dict->nblocks) {
+        return block;
+    }
+    block = fill_heads(dict, block, 2 * k);
+    pos = dict->data + dict->blocks[block];
+    len = get_varint(&pos);
+    dict->heads[k].prefix = pack_prefix(pos, len);
+    dict->heads[k].block = block;
+    return fill_heads(dict, block + 1, 2 * k + 1);
+}
+
+/**
+ * Creates a dictionary holding the given null-terminated strings, in the given
+ * order. Returns a pointer to the new dictionary, or NULL if the call fails.
+ */
+Dict *dict_create(char **strings, int count) {
+    Dict *dict;
+    void *heads;
+    unsigned char *out;
+    size_t len, prevlen, shared, bound;
+    int i;
+
+    if (count < 0 || !(dict = (Dict *) malloc(sizeof(struct Dict)))) {
+        return NULL;
+    }
+    dict->count = count;
+    dict->nblocks = (count + DICT_BLOCK_SIZE - 1) / DICT_BLOCK_SIZE;
+    dict->maxlen = 0;
+
+    bound = 1;
+    for (i = 0; i < count; i++) {
+        bound += strlen(strings[i]) + 20;
+    }
+    dict->data = (unsigned char *) malloc(bound);
+    dict->blocks = (size_t *) malloc((dict->nblocks + 1) * sizeof(size_t));
+    dict->filter = bloom_create(count);
+    dict->heads = posix_memalign(&heads, 64, (dict->nblocks + 1)
+            * sizeof(DictHead)) == 0 ? (DictHead *) heads : NULL;
+    if (!dict->data || !dict->blocks || !dict->filter || !dict->heads) {
+        dict_destroy(dict);
+        return NULL;
+    }
+
+    out = dict->data;
+    prevlen = 0;
+    for (i = 0; i < count; i++) {
+        len = strlen(strings[i]);
+        if (len > dict->maxlen) {
+            dict->maxlen = len;
+        }
+        if (i % DICT_BLOCK_SIZE == 0) {
+            dict->blocks[i / DICT_BLOCK_SIZE] = out - dict->data;
+            shared = 0;
+        }
+        else {
+            shared = common_prefix((unsigned char *) strings[i - 1], prevlen,
+                    strings[i], len);
+            out += put_varint(out, shared);
+        }
+        out += put_varint(out, len - shared);
+        memcpy(out, strings[i] + shared, len - shared);
+        out += len - shared;
+        prevlen = len;
+        bloom_add(dict->filter, strings[i], len);
+    }
+    dict->size = out - dict->data;
+    dict->blocks[dict->nblocks] = dict->size;
+
+    // Give back the slack from the size estimate.
+    if (dict->size > 0 && (out = realloc(dict->data, dict->size)) != NULL) {
+        dict->data = out;
+    }
+    fill_heads(dict, 0, 1);
+    return dict;
+}
+
+/**
+ * Destroys the dictionary, freeing all associated memory.
+ */
+void dict_destroy(Dict *dict) {
+    if (dict) {
+        free(dict->data);
+        free(dict->blocks);
+        free(dict->heads);
+        bloom_destroy(dict->filter);
+        free(dict);
+    }
+}
+
+/**
+ * Returns the number of bytes the dictionary occupies: the front-coded
+ * data, the block offsets, the search tree and the filter.
+ */
+size_t dict_bytes(const Dict *dict) {
+    return dict ? sizeof(struct Dict) + dict->size + (dict->nblocks + 1)
+        * (sizeof(size_t) + sizeof(DictHead)) + bloom_bytes(dict->filter) : 0;
+}
+
+/**
+ * Decodes the string with the given ordinal into the buffer, which must hold
+ * at least maxlen + 1 bytes, by decoding its block up to it. Returns the
+ * length of the string.
+ */
+size_t dict_get(Dict *dict, int ordinal, char *buf) {
+    const unsigned char *pos;
+    size_t len = 0;
+    int i, first;
+
+    first = ordinal - ordinal % DICT_BLOCK_SIZE;
+    pos = dict->data + dict->blocks[ordinal / DICT_BLOCK_SIZE];
+    for (i = first; i <= ordinal; i++) {
+        len = decode_next(&pos, i == first, buf);
+    }
+    buf[len] = '\0';
+    return len;
+}
+
+/**
+ * Compares the key against the first string of the given block without
+ * decoding it. Returns a negative, zero or positive number as the key sorts
+ * before, equal to or after that string.
+ */
+static int compare_head(Dict *dict, int block, const char *key, size_t klen) {
+    const unsigned char *pos;
+    size_t len, m;
+
+    pos = dict->data + dict->blocks[block];
+    len = get_varint(&pos);
+    m = common_prefix(pos, len, key, klen);
+    if (m < len && m < klen) {
+        return (unsigned char) key[m] - pos[m];
+    }
+    return klen < len ? -1 : (klen > len ? 1 : 0);
+}
+
+/**
+ * Finds the first string in the given block that is not less than the key.
+ *
+ * The strings are compared in their encoded form. The scan tracks m, the
+ * length of the prefix the previous string shares with the key; since the
+ * previous string sorts before the key, a string sharing fewer than m bytes
+ * with its predecessor must sort after the key, and one sharing more must
+ * sort before it. Only strings sharing exactly m bytes need their suffix
+ * compared. Returns the ordinal found, or the ordinal following the block;
+ * exact is set if the string found equals the key.
+ */
+static int block_lower_bound(Dict *dict, int block, const char *key,
+        size_t klen, int *exact) {
+    const unsigned char *pos, *suffix;
+    size_t m, shared, len, j;
+    int ordinal, end;
+
+    *exact = 0;
+    ordinal = block * DICT_BLOCK_SIZE;
+    end = ordinal + DICT_BLOCK_SIZE < dict->count ?
+        ordinal + DICT_BLOCK_SIZE : dict->count;
+    pos = dict->data + dict->blocks[block];
+    m = 0;
+
+    for (; ordinal < end; ordinal++) {
+        shared = ordinal % DICT_BLOCK_SIZE == 0 ? 0 : get_varint(&pos);
+        len = get_varint(&pos);
+        suffix = pos;
+        pos += len;
+
+        if (shared < m) {
+            return ordinal;
+        }
+        else if (shared > m) {
+            continue;
+        }
+        j = common_prefix(suffix, len, key + m, klen - m);
+        m += j;
+        if (m == klen) {
+            *exact = j == len;
+            return ordinal;
+        }
+        else if (j < len && suffix[j] > (unsigned char) key[m]) {
+            return ordinal;
+        }
+    }
+    return end;
+}
+
+/**
+ * Returns the ordinal of the first string that is not less than the key, or
+ * the dictionary's count if there is none. The block is picked by descending
+ * the tree of first strings, comparing the packed prefixes as integers and
+ * decoding a first string only when its prefix equals the key's; the
+ * grandchildren of each node are prefetched on the way down. The block is
+ * then scanned. If exact is not NULL, it is set if the string found equals
+ * the key.
+ */
+static int lower_bound(Dict *dict, const char *key, size_t klen, int *exact) {
+    unsigned long long prefix;
+    unsigned int k, n;
+    int block, found, cmp;
+
+    found = 0;
+    if (exact) {
+        *exact = 0;
+    }
+    if (dict->count == 0) {
+        return 0;
+    }
+
+    // Find the first block whose first string is greater than the key; the
+    // key's block is the one before it.
+    prefix = pack_prefix((const unsigned char *) key, klen);
+    n = (unsigned int) dict->nblocks;
+    for (k = 1; k <= n;) {
+        PREFETCH(dict->heads + 4 * k);
+        cmp = prefix > dict->heads[k].prefix ? 1
+            : prefix < dict->heads[k].prefix ? -1
+            : compare_head(dict, dict->heads[k].block, key, klen);
+        k = 2 * k + (cmp >= 0);
+    }
+    k >>= CTZ(~k) + 1;
+    block = (k == 0 ? dict->nblocks : dict->heads[k].block) - 1;
+    if (block < 0) {
+        return 0;
+    }
+
+    block = block_lower_bound(dict, block, key, klen, &found);
+    if (exact) {
+        *exact = found;
+    }
+    return block;
+}
+
+/**
+ * Returns the ordinal of the given string, or -1 if it is not in the
+ * dictionary. The Bloom filter turns most misses away before the search
+ * touches any block. The dictionary must be sorted.
+ */
+int dict_lookup(Dict *dict, const char *key, size_t klen) {
+    int ordinal, exact;
+
+    if (!dict || !key || !bloom_may_contain(dict->filter, key, klen)) {
+        return -1;
+    }
+    ordinal = lower_bound(dict, key, klen, &exact);
+    return exact ? ordinal : -1;
+}
+
+/**
+ * Returns the ordinal of the first string that is not less than the given
+ * key, or the dictionary's count if there is none. The dictionary must be
+ * sorted.
+ */
+int dict_lower_bound(Dict *dict, const char *key, size_t klen) {
+    if (!dict || !key) {
+        return 0;
+    }
+    return lower_bound(dict, key, klen, NULL);
+}
+
+/**
+ * Returns the ordinal one past the last string that starts with the given
+ * prefix, given the ordinal of the first string not less than the prefix.
+ * The strings with the prefix are contiguous, so this walks forward from the
+ * lower bound until a string without the prefix is found.
+ */
+int dict_prefix_end(Dict *dict, int lower, const char *prefix, size_t plen) {
+    DictIterator *iterator;
+    const char *term;
+    size_t len;
+    int end;
+
+    if (!dict || !(iterator = dict_iter_create(dict, lower))) {
+        return lower;
+    }
+    end = lower;
+    while ((term = dict_iter_next(iterator, &len)) != NULL) {
+        if (len < plen || memcmp(term, prefix, plen) != 0) {
+            break;
+        }
+        end = iterator->ordinal + 1;
+    }
+    dict_iter_destroy(iterator);
+    return end;
+}
+
+/**
+ * Creates an iterator positioned at the given ordinal. If the allocation
+ * succeeds, this returns a pointer to a new iterator; otherwise, it returns
+ * NULL.
+ */
+DictIterator *dict_iter_create(Dict *dict, int ordinal) {
+    DictIterator *iterator;
+
+    if (!dict || ordinal < 0) {
+        return NULL;
+    }
+    iterator = (DictIterator *) malloc(sizeof(struct DictIterator));
+    if (!iterator) {
+        return NULL;
+    }
+    else if (!(iterator->term = (char *) malloc(dict->maxlen + 1))) {
+        free(iterator);
+        return NULL;
+    }
+    iterator->dict = dict;
+    dict_iter_seek(iterator, ordinal);
+    return iterator;
+}
+
+/**
+ * Repositions the iterator so that the next string returned is the one with
+ * the given ordinal. The strings before it in its block are decoded, so the
+ * front coding can be continued from there.
+ */
+void dict_iter_seek(DictIterator *iterator, int ordinal) {
+    Dict *dict;
+    int first, i;
+
+    if (!iterator || ordinal < 0) {
+        return;
+    }
+    dict = iterator->dict;
+    iterator->ordinal = -1;
+    iterator->next = ordinal;
+    iterator->len = 0;
+    iterator->pos = NULL;
+    if (ordinal < dict->count) {
+        first = ordinal - ordinal % DICT_BLOCK_SIZE;
+        iterator->pos = dict->data + dict->blocks[ordinal / DICT_BLOCK_SIZE];
+        for (i = first; i < ordinal; i++) {
+            iterator->len = decode_next(&iterator->pos, i == first,
+                    iterator->term);
+        }
+    }
+}
+
+/**
+ * Destroys the iterator, freeing all associated memory.
+ */
+void dict_iter_destroy(DictIterator *iterator) {
+    if (iterator) {
+        free(iterator->term);
+        free(iterator);
+    }
+}
+
+/**
+ * Returns the next string in the iteration and stores its length, or returns
+ * NULL at the end of the dictionary. The returned string is null-terminated
+ * and only valid until the next call.
+ */
+const char *dict_iter_next(DictIterator *iterator, size_t *len) {
+    Dict *dict;
+    int first;
+
+    if (!iterator || iterator->next >= iterator->dict->count) {
+        return NULL;
+    }
+    dict = iterator->dict;
+    first = iterator->next % DICT_BLOCK_SIZE == 0;
+    if (first) {
+        iterator->pos = dict->data
+            + dict->blocks[iterator->next / DICT_BLOCK_SIZE];
+    }
+    iterator->len = decode_next(&iterator->pos, first, iterator->term);
+    iterator->term[iterator->len] = '\0';
+    iterator->ordinal = iterator->next++;
+    if (len) {
+        *len = iterator->len;
+    }
+    return iterator->term;
+}
@@ -0,0 +1,131 @@
+#ifndef DICT_H
+#define DICT_H
+
+#include "bloom.h"
+#include <stddef.h>
+
+/*
+ * Number of strings stored in each front-coded block.
+ */
+#define DICT_BLOCK_SIZE 16
+
+/**
+ * The first string of a block, as a node of the search tree over the
+ * blocks: its first eight bytes packed big-endian into an integer, zero
+ * padded, so that comparing integers compares those bytes, and the block's
+ * number.
+ */
+struct DictHead {
+    unsigned long long prefix;
+    int block;
+};
+
+typedef struct DictHead DictHead;
+
+/**
+ * A static dictionary of strings, stored front-coded in blocks. The first
+ * string of each block is stored in full; every other string is stored as the
+ * length of the prefix it shares with its predecessor followed by the rest of
+ * its bytes. Strings are identified by their position (ordinal) in the
+ * dictionary. If the strings were sorted when the dictionary was created,
+ * exact, prefix and range lookups are supported as well. A Bloom filter over
+ * all the strings lets exact lookups of missing strings return before
+ * touching any block. Blocks are found through a tree of their first
+ * strings stored in Eytzinger order (heads[1] is the root and the children
+ * of heads[k] are heads[2k] and heads[2k + 1]), so the first levels of every
+ * search share a few cache lines and the next levels can be prefetched.
+ */
+struct Dict {
+    int count;
+    int nblocks;
+    size_t maxlen;
+    size_t size;
+    unsigned char *data;
+    size_t *blocks;
+    DictHead *heads;
+    Bloom *filter;
+};
+
+typedef struct Dict Dict;
+
+/**
+ * Creates a dictionary holding the given strings, in the given order. Returns
+ * a pointer to the new dictionary, or NULL if the call fails.
+ */
+Dict *dict_create(char **, int);
+
+/**
+ * Destroys the dictionary, freeing all associated memory.
+ */
+void dict_destroy(Dict *);
+
+/**
+ * Returns the number of bytes the dictionary occupies, including its search
+ * tree and filter.
+ */
+size_t dict_bytes(const Dict *);
+
+/**
+ * Decodes the string with the given ordinal into the buffer, which must hold
+ * at least maxlen + 1 bytes. Returns the length of the string.
+ */
+size_t dict_get(Dict *, int, char *);
+
+/**
+ * Returns the ordinal of the given string, or -1 if it is not in the
+ * dictionary. The dictionary must be sorted.
+ */
+int dict_lookup(Dict *, const char *, size_t);
+
+/**
+ * Returns the ordinal of the first string that is not less than the given
+ * key, or the dictionary's count if there is none. The dictionary must be
+ * sorted.
+ */
+int dict_lower_bound(Dict *, const char *, size_t);
+
+/**
+ * Returns the ordinal one past the last string that starts with the given
+ * prefix, given the lower bound of the prefix. The dictionary must be sorted.
+ */
+int dict_prefix_end(Dict *, int, const char *, size_t);
+
+/**
+ * Iterator type for walking the dictionary in order from a given ordinal.
+ */
+struct DictIterator {
+    Dict *dict;
+    int ordinal;
+    int next;
+    const unsigned char *pos;
+    char *term;
+    size_t len;
+};
+
+typedef struct DictIterator DictIterator;
+
+/**
+ * Creates an iterator positioned at the given ordinal.
+ */
+DictIterator *dict_iter_create(Dict *, int);
+
+/**
+ * Repositions the iterator so that the next string returned is the one with
+ * the given ordinal.
+ */
+void dict_iter_seek(DictIterator *, int);
+
+/**
+ * Destroys the iterator, freeing all associated memory.
+ */
+void dict_iter_destroy(DictIterator *);
+
+/**
+ * Returns the next string in the iteration and stores its length, or returns
+ * NULL at the end of the dictionary. The ordinal of the returned string is
+ * left in the iterator's ordinal field. The string is only valid until the
+ * next call.
+ */
+const char *dict_iter_next(DictIterator *, size_t *);
+
+#endif
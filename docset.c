@@ -0,0 +1,1197 @@
+#include "docset.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define CHUNK_VALUES (1 << DOCSET_CHUNK_BITS)
+#define CHUNK_LOW_MASK (CHUNK_VALUES - 1)
+
+/*
+ * Set operations, as applied to a pair of chunks.
+ */
+#define OP_AND 0
+#define OP_OR 1
+#define OP_ANDNOT 2
+
+#if defined(__GNUC__)
+#define POPCOUNT(w) __builtin_popcountll(w)
+#define CTZ(w) __builtin_ctzll(w)
+#else
+/**
+ * Returns the number of bits set in the word.
+ */
+static int POPCOUNT(unsigned long long w) {
+    int n = 0;
+
+    for (; w; w &= w - 1) {
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Returns the index of the lowest bit set in the word, which must not be 0.
+ */
+static int CTZ(unsigned long long w) {
+    int n = 0;
+
+    for (; !(w & 1); w >>= 1) {
+        n++;
+    }
+    return n;
+}
+#endif
+
+/**
+ * Returns the number of runs of consecutive values in a sorted array.
+ */
+static unsigned int count_value_runs(const unsigned short *values,
+        unsigned int n) {
+    unsigned int i, runs;
+
+    runs = n > 0;
+    for (i = 1; i < n; i++) {
+        if (values[i] != values[i - 1] + 1) {
+            runs++;
+        }
+    }
+    return runs;
+}
+
+/**
+ * Returns the number of runs of set bits in a bitmap.
+ */
+static unsigned int count_bitmap_runs(const unsigned long long *words) {
+    unsigned long long carry;
+    unsigned int runs;
+    int i;
+
+    runs = 0;
+    carry = 0;
+    for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+        // A run starts at every set bit whose lower neighbour is clear.
+        runs += POPCOUNT(words[i] & ~((words[i] << 1) | carry));
+        carry = words[i] >> 63;
+    }
+    return runs;
+}
+
+/**
+ * Picks the smallest container for a chunk with the given number of values
+ * and runs. Run containers take four bytes per run, arrays two bytes per
+ * value and bitmaps a fixed 8 KiB.
+ */
+static int pick_type(unsigned int card, unsigned int runs) {
+    size_t array_bytes, bitmap_bytes;
+
+    array_bytes = card <= DOCSET_ARRAY_MAX ? 2 * (size_t) card : (size_t) -1;
+    bitmap_bytes = DOCSET_BITMAP_WORDS * sizeof(unsigned long long);
+    if (4 * (size_t) runs < array_bytes && 4 * (size_t) runs < bitmap_bytes) {
+        return CHUNK_RUN;
+    }
+    return card <= DOCSET_ARRAY_MAX ? CHUNK_ARRAY : CHUNK_BITMAP;
+}
+
+/**
+ * Sets bits start through end, inclusive, of the bitmap.
+ */
+static void set_range(unsigned long long *words, unsigned int start,
+        unsigned int end) {
+    unsigned int first = start / 64, last = end / 64, i;
+    unsigned long long lo = ~0ULL << (start % 64);
+    unsigned long long hi = ~0ULL >> (63 - end % 64);
+
+    if (first == last) {
+        words[first] |= lo & hi;
+        return;
+    }
+    words[first] |= lo;
+    for (i = first + 1; i < last; i++) {
+        words[i] = ~0ULL;
+    }
+    words[last] |= hi;
+}
+
+/**
+ * Fills in a chunk from a sorted array of distinct low values, choosing its
+ * container. The chunk must hold at least one value. Returns 1 on success
+ * and 0 if memory allocation fails.
+ */
+static int chunk_from_values(Chunk *chunk, unsigned int key,
+        const unsigned short *values, unsigned int n) {
+    unsigned int runs, i, r;
+
+    runs = count_value_runs(values, n);
+    chunk->key = key;
+    chunk->card = n;
+    chunk->type = pick_type(n, runs);
+
+    if (chunk->type == CHUNK_ARRAY) {
+        chunk->size = n;
+        if (!(chunk->data.array = (unsigned short *) malloc(n
+                        * sizeof(unsigned short)))) {
+            return 0;
+        }
+        memcpy(chunk->data.array, values, n * sizeof(unsigned short));
+    }
+    else if (chunk->type == CHUNK_RUN) {
+        chunk->size = runs;
+        if (!(chunk->data.runs = (unsigned short *) malloc(2 * runs
+                        * sizeof(unsigned short)))) {
+            return 0;
+        }
+        r = 0;
+        chunk->data.runs[0] = chunk->data.runs[1] = values[0];
+        for (i = 1; i < n; i++) {
+            if (values[i] == chunk->data.runs[2 * r + 1] + 1) {
+                chunk->data.runs[2 * r + 1] = values[i];
+            }
+            else {
+                r++;
+                chunk->data.runs[2 * r] = chunk->data.runs[2 * r + 1]
+                    = values[i];
+            }
+        }
+    }
+    else {
+        chunk->size = 0;
+        if (!(chunk->data.bitmap = (unsigned long long *) calloc(
+                        DOCSET_BITMAP_WORDS, sizeof(unsigned long long)))) {
+            return 0;
+        }
+        for (i = 0; i < n; i++) {
+            chunk->data.bitmap[values[i] / 64] |= 1ULL << (values[i] % 64);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Fills in a chunk from a bitmap, choosing its container. The chunk's card is
+ * set to zero, with nothing allocated, if the bitmap is empty. Returns 1 on
+ * success and 0 if memory allocation fails.
+ */
+static int chunk_from_bitmap(Chunk *chunk, unsigned int key,
+        const unsigned long long *words) {
+    unsigned long long w, rest;
+    unsigned int card, runs, start, len, n, r, i, s;
+
+    card = 0;
+    for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+        card += POPCOUNT(words[i]);
+    }
+    chunk->key = key;
+    chunk->card = card;
+    chunk->size = 0;
+    if (card == 0) {
+        return 1;
+    }
+    runs = count_bitmap_runs(words);
+    chunk->type = pick_type(card, runs);
+
+    if (chunk->type == CHUNK_BITMAP) {
+        if (!(chunk->data.bitmap = (unsigned long long *) malloc(
+                        DOCSET_BITMAP_WORDS * sizeof(unsigned long long)))) {
+            return 0;
+        }
+        memcpy(chunk->data.bitmap, words, DOCSET_BITMAP_WORDS
+                * sizeof(unsigned long long));
+    }
+    else if (chunk->type == CHUNK_ARRAY) {
+        if (!(chunk->data.array = (unsigned short *) malloc(card
+                        * sizeof(unsigned short)))) {
+            return 0;
+        }
+        n = 0;
+        for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+            for (w = words[i]; w; w &= w - 1) {
+                chunk->data.array[n++] = (unsigned short) (i * 64 + CTZ(w));
+            }
+        }
+        chunk->size = n;
+    }
+    else {
+        if (!(chunk->data.runs = (unsigned short *) malloc(2 * runs
+                        * sizeof(unsigned short)))) {
+            return 0;
+        }
+        r = 0;
+        for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+            w = words[i];
+            while (w) {
+                s = CTZ(w);
+                rest = ~(w >> s);
+                len = rest ? (unsigned int) CTZ(rest) : 64 - s;
+                start = i * 64 + s;
+                if (r > 0 && (unsigned int) chunk->data.runs[2 * r - 1] + 1
+                        == start) {
+                    // Continues a run from the previous word.
+                    chunk->data.runs[2 * r - 1] = start + len - 1;
+                }
+                else {
+                    chunk->data.runs[2 * r] = start;
+                    chunk->data.runs[2 * r + 1] = start + len - 1;
+                    r++;
+                }
+                w = s + len >= 64 ? 0 : w & (~0ULL << (s + len));
+            }
+        }
+        chunk->size = r;
+    }
+    return 1;
+}
+
+/**
+ * Returns the chunk as a bitmap: its own if it is one, and otherwise the
+ * given scratch words, filled in.
+ */
+static const unsigned long long *chunk_bitmap(const Chunk *chunk,
+        unsigned long long *scratch) {
+    unsigned int i;
+
+    if (chunk->type == CHUNK_BITMAP) {
+        return chunk->data.bitmap;
+    }
+    memset(scratch, 0, DOCSET_BITMAP_WORDS * sizeof(unsigned long long));
+    if (chunk->type == CHUNK_ARRAY) {
+        for (i = 0; i < chunk->size; i++) {
+            scratch[chunk->data.array[i] / 64] |= 1ULL
+                << (chunk->data.array[i] % 64);
+        }
+    }
+    else {
+        for (i = 0; i < chunk->size; i++) {
+            set_range(scratch, chunk->data.runs[2 * i],
+                    chunk->data.runs[2 * i + 1]);
+        }
+    }
+    return scratch;
+}
+
+/**
+ * Frees the chunk's container.
+ */
+static void chunk_free(Chunk *chunk) {
+    if (chunk->type == CHUNK_ARRAY) {
+        free(chunk->data.array);
+    }
+    else if (chunk->type == CHUNK_BITMAP) {
+        free(chunk->data.bitmap);
+    }
+    else {
+        free(chunk->data.runs);
+    }
+}
+
+/**
+ * Copies the chunk, container and all. Returns 1 on success and 0 if memory
+ * allocation fails.
+ */
+static int chunk_copy(Chunk *dst, const Chunk *src) {
+    size_t bytes;
+
+    *dst = *src;
+    if (src->type == CHUNK_ARRAY) {
+        bytes = src->size * sizeof(unsigned short);
+    }
+    else if (src->type == CHUNK_BITMAP) {
+        bytes = DOCSET_BITMAP_WORDS * sizeof(unsigned long long);
+    }
+    else {
+        bytes = 2 * src->size * sizeof(unsigned short);
+    }
+    if (!(dst->data.array = (unsigned short *) malloc(bytes ? bytes : 1))) {
+        return 0;
+    }
+    memcpy(dst->data.array, src->data.array, bytes);
+    return 1;
+}
+
+/**
+ * Merges two sorted arrays of low values under the given operation into out,
+ * which must have room for the result. Returns the number of values written.
+ */
+static unsigned int merge_arrays(int op, const unsigned short *a,
+        unsigned int na, const unsigned short *b, unsigned int nb,
+        unsigned short *out) {
+    unsigned int i = 0, j = 0, n = 0;
+
+    while (i < na && j < nb) {
+        if (a[i] < b[j]) {
+            if (op != OP_AND) {
+                out[n++] = a[i];
+            }
+            i++;
+        }
+        else if (a[i] > b[j]) {
+            if (op == OP_OR) {
+                out[n++] = b[j];
+            }
+            j++;
+        }
+        else {
+            if (op != OP_ANDNOT) {
+                out[n++] = a[i];
+            }
+            i++;
+            j++;
+        }
+    }
+    while (op != OP_AND && i < na) {
+        out[n++] = a[i++];
+    }
+    while (op == OP_OR && j < nb) {
+        out[n++] = b[j++];
+    }
+    return n;
+}
+
+/**
+ * Keeps the values of a sorted array whose bits in the bitmap are set (or
+ * clear, if keep_set is zero), writing them to out. Returns the number of
+ * values written.
+ */
+static unsigned int filter_array(const unsigned short *values, unsigned int n,
+        const unsigned long long *words, int keep_set, unsigned short *out) {
+    unsigned int i, m = 0;
+    int set;
+
+    for (i = 0; i < n; i++) {
+        set = (words[values[i] / 64] >> (values[i] % 64)) & 1;
+        if (set == keep_set) {
+            out[m++] = values[i];
+        }
+    }
+    return m;
+}
+
+/**
+ * Applies the operation to two chunks with the same key, filling in out. Two
+ * arrays are merged; an array filtered by a set operation against anything
+ * else is checked against the other chunk's bitmap; every other pair is
+ * combined a word at a time and counted with popcount. The result's card is
+ * zero, with nothing allocated, if it is empty. Returns 1 on success and 0 if
+ * memory allocation fails.
+ */
+static int chunk_op(int op, const Chunk *a, const Chunk *b, Chunk *out) {
+    unsigned long long wa[DOCSET_BITMAP_WORDS], wb[DOCSET_BITMAP_WORDS];
+    const unsigned long long *pa, *pb;
+    const Chunk *small, *large;
+    unsigned short *values;
+    unsigned int n, i;
+    int ok;
+
+    out->card = 0;
+    out->key = a->key;
+    small = NULL;
+    if (a->type == CHUNK_ARRAY && b->type == CHUNK_ARRAY) {
+        values = (unsigned short *) malloc((op == OP_OR ? a->size + b->size
+                    : a->size) * sizeof(unsigned short) + 1);
+        if (!values) {
+            return 0;
+        }
+        n = merge_arrays(op, a->data.array, a->size, b->data.array, b->size,
+                values);
+        if (n == 0) {
+            ok = 1;
+        }
+        else if (n <= DOCSET_ARRAY_MAX) {
+            ok = chunk_from_values(out, a->key, values, n);
+        }
+        else {
+            memset(wa, 0, sizeof(wa));
+            for (i = 0; i < n; i++) {
+                wa[values[i] / 64] |= 1ULL << (values[i] % 64);
+            }
+            ok = chunk_from_bitmap(out, a->key, wa);
+        }
+        free(values);
+        return ok;
+    }
+    else if (op != OP_OR && a->type == CHUNK_ARRAY) {
+        small = a;
+        large = b;
+    }
+    else if (op == OP_AND && b->type == CHUNK_ARRAY) {
+        small = b;
+        large = a;
+    }
+
+    if (small) {
+        if (!(values = (unsigned short *) malloc(small->size
+                        * sizeof(unsigned short) + 1))) {
+            return 0;
+        }
+        n = filter_array(small->data.array, small->size,
+                chunk_bitmap(large, wb), op == OP_AND, values);
+        ok = n == 0 || chunk_from_values(out, a->key, values, n);
+        free(values);
+        return ok;
+    }
+
+    pa = chunk_bitmap(a, wa);
+    pb = chunk_bitmap(b, wb);
+    for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+        if (op == OP_AND) {
+            wa[i] = pa[i] & pb[i];
+        }
+        else if (op == OP_OR) {
+            wa[i] = pa[i] | pb[i];
+        }
+        else {
+            wa[i] = pa[i] & ~pb[i];
+        }
+    }
+    return chunk_from_bitmap(out, a->key, wa);
+}
+
+/**
+ * Appends a chunk to the set, taking ownership of its container. Empty
+ * chunks are dropped. Returns 1 on success and 0 if memory allocation fails,
+ * in which case the chunk is freed.
+ */
+static int append_chunk(DocSet *set, Chunk *chunk) {
+    Chunk *grown;
+
+    if (chunk->card == 0) {
+        return 1;
+    }
+    if (set->count == set->cap) {
+        grown = (Chunk *) realloc(set->chunks, (set->cap ? 2 * set->cap : 4)
+                * sizeof(Chunk));
+        if (!grown) {
+            chunk_free(chunk);
+            return 0;
+        }
+        set->chunks = grown;
+        set->cap = set->cap ? 2 * set->cap : 4;
+    }
+    set->chunks[set->count++] = *chunk;
+    return 1;
+}
+
+/**
+ * Creates an empty set. Returns a pointer to the new set, or NULL if the
+ * call fails.
+ */
+DocSet *docset_create(void) {
+    DocSet *set = (DocSet *) malloc(sizeof(struct DocSet));
+    if (set) {
+        set->chunks = NULL;
+        set->count = 0;
+        set->cap = 0;
+    }
+    return set;
+}
+
+/**
+ * Creates a set holding the given document IDs, which must be sorted and
+ * distinct. The IDs are split into chunks by their high bits, and each chunk
+ * gets the smallest container for its values. Returns a pointer to the new
+ * set, or NULL if the call fails.
+ */
+DocSet *docset_from_sorted(const unsigned int *ids, size_t count) {
+    DocSet *set;
+    Chunk chunk;
+    unsigned short *values;
+    unsigned int key, n;
+    size_t i;
+
+    if (!(set = docset_create())) {
+        return NULL;
+    }
+    else if (count == 0) {
+        return set;
+    }
+    else if (!(values = (unsigned short *) malloc((count < CHUNK_VALUES ?
+                        count : CHUNK_VALUES) * sizeof(unsigned short)))) {
+        docset_destroy(set);
+        return NULL;
+    }
+
+    i = 0;
+    while (i < count) {
+        key = ids[i] >> DOCSET_CHUNK_BITS;
+        n = 0;
+        while (i < count && ids[i] >> DOCSET_CHUNK_BITS == key) {
+            values[n++] = (unsigned short) (ids[i++] & CHUNK_LOW_MASK);
+        }
+        if (!chunk_from_values(&chunk, key, values, n)
+                || !append_chunk(set, &chunk)) {
+            free(values);
+            docset_destroy(set);
+            return NULL;
+        }
+    }
+    free(values);
+    return set;
+}
+
+/**
+ * Creates a copy of the given set, or returns NULL if the call fails.
+ */
+DocSet *docset_copy(const DocSet *set) {
+    DocSet *copy;
+    Chunk chunk;
+    int i;
+
+    if (!set || !(copy = docset_create())) {
+        return NULL;
+    }
+    for (i = 0; i < set->count; i++) {
+        if (!chunk_copy(&chunk, &set->chunks[i])
+                || !append_chunk(copy, &chunk)) {
+            docset_destroy(copy);
+            return NULL;
+        }
+    }
+    return copy;
+}
+
+/**
+ * Destroys the set, freeing all associated memory.
+ */
+void docset_destroy(DocSet *set) {
+    int i;
+
+    if (set) {
+        for (i = 0; i < set->count; i++) {
+            chunk_free(&set->chunks[i]);
+        }
+        free(set->chunks);
+        free(set);
+    }
+}
+
+/**
+ * Points the view at the chunks of the set whose keys lie between lo and hi,
+ * inclusive. The chunks are sorted by key, so the first and last are found
+ * by binary search; nothing is copied.
+ */
+void docset_view(const DocSet *set, unsigned int lo, unsigned int hi,
+        DocSet *view) {
+    int first, last, end, mid;
+
+    first = 0;
+    end = set->count;
+    while (first < end) {
+        mid = first + (end - first) / 2;
+        if (set->chunks[mid].key < lo) {
+            first = mid + 1;
+        }
+        else {
+            end = mid;
+        }
+    }
+    last = first;
+    end = set->count;
+    while (last < end) {
+        mid = last + (end - last) / 2;
+        if (set->chunks[mid].key <= hi) {
+            last = mid + 1;
+        }
+        else {
+            end = mid;
+        }
+    }
+    view->chunks = set->chunks + first;
+    view->count = last - first;
+    view->cap = 0;
+}
+
+/**
+ * Moves the chunks of src to the end of dst and destroys src. Returns 1 on
+ * success and 0 if memory allocation fails, in which case both sets are
+ * unchanged.
+ */
+int docset_append(DocSet *dst, DocSet *src) {
+    Chunk *grown;
+
+    if (dst->count + src->count > dst->cap) {
+        if (!(grown = (Chunk *) realloc(dst->chunks, (dst->count + src->count)
+                        * sizeof(Chunk)))) {
+            return 0;
+        }
+        dst->chunks = grown;
+        dst->cap = dst->count + src->count;
+    }
+    memcpy(dst->chunks + dst->count, src->chunks, src->count * sizeof(Chunk));
+    dst->count += src->count;
+    free(src->chunks);
+    free(src);
+    return 1;
+}
+
+/**
+ * Returns the number of documents in the set.
+ */
+size_t docset_cardinality(const DocSet *set) {
+    size_t card = 0;
+    int i;
+
+    for (i = 0; set && i < set->count; i++) {
+        card += set->chunks[i].card;
+    }
+    return card;
+}
+
+/**
+ * Returns one if the set contains the given document ID; zero otherwise. The
+ * chunk is found by binary search on its key, and arrays and runs are
+ * searched the same way.
+ */
+int docset_contains(const DocSet *set, unsigned int doc) {
+    const Chunk *chunk;
+    unsigned int key, low;
+    int lo, hi, mid;
+
+    if (!set) {
+        return 0;
+    }
+    key = doc >> DOCSET_CHUNK_BITS;
+    low = doc & CHUNK_LOW_MASK;
+    lo = 0;
+    hi = set->count - 1;
+    while (lo <= hi) {
+        mid = lo + (hi - lo) / 2;
+        if (set->chunks[mid].key < key) {
+            lo = mid + 1;
+        }
+        else if (set->chunks[mid].key > key) {
+            hi = mid - 1;
+        }
+        else {
+            break;
+        }
+    }
+    if (lo > hi) {
+        return 0;
+    }
+    chunk = &set->chunks[mid];
+
+    if (chunk->type == CHUNK_BITMAP) {
+        return (chunk->data.bitmap[low / 64] >> (low % 64)) & 1;
+    }
+    lo = 0;
+    hi = (int) chunk->size - 1;
+    while (lo <= hi) {
+        mid = lo + (hi - lo) / 2;
+        if (chunk->type == CHUNK_ARRAY) {
+            if (chunk->data.array[mid] == low) {
+                return 1;
+            }
+            else if (chunk->data.array[mid] < low) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid - 1;
+            }
+        }
+        else if (chunk->data.runs[2 * mid + 1] < low) {
+            lo = mid + 1;
+        }
+        else if (chunk->data.runs[2 * mid] > low) {
+            hi = mid - 1;
+        }
+        else {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns the number of bytes the set's containers occupy.
+ */
+size_t docset_bytes(const DocSet *set) {
+    size_t bytes;
+    int i;
+
+    if (!set) {
+        return 0;
+    }
+    bytes = sizeof(struct DocSet) + set->cap * sizeof(Chunk);
+    for (i = 0; i < set->count; i++) {
+        if (set->chunks[i].type == CHUNK_ARRAY) {
+            bytes += set->chunks[i].size * sizeof(unsigned short);
+        }
+        else if (set->chunks[i].type == CHUNK_BITMAP) {
+            bytes += DOCSET_BITMAP_WORDS * sizeof(unsigned long long);
+        }
+        else {
+            bytes += 2 * set->chunks[i].size * sizeof(unsigned short);
+        }
+    }
+    return bytes;
+}
+
+/**
+ * Applies the operation to two sets, walking their chunks in key order.
+ * Chunks with the same key are combined; a chunk found in only one set is
+ * copied when the operation keeps it. Returns a new set, or NULL if the call
+ * fails.
+ */
+static DocSet *docset_op(int op, const DocSet *s1, const DocSet *s2) {
+    DocSet *result;
+    Chunk chunk;
+    int i, j, ok;
+
+    if (!s1 || !s2 || !(result = docset_create())) {
+        return NULL;
+    }
+    i = j = 0;
+    ok = 1;
+    while (ok && (i < s1->count || j < s2->count)) {
+        if (j == s2->count || (i < s1->count
+                    && s1->chunks[i].key < s2->chunks[j].key)) {
+            if (op != OP_AND) {
+                ok = chunk_copy(&chunk, &s1->chunks[i])
+                    && append_chunk(result, &chunk);
+            }
+            else if (j == s2->count) {
+                break;
+            }
+            i++;
+        }
+        else if (i == s1->count || s1->chunks[i].key > s2->chunks[j].key) {
+            if (op == OP_OR) {
+                ok = chunk_copy(&chunk, &s2->chunks[j])
+                    && append_chunk(result, &chunk);
+            }
+            else if (i == s1->count) {
+                break;
+            }
+            j++;
+        }
+        else {
+            ok = chunk_op(op, &s1->chunks[i++], &s2->chunks[j++], &chunk)
+                && append_chunk(result, &chunk);
+        }
+    }
+    if (!ok) {
+        docset_destroy(result);
+        return NULL;
+    }
+    return result;
+}
+
+/**
+ * Returns a new set holding the documents in both sets, or NULL if the call
+ * fails.
+ */
+DocSet *docset_and(const DocSet *s1, const DocSet *s2) {
+    return docset_op(OP_AND, s1, s2);
+}
+
+/**
+ * Returns a new set holding the documents in either set, or NULL if the call
+ * fails.
+ */
+DocSet *docset_or(const DocSet *s1, const DocSet *s2) {
+    return docset_op(OP_OR, s1, s2);
+}
+
+/**
+ * Returns a new set holding the documents in the first set but not the
+ * second, or NULL if the call fails.
+ */
+DocSet *docset_andnot(const DocSet *s1, const DocSet *s2) {
+    return docset_op(OP_ANDNOT, s1, s2);
+}
+
+/**
+ * Returns whether set a's current chunk key is smaller than set b's, given
+ * each set's chunk cursor.
+ */
+static int key_less(const DocSet **sets, const int *cursors, int a, int b) {
+    return sets[a]->chunks[cursors[a]].key < sets[b]->chunks[cursors[b]].key;
+}
+
+/**
+ * Restores the heap property of the set numbers from position i downwards,
+ * ordering them by the key of each set's current chunk.
+ */
+static void heap_sift(int *heap, int n, int i, const DocSet **sets,
+        const int *cursors) {
+    int child, top;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && key_less(sets, cursors, heap[child + 1],
+                    heap[child])) {
+            child++;
+        }
+        if (!key_less(sets, cursors, heap[child], heap[i])) {
+            break;
+        }
+        top = heap[i];
+        heap[i] = heap[child];
+        heap[child] = top;
+        i = child;
+    }
+}
+
+/**
+ * Merges the given sets into result, or only counts their union if result is
+ * NULL. Returns the number of documents in the union, or (size_t) -1 if
+ * memory allocation fails.
+ *
+ * The sets are merged in one pass rather than folded pairwise, which would
+ * copy the growing result once per set. A min-heap holds one cursor per set,
+ * ordered by the key of its current chunk; all chunks with the smallest key
+ * are popped together. A key found in one set has its chunk copied as is;
+ * otherwise the chunks are OR-ed into a bitmap and the result gets whichever
+ * container suits it, so each document is produced exactly once. When only
+ * counting, the bitmap's popcount is all that is kept.
+ */
+static size_t union_sets(const DocSet **sets, int n, DocSet *result) {
+    unsigned long long words[DOCSET_BITMAP_WORDS], scratch[DOCSET_BITMAP_WORDS];
+    const unsigned long long *bits;
+    const Chunk *first, *chunk;
+    Chunk merged;
+    int *heap, *cursors, size, i, j, matches, ok;
+    unsigned int key;
+    size_t card;
+
+    heap = (int *) malloc((n ? n : 1) * sizeof(int));
+    cursors = (int *) calloc(n ? n : 1, sizeof(int));
+    if (!heap || !cursors) {
+        free(heap);
+        free(cursors);
+        return (size_t) -1;
+    }
+
+    size = 0;
+    for (i = 0; i < n; i++) {
+        if (sets[i] && sets[i]->count > 0) {
+            heap[size++] = i;
+        }
+    }
+    for (i = size / 2 - 1; i >= 0; i--) {
+        heap_sift(heap, size, i, sets, cursors);
+    }
+
+    ok = 1;
+    card = 0;
+    while (ok && size > 0) {
+        i = heap[0];
+        first = &sets[i]->chunks[cursors[i]];
+        key = first->key;
+        matches = 0;
+        while (size > 0 && sets[heap[0]]->chunks[cursors[heap[0]]].key
+                == key) {
+            j = heap[0];
+            chunk = &sets[j]->chunks[cursors[j]];
+            if (matches == 0) {
+                first = chunk;
+            }
+            else {
+                if (matches == 1) {
+                    memcpy(words, chunk_bitmap(first, scratch),
+                            sizeof(words));
+                }
+                bits = chunk_bitmap(chunk, scratch);
+                for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+                    words[i] |= bits[i];
+                }
+            }
+            matches++;
+
+            // Advance the set, dropping it once it runs out of chunks.
+            if (++cursors[j] == sets[j]->count) {
+                heap[0] = heap[--size];
+            }
+            heap_sift(heap, size, 0, sets, cursors);
+        }
+
+        if (!result && matches == 1) {
+            card += first->card;
+        }
+        else if (!result) {
+            for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+                card += POPCOUNT(words[i]);
+            }
+        }
+        else {
+            ok = matches == 1 ? chunk_copy(&merged, first)
+                : chunk_from_bitmap(&merged, key, words);
+            card += ok ? merged.card : 0;
+            ok = ok && append_chunk(result, &merged);
+        }
+    }
+
+    free(heap);
+    free(cursors);
+    return ok ? card : (size_t) -1;
+}
+
+/**
+ * Returns a new set holding the documents in any of the given sets, merged
+ * in a single pass, or NULL if the call fails.
+ */
+DocSet *docset_union_many(const DocSet **sets, int n) {
+    DocSet *result;
+
+    if (!sets || n < 0 || !(result = docset_create())) {
+        return NULL;
+    }
+    else if (union_sets(sets, n, result) == (size_t) -1) {
+        docset_destroy(result);
+        return NULL;
+    }
+    return result;
+}
+
+/**
+ * Returns the number of documents in any of the given sets without building
+ * their union, or (size_t) -1 if the call fails.
+ */
+size_t docset_union_count(const DocSet **sets, int n) {
+    if (!sets || n < 0) {
+        return (size_t) -1;
+    }
+    return union_sets(sets, n, NULL);
+}
+
+/**
+ * Returns the number of documents two chunks with the same key have in
+ * common. Arrays are merged, an array against anything else is checked bit
+ * by bit, and every other pair is AND-ed and counted a word at a time.
+ */
+static size_t chunk_and_count(const Chunk *a, const Chunk *b) {
+    unsigned long long wa[DOCSET_BITMAP_WORDS], wb[DOCSET_BITMAP_WORDS];
+    const unsigned long long *pa, *pb;
+    const Chunk *small, *large;
+    unsigned int i, j;
+    size_t card;
+
+    card = 0;
+    if (a->type == CHUNK_ARRAY && b->type == CHUNK_ARRAY) {
+        i = j = 0;
+        while (i < a->size && j < b->size) {
+            if (a->data.array[i] < b->data.array[j]) {
+                i++;
+            }
+            else if (a->data.array[i] > b->data.array[j]) {
+                j++;
+            }
+            else {
+                card++;
+                i++;
+                j++;
+            }
+        }
+        return card;
+    }
+    else if (a->type == CHUNK_ARRAY || b->type == CHUNK_ARRAY) {
+        small = a->type == CHUNK_ARRAY ? a : b;
+        large = small == a ? b : a;
+        pb = chunk_bitmap(large, wb);
+        for (i = 0; i < small->size; i++) {
+            card += (pb[small->data.array[i] / 64]
+                    >> (small->data.array[i] % 64)) & 1;
+        }
+        return card;
+    }
+    pa = chunk_bitmap(a, wa);
+    pb = chunk_bitmap(b, wb);
+    for (i = 0; i < DOCSET_BITMAP_WORDS; i++) {
+        card += POPCOUNT(pa[i] & pb[i]);
+    }
+    return card;
+}
+
+/**
+ * Returns the number of documents in both sets without building their
+ * intersection.
+ */
+size_t docset_and_count(const DocSet *s1, const DocSet *s2) {
+    size_t card;
+    int i, j;
+
+    card = 0;
+    i = j = 0;
+    while (s1 && s2 && i < s1->count && j < s2->count) {
+        if (s1->chunks[i].key < s2->chunks[j].key) {
+            i++;
+        }
+        else if (s1->chunks[i].key > s2->chunks[j].key) {
+            j++;
+        }
+        else {
+            card += chunk_and_count(&s1->chunks[i++], &s2->chunks[j++]);
+        }
+    }
+    return card;
+}
+
+/**
+ * Creates an iterator positioned at the set's first document. If the
+ * allocation succeeds, this returns a pointer to a new iterator; otherwise,
+ * it returns NULL.
+ */
+DocSetIterator *docset_iter_create(const DocSet *set) {
+    DocSetIterator *iterator;
+
+    if (!set || !(iterator = (DocSetIterator *) malloc(
+                    sizeof(struct DocSetIterator)))) {
+        return NULL;
+    }
+    iterator->set = set;
+    iterator->chunk = 0;
+    iterator->pos = 0;
+    iterator->value = 0;
+    iterator->word = 0;
+    return iterator;
+}
+
+/**
+ * Destroys the iterator, freeing all associated memory.
+ */
+void docset_iter_destroy(DocSetIterator *iterator) {
+    free(iterator);
+}
+
+/**
+ * Stores the next document ID in the iteration and returns 1, or returns 0 at
+ * the end of the set. In an array chunk pos indexes the values; in a bitmap
+ * it is one past the index of the word being consumed; in a run chunk it
+ * indexes the runs and value is the offset into the current run.
+ */
+int docset_iter_next(DocSetIterator *iterator, unsigned int *doc) {
+    const Chunk *chunk;
+    unsigned int base, start;
+
+    if (!iterator) {
+        return 0;
+    }
+    while (iterator->chunk < iterator->set->count) {
+        chunk = &iterator->set->chunks[iterator->chunk];
+        base = chunk->key << DOCSET_CHUNK_BITS;
+
+        if (chunk->type == CHUNK_ARRAY && iterator->pos < chunk->size) {
+            *doc = base | chunk->data.array[iterator->pos++];
+            return 1;
+        }
+        else if (chunk->type == CHUNK_BITMAP) {
+            while (!iterator->word && iterator->pos < DOCSET_BITMAP_WORDS) {
+                iterator->word = chunk->data.bitmap[iterator->pos++];
+            }
+            if (iterator->word) {
+                *doc = base | ((iterator->pos - 1) * 64
+                        + CTZ(iterator->word));
+                iterator->word &= iterator->word - 1;
+                return 1;
+            }
+        }
+        else if (chunk->type == CHUNK_RUN && iterator->pos < chunk->size) {
+            start = chunk->data.runs[2 * iterator->pos];
+            *doc = base | (start + iterator->value);
+            if (start + iterator->value == chunk->data.runs[2 * iterator->pos
+                    + 1]) {
+                iterator->pos++;
+                iterator->value = 0;
+            }
+            else {
+                iterator->value++;
+            }
+            return 1;
+        }
+
+        iterator->chunk++;
+        iterator->pos = 0;
+        iterator->value = 0;
+        iterator->word = 0;
+    }
+    return 0;
+}
+
+/**
+ * Stores the first document ID not less than the target among those the
+ * iterator has yet to return, and returns 1; returns 0 if there is none.
+ * Chunks before the target's are skipped by binary search on their keys,
+ * and the iterator is repositioned within the target's chunk without
+ * visiting the documents in between. An iterator is never moved backwards.
+ */
+int docset_iter_advance(DocSetIterator *iterator, unsigned int target,
+        unsigned int *doc) {
+    const DocSet *set;
+    const Chunk *chunk;
+    unsigned int key, low, lo, hi, mid, w;
+    int first, last, middle;
+
+    if (!iterator) {
+        return 0;
+    }
+    set = iterator->set;
+    key = target >> DOCSET_CHUNK_BITS;
+    low = target & CHUNK_LOW_MASK;
+
+    // Find the first remaining chunk whose key is not below the target's.
+    first = iterator->chunk;
+    last = set->count;
+    while (first < last) {
+        middle = first + (last - first) / 2;
+        if (set->chunks[middle].key < key) {
+            first = middle + 1;
+        }
+        else {
+            last = middle;
+        }
+    }
+    if (first != iterator->chunk) {
+        iterator->chunk = first;
+        iterator->pos = 0;
+        iterator->value = 0;
+        iterator->word = 0;
+    }
+    if (first == set->count) {
+        return 0;
+    }
+    chunk = &set->chunks[first];
+
+    if (chunk->key == key && chunk->type == CHUNK_ARRAY) {
+        lo = iterator->pos;
+        hi = chunk->size;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (chunk->data.array[mid] < low) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        iterator->pos = lo;
+    }
+    else if (chunk->key == key && chunk->type == CHUNK_BITMAP) {
+        w = low / 64;
+        if (iterator->pos <= w) {
+            iterator->word = chunk->data.bitmap[w] & (~0ULL << (low % 64));
+            iterator->pos = w + 1;
+        }
+        else if (iterator->pos == w + 1) {
+            iterator->word &= ~0ULL << (low % 64);
+        }
+    }
+    else if (chunk->key == key) {
+        lo = iterator->pos;
+        hi = chunk->size;
+        while (lo < hi) {
+            mid = lo + (hi - lo) / 2;
+            if (chunk->data.runs[2 * mid + 1] < low) {
+                lo = mid + 1;
+            }
+            else {
+                hi = mid;
+            }
+        }
+        if (lo != iterator->pos) {
+            iterator->pos = lo;
+            iterator->value = 0;
+        }
+        if (lo < chunk->size && chunk->data.runs[2 * lo] < low
+                && low - chunk->data.runs[2 * lo] > iterator->value) {
+            iterator->value = low - chunk->data.runs[2 * lo];
+        }
+    }
+    return docset_iter_next(iterator, doc);
+}
@@ -0,0 +1,182 @@
+#ifndef DOCSET_H
+#define DOCSET_H
+
+#include <stddef.h>
+
+/*
+ * Number of document IDs covered by one chunk, and the container limits.
+ * An array chunk holds at most DOCSET_ARRAY_MAX IDs; past that a bitmap of
+ * DOCSET_BITMAP_WORDS 64-bit words is never larger.
+ */
+#define DOCSET_CHUNK_BITS 16
+#define DOCSET_ARRAY_MAX 4096
+#define DOCSET_BITMAP_WORDS 1024
+
+/*
+ * Container types of a chunk.
+ */
+#define CHUNK_ARRAY 0
+#define CHUNK_BITMAP 1
+#define CHUNK_RUN 2
+
+/**
+ * The documents of a set whose IDs share their high 16 bits (the key). The
+ * low 16 bits are stored in whichever container is smallest: a sorted array
+ * of values, a bitmap, or a sorted array of inclusive (start, end) runs.
+ * Size is the number of array values or runs.
+ */
+struct Chunk {
+    unsigned int key;
+    int type;
+    unsigned int card;
+    unsigned int size;
+    union {
+        unsigned short *array;
+        unsigned long long *bitmap;
+        unsigned short *runs;
+    } data;
+};
+
+typedef struct Chunk Chunk;
+
+/**
+ * A set of document IDs, stored Roaring-style as a sorted array of chunks.
+ * Each chunk picks its own container, so sparse and dense stretches of the
+ * ID space are both stored compactly, and set operations between dense
+ * chunks run a machine word at a time.
+ */
+struct DocSet {
+    Chunk *chunks;
+    int count;
+    int cap;
+};
+
+typedef struct DocSet DocSet;
+
+/**
+ * Creates an empty set. Returns a pointer to the new set, or NULL if the
+ * call fails.
+ */
+DocSet *docset_create(void);
+
+/**
+ * Creates a set holding the given document IDs, which must be sorted and
+ * distinct. Returns a pointer to the new set, or NULL if the call fails.
+ */
+DocSet *docset_from_sorted(const unsigned int *, size_t);
+
+/**
+ * Creates a copy of the given set, or returns NULL if the call fails.
+ */
+DocSet *docset_copy(const DocSet *);
+
+/**
+ * Destroys the set, freeing all associated memory.
+ */
+void docset_destroy(DocSet *);
+
+/**
+ * Fills in the given set as a read-only view of the chunks of a set whose
+ * keys lie between the two given keys, inclusive. The view shares the set's
+ * chunks: it can be passed to any operation that does not change its
+ * argument, stays valid as long as the set is unchanged, and must not be
+ * destroyed.
+ */
+void docset_view(const DocSet *, unsigned int, unsigned int, DocSet *);
+
+/**
+ * Moves the chunks of the second set, whose keys must all be greater than
+ * the first set's, to the end of the first set and destroys the second.
+ * Returns 1 on success and 0 if memory allocation fails, in which case
+ * neither set changes.
+ */
+int docset_append(DocSet *, DocSet *);
+
+/**
+ * Returns the number of documents in the set.
+ */
+size_t docset_cardinality(const DocSet *);
+
+/**
+ * Returns one if the set contains the given document ID; zero otherwise.
+ */
+int docset_contains(const DocSet *, unsigned int);
+
+/**
+ * Returns the number of bytes the set's containers occupy.
+ */
+size_t docset_bytes(const DocSet *);
+
+/**
+ * Returns a new set holding the documents in both sets, or NULL if the call
+ * fails.
+ */
+DocSet *docset_and(const DocSet *, const DocSet *);
+
+/**
+ * Returns a new set holding the documents in either set, or NULL if the call
+ * fails.
+ */
+DocSet *docset_or(const DocSet *, const DocSet *);
+
+/**
+ * Returns a new set holding the documents in the first set but not the
+ * second, or NULL if the call fails.
+ */
+DocSet *docset_andnot(const DocSet *, const DocSet *);
+
+/**
+ * Returns a new set holding the documents in any of the given sets, merged
+ * in a single pass, or NULL if the call fails.
+ */
+DocSet *docset_union_many(const DocSet **, int);
+
+/**
+ * Returns the number of documents in any of the given sets without building
+ * their union, or (size_t) -1 if the call fails.
+ */
+size_t docset_union_count(const DocSet **, int);
+
+/**
+ * Returns the number of documents in both sets without building their
+ * intersection.
+ */
+size_t docset_and_count(const DocSet *, const DocSet *);
+
+/**
+ * Iterator type for walking a set's document IDs in increasing order.
+ */
+struct DocSetIterator {
+    const DocSet *set;
+    int chunk;
+    unsigned int pos;
+    unsigned int value;
+    unsigned long long word;
+};
+
+typedef struct DocSetIterator DocSetIterator;
+
+/**
+ * Creates an iterator positioned at the set's first document.
+ */
+DocSetIterator *docset_iter_create(const DocSet *);
+
+/**
+ * Destroys the iterator, freeing all associated memory.
+ */
+void docset_iter_destroy(DocSetIterator *);
+
+/**
+ * Stores the next document ID in the iteration and returns 1, or returns 0 at
+ * the end of the set.
+ */
+int docset_iter_next(DocSetIterator *, unsigned int *);
+
+/**
+ * Stores the first remaining document ID not less than the given target and
+ * returns 1, or returns 0 if there is none. The iterator then continues after
+ * that document.
+ */
+int docset_iter_advance(DocSetIterator *, unsigned int, unsigned int *);
+
+#endif
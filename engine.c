@@ -0,0 +1,1069 @@
+#include "docset.h"
+#include "engine.h"
+#include "inverted-index.h"
+#include "levenshtein.h"
+#include "stats.h"
+#include "tokenizer.h"
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Parses the edit distance of a fuzzy term, the digits between the '~' and
+ * the end of the term. Returns the distance, or -1 if it is not all digits
+ * or larger than LEV_MAX_DISTANCE.
+ */
+static int fuzzy_distance(const char *digits, const char *end) {
+    char *stop;
+    long value;
+
+    if (digits == end || *digits < '0' || *digits > '9') {
+        return -1;
+    }
+    value = strtol(digits, &stop, 10);
+    return stop == end && value <= LEV_MAX_DISTANCE ? (int) value : -1;
+}
+
+/**
+ * Looks up a single query term, given as a (pointer, length) view. A term
+ * ending in '*' matches every token with that prefix, and a term of the form
+ * lo..hi matches every token between lo and hi, inclusive. A term of the form
+ * word~ or word~N matches every token within edit distance N (1 by default)
+ * of word; N must be at most LEV_MAX_DISTANCE, or the term is invalid and
+ * NULL is returned. Any other term must match a token exactly. The tokens
+ * of the first three forms are merged within the given limits.
+ */
+DocSet *match_query_term(Index *index, const char *term, size_t len,
+        LookupLimits *limits) {
+    const char *sep;
+    int maxdist;
+
+    if (len > 0 && term[len - 1] == '*') {
+        return match_prefix(index, term, len - 1, limits);
+    }
+    else if ((sep = memchr(term, '~', len)) != NULL) {
+        if (sep == term + len - 1) {
+            return match_fuzzy(index, term, sep - term, 1, limits);
+        }
+        else if ((maxdist = fuzzy_distance(sep + 1, term + len)) == -1) {
+            return NULL;
+        }
+        return match_fuzzy(index, term, sep - term, maxdist, limits);
+    }
+    for (sep = term; sep + 1 < term + len; sep++) {
+        if (sep[0] == '.' && sep[1] == '.') {
+            return match_range(index, term, sep - term, sep + 2,
+                    term + len - sep - 2, limits);
+        }
+    }
+    return match_term(index, term, len);
+}
+
+/**
+ * Parses a non-negative decimal number from the next token. Returns 1 on
+ * success and 0 if there is no token, it is not a number or it does not fit
+ * in a size_t.
+ */
+static int next_number(TokenizerT *tk, size_t *value) {
+    const char *token;
+    size_t len, i;
+
+    if (!TKNextSlice(tk, &token, &len)) {
+        return 0;
+    }
+    *value = 0;
+    for (i = 0; i < len; i++) {
+        if (token[i] < '0' || token[i] > '9'
+                || *value > (SIZE_MAX - (token[i] - '0')) / 10) {
+            return 0;
+        }
+        *value = *value * 10 + (token[i] - '0');
+    }
+    return 1;
+}
+
+/**
+ * Appends a term's document set to the plan. Returns 1 on success and 0 if
+ * memory allocation fails, in which case the set is destroyed.
+ */
+static int plan_add(QueryPlan *plan, DocSet *docs, int *cap) {
+    DocSet **grown;
+
+    if (plan->nsets == *cap) {
+        *cap = *cap ? 2 * *cap : 8;
+        if (!(grown = (DocSet **) realloc(plan->sets, *cap
+                        * sizeof(DocSet *)))) {
+            docset_destroy(docs);
+            return 0;
+        }
+        plan->sets = grown;
+    }
+    plan->sets[plan->nsets++] = docs;
+    return 1;
+}
+
+/**
+ * Parses the flags at the start of the rest of a query line into the plan
+ * and stores the first term that follows them, if any; term is set to NULL
+ * if there is none. Returns 1 on success and 0 if a flag is invalid.
+ */
+int plan_parse_flags(QueryPlan *plan, TokenizerT *tk, const char **term,
+        size_t *len) {
+    *term = NULL;
+    while (TKNextSlice(tk, term, len)) {
+        if (*len != 2 || (*term)[0] != '-') {
+            return 1;
+        }
+        else if ((*term)[1] == 'c') {
+            plan->count_only = 1;
+        }
+        else if ((*term)[1] == 'l') {
+            if (!next_number(tk, &plan->limit) || plan->limit == 0) {
+                return 0;
+            }
+        }
+        else if ((*term)[1] != 'o' || !next_number(tk, &plan->offset)) {
+            return 0;
+        }
+        *term = NULL;
+    }
+    *term = NULL;
+    return 1;
+}
+
+/**
+ * Appends the ordinals of the terms whose postings a query term will read
+ * to the list, mirroring the forms match_query_term accepts. Fuzzy terms
+ * add nothing, since their tokens are only known once the dictionary has
+ * been searched. Returns 1 on success and 0 if memory allocation fails.
+ */
+static int collect_query_term(Index *index, const char *term, size_t len,
+        OrdinalList *list) {
+    const char *sep;
+
+    if (len > 0 && term[len - 1] == '*') {
+        return collect_prefix(index, term, len - 1, list);
+    }
+    else if (memchr(term, '~', len) != NULL) {
+        return 1;
+    }
+    for (sep = term; sep + 1 < term + len; sep++) {
+        if (sep[0] == '.' && sep[1] == '.') {
+            return collect_range(index, term, sep - term, sep + 2,
+                    term + len - sep - 2, list);
+        }
+    }
+    return collect_term(index, term, len, list);
+}
+
+/**
+ * Returns one if a query term, given as a (pointer, length) view, matches a
+ * token exactly rather than a prefix, range or fuzzy form; zero otherwise.
+ */
+static int is_exact_term(const char *term, size_t len) {
+    const char *sep;
+
+    if (len == 0 || term[len - 1] == '*' || memchr(term, '~', len)) {
+        return 0;
+    }
+    for (sep = term; sep + 1 < term + len; sep++) {
+        if (sep[0] == '.' && sep[1] == '.') {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Returns the length of the postings list of the token a query term matches
+ * exactly, or zero if the index has no such token.
+ */
+static size_t term_cost(Index *index, const char *term, size_t len) {
+    int ordinal = dict_lookup(index->terms, term, len);
+
+    return ordinal == -1 ? 0
+        : index->offsets[ordinal + 1] - index->offsets[ordinal];
+}
+
+/**
+ * Reads the cold postings of all of a query's terms, or only of its exact
+ * ones if the flag is set, in one concurrent batch and pins them, so that
+ * looking the terms up afterwards finds them in the cache. Returns the
+ * pinned ordinals, to be passed to release_pinned, or an empty list if
+ * there is nothing to pin or the batch fails, in which case the lookups
+ * read the postings themselves.
+ */
+static OrdinalList pin_query_terms(Index *index, const char **terms,
+        const size_t *lens, int nterms, int exact_only) {
+    OrdinalList list = {NULL, 0, 0};
+    const unsigned int **lists;
+    int i, ok;
+
+    for (i = 0, ok = 1; ok && i < nterms; i++) {
+        if (!exact_only || is_exact_term(terms[i], lens[i])) {
+            ok = collect_query_term(index, terms[i], lens[i], &list);
+        }
+    }
+    lists = ok && list.count > 0 ? (const unsigned int **) malloc(list.count
+            * sizeof(unsigned int *)) : NULL;
+    if (!lists || !fetch_postings_many(index, list.ordinals, list.count,
+                lists)) {
+        free(list.ordinals);
+        list.ordinals = NULL;
+        list.count = 0;
+    }
+    free(lists);
+    return list;
+}
+
+/**
+ * Releases the postings pinned by pin_query_terms.
+ */
+static void release_pinned(Index *index, OrdinalList *list) {
+    int i;
+
+    for (i = 0; i < list->count; i++) {
+        release_postings(index, list->ordinals[i]);
+    }
+    free(list->ordinals);
+}
+
+/**
+ * Rewrites an intersection to use the index's precomputed pair
+ * intersections. Exact terms are paired up greedily, in query order, with
+ * the first later term the index has a pair for; each such pair's set is
+ * added to the plan, its size noted for both terms' slots, and both terms
+ * are removed from the list, leaving the rest to be looked up as usual.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+static int plan_use_pairs(QueryPlan *plan, Index *index, const char **terms,
+        size_t *lens, int *slots, int *nterms, int *cap) {
+    const DocSet *both;
+    DocSet *docs;
+    int *ordinals, i, j, n, ok;
+
+    if (!(ordinals = (int *) malloc(*nterms * sizeof(int)))) {
+        return 0;
+    }
+    for (i = 0; i < *nterms; i++) {
+        ordinals[i] = is_exact_term(terms[i], lens[i])
+            ? dict_lookup(index->terms, terms[i], lens[i]) : -1;
+    }
+    ok = 1;
+    for (i = 0; ok && i < *nterms; i++) {
+        for (j = i + 1; ordinals[i] >= 0 && j < *nterms; j++) {
+            if (ordinals[j] < 0 || !(both = pair_docs(index, ordinals[i],
+                            ordinals[j]))) {
+                continue;
+            }
+            ok = (docs = docset_copy(both)) != NULL
+                && plan_add(plan, docs, cap);
+            plan->sizes[slots[i]] = plan->sizes[slots[j]]
+                = docset_cardinality(both);
+            ordinals[i] = ordinals[j] = -2;
+        }
+    }
+
+    // Drop the terms the pairs cover.
+    for (i = 0, n = 0; i < *nterms; i++) {
+        if (ordinals[i] != -2) {
+            terms[n] = terms[i];
+            slots[n] = slots[i];
+            lens[n++] = lens[i];
+        }
+    }
+    *nterms = n;
+    free(ordinals);
+    return ok;
+}
+
+/**
+ * Parses the rest of a query line from the tokenizer: optional flags
+ * followed by terms. When the index keeps its postings on disk, the
+ * postings of every term are read in one concurrent batch before the first
+ * one is looked up, so a cold query waits about as long as its slowest read
+ * rather than the sum of them. An intersection uses the index's precomputed
+ * pair intersections where it can, so a hot pair costs a single set instead
+ * of reading and intersecting two postings lists.
+ *
+ * Under a budget or deadline, the exact terms' postings lengths are summed
+ * from the index's offsets before any set is built and counted against the
+ * budget first; the prefix, range and fuzzy terms then each merge only the
+ * tokens that fit in an equal share of what is left, and by the deadline,
+ * and the plan is marked truncated if any were left out. Only the exact
+ * terms' cold postings are read ahead then. Returns a pointer to the new
+ * plan, or NULL if the flags are invalid or an error occurs.
+ */
+QueryPlan *plan_create(Index *index, TokenizerT *tk, int conjunctive,
+        size_t budget, double deadline) {
+    QueryPlan *plan;
+    OrdinalList pinned = {NULL, 0, 0};
+    LookupLimits limits = {budget, deadline, 0, 0};
+    DocSet *docs;
+    const char **terms, **grown, *token;
+    size_t *lens, *lgrown, len, share;
+    int *slots, cap, setcap, nterms, expanding, i, ok;
+
+    if (!index || !tk || !(plan = (QueryPlan *) malloc(
+                    sizeof(struct QueryPlan)))) {
+        return NULL;
+    }
+    plan->conjunctive = conjunctive;
+    plan->count_only = 0;
+    plan->offset = 0;
+    plan->limit = 0;
+    plan->sets = NULL;
+    plan->nsets = 0;
+    plan->sizes = NULL;
+    plan->nterms = 0;
+    plan->pool = NULL;
+    plan->budget = budget;
+    plan->deadline = deadline;
+    plan->truncated = 0;
+
+    // Collect the terms.
+    terms = NULL;
+    lens = NULL;
+    cap = nterms = 0;
+    ok = plan_parse_flags(plan, tk, &token, &len);
+    while (ok && token) {
+        if (nterms == cap) {
+            cap = cap ? 2 * cap : 8;
+            grown = (const char **) realloc(terms, cap * sizeof(char *));
+            terms = grown ? grown : terms;
+            lgrown = (size_t *) realloc(lens, cap * sizeof(size_t));
+            lens = lgrown ? lgrown : lens;
+            if (!grown || !lgrown) {
+                ok = 0;
+                break;
+            }
+        }
+        terms[nterms] = token;
+        lens[nterms++] = len;
+        if (!TKNextSlice(tk, &token, &len)) {
+            token = NULL;
+        }
+    }
+
+    // Each term's size goes to its slot, its position in the query.
+    slots = ok ? (int *) malloc((nterms ? nterms : 1) * sizeof(int)) : NULL;
+    plan->sizes = ok ? (size_t *) calloc(nterms ? nterms : 1,
+            sizeof(size_t)) : NULL;
+    ok = slots && plan->sizes;
+    for (i = 0; ok && i < nterms; i++) {
+        slots[i] = i;
+    }
+    plan->nterms = ok ? nterms : 0;
+
+    // Replace hot pairs, read the other terms' postings, then look them up.
+    setcap = 0;
+    if (ok && conjunctive && index->npairs > 0 && nterms > 1) {
+        ok = plan_use_pairs(plan, index, terms, lens, slots, &nterms,
+                &setcap);
+    }
+    for (i = 0, expanding = 0; ok && i < nterms; i++) {
+        if (is_exact_term(terms[i], lens[i])) {
+            limits.spent += term_cost(index, terms[i], lens[i]);
+        }
+        else {
+            expanding++;
+        }
+    }
+    if (ok && index->cold) {
+        pinned = pin_query_terms(index, terms, lens, nterms,
+                budget > 0 || deadline > 0);
+    }
+    for (i = 0; ok && i < nterms; i++) {
+        if (budget > 0 && !is_exact_term(terms[i], lens[i])) {
+            // Give each expanding term an equal share of what is left.
+            share = budget > limits.spent
+                ? (budget - limits.spent) / expanding-- : 0;
+            limits.budget = limits.spent + (share ? share : 1);
+        }
+        ok = (docs = match_query_term(index, terms[i], lens[i], &limits))
+            != NULL && plan_add(plan, docs, &setcap);
+        if (ok) {
+            plan->sizes[slots[i]] = docset_cardinality(docs);
+        }
+    }
+    release_pinned(index, &pinned);
+    // A plan estimated past its budget cannot be answered in full.
+    plan->truncated = limits.stopped || (budget > 0 && ok
+            && (limits.spent > budget || plan_cost(plan) > budget));
+    free(slots);
+    free(terms);
+    free(lens);
+    if (!ok) {
+        plan_destroy(plan);
+        return NULL;
+    }
+    return plan;
+}
+
+/**
+ * Destroys the plan, freeing all associated memory.
+ */
+void plan_destroy(QueryPlan *plan) {
+    int i;
+
+    if (plan) {
+        for (i = 0; i < plan->nsets; i++) {
+            docset_destroy(plan->sets[i]);
+        }
+        free(plan->sets);
+        free(plan->sizes);
+        free(plan);
+    }
+}
+
+/**
+ * qsort comparison function ordering document sets by their size.
+ */
+static int compare_sizes(const void *s1, const void *s2) {
+    size_t c1 = docset_cardinality(*(DocSet **) s1);
+    size_t c2 = docset_cardinality(*(DocSet **) s2);
+
+    return c1 < c2 ? -1 : (c1 > c2 ? 1 : 0);
+}
+
+/**
+ * Returns the intersection of all the given sets but the last, which are
+ * sorted by size so that the running intersection shrinks as fast as
+ * possible. Returns NULL if memory allocation fails.
+ */
+static DocSet *intersect_prefix(DocSet **sets, int n) {
+    DocSet *result, *combined;
+    int i;
+
+    qsort(sets, n, sizeof(DocSet *), compare_sizes);
+    if (!(result = docset_copy(sets[0]))) {
+        return NULL;
+    }
+    for (i = 1; i < n - 1; i++) {
+        combined = docset_and(result, sets[i]);
+        docset_destroy(result);
+        if (!(result = combined)) {
+            return NULL;
+        }
+    }
+    return result;
+}
+
+/**
+ * Returns the number of documents matched by intersecting or uniting the
+ * given sets, without building the result. A union is counted chunk by
+ * chunk with popcount. The overlap of two sets is only counted; with more,
+ * an intersection is built for all but the largest set, whose overlap with
+ * it is then counted. Returns (size_t) -1 if memory allocation fails.
+ */
+static size_t count_sets(DocSet **sets, int n, int conjunctive) {
+    DocSet *partial;
+    size_t count;
+
+    if (n == 0) {
+        return 0;
+    }
+    else if (n == 1) {
+        return docset_cardinality(sets[0]);
+    }
+    else if (!conjunctive) {
+        return docset_union_count((const DocSet **) sets, n);
+    }
+    else if (n == 2) {
+        return docset_and_count(sets[0], sets[1]);
+    }
+    else if (!(partial = intersect_prefix(sets, n))) {
+        return (size_t) -1;
+    }
+    count = docset_and_count(partial, sets[n - 1]);
+    docset_destroy(partial);
+    return count;
+}
+
+/**
+ * Returns the intersection or union of the given sets, built with
+ * whole-set operations, or NULL if memory allocation fails.
+ */
+static DocSet *combine_sets(DocSet **sets, int n, int conjunctive) {
+    DocSet *result, *combined;
+
+    if (n == 0) {
+        return docset_create();
+    }
+    else if (!conjunctive) {
+        return docset_union_many((const DocSet **) sets, n);
+    }
+    result = intersect_prefix(sets, n);
+    if (result && n > 1) {
+        combined = docset_and(result, sets[n - 1]);
+        docset_destroy(result);
+        result = combined;
+    }
+    return result;
+}
+
+/**
+ * Tracks the partitions of a query evaluated on the pool, so that the
+ * querying thread can wait for its own partitions only.
+ */
+struct PartJob {
+    int remaining;
+    pthread_mutex_t lock;
+    pthread_cond_t done;
+};
+
+typedef struct PartJob PartJob;
+
+/**
+ * One partition of a query: views of the plan's sets restricted to a range
+ * of chunk keys, and the partition's result or count.
+ */
+struct PlanPart {
+    DocSet *views;
+    DocSet **sets;
+    int nsets;
+    int conjunctive;
+    int count_only;
+    DocSet *result;
+    size_t count;
+    PartJob *job;
+};
+
+typedef struct PlanPart PlanPart;
+
+/**
+ * Evaluates a partition exactly as a whole plan would be evaluated. The
+ * argument is a PlanPart; a pooled partition signals its job when done.
+ */
+static void run_part(void *arg) {
+    PlanPart *part = (PlanPart *) arg;
+
+    if (part->count_only) {
+        part->count = count_sets(part->sets, part->nsets, part->conjunctive);
+    }
+    else {
+        part->result = combine_sets(part->sets, part->nsets,
+                part->conjunctive);
+    }
+    if (part->job) {
+        pthread_mutex_lock(&part->job->lock);
+        if (--part->job->remaining == 0) {
+            pthread_cond_signal(&part->job->done);
+        }
+        pthread_mutex_unlock(&part->job->lock);
+    }
+}
+
+/**
+ * Finds the range of chunk keys the plan's result can fall in: the keys all
+ * sets share for an intersection, and those any set has for a union.
+ * Returns 1 on success and 0 if the result is certainly empty.
+ */
+static int plan_range(const QueryPlan *plan, unsigned int *lo,
+        unsigned int *hi) {
+    const DocSet *set;
+    unsigned int first, last;
+    int i, seen;
+
+    seen = 0;
+    for (i = 0; i < plan->nsets; i++) {
+        if ((set = plan->sets[i])->count == 0) {
+            if (plan->conjunctive) {
+                return 0;
+            }
+            continue;
+        }
+        first = set->chunks[0].key;
+        last = set->chunks[set->count - 1].key;
+        if (!seen++) {
+            *lo = first;
+            *hi = last;
+        }
+        else if (plan->conjunctive) {
+            *lo = first > *lo ? first : *lo;
+            *hi = last < *hi ? last : *hi;
+        }
+        else {
+            *lo = first < *lo ? first : *lo;
+            *hi = last > *hi ? last : *hi;
+        }
+    }
+    return seen && *lo <= *hi;
+}
+
+/**
+ * Returns the plan's estimated cost: the total number of documents in its
+ * sets.
+ */
+size_t plan_cost(const QueryPlan *plan) {
+    size_t cost = 0;
+    int i;
+
+    for (i = 0; plan && i < plan->nsets; i++) {
+        cost += docset_cardinality(plan->sets[i]);
+    }
+    return cost;
+}
+
+/**
+ * Returns the estimated cost of the part of the plan within a range of chunk
+ * keys, found by viewing each set's chunks in the range.
+ */
+static size_t range_cost(const QueryPlan *plan, unsigned int lo,
+        unsigned int hi) {
+    DocSet view;
+    size_t cost = 0;
+    int i;
+
+    for (i = 0; i < plan->nsets; i++) {
+        docset_view(plan->sets[i], lo, hi, &view);
+        cost += docset_cardinality(&view);
+    }
+    return cost;
+}
+
+/**
+ * Returns the number of partitions a range of chunk keys of the plan with
+ * the given estimated cost is split into. A range is split only if the plan
+ * has a pool, the cost reaches PLAN_PARALLEL_COST and the range spans
+ * several chunks.
+ */
+static int count_parts(const QueryPlan *plan, size_t cost, unsigned int lo,
+        unsigned int hi) {
+    int n;
+
+    if (!plan->pool || plan->nsets < 2 || cost < PLAN_PARALLEL_COST
+            || hi <= lo) {
+        return 1;
+    }
+    n = plan->pool->nthreads + 1;
+    n = n < PLAN_MAX_PARTS ? n : PLAN_MAX_PARTS;
+    return hi - lo + 1 < (unsigned int) n ? (int) (hi - lo + 1) : n;
+}
+
+/**
+ * Decides how many partitions the whole plan is split into and the range of
+ * chunk keys they cover. Returns the number of partitions, one if the plan
+ * is evaluated whole.
+ */
+static int plan_partitions(QueryPlan *plan, unsigned int *lo,
+        unsigned int *hi) {
+    if (!plan->pool || plan->nsets < 2 || !plan_range(plan, lo, hi)) {
+        return 1;
+    }
+    return count_parts(plan, plan_cost(plan), *lo, *hi);
+}
+
+/**
+ * Evaluates the plan split by document ID into ranges of whole chunks. The
+ * sets' chunks are sorted by key, so each set's share of a range is found by
+ * binary search and viewed in place. The partitions but the first run on
+ * the plan's pool while the querying thread runs the first, and since the
+ * ranges are disjoint and increasing, the results are concatenated chunk
+ * lists. Stores the count, or the result if the plan does not only count.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+static int run_parallel(QueryPlan *plan, int nparts, unsigned int lo,
+        unsigned int hi, DocSet **result, size_t *count) {
+    PlanPart *parts;
+    PartJob job;
+    unsigned int span, first, last;
+    int p, i, ok;
+
+    if (!(parts = (PlanPart *) calloc(nparts, sizeof(PlanPart)))) {
+        return 0;
+    }
+    span = hi - lo + 1;
+    ok = 1;
+    for (p = 0; ok && p < nparts; p++) {
+        parts[p].views = (DocSet *) malloc(plan->nsets * sizeof(DocSet));
+        parts[p].sets = (DocSet **) malloc(plan->nsets * sizeof(DocSet *));
+        if (!(ok = parts[p].views && parts[p].sets)) {
+            break;
+        }
+        first = lo + (unsigned int) ((unsigned long long) span * p / nparts);
+        last = lo + (unsigned int) ((unsigned long long) span * (p + 1)
+                / nparts) - 1;
+        for (i = 0; i < plan->nsets; i++) {
+            docset_view(plan->sets[i], first, last, &parts[p].views[i]);
+            parts[p].sets[i] = &parts[p].views[i];
+        }
+        parts[p].nsets = plan->nsets;
+        parts[p].conjunctive = plan->conjunctive;
+        parts[p].count_only = count != NULL;
+        parts[p].job = p > 0 ? &job : NULL;
+    }
+
+    if (ok) {
+        job.remaining = nparts - 1;
+        pthread_mutex_init(&job.lock, NULL);
+        pthread_cond_init(&job.done, NULL);
+        for (p = 1; p < nparts; p++) {
+            if (!pool_submit(plan->pool, run_part, &parts[p])) {
+                run_part(&parts[p]);
+            }
+        }
+        parts[0].job = NULL;
+        run_part(&parts[0]);
+        pthread_mutex_lock(&job.lock);
+        while (job.remaining > 0) {
+            pthread_cond_wait(&job.done, &job.lock);
+        }
+        pthread_mutex_unlock(&job.lock);
+        pthread_mutex_destroy(&job.lock);
+        pthread_cond_destroy(&job.done);
+    }
+
+    // Gather the partitions in order.
+    if (count) {
+        *count = 0;
+        for (p = 0; p < nparts; p++) {
+            ok = ok && parts[p].count != (size_t) -1;
+            *count += parts[p].count;
+        }
+    }
+    for (p = 1; !count && p < nparts; p++) {
+        ok = ok && parts[0].result && parts[p].result
+            && docset_append(parts[0].result, parts[p].result);
+        if (ok) {
+            parts[p].result = NULL;
+        }
+    }
+    if (!count) {
+        *result = ok ? parts[0].result : NULL;
+    }
+    for (p = 0; p < nparts; p++) {
+        if (!ok || p > 0) {
+            docset_destroy(parts[p].result);
+        }
+        free(parts[p].views);
+        free(parts[p].sets);
+    }
+    free(parts);
+    return ok;
+}
+
+/**
+ * Passes a document on unless it falls within the plan's offset. Returns 1
+ * once the plan's limit has been reached and 0 otherwise.
+ */
+static int emit(QueryPlan *plan, unsigned int doc, size_t *seen,
+        size_t *emitted, DocFunc func, void *arg) {
+    if ((*seen)++ < plan->offset) {
+        return 0;
+    }
+    func(doc, arg);
+    return ++*emitted == plan->limit;
+}
+
+/**
+ * Returns one, and marks the plan truncated, if the plan has spent more
+ * than its budget or passed its deadline; zero otherwise.
+ */
+static int plan_expired(QueryPlan *plan, size_t spent) {
+    if ((plan->budget > 0 && spent > plan->budget)
+            || (plan->deadline > 0 && stats_now() >= plan->deadline)) {
+        plan->truncated = 1;
+        return 1;
+    }
+    return 0;
+}
+
+/**
+ * Evaluates a bounded plan in slices by document ID: ranges of chunk keys,
+ * in increasing order, each estimated to cost about PLAN_SLICE_COST, or the
+ * budget if that is smaller. Before every slice, the plan stops if the slice
+ * would take it past its budget or its deadline has passed, so that what it
+ * has gathered is the start of the full result. Each slice is counted, or
+ * built and passed on after the plan's offset; a large slice is itself split
+ * into parallel partitions. Returns the number of documents counted or
+ * passed on, or (size_t) -1 if an error occurs.
+ */
+static size_t run_slices(QueryPlan *plan, DocFunc func, void *arg) {
+    DocSetIterator *iterator;
+    DocSet *result;
+    unsigned int lo, hi, first, last, doc;
+    unsigned long long step;
+    size_t cost, target, spent, slice, seen, emitted, count;
+
+    if (!plan_range(plan, &lo, &hi)) {
+        return 0;
+    }
+    target = plan->budget > 0 && plan->budget < PLAN_SLICE_COST
+        ? plan->budget : PLAN_SLICE_COST;
+    step = hi - lo + 1;
+    if ((cost = plan_cost(plan)) > target) {
+        step = step * target / cost;
+        step = step > 0 ? step : 1;
+    }
+
+    spent = seen = emitted = 0;
+    for (first = lo; first <= hi; first = last + 1) {
+        last = hi - first < step ? hi : first + (unsigned int) step - 1;
+        slice = range_cost(plan, first, last);
+        if (plan_expired(plan, spent + slice)) {
+            break;
+        }
+        spent += slice;
+        if (!func) {
+            if (!run_parallel(plan, count_parts(plan, slice, first, last),
+                        first, last, NULL, &count)) {
+                return (size_t) -1;
+            }
+            emitted += count;
+            continue;
+        }
+        result = NULL;
+        if (!run_parallel(plan, count_parts(plan, slice, first, last), first,
+                    last, &result, NULL)
+                || !(iterator = docset_iter_create(result))) {
+            docset_destroy(result);
+            return (size_t) -1;
+        }
+        while (docset_iter_next(iterator, &doc)) {
+            emit(plan, doc, &seen, &emitted, func, arg);
+        }
+        docset_iter_destroy(iterator);
+        docset_destroy(result);
+    }
+    return emitted;
+}
+
+/**
+ * Returns the number of documents the plan matches, without building the
+ * result. A large plan with a pool is counted in parallel partitions, and a
+ * plan with a budget or deadline in slices.
+ */
+size_t plan_count(QueryPlan *plan) {
+    unsigned int lo, hi;
+    size_t count;
+    int nparts;
+
+    if (!plan) {
+        return (size_t) -1;
+    }
+    else if (plan->budget > 0 || plan->deadline > 0) {
+        return run_slices(plan, NULL, NULL);
+    }
+    else if ((nparts = plan_partitions(plan, &lo, &hi)) > 1) {
+        return run_parallel(plan, nparts, lo, hi, NULL, &count) ? count
+            : (size_t) -1;
+    }
+    return count_sets(plan->sets, plan->nsets, plan->conjunctive);
+}
+
+/**
+ * Streams the intersection of the plan's sets, leapfrogging their
+ * iterators. The smallest set proposes a candidate and every other set leaps
+ * forward to it; a set that overshoots makes the smallest set leap past the
+ * candidate in turn, until all sets agree. Each set's current document is
+ * kept, since an iterator cannot give back what it has returned. Returns the
+ * number of documents passed on, or (size_t) -1 if memory allocation fails.
+ */
+static size_t stream_and(QueryPlan *plan, DocSetIterator **its,
+        unsigned int *current, DocFunc func, void *arg) {
+    unsigned int candidate;
+    size_t seen, emitted, steps;
+    int i, agreed;
+
+    qsort(plan->sets, plan->nsets, sizeof(DocSet *), compare_sizes);
+    for (i = 0; i < plan->nsets; i++) {
+        if (!(its[i] = docset_iter_create(plan->sets[i]))) {
+            return (size_t) -1;
+        }
+        current[i] = 0;
+    }
+    seen = emitted = 0;
+    if (!docset_iter_next(its[0], &candidate)) {
+        return 0;
+    }
+    for (i = 1; i < plan->nsets; i++) {
+        if (!docset_iter_advance(its[i], candidate, &current[i])) {
+            return 0;
+        }
+    }
+
+    steps = 0;
+    while (1) {
+        if (((++steps & (PLAN_CHECK_INTERVAL - 1)) == 0
+                    || (plan->budget > 0 && steps > plan->budget))
+                && plan_expired(plan, steps)) {
+            return emitted;
+        }
+        agreed = 1;
+        for (i = 1; i < plan->nsets; i++) {
+            if (current[i] < candidate
+                    && !docset_iter_advance(its[i], candidate, &current[i])) {
+                return emitted;
+            }
+            else if (current[i] > candidate) {
+                if (!docset_iter_advance(its[0], current[i], &candidate)) {
+                    return emitted;
+                }
+                agreed = 0;
+                break;
+            }
+        }
+        if (agreed && (emit(plan, candidate, &seen, &emitted, func, arg)
+                    || !docset_iter_next(its[0], &candidate))) {
+            return emitted;
+        }
+    }
+}
+
+/**
+ * Restores the heap property of the iterators from position i downwards,
+ * ordering them by their current documents.
+ */
+static void sift_iterators(DocSetIterator **its, unsigned int *current,
+        int n, int i) {
+    DocSetIterator *it;
+    unsigned int doc;
+    int child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && current[child + 1] < current[child]) {
+            child++;
+        }
+        if (current[i] <= current[child]) {
+            break;
+        }
+        it = its[i];
+        its[i] = its[child];
+        its[child] = it;
+        doc = current[i];
+        current[i] = current[child];
+        current[child] = doc;
+        i = child;
+    }
+}
+
+/**
+ * Swaps two iterators and their current documents.
+ */
+static void swap_iterators(DocSetIterator **its, unsigned int *current,
+        int i, int j) {
+    DocSetIterator *it = its[i];
+    unsigned int doc = current[i];
+
+    its[i] = its[j];
+    its[j] = it;
+    current[i] = current[j];
+    current[j] = doc;
+}
+
+/**
+ * Streams the union of the plan's sets through a min-heap of their
+ * iterators, skipping repeats of the last document passed on. Exhausted
+ * iterators are swapped out past the end of the heap. Returns the number of
+ * documents passed on, or (size_t) -1 if memory allocation fails.
+ */
+static size_t stream_or(QueryPlan *plan, DocSetIterator **its,
+        unsigned int *current, DocFunc func, void *arg) {
+    size_t seen, emitted, steps;
+    unsigned int last;
+    int i, size;
+
+    size = 0;
+    for (i = 0; i < plan->nsets; i++) {
+        if (!(its[i] = docset_iter_create(plan->sets[i]))) {
+            return (size_t) -1;
+        }
+        else if (docset_iter_next(its[i], &current[i])) {
+            swap_iterators(its, current, i, size++);
+        }
+    }
+    for (i = size / 2 - 1; i >= 0; i--) {
+        sift_iterators(its, current, size, i);
+    }
+
+    seen = emitted = steps = 0;
+    last = 0;
+    while (size > 0) {
+        if (((++steps & (PLAN_CHECK_INTERVAL - 1)) == 0
+                    || (plan->budget > 0 && steps > plan->budget))
+                && plan_expired(plan, steps)) {
+            break;
+        }
+        if ((seen == 0 || current[0] != last)
+                && emit(plan, (last = current[0]), &seen, &emitted, func,
+                    arg)) {
+            break;
+        }
+        if (!docset_iter_next(its[0], &current[0])) {
+            swap_iterators(its, current, 0, --size);
+        }
+        sift_iterators(its, current, size, 0);
+    }
+    return emitted;
+}
+
+/**
+ * Passes the plan's resulting document IDs, in increasing order and after
+ * applying its offset and limit, to the given function.
+ *
+ * A plan with a limit is evaluated lazily: its sets are walked with
+ * iterators and the walk stops as soon as the page is full, so asking for
+ * the first few results of a broad query touches only the start of each
+ * set. Without a limit every document is needed anyway, so the result is
+ * built with whole-set operations, in parallel partitions if the plan is
+ * large and has a pool, and then walked. A plan with a budget or deadline
+ * checks them every PLAN_CHECK_INTERVAL steps of a walk, or between the
+ * slices of a built result, and stops early once it reaches either. Returns
+ * the number of documents passed on, or (size_t) -1 if an error occurs.
+ */
+size_t plan_run(QueryPlan *plan, DocFunc func, void *arg) {
+    DocSetIterator **its, *iterator;
+    DocSet *result;
+    unsigned int *current, doc, lo, hi;
+    size_t seen, emitted;
+    int i, nparts;
+
+    if (!plan || !func) {
+        return (size_t) -1;
+    }
+    else if (plan->nsets == 0) {
+        return 0;
+    }
+
+    if (plan->limit > 0) {
+        its = (DocSetIterator **) calloc(plan->nsets, sizeof(DocSetIterator *));
+        current = (unsigned int *) malloc(plan->nsets * sizeof(unsigned int));
+        emitted = (size_t) -1;
+        if (its && current) {
+            emitted = plan->conjunctive
+                ? stream_and(plan, its, current, func, arg)
+                : stream_or(plan, its, current, func, arg);
+        }
+        for (i = 0; its && i < plan->nsets; i++) {
+            docset_iter_destroy(its[i]);
+        }
+        free(its);
+        free(current);
+        return emitted;
+    }
+    else if (plan->budget > 0 || plan->deadline > 0) {
+        return run_slices(plan, func, arg);
+    }
+
+    result = NULL;
+    if ((nparts = plan_partitions(plan, &lo, &hi)) > 1) {
+        if (!run_parallel(plan, nparts, lo, hi, &result, NULL)) {
+            return (size_t) -1;
+        }
+    }
+    else {
+        result = combine_sets(plan->sets, plan->nsets, plan->conjunctive);
+    }
+    if (!result || !(iterator = docset_iter_create(result))) {
+        docset_destroy(result);
+        return (size_t) -1;
+    }
+    seen = emitted = 0;
+    while (docset_iter_next(iterator, &doc)
+            && !emit(plan, doc, &seen, &emitted, func, arg))
+        ;
+    docset_iter_destroy(iterator);
+    docset_destroy(result);
+    return emitted;
+}
@@ -0,0 +1,120 @@
+#ifndef ENGINE_H
+#define ENGINE_H
+
+#include "docset.h"
+#include "inverted-index.h"
+#include "threadpool.h"
+#include "tokenizer.h"
+#include <stddef.h>
+
+/*
+ * Estimated cost, in documents across a query's sets, from which a query is
+ * split by document ID and evaluated in parallel, and the most partitions it
+ * is split into.
+ */
+#define PLAN_PARALLEL_COST (1 << 18)
+#define PLAN_MAX_PARTS 16
+
+/*
+ * Estimated cost of each slice a plan with a deadline or a cost budget is
+ * evaluated in, and the number of steps a streamed plan takes between checks
+ * of its deadline and budget (a power of two).
+ */
+#define PLAN_SLICE_COST (1 << 16)
+#define PLAN_CHECK_INTERVAL 4096
+
+/**
+ * A parsed query: the document set of each of its terms, whether they are
+ * intersected or united, and how the result is reported. A query either asks
+ * only for the number of matching documents, or for the documents after the
+ * first offset ones, at most limit of them (all of them if limit is zero).
+ * If the caller sets a pool, large queries use it to evaluate ranges of
+ * document IDs in parallel. For reporting, sizes holds the number of
+ * documents each of the nterms terms matched, in the order they were written;
+ * both terms of a precomputed pair get the pair's size.
+ *
+ * A query's work may also be bounded when it is created: budget caps the
+ * postings its terms read and its estimated cost, in documents (zero for no
+ * cap), and deadline is the stats_now time by which it must finish (zero
+ * for none). A query that reaches either stops early and sets truncated,
+ * as does one whose estimated cost already exceeds its budget when it is
+ * created; its count is then a lower bound. If it stopped while evaluating,
+ * its results are those with the smallest document IDs; if a prefix, range
+ * or fuzzy term left tokens out, they are only some of the matches.
+ */
+struct QueryPlan {
+    int conjunctive;
+    int count_only;
+    size_t offset;
+    size_t limit;
+    DocSet **sets;
+    int nsets;
+    size_t *sizes;
+    int nterms;
+    ThreadPool *pool;
+    size_t budget;
+    double deadline;
+    int truncated;
+};
+
+typedef struct QueryPlan QueryPlan;
+
+/*
+ * Type of the function a plan passes each resulting document ID to.
+ */
+typedef void (*DocFunc)(unsigned int, void *);
+
+/**
+ * Looks up a single query term, given as a (pointer, length) view. A term
+ * ending in '*' matches every token with that prefix, a term of the form
+ * lo..hi every token between lo and hi, inclusive, and a term of the form
+ * word~ or word~N every token within edit distance N (1 by default) of word,
+ * the tokens of these three forms being merged within the given limits
+ * (NULL for none). Any other term must match a token exactly. Returns NULL
+ * if the term is invalid or an error occurs.
+ */
+DocSet *match_query_term(Index *, const char *, size_t, LookupLimits *);
+
+/**
+ * Parses the flags at the start of the rest of a query line into the plan's
+ * count_only, offset and limit fields, and stores the first term after them
+ * as a (pointer, length) view, or NULL if there is none. Returns 1 on success
+ * and 0 if a flag is invalid.
+ */
+int plan_parse_flags(QueryPlan *, TokenizerT *, const char **, size_t *);
+
+/**
+ * Parses the rest of a query line from the tokenizer: optional flags (-c to
+ * count, -l N to limit and -o N to offset the results) followed by terms.
+ * The terms are intersected if the given flag is set and united otherwise,
+ * under the given cost budget (zero for none) and stats_now deadline (zero
+ * for none), which already bound looking the terms up. Returns a pointer to
+ * the new plan, or NULL if the flags are invalid or an error occurs.
+ */
+QueryPlan *plan_create(Index *, TokenizerT *, int, size_t, double);
+
+/**
+ * Destroys the plan, freeing all associated memory.
+ */
+void plan_destroy(QueryPlan *);
+
+/**
+ * Returns the plan's estimated cost: the total number of documents in its
+ * sets.
+ */
+size_t plan_cost(const QueryPlan *);
+
+/**
+ * Returns the number of documents the plan matches, without building the
+ * result, or (size_t) -1 if an error occurs.
+ */
+size_t plan_count(QueryPlan *);
+
+/**
+ * Passes the plan's resulting document IDs, in increasing order and after
+ * applying its offset and limit, to the given function. Returns the number
+ * of documents passed, or (size_t) -1 if an error occurs.
+ */
+size_t plan_run(QueryPlan *, DocFunc, void *);
+
+#endif
@@ -0,0 +1,192 @@
+#include "epoch.h"
+#include "parser.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Creates a handle publishing the given index and reloading it from the
+ * given file. Returns a pointer to the new handle, or NULL if memory
+ * allocation fails.
+ */
+IndexHandle *handle_create(Index *index, const char *path, size_t budget) {
+    IndexHandle *handle;
+    int i;
+
+    if (!index || !path || !(handle = (IndexHandle *) malloc(
+                    sizeof(IndexHandle)))) {
+        return NULL;
+    }
+    else if (!(handle->path = (char *) malloc(strlen(path) + 1))) {
+        free(handle);
+        return NULL;
+    }
+    strcpy(handle->path, path);
+    handle->budget = budget;
+    atomic_init(&handle->current, index);
+    atomic_init(&handle->epoch, 1);
+    for (i = 0; i < EPOCH_MAX_READERS; i++) {
+        atomic_init(&handle->readers[i], 0);
+    }
+    atomic_init(&handle->nreaders, 0);
+    atomic_init(&handle->reloading, 0);
+    pthread_mutex_init(&handle->lock, NULL);
+    handle->retired = NULL;
+    handle->started = 0;
+    return handle;
+}
+
+/**
+ * Waits for any reload to finish, then destroys the handle along with its
+ * current and retired indexes.
+ */
+void handle_destroy(IndexHandle *handle) {
+    Retired *next;
+
+    if (!handle) {
+        return;
+    }
+    if (handle->started) {
+        pthread_join(handle->loader, NULL);
+    }
+    while (handle->retired) {
+        next = handle->retired->next;
+        destroy_index(handle->retired->index);
+        free(handle->retired);
+        handle->retired = next;
+    }
+    destroy_index(atomic_load(&handle->current));
+    pthread_mutex_destroy(&handle->lock);
+    free(handle->path);
+    free(handle);
+}
+
+/**
+ * Claims a reader slot. Returns the slot, or -1 if all are taken.
+ */
+int handle_register(IndexHandle *handle) {
+    int slot = atomic_fetch_add(&handle->nreaders, 1);
+
+    if (slot >= EPOCH_MAX_READERS) {
+        atomic_fetch_sub(&handle->nreaders, 1);
+        return -1;
+    }
+    return slot;
+}
+
+/**
+ * Pins the current index for the reader in the given slot and returns it.
+ * The epoch is announced before the pointer is loaded, so a publisher that
+ * swaps the pointer after seeing the announcement keeps the old index alive.
+ */
+Index *handle_pin(IndexHandle *handle, int slot) {
+    atomic_store(&handle->readers[slot], atomic_load(&handle->epoch));
+    return atomic_load(&handle->current);
+}
+
+/**
+ * Releases the reader's pin.
+ */
+void handle_unpin(IndexHandle *handle, int slot) {
+    atomic_store(&handle->readers[slot], 0);
+}
+
+/**
+ * Replaces the current index and retires the old one, tagged with the epoch
+ * that begins after the swap, then destroys whatever is safe to destroy.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+int handle_publish(IndexHandle *handle, Index *index) {
+    Retired *retired;
+
+    if (!index || !(retired = (Retired *) malloc(sizeof(Retired)))) {
+        return 0;
+    }
+    pthread_mutex_lock(&handle->lock);
+    retired->index = atomic_exchange(&handle->current, index);
+    retired->epoch = atomic_fetch_add(&handle->epoch, 1) + 1;
+    retired->next = handle->retired;
+    handle->retired = retired;
+    pthread_mutex_unlock(&handle->lock);
+    handle_reclaim(handle);
+    return 1;
+}
+
+/**
+ * Destroys the retired indexes no reader can still be using: those retired
+ * in an epoch no later than the oldest one a reader has announced. Returns
+ * the number left waiting.
+ */
+int handle_reclaim(IndexHandle *handle) {
+    Retired **link, *retired;
+    unsigned long oldest = 0, epoch;
+    int i, n, waiting = 0;
+
+    n = atomic_load(&handle->nreaders);
+    for (i = 0; i < n && i < EPOCH_MAX_READERS; i++) {
+        epoch = atomic_load(&handle->readers[i]);
+        if (epoch && (!oldest || epoch < oldest)) {
+            oldest = epoch;
+        }
+    }
+
+    pthread_mutex_lock(&handle->lock);
+    link = &handle->retired;
+    while ((retired = *link) != NULL) {
+        if (!oldest || retired->epoch <= oldest) {
+            *link = retired->next;
+            destroy_index(retired->index);
+            free(retired);
+        }
+        else {
+            link = &retired->next;
+            waiting++;
+        }
+    }
+    pthread_mutex_unlock(&handle->lock);
+    return waiting;
+}
+
+/**
+ * Entry point of the loader thread: parses the index file and publishes the
+ * result, leaving the current index in place if loading fails.
+ */
+static void *loader_main(void *arg) {
+    IndexHandle *handle = (IndexHandle *) arg;
+    Index *index = parse_with_budget(handle->path, handle->budget, NULL);
+    int ndocs = index ? index->ndocs : 0;
+
+    if (index && handle_publish(handle, index)) {
+        fprintf(stderr, "search: Reloaded the index (%d files).\n", ndocs);
+    }
+    else {
+        fprintf(stderr, "search: Reload failed; keeping the current index.\n");
+        if (index) {
+            destroy_index(index);
+        }
+    }
+    atomic_store(&handle->reloading, 0);
+    return NULL;
+}
+
+/**
+ * Starts a background reload unless one is already running. Returns 1 if
+ * the reload started and 0 otherwise.
+ */
+int handle_reload(IndexHandle *handle) {
+    int expected = 0;
+
+    if (!atomic_compare_exchange_strong(&handle->reloading, &expected, 1)) {
+        return 0;
+    }
+    if (handle->started) {
+        pthread_join(handle->loader, NULL);
+        handle->started = 0;
+    }
+    if (pthread_create(&handle->loader, NULL, loader_main, handle) != 0) {
+        atomic_store(&handle->reloading, 0);
+        return 0;
+    }
+    handle->started = 1;
+    return 1;
+}
@@ -0,0 +1,102 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include "inverted-index.h"
+#include <pthread.h>
+#include <stdatomic.h>
+
+/*
+ * Maximum number of threads that can read through one handle.
+ */
+#define EPOCH_MAX_READERS 64
+
+/**
+ * An index replaced by a newer one, waiting until no reader can still be
+ * using it. It is safe to destroy once every pinned reader has announced an
+ * epoch at or after the one it was retired in.
+ */
+struct Retired {
+    Index *index;
+    unsigned long epoch;
+    struct Retired *next;
+};
+
+typedef struct Retired Retired;
+
+/**
+ * The current version of an index, shared between reader threads that pin
+ * it for the duration of a query and a loader that publishes new versions.
+ * Readers announce the global epoch in their slot before loading the
+ * pointer and clear it when done, so pinning takes no lock. Publishing
+ * swaps the pointer, advances the epoch and retires the old index, which is
+ * destroyed once no slot holds an older epoch. A slot holding zero is idle.
+ */
+struct IndexHandle {
+    _Atomic(Index *) current;
+    atomic_ulong epoch;
+    atomic_ulong readers[EPOCH_MAX_READERS];
+    atomic_int nreaders;
+    pthread_mutex_t lock;
+    Retired *retired;
+    char *path;
+    size_t budget;
+    pthread_t loader;
+    int started;
+    atomic_int reloading;
+};
+
+typedef struct IndexHandle IndexHandle;
+
+/**
+ * Creates a handle publishing the given index, which the handle then owns,
+ * and reloading it on request from the given file with the given postings
+ * memory budget (zero to load everything). Returns a pointer to the new
+ * handle, or NULL if the call fails.
+ */
+IndexHandle *handle_create(Index *, const char *, size_t);
+
+/**
+ * Waits for any reload to finish, then destroys the handle along with its
+ * current and retired indexes. No reader may have it pinned.
+ */
+void handle_destroy(IndexHandle *);
+
+/**
+ * Claims a reader slot for the calling thread. Returns the slot, or -1 if
+ * all are taken.
+ */
+int handle_register(IndexHandle *);
+
+/**
+ * Pins the current index for the reader in the given slot and returns it.
+ * It stays valid, even if a newer one is published, until the reader calls
+ * handle_unpin.
+ */
+Index *handle_pin(IndexHandle *, int);
+
+/**
+ * Releases the reader's pin, letting retired indexes be destroyed.
+ */
+void handle_unpin(IndexHandle *, int);
+
+/**
+ * Atomically replaces the current index with the given one, retiring the
+ * old one. Returns 1 on success and 0 if memory allocation fails, in which
+ * case nothing changes.
+ */
+int handle_publish(IndexHandle *, Index *);
+
+/**
+ * Destroys the retired indexes no reader can still be using. Returns the
+ * number left waiting.
+ */
+int handle_reclaim(IndexHandle *);
+
+/**
+ * Starts loading the index file again on a background thread, publishing
+ * the result when it is ready. Returns 1 if the reload started, and 0 if one
+ * is already running or the thread cannot be created.
+ */
+int handle_reload(IndexHandle *);
+
+#endif
@@ -0,0 +1,497 @@
+#include "federation.h"
+#include "engine.h"
+#include "parser.h"
+#include "sort.h"
+#include "tokenizer.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * One index file to load and, once loaded, its index.
+ */
+struct LoadTask {
+    char *path;
+    size_t budget;
+    LoadStats *stats;
+    Index *index;
+};
+
+typedef struct LoadTask LoadTask;
+
+/**
+ * A document of one of the indexes, named by its filename.
+ */
+struct DocRef {
+    const char *name;
+    unsigned int index;
+    unsigned int doc;
+};
+
+typedef struct DocRef DocRef;
+
+/**
+ * The global IDs of a query's results gathered from the indexes, and the
+ * map from the current index's IDs to global ones.
+ */
+struct Collector {
+    unsigned int *ids;
+    size_t count;
+    size_t cap;
+    const unsigned int *global;
+    int failed;
+};
+
+typedef struct Collector Collector;
+
+/**
+ * The function and argument a federation's resulting filenames are passed
+ * to, given global IDs.
+ */
+struct Namer {
+    Federation *fed;
+    NameFunc func;
+    void *arg;
+};
+
+typedef struct Namer Namer;
+
+/**
+ * Returns nonzero if the first document sorts before the second: by
+ * filename, then by the index it comes from.
+ */
+static int ref_less(const DocRef *r1, const DocRef *r2) {
+    int cmp = strcmp(r1->name, r2->name);
+
+    return cmp < 0 || (cmp == 0 && r1->index < r2->index);
+}
+
+#define REF_LESS(r1, r2) ref_less(r1, r2)
+#define ID_LESS(a, b) (*(a) < *(b))
+
+DEFINE_SORT(sort_refs, DocRef, REF_LESS)
+DEFINE_SORT(sort_ids, unsigned int, ID_LESS)
+
+/**
+ * Loads one index file. The argument is a LoadTask.
+ */
+static void load_one(void *arg) {
+    LoadTask *task = (LoadTask *) arg;
+
+    task->index = parse_with_budget(task->path, task->budget, task->stats);
+}
+
+/**
+ * Numbers the documents of every index globally: their filenames are
+ * decoded into one buffer, sorted, and given consecutive IDs, equal names
+ * sharing one. Then notes which indexes are ordered. Returns 1 on success
+ * and 0 if memory allocation fails.
+ */
+static int number_docs(Federation *fed) {
+    DocRef *refs;
+    char *names, *grown;
+    size_t total, len, cap, used, maxlen, *offsets;
+    unsigned int g, n, d;
+    int i, ok;
+
+    maxlen = 0;
+    for (i = 0, total = 0; i < fed->count; i++) {
+        total += fed->indexes[i]->ndocs;
+        maxlen = fed->indexes[i]->docs->maxlen > maxlen
+            ? fed->indexes[i]->docs->maxlen : maxlen;
+    }
+    fed->name = (char *) malloc(maxlen + 1);
+    refs = (DocRef *) malloc((total + 1) * sizeof(DocRef));
+    offsets = (size_t *) malloc((total + 1) * sizeof(size_t));
+    fed->global = (unsigned int **) calloc(fed->count,
+            sizeof(unsigned int *));
+    fed->ordered = (unsigned char *) malloc(fed->count);
+    fed->owners = (unsigned int *) malloc((total + 1) * sizeof(unsigned int));
+    fed->locals = (unsigned int *) malloc((total + 1) * sizeof(unsigned int));
+    cap = total * 16 + maxlen + 1;
+    names = (char *) malloc(cap);
+    ok = fed->name && refs && offsets && fed->global && fed->ordered
+        && fed->owners && fed->locals && names;
+
+    // Decode every filename, growing the buffer as needed.
+    for (i = 0, n = 0, used = 0; ok && i < fed->count; i++) {
+        ok = (fed->global[i] = (unsigned int *) malloc((fed->indexes[i]->ndocs
+                        + 1) * sizeof(unsigned int))) != NULL;
+        for (d = 0; ok && d < (unsigned int) fed->indexes[i]->ndocs; d++) {
+            if (used + maxlen + 1 > cap) {
+                cap = 2 * cap;
+                if (!(ok = (grown = (char *) realloc(names, cap)) != NULL)) {
+                    break;
+                }
+                names = grown;
+            }
+            len = doc_name(fed->indexes[i], d, names + used);
+            offsets[n] = used;
+            refs[n].index = i;
+            refs[n++].doc = d;
+            used += len + 1;
+        }
+    }
+
+    // Sort them and number the distinct names.
+    if (ok) {
+        for (d = 0; d < n; d++) {
+            refs[d].name = names + offsets[d];
+        }
+        sort_refs(refs, n);
+        for (d = 0, g = 0; d < n; d++) {
+            if (d > 0 && strcmp(refs[d].name, refs[d - 1].name) == 0) {
+                fed->shared = 1;
+            }
+            else {
+                fed->owners[g] = refs[d].index;
+                fed->locals[g++] = refs[d].doc;
+            }
+            fed->global[refs[d].index][refs[d].doc] = g - 1;
+        }
+        fed->ndocs = g;
+        for (i = 0; i < fed->count; i++) {
+            fed->ordered[i] = 1;
+            for (d = 1; d < (unsigned int) fed->indexes[i]->ndocs; d++) {
+                if (fed->global[i][d] < fed->global[i][d - 1]) {
+                    fed->ordered[i] = 0;
+                    break;
+                }
+            }
+        }
+    }
+    free(refs);
+    free(offsets);
+    free(names);
+    return ok;
+}
+
+/**
+ * Loads the index files on a temporary pool, one task per file, so that
+ * their reads and parsing overlap, then numbers their documents. Returns a
+ * pointer to the new federation, or NULL if any file fails to load or
+ * memory allocation fails.
+ */
+Federation *federation_load(char **paths, int count, size_t budget,
+        LoadStats *stats) {
+    Federation *fed;
+    ThreadPool *loaders = NULL;
+    LoadTask *tasks;
+    int i, nthreads, ok;
+
+    if (!paths || count < 1 || !(fed = (Federation *) calloc(1,
+                    sizeof(Federation)))) {
+        return NULL;
+    }
+    else if (!(tasks = (LoadTask *) calloc(count, sizeof(LoadTask)))
+            || !(fed->indexes = (Index **) calloc(count, sizeof(Index *)))) {
+        free(tasks);
+        free(fed);
+        return NULL;
+    }
+    fed->count = count;
+    for (i = 0; i < count; i++) {
+        tasks[i].path = paths[i];
+        tasks[i].budget = budget / count;
+        tasks[i].stats = stats ? &stats[i] : NULL;
+    }
+    nthreads = pool_default_size();
+    nthreads = nthreads < count ? nthreads : count;
+    if (nthreads > 1) {
+        loaders = pool_create(nthreads);
+    }
+    for (i = 0; i < count; i++) {
+        if (!loaders || !pool_submit(loaders, load_one, &tasks[i])) {
+            load_one(&tasks[i]);
+        }
+    }
+    if (loaders) {
+        pool_wait(loaders);
+        pool_destroy(loaders);
+    }
+
+    for (i = 0, ok = 1; i < count; i++) {
+        ok = (fed->indexes[i] = tasks[i].index) != NULL && ok;
+    }
+    free(tasks);
+    if (!ok || !number_docs(fed)) {
+        federation_destroy(fed);
+        return NULL;
+    }
+    return fed;
+}
+
+/**
+ * Destroys the federation along with its indexes.
+ */
+void federation_destroy(Federation *fed) {
+    int i;
+
+    if (!fed) {
+        return;
+    }
+    for (i = 0; i < fed->count; i++) {
+        if (fed->indexes[i]) {
+            destroy_index(fed->indexes[i]);
+        }
+        if (fed->global) {
+            free(fed->global[i]);
+        }
+    }
+    free(fed->indexes);
+    free(fed->global);
+    free(fed->ordered);
+    free(fed->owners);
+    free(fed->locals);
+    free(fed->name);
+    free(fed);
+}
+
+/**
+ * Appends the global ID of a resulting document. The argument is a
+ * Collector.
+ */
+static void collect(unsigned int doc, void *arg) {
+    Collector *collector = (Collector *) arg;
+    unsigned int *grown;
+
+    if (collector->count == collector->cap) {
+        collector->cap = collector->cap ? 2 * collector->cap : 256;
+        if (!(grown = (unsigned int *) realloc(collector->ids,
+                        collector->cap * sizeof(unsigned int)))) {
+            collector->failed = 1;
+            collector->cap = collector->count;
+            return;
+        }
+        collector->ids = grown;
+    }
+    collector->ids[collector->count++] = collector->global[doc];
+}
+
+/**
+ * Passes the filename of a resulting document to the namer's function. The
+ * argument is a Namer.
+ */
+static void name_global(unsigned int doc, void *arg) {
+    Namer *namer = (Namer *) arg;
+    Federation *fed = namer->fed;
+
+    doc_name(fed->indexes[fed->owners[doc]], fed->locals[doc], fed->name);
+    namer->func(fed->name, namer->arg);
+}
+
+/**
+ * Returns the documents a query term matches in any of the indexes as a set
+ * of global IDs: the term is looked up in each index within the limits, and
+ * the global IDs of its documents are sorted and deduplicated. Returns NULL
+ * if the term is invalid or an error occurs.
+ */
+static DocSet *match_global(Federation *fed, const char *term, size_t len,
+        LookupLimits *limits) {
+    DocSetIterator *iterator;
+    DocSet *docs, *result;
+    unsigned int *ids, *grown, doc;
+    size_t count, cap, d, n;
+    int i, ok;
+
+    ids = NULL;
+    count = cap = 0;
+    for (i = 0, ok = 1; ok && i < fed->count; i++) {
+        if (!(docs = match_query_term(fed->indexes[i], term, len, limits))) {
+            ok = 0;
+            break;
+        }
+        n = docset_cardinality(docs);
+        if (count + n > cap) {
+            cap = 2 * (count + n);
+            grown = (unsigned int *) realloc(ids, cap * sizeof(unsigned int));
+            ids = grown ? grown : ids;
+            ok = grown != NULL;
+        }
+        if (ok && (ok = (iterator = docset_iter_create(docs)) != NULL)) {
+            while (docset_iter_next(iterator, &doc)) {
+                ids[count++] = fed->global[i][doc];
+            }
+            docset_iter_destroy(iterator);
+        }
+        docset_destroy(docs);
+    }
+    if (!ok) {
+        free(ids);
+        return NULL;
+    }
+    sort_ids(ids, count);
+    for (d = 0, n = 0; d < count; d++) {
+        if (n == 0 || ids[d] != ids[n - 1]) {
+            ids[n++] = ids[d];
+        }
+    }
+    result = docset_from_sorted(ids, n);
+    free(ids);
+    return result;
+}
+
+/**
+ * Answers a query over indexes that share filenames, whose terms may match
+ * one file in several of them: each term's documents are gathered from
+ * every index into one set of global IDs, and the plan over these sets is
+ * evaluated as a single index's would be. The flags have already been
+ * parsed, and the tokenizer stands after the given first term. Returns the
+ * number of matching documents or of filenames passed, or (size_t) -1 if
+ * the query is invalid or an error occurs.
+ */
+static size_t query_shared(Federation *fed, TokenizerT *tk,
+        const QueryPlan *flags, const char *token, size_t len,
+        int conjunctive, double deadline, int *truncated, NameFunc func,
+        void *arg) {
+    LookupLimits limits = {fed->budget, deadline, 0, 0};
+    QueryPlan *plan;
+    DocSet **sets;
+    Namer namer = {fed, func, arg};
+    size_t *sizes, count;
+    int cap, ok;
+
+    if (!(plan = (QueryPlan *) calloc(1, sizeof(QueryPlan)))) {
+        return (size_t) -1;
+    }
+    plan->conjunctive = conjunctive;
+    plan->count_only = flags->count_only;
+    plan->offset = flags->offset;
+    plan->limit = flags->limit;
+    plan->pool = fed->pool;
+    plan->budget = fed->budget;
+    plan->deadline = deadline;
+
+    for (cap = 0, ok = 1; ok && token; ) {
+        if (plan->nsets == cap) {
+            cap = cap ? 2 * cap : 8;
+            sets = (DocSet **) realloc(plan->sets, cap * sizeof(DocSet *));
+            plan->sets = sets ? sets : plan->sets;
+            sizes = (size_t *) realloc(plan->sizes, cap * sizeof(size_t));
+            plan->sizes = sizes ? sizes : plan->sizes;
+            if (!sets || !sizes) {
+                ok = 0;
+                break;
+            }
+        }
+        if (!(ok = (plan->sets[plan->nsets] = match_global(fed, token, len,
+                            &limits)) != NULL)) {
+            break;
+        }
+        plan->sizes[plan->nsets] = docset_cardinality(plan->sets[plan->nsets]);
+        plan->nterms = ++plan->nsets;
+        if (!TKNextSlice(tk, &token, &len)) {
+            token = NULL;
+        }
+    }
+    plan->truncated = limits.stopped;
+
+    if (!ok) {
+        count = (size_t) -1;
+    }
+    else if (plan->count_only) {
+        count = plan_count(plan);
+    }
+    else {
+        count = plan_run(plan, name_global, &namer);
+    }
+    *truncated = plan->truncated;
+    plan_destroy(plan);
+    return count;
+}
+
+/**
+ * Answers a query line across every index. If the indexes share filenames,
+ * see query_shared. Otherwise the query is planned and run on each index in
+ * turn, each using the pool for its own partitions. A cost budget is shared
+ * out as it goes: each index gets an equal part of what is left, and its
+ * estimated cost, up to that part, is taken off before the next is planned;
+ * once nothing is left the query stops truncated. A count is the sum of
+ * theirs; otherwise each index passes on the global IDs of its results,
+ * only the first offset + limit of them if it is ordered and the query has
+ * a limit, and these are sorted before the offset and limit are applied to
+ * the whole. Returns the number of matching documents or of filenames
+ * passed, or (size_t) -1 if the query is invalid or an error occurs.
+ */
+size_t federation_query(Federation *fed, const char *line, double deadline,
+        int *count_only, int *truncated, NameFunc func, void *arg) {
+    Collector collector;
+    QueryPlan flags, *plan;
+    TokenizerT tk;
+    const char *token;
+    size_t len, total, count, remaining, share, cost, d;
+    int i, conjunctive, ok;
+
+    if (!fed || !line || !count_only || !truncated) {
+        return (size_t) -1;
+    }
+
+    // Parse the flags here too, since the offset and limit apply to the
+    // merged result.
+    memset(&flags, 0, sizeof(flags));
+    TKInit(&tk, " \t\n", line, strlen(line));
+    if (!TKNextSlice(&tk, &token, &len) || len != 2 || token[0] != 's'
+            || (token[1] != 'a' && token[1] != 'o')) {
+        return (size_t) -1;
+    }
+    conjunctive = token[1] == 'a';
+    if (!plan_parse_flags(&flags, &tk, &token, &len)) {
+        return (size_t) -1;
+    }
+    *count_only = flags.count_only;
+    *truncated = 0;
+    if (fed->shared) {
+        return query_shared(fed, &tk, &flags, token, len, conjunctive,
+                deadline, truncated, func, arg);
+    }
+
+    memset(&collector, 0, sizeof(collector));
+    total = 0;
+    remaining = fed->budget;
+    for (i = 0, ok = 1; ok && i < fed->count; i++) {
+        if (fed->budget > 0 && remaining == 0) {
+            *truncated = 1;
+            break;
+        }
+        share = (remaining + (size_t) (fed->count - i) - 1)
+            / (size_t) (fed->count - i);
+        TKInit(&tk, " \t\n", line, strlen(line));
+        TKNextSlice(&tk, &token, &len);
+        if (!(plan = plan_create(fed->indexes[i], &tk, conjunctive, share,
+                        deadline))) {
+            ok = 0;
+            break;
+        }
+        cost = plan_cost(plan);
+        remaining -= cost < share ? cost : share;
+        plan->pool = fed->pool;
+        if (flags.count_only) {
+            ok = (count = plan_count(plan)) != (size_t) -1;
+            total += count;
+        }
+        else {
+            plan->offset = 0;
+            plan->limit = flags.limit && fed->ordered[i]
+                ? flags.offset + flags.limit : 0;
+            collector.global = fed->global[i];
+            ok = plan_run(plan, collect, &collector) != (size_t) -1
+                && !collector.failed;
+        }
+        *truncated |= plan->truncated;
+        plan_destroy(plan);
+    }
+    if (!ok || flags.count_only) {
+        free(collector.ids);
+        return ok ? total : (size_t) -1;
+    }
+
+    // Merge the indexes' results by global ID; no file is in two of them.
+    sort_ids(collector.ids, collector.count);
+    for (d = flags.offset; d < collector.count
+            && (!flags.limit || total < flags.limit); d++, total++) {
+        doc_name(fed->indexes[fed->owners[collector.ids[d]]],
+                fed->locals[collector.ids[d]], fed->name);
+        func(fed->name, arg);
+    }
+    free(collector.ids);
+    return total;
+}
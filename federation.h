@@ -0,0 +1,63 @@
+#ifndef FEDERATION_H
+#define FEDERATION_H
+
+#include "inverted-index.h"
+#include "shard.h"
+#include "stats.h"
+#include "threadpool.h"
+#include <stddef.h>
+
+/**
+ * Several index files searched as one. Each file keeps its document IDs in
+ * its own index and also gets one in a global space, in filename order, the
+ * order one text index over all the files would give it; a file listed in
+ * several indexes gets a single global ID. global maps each index's IDs to
+ * global ones, and owners and locals map a global ID back to the index and
+ * ID it is named by. An index is ordered if its IDs already follow filename
+ * order, as a text index's do. Queries use the pool and cost budget, if set.
+ */
+struct Federation {
+    Index **indexes;
+    int count;
+    unsigned int **global;
+    unsigned char *ordered;
+    unsigned int *owners;
+    unsigned int *locals;
+    unsigned int ndocs;
+    int shared;
+    char *name;
+    ThreadPool *pool;
+    size_t budget;
+};
+
+typedef struct Federation Federation;
+
+/**
+ * Loads the given number of index files concurrently, each with an equal
+ * share of the postings memory budget (zero to load everything), and numbers
+ * their documents globally. If stats is not NULL, it must hold one entry per
+ * file, which receives that file's load timings. Returns a pointer to the new
+ * federation, or NULL if any file fails to load.
+ */
+Federation *federation_load(char **, int, size_t, LoadStats *);
+
+/**
+ * Destroys the federation along with its indexes.
+ */
+void federation_destroy(Federation *);
+
+/**
+ * Answers a query line (sa or so, flags and terms) across every index by
+ * the given stats_now deadline (zero for none). If the query only counts,
+ * the flag is set; otherwise the resulting filenames, in global order and
+ * after applying the query's offset and limit, are passed to the given
+ * function. Where indexes share filenames, a file matches as it would in
+ * one index over all of them, its terms found in any of the indexes that
+ * list it. The truncated flag is set if any index stopped early. Returns
+ * the number of matching documents or of filenames passed, or (size_t) -1
+ * if the query is invalid or an error occurs.
+ */
+size_t federation_query(Federation *, const char *, double, int *, int *,
+        NameFunc, void *);
+
+#endif
@@ -0,0 +1,962 @@
+#include "builder.h"
+#include "indexer.h"
+#include "reorder.h"
+#include "run.h"
+#include "segment.h"
+#include "sort.h"
+#include "threadpool.h"
+#include "tokenizer.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Most runs merged at once, which also bounds the temporary files open while
+ * spilling.
+ */
+#define INDEX_MERGE_FANIN 64
+
+/**
+ * A growable list of file paths.
+ */
+struct PathList {
+    char **paths;
+    size_t count;
+    size_t cap;
+};
+
+typedef struct PathList PathList;
+
+/**
+ * State shared by the indexing tasks. Each task owns one builder and claims
+ * files by taking the next document ID from the shared counter, so every
+ * builder sees its documents in increasing order of ID. If a memory budget
+ * is set, each builder gets an equal share of it and is spilled to a sorted
+ * run in a temporary file whenever it grows past its share. Each run has a
+ * level, the number of merges behind it, and the runs are kept in
+ * decreasing order of level.
+ */
+struct IndexJob {
+    PathList *files;
+    size_t next;
+    size_t budget;
+    FILE **runs;
+    int *levels;
+    int nruns;
+    int runcap;
+    int failed;
+    pthread_mutex_t lock;
+};
+
+typedef struct IndexJob IndexJob;
+
+/**
+ * Per-task state: the shared job, the task's builder and its delimiters.
+ */
+struct IndexTask {
+    IndexJob *job;
+    Builder *builder;
+    const char *delimiters;
+};
+
+typedef struct IndexTask IndexTask;
+
+/**
+ * Appends a copy of the path to the list. Returns 1 on success and 0 if
+ * memory allocation fails.
+ */
+static int path_append(PathList *list, const char *path) {
+    char **grown;
+
+    if (list->count == list->cap) {
+        list->cap = list->cap ? 2 * list->cap : 256;
+        if (!(grown = (char **) realloc(list->paths, list->cap
+                        * sizeof(char *)))) {
+            return 0;
+        }
+        list->paths = grown;
+    }
+    if (!(list->paths[list->count] = (char *) malloc(strlen(path) + 1))) {
+        return 0;
+    }
+    strcpy(list->paths[list->count++], path);
+    return 1;
+}
+
+/**
+ * Collects the regular files under the given directory, recursively.
+ * Symbolic links are not followed. Returns 1 on success and 0 if the
+ * directory cannot be read or memory allocation fails.
+ */
+static int collect_files(const char *dir, PathList *list) {
+    DIR *handle;
+    struct dirent *entry;
+    struct stat info;
+    char *path;
+    size_t dirlen;
+    int ok;
+
+    if (!(handle = opendir(dir))) {
+        fprintf(stderr, "Could not open directory '%s'.\n", dir);
+        return 0;
+    }
+    dirlen = strlen(dir);
+    ok = 1;
+    while (ok && (entry = readdir(handle)) != NULL) {
+        if (strcmp(entry->d_name, ".") == 0
+                || strcmp(entry->d_name, "..") == 0) {
+            continue;
+        }
+        if (!(path = (char *) malloc(dirlen + strlen(entry->d_name) + 2))) {
+            ok = 0;
+            break;
+        }
+        sprintf(path, "%s/%s", dir, entry->d_name);
+        if (lstat(path, &info) == 0) {
+            if (S_ISDIR(info.st_mode)) {
+                ok = collect_files(path, list);
+            }
+            else if (S_ISREG(info.st_mode)) {
+                ok = path_append(list, path);
+            }
+        }
+        free(path);
+    }
+    closedir(handle);
+    return ok;
+}
+
+/**
+ * qsort comparison function for an array of strings.
+ */
+static int compare_paths(const void *p1, const void *p2) {
+    return strcmp(*(char **) p1, *(char **) p2);
+}
+
+/**
+ * Reads the whole file into a newly allocated buffer, lowercasing it and
+ * replacing null bytes with spaces so that they act as delimiters. Returns
+ * the buffer and stores its length, or returns NULL if the file cannot be
+ * read.
+ */
+static char *read_file(const char *path, size_t *len) {
+    struct stat info;
+    char *buffer;
+    ssize_t nread;
+    size_t fill, i;
+    int fd;
+
+    if ((fd = open(path, O_RDONLY)) == -1) {
+        return NULL;
+    }
+    else if (fstat(fd, &info) == -1
+            || !(buffer = (char *) malloc(info.st_size + 1))) {
+        close(fd);
+        return NULL;
+    }
+    fill = 0;
+    while (fill < (size_t) info.st_size
+            && (nread = read(fd, buffer + fill, info.st_size - fill)) > 0) {
+        fill += nread;
+    }
+    close(fd);
+
+    for (i = 0; i < fill; i++) {
+        buffer[i] = buffer[i] == '\0' ? ' '
+            : tolower((unsigned char) buffer[i]);
+    }
+    *len = fill;
+    return buffer;
+}
+
+/**
+ * Returns whether the first reader's current term sorts before the second's,
+ * with ties broken by run order.
+ */
+static int reader_less(RunReader **readers, int *order, int i, int j) {
+    int c = termcmp(readers[i]->term, readers[i]->len, readers[j]->term,
+            readers[j]->len);
+    return c < 0 || (c == 0 && order[i] < order[j]);
+}
+
+/**
+ * Restores the heap property of the readers from position i downwards.
+ */
+static void sift_down(RunReader **readers, int *order, int n, int i) {
+    RunReader *reader;
+    int child, rank;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && reader_less(readers, order, child + 1, child)) {
+            child++;
+        }
+        if (!reader_less(readers, order, child, i)) {
+            break;
+        }
+        reader = readers[i];
+        readers[i] = readers[child];
+        readers[child] = reader;
+        rank = order[i];
+        order[i] = order[child];
+        order[child] = rank;
+        i = child;
+    }
+}
+
+/**
+ * Restores the heap property of the readers from position i upwards.
+ */
+static void sift_up(RunReader **readers, int *order, int i) {
+    RunReader *reader;
+    int parent, rank;
+
+    while (i > 0 && reader_less(readers, order, i, (parent = (i - 1) / 2))) {
+        reader = readers[i];
+        readers[i] = readers[parent];
+        readers[parent] = reader;
+        rank = order[i];
+        order[i] = order[parent];
+        order[parent] = rank;
+        i = parent;
+    }
+}
+
+/**
+ * Merges the sorted runs into the segment, or if it is NULL into a new run
+ * written to the given file. The readers are kept in a min-heap ordered by
+ * their current term; all readers holding the smallest term are taken off
+ * it, their postings are merged by document ID straight into the segment,
+ * and they are put back once advanced. Only one term and one posting per
+ * run are in memory at a time, except that a run needs a term's number of
+ * postings before them, so its merged postings are gathered first. Returns
+ * 1 on success and 0 on failure.
+ */
+static int merge_runs(FILE **runs, int nruns, SegmentWriter *writer,
+        FILE *out) {
+    RunReader **readers, **matches;
+    Posting *heads, *merged, *grown;
+    char *term;
+    size_t len, cap;
+    int *order, *ranks, *live, i, n, nmatches, min, count, mcap, ok;
+
+    readers = (RunReader **) calloc(nruns, sizeof(RunReader *));
+    matches = (RunReader **) malloc(nruns * sizeof(RunReader *));
+    heads = (Posting *) malloc(nruns * sizeof(Posting));
+    order = (int *) malloc(nruns * sizeof(int));
+    ranks = (int *) malloc(nruns * sizeof(int));
+    live = (int *) malloc(nruns * sizeof(int));
+    cap = 64;
+    term = (char *) malloc(cap);
+    merged = NULL;
+    mcap = 0;
+    ok = readers && matches && heads && order && ranks && live && term;
+
+    // Open every run and heapify the ones that are not empty.
+    n = 0;
+    for (i = 0; ok && i < nruns; i++) {
+        if (!(readers[n] = run_open(runs[i]))) {
+            ok = 0;
+        }
+        else if (run_next_term(readers[n])) {
+            order[n++] = i;
+        }
+        else {
+            run_close(readers[n]);
+            readers[n] = NULL;
+        }
+    }
+    for (i = n / 2 - 1; ok && i >= 0; i--) {
+        sift_down(readers, order, n, i);
+    }
+
+    while (ok && n > 0) {
+        // Take every reader positioned on the smallest term off the heap.
+        len = readers[0]->len;
+        if (len + 1 > cap) {
+            free(term);
+            cap = len + 1;
+            if (!(term = (char *) malloc(cap))) {
+                ok = 0;
+                break;
+            }
+        }
+        memcpy(term, readers[0]->term, len);
+        nmatches = 0;
+        while (n > 0 && termcmp(readers[0]->term, readers[0]->len, term,
+                    len) == 0) {
+            matches[nmatches] = readers[0];
+            ranks[nmatches++] = order[0];
+            readers[0] = readers[--n];
+            order[0] = order[n];
+            sift_down(readers, order, n, 0);
+        }
+
+        // Merge their postings by document ID.
+        for (i = 0; i < nmatches; i++) {
+            live[i] = run_next_posting(matches[i], &heads[i]);
+        }
+        count = 0;
+        while (ok) {
+            min = -1;
+            for (i = 0; i < nmatches; i++) {
+                if (live[i] && (min == -1 || heads[i].doc < heads[min].doc)) {
+                    min = i;
+                }
+            }
+            if (min == -1) {
+                break;
+            }
+            else if (writer) {
+                ok = segment_add_posting(writer, heads[min].doc,
+                        heads[min].hits);
+            }
+            else {
+                if (count == mcap) {
+                    mcap = mcap ? 2 * mcap : 256;
+                    if (!(grown = (Posting *) realloc(merged, mcap
+                                    * sizeof(Posting)))) {
+                        ok = 0;
+                        break;
+                    }
+                    merged = grown;
+                }
+                merged[count++] = heads[min];
+            }
+            live[min] = run_next_posting(matches[min], &heads[min]);
+        }
+        if (ok && writer) {
+            ok = segment_end_term(writer, term, len);
+        }
+        else if (ok) {
+            run_write_term(out, term, len, merged, count);
+            ok = !ferror(out);
+        }
+
+        // Advance the readers and put back the ones with terms left.
+        for (i = 0; i < nmatches; i++) {
+            if (run_next_term(matches[i])) {
+                readers[n] = matches[i];
+                order[n] = ranks[i];
+                n++;
+                sift_up(readers, order, n - 1);
+            }
+            else {
+                ok = ok && !ferror(runs[ranks[i]]);
+                run_close(matches[i]);
+            }
+        }
+    }
+
+    for (i = 0; readers && i < n; i++) {
+        run_close(readers[i]);
+    }
+    free(readers);
+    free(matches);
+    free(heads);
+    free(order);
+    free(ranks);
+    free(live);
+    free(term);
+    free(merged);
+    return ok && (writer || fflush(out) == 0);
+}
+
+/**
+ * Merges the given runs into a new run in a temporary file, closing them
+ * either way. Returns the new run, or NULL on failure.
+ */
+static FILE *merge_to_run(FILE **runs, int count) {
+    FILE *run;
+    int i;
+
+    if (!(run = tmpfile())) {
+        fprintf(stderr, "Could not create a temporary file.\n");
+    }
+    else if (!merge_runs(runs, count, NULL, run)) {
+        fprintf(stderr, "An error occurred while merging temporary files.\n");
+        fclose(run);
+        run = NULL;
+    }
+    for (i = 0; i < count; i++) {
+        fclose(runs[i]);
+    }
+    return run;
+}
+
+/**
+ * Records a run of the given level in the job, after the runs of a higher
+ * or equal level, so that the runs stay in decreasing order of level. The
+ * caller holds the job's lock. Returns 1 on success and 0 if memory
+ * allocation fails, in which case the run is closed.
+ */
+static int add_run(IndexJob *job, FILE *run, int level) {
+    FILE **grown;
+    int *lgrown, i;
+
+    if (job->nruns == job->runcap) {
+        grown = (FILE **) realloc(job->runs, (job->runcap ? 2 * job->runcap
+                    : 16) * sizeof(FILE *));
+        job->runs = grown ? grown : job->runs;
+        lgrown = (int *) realloc(job->levels, (job->runcap ? 2 * job->runcap
+                    : 16) * sizeof(int));
+        job->levels = lgrown ? lgrown : job->levels;
+        if (!grown || !lgrown) {
+            fclose(run);
+            return 0;
+        }
+        job->runcap = job->runcap ? 2 * job->runcap : 16;
+    }
+    for (i = job->nruns; i > 0 && job->levels[i - 1] < level; i--) {
+        job->runs[i] = job->runs[i - 1];
+        job->levels[i] = job->levels[i - 1];
+    }
+    job->runs[i] = run;
+    job->levels[i] = level;
+    job->nruns++;
+    return 1;
+}
+
+/**
+ * Merges the job's last count runs, at most INDEX_MERGE_FANIN, into one new
+ * run a level above the highest of theirs. The caller holds the job's lock.
+ * The runs are taken out of the job and the lock is released while they are
+ * merged, so that other tasks go on claiming files and spilling; the new
+ * run is then recorded under the lock again. Returns 1 on success and 0 on
+ * failure.
+ */
+static int compact_runs(IndexJob *job, int count) {
+    FILE *runs[INDEX_MERGE_FANIN], *run;
+    int level;
+
+    job->nruns -= count;
+    level = job->levels[job->nruns] + 1;
+    memcpy(runs, job->runs + job->nruns, count * sizeof(FILE *));
+    pthread_mutex_unlock(&job->lock);
+    run = merge_to_run(runs, count);
+    pthread_mutex_lock(&job->lock);
+    return run && add_run(job, run, level);
+}
+
+/**
+ * Writes the builder's contents to a new run, records the run in the job and
+ * empties the builder. Whenever the last INDEX_MERGE_FANIN runs share a
+ * level they are merged into one, so that few runs are open at a time and
+ * each posting is merged again only once per level. Returns 1 on success
+ * and 0 on failure.
+ */
+static int spill_builder(IndexJob *job, Builder *builder) {
+    FILE *run;
+    int ok;
+
+    if (!(run = tmpfile())) {
+        fprintf(stderr, "Could not create a temporary file.\n");
+        return 0;
+    }
+    else if (!run_write(run, builder)) {
+        fprintf(stderr, "An error occurred while writing a temporary file.\n");
+        fclose(run);
+        return 0;
+    }
+    builder_reset(builder);
+
+    pthread_mutex_lock(&job->lock);
+    ok = add_run(job, run, 0);
+    while (ok && job->nruns >= INDEX_MERGE_FANIN
+            && job->levels[job->nruns - INDEX_MERGE_FANIN]
+            == job->levels[job->nruns - 1]) {
+        ok = compact_runs(job, INDEX_MERGE_FANIN);
+    }
+    pthread_mutex_unlock(&job->lock);
+    return ok;
+}
+
+/**
+ * Body of an indexing task: claims files until there are none left and adds
+ * every token in them to the task's builder, spilling the builder whenever
+ * it goes over its share of the memory budget.
+ */
+static void index_files(void *arg) {
+    IndexTask *task = (IndexTask *) arg;
+    IndexJob *job = task->job;
+    TokenizerT tk;
+    const char *token;
+    char *contents;
+    size_t doc, len, toklen;
+    int ok;
+
+    TKInit(&tk, task->delimiters, NULL, 0);
+    while (1) {
+        pthread_mutex_lock(&job->lock);
+        doc = job->next++;
+        ok = !job->failed;
+        pthread_mutex_unlock(&job->lock);
+        if (!ok || doc >= job->files->count) {
+            break;
+        }
+
+        if (!(contents = read_file(job->files->paths[doc], &len))) {
+            fprintf(stderr, "Could not read file '%s'; skipping it.\n",
+                    job->files->paths[doc]);
+            continue;
+        }
+        TKReset(&tk, contents, len);
+        while (ok && TKNextSlice(&tk, &token, &toklen)) {
+            ok = builder_add(task->builder, token, toklen, (unsigned int) doc);
+        }
+        free(contents);
+        if (ok && job->budget > 0 && task->builder->bytes > job->budget) {
+            ok = spill_builder(job, task->builder);
+        }
+
+        if (!ok) {
+            pthread_mutex_lock(&job->lock);
+            job->failed = 1;
+            pthread_mutex_unlock(&job->lock);
+            break;
+        }
+    }
+}
+
+/**
+ * Merges the postings lists of one term from several builders into the
+ * output array, in order of document ID. The builders' lists are each sorted
+ * and hold disjoint documents, so the smallest head is taken each time.
+ * Returns the number of postings written.
+ */
+static int merge_postings(TermEntry **lists, int nlists, int *cursors,
+        Posting *out) {
+    int i, min, n;
+
+    for (i = 0; i < nlists; i++) {
+        cursors[i] = 0;
+    }
+    n = 0;
+    while (1) {
+        min = -1;
+        for (i = 0; i < nlists; i++) {
+            if (cursors[i] < lists[i]->count && (min == -1
+                        || lists[i]->postings[cursors[i]].doc
+                        < lists[min]->postings[cursors[min]].doc)) {
+                min = i;
+            }
+        }
+        if (min == -1) {
+            return n;
+        }
+        out[n++] = lists[min]->postings[cursors[min]++];
+    }
+}
+
+/**
+ * Called by merge_terms with each term, as a (pointer, length) view, and its
+ * merged postings in order of document ID. Returns 1 to continue and 0 to
+ * stop with a failure.
+ */
+typedef int (*TermFunc)(void *, const char *, size_t, Posting *, int);
+
+/**
+ * Merges the builders' sorted entries by term and passes each term with its
+ * merged postings to the given function. Returns 1 on success and 0 on
+ * failure.
+ */
+static int merge_terms(Builder **builders, int n, TermFunc func, void *arg) {
+    TermEntry ***sorted, **matches, *min;
+    size_t *positions;
+    Posting *merged;
+    int *cursors, i, nmatches, total, cap, ok;
+
+    sorted = (TermEntry ***) calloc(n, sizeof(TermEntry **));
+    positions = (size_t *) calloc(n, sizeof(size_t));
+    matches = (TermEntry **) malloc(n * sizeof(TermEntry *));
+    cursors = (int *) malloc(n * sizeof(int));
+    cap = 1024;
+    merged = (Posting *) malloc(cap * sizeof(Posting));
+    ok = sorted && positions && matches && cursors && merged;
+    for (i = 0; ok && i < n; i++) {
+        ok = (sorted[i] = builder_sorted(builders[i])) != NULL;
+    }
+
+    while (ok) {
+        // Find the smallest term at the head of any builder.
+        min = NULL;
+        for (i = 0; i < n; i++) {
+            if (positions[i] < builders[i]->count && (!min
+                        || termcmp(sorted[i][positions[i]]->term,
+                            sorted[i][positions[i]]->len,
+                            min->term, min->len) < 0)) {
+                min = sorted[i][positions[i]];
+            }
+        }
+        if (!min) {
+            break;
+        }
+
+        // Gather every builder's entry for it.
+        nmatches = total = 0;
+        for (i = 0; i < n; i++) {
+            if (positions[i] < builders[i]->count
+                    && termcmp(sorted[i][positions[i]]->term,
+                        sorted[i][positions[i]]->len,
+                        min->term, min->len) == 0) {
+                matches[nmatches] = sorted[i][positions[i]++];
+                total += matches[nmatches++]->count;
+            }
+        }
+        if (total > cap) {
+            free(merged);
+            cap = total;
+            if (!(merged = (Posting *) malloc(cap * sizeof(Posting)))) {
+                ok = 0;
+                break;
+            }
+        }
+        total = merge_postings(matches, nmatches, cursors, merged);
+        ok = func(arg, matches[0]->term, matches[0]->len, merged, total);
+    }
+
+    for (i = 0; sorted && i < n; i++) {
+        free(sorted[i]);
+    }
+    free(sorted);
+    free(positions);
+    free(matches);
+    free(cursors);
+    free(merged);
+    return ok;
+}
+
+/**
+ * The documents of every term shared by at least two documents, gathered
+ * for reordering: docs[offsets[t]] to docs[offsets[t + 1]] for term t.
+ */
+struct DocGraph {
+    size_t *offsets;
+    unsigned int *docs;
+    int nterms;
+    int termcap;
+    size_t doccap;
+};
+
+typedef struct DocGraph DocGraph;
+
+/**
+ * TermFunc that appends a term's documents to the graph, skipping terms
+ * found in a single document, which no order can help. Returns 1 on success
+ * and 0 if memory allocation fails.
+ */
+static int add_to_graph(void *arg, const char *term, size_t len,
+        Posting *postings, int count) {
+    DocGraph *graph = (DocGraph *) arg;
+    size_t *offsets, used = graph->offsets[graph->nterms];
+    unsigned int *docs;
+    int i;
+
+    (void) term;
+    (void) len;
+    if (count < 2) {
+        return 1;
+    }
+    if (graph->nterms + 1 == graph->termcap) {
+        if (!(offsets = (size_t *) realloc(graph->offsets, 2 * graph->termcap
+                        * sizeof(size_t)))) {
+            return 0;
+        }
+        graph->offsets = offsets;
+        graph->termcap *= 2;
+    }
+    if (used + count > graph->doccap) {
+        while (used + count > graph->doccap) {
+            graph->doccap *= 2;
+        }
+        if (!(docs = (unsigned int *) realloc(graph->docs, graph->doccap
+                        * sizeof(unsigned int)))) {
+            return 0;
+        }
+        graph->docs = docs;
+    }
+    for (i = 0; i < count; i++) {
+        graph->docs[used + i] = postings[i].doc;
+    }
+    graph->offsets[++graph->nterms] = used + count;
+    return 1;
+}
+
+/**
+ * Reorders the documents by recursive graph bisection over the terms they
+ * share. Returns a newly allocated array holding the new ID of every
+ * document, or NULL if memory allocation fails.
+ */
+static unsigned int *reorder(Builder **builders, int n, size_t ndocs) {
+    DocGraph graph;
+    unsigned int *ids = NULL;
+
+    graph.nterms = 0;
+    graph.termcap = 1024;
+    graph.doccap = 1024;
+    graph.offsets = (size_t *) calloc(graph.termcap, sizeof(size_t));
+    graph.docs = (unsigned int *) malloc(graph.doccap * sizeof(unsigned int));
+    if (graph.offsets && graph.docs
+            && merge_terms(builders, n, add_to_graph, &graph)) {
+        ids = reorder_docs(graph.offsets, graph.docs, graph.nterms,
+                (unsigned int) ndocs);
+    }
+    free(graph.offsets);
+    free(graph.docs);
+    return ids;
+}
+
+/**
+ * The segment being written and, if the documents were reordered, the new
+ * ID of every document and the size of the postings in either order.
+ */
+struct TermWriter {
+    SegmentWriter *writer;
+    const unsigned int *ids;
+    unsigned long long before;
+    unsigned long long after;
+};
+
+typedef struct TermWriter TermWriter;
+
+/**
+ * Returns the number of bytes in the varint encoding of a value.
+ */
+static size_t varint_size(unsigned long long value) {
+    size_t n = 1;
+
+    while (value >= 0x80) {
+        value >>= 7;
+        n++;
+    }
+    return n;
+}
+
+/**
+ * Returns the number of bytes the postings take in a segment, as pairs of
+ * varint gaps and hit counts.
+ */
+static unsigned long long postings_size(const Posting *postings, int count) {
+    unsigned long long size = 0;
+    unsigned int prev = 0;
+    int i;
+
+    for (i = 0; i < count; i++) {
+        size += varint_size(postings[i].doc - prev)
+            + varint_size(postings[i].hits);
+        prev = postings[i].doc;
+    }
+    return size;
+}
+
+/*
+ * Orders postings by document ID.
+ */
+#define POSTING_LESS(p1, p2) ((p1)->doc < (p2)->doc)
+
+DEFINE_SORT(sort_postings, Posting, POSTING_LESS)
+
+/**
+ * TermFunc that writes a term to the segment, first giving its postings
+ * their new document IDs if the documents were reordered.
+ */
+static int write_term(void *arg, const char *term, size_t len,
+        Posting *postings, int count) {
+    TermWriter *out = (TermWriter *) arg;
+    int i;
+
+    if (out->ids) {
+        out->before += postings_size(postings, count);
+        for (i = 0; i < count; i++) {
+            postings[i].doc = out->ids[postings[i].doc];
+        }
+        sort_postings(postings, count);
+        out->after += postings_size(postings, count);
+    }
+    return segment_add_term(out->writer, term, len, postings, count);
+}
+
+/**
+ * Builds the delimiter set used for file contents: every byte that is not a
+ * letter or digit. The string must hold 256 bytes.
+ */
+static void content_delimiters(char *delimiters) {
+    int c, n;
+
+    n = 0;
+    for (c = 1; c < 256; c++) {
+        if (!isalnum(c)) {
+            delimiters[n++] = (char) c;
+        }
+    }
+    delimiters[n] = '\0';
+}
+
+/**
+ * Walks the given directory tree and writes an inverted index of the files in
+ * it to the given path in the binary index format.
+ *
+ * The paths are sorted first, so that document IDs follow the order of the
+ * filenames. Each thread then tokenizes files into its own builder, with no
+ * sharing beyond claiming the next file, and the builders are merged term by
+ * term into the output once all files are done.
+ *
+ * If budget is not zero, the builders together hold at most about that many
+ * bytes of postings: a builder past its share is spilled to a sorted run, and
+ * once all files are done the remaining builders are spilled too and the runs
+ * are merged into the output. Pairs, if given, are handed to the writer,
+ * which intersects their postings as the terms go by.
+ *
+ * If reordering is requested, the documents are given new IDs by recursive
+ * graph bisection before anything is written, and the postings size in path
+ * order and in the new order is reported. That needs every posting in
+ * memory, so an index that spilled to runs keeps the path order. Returns 1
+ * on success and 0 on failure.
+ */
+int build_index(const char *dir, const char *output, int nthreads,
+        size_t budget, const PairList *pairs, int reordered) {
+    PathList files;
+    IndexJob job;
+    IndexTask *tasks;
+    Builder **builders;
+    ThreadPool *pool;
+    SegmentWriter *writer;
+    TermWriter out;
+    unsigned int *ids, *order;
+    char delimiters[256];
+    size_t i, d;
+    int t, ok;
+
+    if (!dir || !output) {
+        return 0;
+    }
+    if (nthreads <= 0) {
+        nthreads = pool_default_size();
+    }
+    memset(&files, 0, sizeof(files));
+    if (!collect_files(dir, &files)) {
+        for (i = 0; i < files.count; i++) {
+            free(files.paths[i]);
+        }
+        free(files.paths);
+        return 0;
+    }
+    qsort(files.paths, files.count, sizeof(char *), compare_paths);
+
+    content_delimiters(delimiters);
+    job.files = &files;
+    job.next = 0;
+    job.budget = budget / nthreads;
+    job.runs = NULL;
+    job.levels = NULL;
+    job.nruns = job.runcap = 0;
+    job.failed = 0;
+    pthread_mutex_init(&job.lock, NULL);
+    tasks = (IndexTask *) malloc(nthreads * sizeof(IndexTask));
+    builders = (Builder **) calloc(nthreads, sizeof(Builder *));
+    pool = pool_create(nthreads);
+    ok = tasks && builders && pool;
+
+    for (t = 0; ok && t < nthreads; t++) {
+        if (!(builders[t] = builder_create())) {
+            ok = 0;
+            break;
+        }
+        tasks[t].job = &job;
+        tasks[t].builder = builders[t];
+        tasks[t].delimiters = delimiters;
+        ok = pool_submit(pool, index_files, &tasks[t]);
+    }
+    pool_wait(pool);
+    pool_destroy(pool);
+    ok = ok && !job.failed;
+
+    // Once anything has been spilled, everything goes through the runs.
+    for (t = 0; ok && job.nruns > 0 && t < nthreads; t++) {
+        if (builders[t]->count > 0) {
+            ok = spill_builder(&job, builders[t]);
+        }
+    }
+    if (!ok) {
+        fprintf(stderr, "An error occurred while indexing '%s'.\n", dir);
+    }
+
+    // Reordering gives the new IDs; the documents are written in that order.
+    ids = order = NULL;
+    if (ok && reordered && job.nruns > 0) {
+        fprintf(stderr, "Postings spilled to disk; keeping path order.\n");
+    }
+    else if (ok && reordered && files.count > 0) {
+        ok = (ids = reorder(builders, nthreads, files.count)) != NULL
+            && (order = (unsigned int *) malloc(files.count
+                        * sizeof(unsigned int))) != NULL;
+        for (i = 0; ok && i < files.count; i++) {
+            order[ids[i]] = (unsigned int) i;
+        }
+        if (!ok) {
+            fprintf(stderr, "Not enough memory to reorder '%s'.\n", dir);
+        }
+    }
+
+    writer = ok ? segment_create(output) : NULL;
+    if (ok && !writer) {
+        fprintf(stderr, "Could not open file '%s' for writing.\n", output);
+        ok = 0;
+    }
+    if (ok && pairs) {
+        ok = segment_set_pairs(writer, pairs);
+    }
+    for (i = 0; ok && i < files.count; i++) {
+        d = order ? order[i] : i;
+        ok = segment_add_doc(writer, files.paths[d], strlen(files.paths[d]));
+    }
+    out.writer = writer;
+    out.ids = ids;
+    out.before = out.after = 0;
+    pthread_mutex_lock(&job.lock);
+    while (ok && job.nruns > INDEX_MERGE_FANIN) {
+        ok = compact_runs(&job, INDEX_MERGE_FANIN);
+    }
+    pthread_mutex_unlock(&job.lock);
+    if (ok && job.nruns > 0) {
+        ok = merge_runs(job.runs, job.nruns, writer, NULL);
+    }
+    else if (ok) {
+        ok = merge_terms(builders, nthreads, write_term, &out);
+    }
+    if (writer && !ok) {
+        segment_abort(writer);
+    }
+    else if (writer && !(ok = segment_finish(writer))) {
+        fprintf(stderr, "An error occurred while writing '%s'.\n", output);
+    }
+    if (ok && ids) {
+        printf("Postings: %llu bytes in path order, %llu bytes reordered "
+                "(%.1f%% smaller)\n", out.before, out.after, out.before
+                ? 100.0 * ((double) out.before - (double) out.after)
+                / (double) out.before : 0.0);
+    }
+
+    for (t = 0; builders && t < nthreads; t++) {
+        builder_destroy(builders[t]);
+    }
+    free(builders);
+    free(tasks);
+    free(ids);
+    free(order);
+    for (t = 0; t < job.nruns; t++) {
+        fclose(job.runs[t]);
+    }
+    free(job.runs);
+    free(job.levels);
+    pthread_mutex_destroy(&job.lock);
+    for (i = 0; i < files.count; i++) {
+        free(files.paths[i]);
+    }
+    free(files.paths);
+    return ok;
+}
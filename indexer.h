@@ -0,0 +1,22 @@
+#ifndef INDEXER_H
+#define INDEXER_H
+
+#include "pairs.h"
+#include <stddef.h>
+
+/**
+ * Walks the given directory tree, tokenizes the contents of every regular
+ * file in it and writes the resulting inverted index to the given path in the
+ * binary index format. Files are tokenized on the given number of threads
+ * (all online processors if it is not positive). If the memory budget, in
+ * bytes, is not zero, postings beyond it are spilled to sorted runs in
+ * temporary files and merged at the end. If a list of term pairs is given,
+ * the intersection of each pair's postings is stored as well. If the last
+ * argument is not zero, documents are numbered by recursive graph bisection
+ * rather than in path order, so that similar documents get close IDs and
+ * smaller gaps. Returns 1 on success and 0 on failure.
+ */
+int build_index(const char *, const char *, int, size_t, const PairList *,
+        int);
+
+#endif
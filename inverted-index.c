@@ -1,7 +1,13 @@
+#include "dict.h"
+#include "docset.h"
 #include "inverted-index.h"
+#include "levenshtein.h"
+#include "node.h"
 #include "record.h"
 #include "set.h"
+#include "sort.h"
 #include "sorted-list.h"
+#include "stats.h"
 #include <ctype.h>
 #include <stdlib.h>
 #include <string.h>
@@ -34,6 +40,19 @@ Index *create_index() {
         for(i = 0; i < 36; i++) {
             index->lists[i] = NULL;
         }
+        index->pending = NULL;
+        index->npending = 0;
+        index->pending_cap = 0;
+        index->terms = NULL;
+        index->offsets = NULL;
+        index->postings = NULL;
+        index->docs = NULL;
+        index->names = NULL;
+        index->ndocs = 0;
+        index->dense = NULL;
+        index->cold = NULL;
+        index->pairs = NULL;
+        index->npairs = 0;
         return index;
     }
     else
@@ -44,11 +63,24 @@ Index *create_index() {
  * Adds or updates another record for the given token in the inverted index.
  */
 int put_record(Index *index, const char *tok, const char *fname) {
+    return put_record_n(index, tok, strlen(tok), fname, strlen(fname));
+}
+
+/**
+ * Adds or updates another record for the given token and filename views in the
+ * inverted index. The strings are only copied if a new record is created.
+ */
+int put_record_n(Index *index, const char *tok, size_t toklen,
+        const char *fname, size_t fnamelen) {
     SortedList *list;
     int i;
 
-    i = hash(tok);
-    if (i == -1) {
+    i = toklen > 0 ? hash(tok) : -1;
+    if (index->terms) {
+        // A frozen index can't be changed.
+        return 0;
+    }
+    else if (i == -1) {
         // This isn't a valid token and has no place in the index.
         return 0;
     }
@@ -58,8 +90,253 @@ int put_record(Index *index, const char *tok, const char *fname) {
         if (list == NULL) {
             index->lists[i] = sl_create(reccmp);
         }
-        return sl_putrecord(index->lists[i], tok, fname);
+        return sl_putrecord_n(index->lists[i], tok, toklen, fname, fnamelen);
+    }
+}
+
+/**
+ * Appends a record for the given token and filename views to the index's
+ * pending records, to be sorted and merged with the others when the index is
+ * frozen. The strings are copied into the new record.
+ */
+int append_record_n(Index *index, const char *tok, size_t toklen,
+        const char *fname, size_t fnamelen) {
+    Record **grown, *record;
+    size_t cap;
+
+    if (index->terms || toklen == 0 || hash(tok) == -1) {
+        return 0;
+    }
+    else if (index->npending == index->pending_cap) {
+        cap = index->pending_cap ? index->pending_cap * 2 : 1024;
+        if (!(grown = (Record **) realloc(index->pending,
+                        cap * sizeof(Record *)))) {
+            return 0;
+        }
+        index->pending = grown;
+        index->pending_cap = cap;
+    }
+    if (!(record = create_record_n(tok, toklen, fname, fnamelen, 1))) {
+        return 0;
+    }
+    index->pending[index->npending++] = record;
+    return 1;
+}
+
+/**
+ * Frees the records loaded in bulk into an index that is being built.
+ */
+static void free_pending(Index *index) {
+    size_t i;
+
+    for (i = 0; i < index->npending; i++) {
+        destroy_record(index->pending[i]);
+    }
+    free(index->pending);
+    index->pending = NULL;
+    index->npending = 0;
+    index->pending_cap = 0;
+}
+
+/**
+ * Frees the prebuilt sets of the index's frequent terms.
+ */
+static void free_dense_sets(Index *index) {
+    int i;
+
+    if (index->dense) {
+        for (i = 0; i < index->terms->count; i++) {
+            docset_destroy(index->dense[i]);
+        }
+        free(index->dense);
+        index->dense = NULL;
+    }
+}
+
+/**
+ * Frees the index's precomputed pair intersections.
+ */
+static void free_pair_sets(Index *index) {
+    int i;
+
+    for (i = 0; i < index->npairs; i++) {
+        docset_destroy(index->pairs[i].docs);
+    }
+    free(index->pairs);
+    index->pairs = NULL;
+    index->npairs = 0;
+}
+
+/**
+ * Frees the expanded filenames, if the Set queries built them.
+ */
+static void free_doc_names(Index *index) {
+    int i;
+
+    for (i = 0; index->names && i < index->ndocs; i++) {
+        free(index->names[i]);
+    }
+    free(index->names);
+    index->names = NULL;
+}
+
+/**
+ * Expands the document table into one string per filename, for the Set
+ * queries, whose results must point at filenames that outlive them. Returns
+ * 1 on success and 0 if memory allocation fails.
+ */
+static int expand_doc_names(Index *index) {
+    DictIterator *iterator;
+    const char *name;
+    size_t len;
+    int n;
+
+    if (index->names) {
+        return 1;
+    }
+    else if (!(index->names = (char **) calloc(index->ndocs ? index->ndocs : 1,
+                    sizeof(char *)))) {
+        return 0;
+    }
+    else if (!(iterator = dict_iter_create(index->docs, 0))) {
+        free_doc_names(index);
+        return 0;
+    }
+    for (n = 0; (name = dict_iter_next(iterator, &len)) != NULL; n++) {
+        if (!(index->names[n] = (char *) malloc(len + 1))) {
+            dict_iter_destroy(iterator);
+            free_doc_names(index);
+            return 0;
+        }
+        memcpy(index->names[n], name, len + 1);
+    }
+    dict_iter_destroy(iterator);
+    return 1;
+}
+
+/**
+ * Decodes the filename of the document with the given ID into the buffer,
+ * which must hold at least docs->maxlen + 1 bytes. Returns its length.
+ */
+size_t doc_name(Index *index, unsigned int doc, char *buf) {
+    return dict_get(index->docs, (int) doc, buf);
+}
+
+/**
+ * Returns the precomputed intersection of the terms with the two given
+ * ordinals, found by binary search, or NULL if the index does not have it.
+ */
+const DocSet *pair_docs(Index *index, int a, int b) {
+    int lo, hi, mid, first, second;
+
+    first = a < b ? a : b;
+    second = a < b ? b : a;
+    lo = 0;
+    hi = index->npairs;
+    while (lo < hi) {
+        mid = lo + (hi - lo) / 2;
+        if (index->pairs[mid].first < first || (index->pairs[mid].first
+                    == first && index->pairs[mid].second < second)) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    if (lo < index->npairs && index->pairs[lo].first == first
+            && index->pairs[lo].second == second) {
+        return index->pairs[lo].docs;
+    }
+    return NULL;
+}
+
+/**
+ * Prebuilds a document set for every term that appears in at least one in
+ * INDEX_DENSE_FRACTION documents. Such sets mostly get bitmap or run chunks,
+ * so queries on frequent terms combine them a word at a time instead of
+ * first converting their postings. Returns 1 on success and 0 if memory
+ * allocation fails.
+ */
+int build_dense_sets(Index *index) {
+    const unsigned int *postings;
+    size_t count;
+    int t;
+
+    if (!index || !index->terms) {
+        return 0;
+    }
+    free_dense_sets(index);
+    if (!(index->dense = (DocSet **) calloc(index->terms->count
+                    ? index->terms->count : 1, sizeof(DocSet *)))) {
+        return 0;
+    }
+    for (t = 0; t < index->terms->count; t++) {
+        count = index->offsets[t + 1] - index->offsets[t];
+        if (count == 0
+                || count * INDEX_DENSE_FRACTION < (size_t) index->ndocs) {
+            continue;
+        }
+        else if (!(postings = fetch_postings(index, t))) {
+            free_dense_sets(index);
+            return 0;
+        }
+        index->dense[t] = docset_from_sorted(postings, count);
+        release_postings(index, t);
+        if (!index->dense[t]) {
+            free_dense_sets(index);
+            return 0;
+        }
     }
+    return 1;
+}
+
+/**
+ * Returns the postings of the term with the given ordinal, reading them
+ * through the cache if they are cold, or NULL if the read fails.
+ */
+const unsigned int *fetch_postings(Index *index, int t) {
+    if (index->cold) {
+        return cold_fetch(index->cold, t,
+                index->offsets[t + 1] - index->offsets[t]);
+    }
+    return index->postings + index->offsets[t];
+}
+
+/**
+ * Releases postings returned by fetch_postings, letting the cache evict
+ * them.
+ */
+void release_postings(Index *index, int t) {
+    if (index->cold) {
+        cold_release(index->cold, t);
+    }
+}
+
+/**
+ * Stores the postings of the given terms in the array, reading the cold
+ * ones concurrently. Returns 1 on success and 0 if a read fails.
+ */
+int fetch_postings_many(Index *index, const int *ordinals, int n,
+        const unsigned int **lists) {
+    size_t *counts;
+    int i, ok;
+
+    if (!index->cold) {
+        for (i = 0; i < n; i++) {
+            lists[i] = index->postings + index->offsets[ordinals[i]];
+        }
+        return 1;
+    }
+    else if (!(counts = (size_t *) malloc((n ? n : 1) * sizeof(size_t)))) {
+        return 0;
+    }
+    for (i = 0; i < n; i++) {
+        counts[i] = index->offsets[ordinals[i] + 1]
+            - index->offsets[ordinals[i]];
+    }
+    ok = cold_fetch_many(index->cold, ordinals, counts, n, lists);
+    free(counts);
+    return ok;
 }
 
 /**
@@ -73,9 +350,614 @@ void destroy_index(Index *index) {
     for (i = 0; i < 36; i++) {
         sl_destroy(index->lists[i]);
     }
+    free_pending(index);
+    free_dense_sets(index);
+    free_pair_sets(index);
+    free_doc_names(index);
+    dict_destroy(index->docs);
+    dict_destroy(index->terms);
+    free(index->offsets);
+    free(index->postings);
+    cold_close(index->cold);
     free(index);
 }
 
+/**
+ * Returns whether the first record sorts before the second by reccmp's
+ * ordering, by token and then by filename.
+ */
+static int record_less(const Record *r1, const Record *r2) {
+    int c = strcmp(r1->token, r2->token);
+
+    return c != 0 ? c < 0 : strcmp(r1->filename, r2->filename) < 0;
+}
+
+/*
+ * Orders pointers to records as reccmp does, and strings as strcmp does.
+ */
+#define RECORD_LESS(r1, r2) record_less(*(r1), *(r2))
+#define STRING_LESS(s1, s2) (strcmp(*(s1), *(s2)) < 0)
+
+DEFINE_SORT(sort_records, Record *, RECORD_LESS)
+DEFINE_SORT(sort_strings, char *, STRING_LESS)
+
+/**
+ * Builds the sorted, duplicate-free table of filenames from the records.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+static int build_doc_table(Index *index, Record **records, size_t count) {
+    char **names;
+    size_t i;
+    int n;
+
+    if (!(names = (char **) malloc((count ? count : 1) * sizeof(char *)))) {
+        return 0;
+    }
+    for (i = 0; i < count; i++) {
+        names[i] = records[i]->filename;
+    }
+    sort_strings(names, count);
+
+    for (i = 0, n = 0; i < count; i++) {
+        if (n == 0 || strcmp(names[n - 1], names[i]) != 0) {
+            names[n++] = names[i];
+        }
+    }
+    index->docs = dict_create(names, n);
+    index->ndocs = index->docs ? n : 0;
+    free(names);
+    return index->docs != NULL;
+}
+
+/**
+ * Builds the frozen structures from the given records, which must be sorted by
+ * reccmp. Returns 1 on success and 0 if memory allocation fails.
+ */
+static int freeze_records(Index *index, Record **records, size_t count) {
+    char **terms;
+    size_t i;
+    int nterms;
+
+    terms = (char **) malloc((count ? count : 1) * sizeof(char *));
+    index->offsets = (size_t *) malloc((count + 1) * sizeof(size_t));
+    index->postings = (unsigned int *) malloc((count ? count : 1)
+            * sizeof(unsigned int));
+    if (!terms || !index->offsets || !index->postings
+            || !build_doc_table(index, records, count)) {
+        free(terms);
+        return 0;
+    }
+
+    nterms = 0;
+    for (i = 0; i < count; i++) {
+        if (nterms == 0 || strcmp(terms[nterms - 1], records[i]->token) != 0) {
+            terms[nterms] = records[i]->token;
+            index->offsets[nterms++] = i;
+        }
+        index->postings[i] = (unsigned int) dict_lookup(index->docs,
+                records[i]->filename, strlen(records[i]->filename));
+    }
+    index->offsets[nterms] = count;
+    index->terms = dict_create(terms, nterms);
+    free(terms);
+    return index->terms != NULL && build_dense_sets(index);
+}
+
+/**
+ * Drops the repeats of each (token, filename) pair from the sorted records,
+ * adding their hits to the first. The records themselves stay owned by their
+ * lists or by the pending array. Returns the number of records left.
+ */
+static size_t merge_records(Record **records, size_t count) {
+    size_t i, n;
+
+    for (i = 0, n = 0; i < count; i++) {
+        if (n > 0 && reccmp(records[n - 1], records[i]) == 0) {
+            records[n - 1]->hits += records[i]->hits;
+        }
+        else {
+            records[n++] = records[i];
+        }
+    }
+    return n;
+}
+
+/**
+ * Converts the index from its build-time form into its frozen form. All
+ * records are sorted by token and filename and repeats of a pair loaded in
+ * bulk are merged, filenames are interned into the document table, and each
+ * token's records become one postings list of document IDs. Since the
+ * document table is sorted, each postings list comes out sorted as well. The
+ * sorted lists and pending records are freed afterwards, so this keeps one
+ * copy of each token and filename instead of one per record.
+ * Returns 1 on success and 0 if memory allocation fails, in which case the
+ * index is left unfrozen.
+ */
+int freeze_index(Index *index) {
+    SortedListIterator *iterator;
+    Record **records, *record;
+    size_t count, i;
+
+    if (!index) {
+        return 0;
+    }
+    else if (index->terms) {
+        return 1;
+    }
+
+    count = index->npending;
+    for (i = 0; i < 36; i++) {
+        if (index->lists[i] && (iterator = create_iter(index->lists[i]))) {
+            while (next_item(iterator) != NULL) {
+                count++;
+            }
+            destroy_iter(iterator);
+        }
+    }
+    if (!(records = (Record **) malloc((count ? count : 1)
+                    * sizeof(Record *)))) {
+        return 0;
+    }
+
+    for (count = 0; count < index->npending; count++) {
+        records[count] = index->pending[count];
+    }
+    for (i = 0; i < 36; i++) {
+        if (index->lists[i] && (iterator = create_iter(index->lists[i]))) {
+            while ((record = next_item(iterator)) != NULL) {
+                records[count++] = record;
+            }
+            destroy_iter(iterator);
+        }
+    }
+    sort_records(records, count);
+    count = merge_records(records, count);
+
+    if (!freeze_records(index, records, count)) {
+        free(records);
+        free_dense_sets(index);
+        dict_destroy(index->terms);
+        index->terms = NULL;
+        free(index->offsets);
+        free(index->postings);
+        index->offsets = NULL;
+        index->postings = NULL;
+        dict_destroy(index->docs);
+        index->docs = NULL;
+        index->ndocs = 0;
+        return 0;
+    }
+
+    free(records);
+    for (i = 0; i < 36; i++) {
+        sl_destroy(index->lists[i]);
+        index->lists[i] = NULL;
+    }
+    free_pending(index);
+    return 1;
+}
+
+/**
+ * Creates a set holding the filenames of the documents in the given set.
+ * Since the document table is sorted, the nodes are appended in order
+ * instead of being inserted one by one. The document set is destroyed.
+ * Returns NULL if it is NULL or if memory allocation fails.
+ */
+static Set *docs_to_set(Index *index, DocSet *docs) {
+    DocSetIterator *iterator;
+    Set *result;
+    Node *node, *tail;
+    unsigned int doc;
+
+    if (!docs || !expand_doc_names(index)
+            || !(iterator = docset_iter_create(docs))) {
+        docset_destroy(docs);
+        return NULL;
+    }
+    else if (!(result = set_create(generic_strcmp))) {
+        docset_iter_destroy(iterator);
+        docset_destroy(docs);
+        return NULL;
+    }
+    tail = NULL;
+    while (docset_iter_next(iterator, &doc)) {
+        if (!(node = create_node(index->names[doc], NULL))) {
+            set_destroy(result);
+            result = NULL;
+            break;
+        }
+        if (tail) {
+            tail->next = node;
+        }
+        else {
+            result->head = node;
+        }
+        tail = node;
+    }
+    docset_iter_destroy(iterator);
+    docset_destroy(docs);
+    return result;
+}
+
+/**
+ * Returns the documents of the term with the given ordinal as a new set: a
+ * copy of its prebuilt set if it is a frequent term, and otherwise a set
+ * built from its postings.
+ */
+static DocSet *term_docs(Index *index, int ordinal) {
+    const unsigned int *postings;
+    DocSet *docs;
+
+    if (index->dense && index->dense[ordinal]) {
+        return docset_copy(index->dense[ordinal]);
+    }
+    else if (!(postings = fetch_postings(index, ordinal))) {
+        return NULL;
+    }
+    docs = docset_from_sorted(postings,
+            index->offsets[ordinal + 1] - index->offsets[ordinal]);
+    release_postings(index, ordinal);
+    return docs;
+}
+
+/**
+ * Restores the heap property of the cursors from position i downwards,
+ * ordering them by the document ID each one points at.
+ */
+static void sift_cursors(const unsigned int **cursors,
+        const unsigned int **ends, int n, int i) {
+    const unsigned int *cursor, *end;
+    int child;
+
+    while ((child = 2 * i + 1) < n) {
+        if (child + 1 < n && *cursors[child + 1] < *cursors[child]) {
+            child++;
+        }
+        if (*cursors[i] <= *cursors[child]) {
+            break;
+        }
+        cursor = cursors[i];
+        cursors[i] = cursors[child];
+        cursors[child] = cursor;
+        end = ends[i];
+        ends[i] = ends[child];
+        ends[child] = end;
+        i = child;
+    }
+}
+
+/**
+ * Returns the union of the postings of the given terms as a set of
+ * documents. The postings lists are merged in a single pass through a
+ * min-heap holding one cursor per list, so each document costs O(log k)
+ * rather than O(k) however many terms a prefix or fuzzy term expands to. A
+ * document is emitted when it first reaches the top of the heap and skipped
+ * on later visits. Every list is fetched before the merge, cold ones all at
+ * once, and released after it, so they stay pinned while the cursors point
+ * into them.
+ */
+static DocSet *merge_ordinals(Index *index, const int *ordinals, int k) {
+    const unsigned int **cursors, **ends, **lists;
+    unsigned int *merged, doc;
+    DocSet *result;
+    size_t total, n;
+    int i, size, fetched;
+
+    if (k <= 0) {
+        return docset_create();
+    }
+    else if (k == 1) {
+        return term_docs(index, ordinals[0]);
+    }
+
+    cursors = (const unsigned int **) malloc(k * sizeof(unsigned int *));
+    ends = (const unsigned int **) malloc(k * sizeof(unsigned int *));
+    lists = (const unsigned int **) malloc(k * sizeof(unsigned int *));
+    fetched = cursors && ends && lists
+        && fetch_postings_many(index, ordinals, k, lists);
+    total = 0;
+    size = 0;
+    for (i = 0; fetched && i < k; i++) {
+        cursors[size] = lists[i];
+        ends[size] = lists[i] + (index->offsets[ordinals[i] + 1]
+                - index->offsets[ordinals[i]]);
+        if (cursors[size] < ends[size]) {
+            total += ends[size] - cursors[size];
+            size++;
+        }
+    }
+    merged = fetched ? (unsigned int *) malloc((total ? total : 1)
+            * sizeof(unsigned int)) : NULL;
+    free(lists);
+    if (!merged) {
+        for (i = 0; fetched && i < k; i++) {
+            release_postings(index, ordinals[i]);
+        }
+        free(cursors);
+        free(ends);
+        return NULL;
+    }
+    for (i = size / 2 - 1; i >= 0; i--) {
+        sift_cursors(cursors, ends, size, i);
+    }
+
+    n = 0;
+    while (size > 0) {
+        doc = *cursors[0];
+        if (n == 0 || merged[n - 1] != doc) {
+            merged[n++] = doc;
+        }
+        if (++cursors[0] == ends[0]) {
+            size--;
+            cursors[0] = cursors[size];
+            ends[0] = ends[size];
+        }
+        sift_cursors(cursors, ends, size, 0);
+    }
+    for (i = 0; i < k; i++) {
+        release_postings(index, ordinals[i]);
+    }
+
+    result = docset_from_sorted(merged, n);
+    free(cursors);
+    free(ends);
+    free(merged);
+    return result;
+}
+
+/**
+ * Returns the union of the postings of the given terms as a set of
+ * documents, within the given limits (NULL for none). Under limits, the
+ * terms are merged in groups of about LOOKUP_CHECK_POSTINGS postings, each
+ * group's length checked against the budget before any of its postings are
+ * read and the deadline checked before each group; the first term that
+ * would break either bound and all those after it are left out.
+ */
+static DocSet *union_ordinals(Index *index, const int *ordinals, int k,
+        LookupLimits *limits) {
+    DocSet *result, *part, *combined;
+    size_t len, group;
+    int first, i, stop;
+
+    if (!limits || (limits->budget == 0 && limits->deadline == 0)) {
+        return merge_ordinals(index, ordinals, k);
+    }
+    result = NULL;
+    for (first = 0, stop = 0; first < k && !stop; first = i) {
+        if (limits->deadline > 0 && stats_now() >= limits->deadline) {
+            limits->stopped = 1;
+            break;
+        }
+        for (i = first, group = 0; i < k && group < LOOKUP_CHECK_POSTINGS;
+                i++) {
+            len = index->offsets[ordinals[i] + 1] - index->offsets[ordinals[i]];
+            if (limits->budget > 0 && limits->spent + len > limits->budget) {
+                limits->stopped = stop = 1;
+                break;
+            }
+            limits->spent += len;
+            group += len;
+        }
+        if (i == first) {
+            break;
+        }
+        else if (!(part = merge_ordinals(index, ordinals + first,
+                        i - first))) {
+            docset_destroy(result);
+            return NULL;
+        }
+        combined = result ? docset_or(result, part) : part;
+        if (result) {
+            docset_destroy(result);
+            docset_destroy(part);
+        }
+        if (!(result = combined)) {
+            return NULL;
+        }
+    }
+    return result ? result : docset_create();
+}
+
+/**
+ * Returns the union of the postings of the terms with ordinals first through
+ * last - 1 as a set of documents, within the given limits (NULL for none).
+ */
+static DocSet *union_terms(Index *index, int first, int last,
+        LookupLimits *limits) {
+    DocSet *result;
+    int *ordinals, i;
+
+    if (last - first <= 1) {
+        return union_ordinals(index, &first, last - first, limits);
+    }
+    else if (!(ordinals = (int *) malloc((last - first) * sizeof(int)))) {
+        return NULL;
+    }
+    for (i = first; i < last; i++) {
+        ordinals[i - first] = i;
+    }
+    result = union_ordinals(index, ordinals, last - first, limits);
+    free(ordinals);
+    return result;
+}
+
+/**
+ * Finds the ordinals first through last - 1 of the tokens starting with the
+ * given prefix, which are contiguous in the term dictionary.
+ */
+static void prefix_bounds(Index *index, const char *prefix, size_t len,
+        int *first, int *last) {
+    *first = dict_lower_bound(index->terms, prefix, len);
+    *last = dict_prefix_end(index->terms, *first, prefix, len);
+}
+
+/**
+ * Finds the ordinals first through last - 1 of the tokens between lo and hi,
+ * inclusive. The range is empty if lo sorts after hi.
+ */
+static void range_bounds(Index *index, const char *lo, size_t lolen,
+        const char *hi, size_t hilen, int *first, int *last) {
+    *first = dict_lower_bound(index->terms, lo, lolen);
+    *last = dict_lower_bound(index->terms, hi, hilen);
+    if (dict_lookup(index->terms, hi, hilen) != -1) {
+        (*last)++;
+    }
+    if (*last < *first) {
+        *last = *first;
+    }
+}
+
+/**
+ * Appends the ordinals first through last - 1 to the list, skipping terms
+ * with prebuilt sets, whose postings are never read. Returns 1 on success
+ * and 0 if memory allocation fails.
+ */
+static int collect_ordinals(Index *index, int first, int last,
+        OrdinalList *list) {
+    int *grown;
+
+    for (; first < last; first++) {
+        if (index->dense && index->dense[first]) {
+            continue;
+        }
+        else if (list->count == list->cap) {
+            list->cap = list->cap ? 2 * list->cap : 16;
+            if (!(grown = (int *) realloc(list->ordinals, list->cap
+                            * sizeof(int)))) {
+                return 0;
+            }
+            list->ordinals = grown;
+        }
+        list->ordinals[list->count++] = first;
+    }
+    return 1;
+}
+
+/**
+ * Appends the ordinal of the token to the list unless it is missing or has
+ * a prebuilt set. Returns 1 on success and 0 if memory allocation fails.
+ */
+int collect_term(Index *index, const char *token, size_t len,
+        OrdinalList *list) {
+    int ordinal;
+
+    if (!index || !token || !index->terms
+            || (ordinal = dict_lookup(index->terms, token, len)) == -1) {
+        return 1;
+    }
+    return collect_ordinals(index, ordinal, ordinal + 1, list);
+}
+
+/**
+ * Appends the ordinals of the tokens with the given prefix to the list.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+int collect_prefix(Index *index, const char *prefix, size_t len,
+        OrdinalList *list) {
+    int first, last;
+
+    if (!index || !prefix || !index->terms) {
+        return 1;
+    }
+    prefix_bounds(index, prefix, len, &first, &last);
+    return collect_ordinals(index, first, last, list);
+}
+
+/**
+ * Appends the ordinals of the tokens between lo and hi to the list. Returns
+ * 1 on success and 0 if memory allocation fails.
+ */
+int collect_range(Index *index, const char *lo, size_t lolen,
+        const char *hi, size_t hilen, OrdinalList *list) {
+    int first, last;
+
+    if (!index || !lo || !hi || !index->terms) {
+        return 1;
+    }
+    range_bounds(index, lo, lolen, hi, hilen, &first, &last);
+    return collect_ordinals(index, first, last, list);
+}
+
+/**
+ * Returns the documents of a frozen index that contain the token given as a
+ * (pointer, length) view. Returns the empty set if there are none, and NULL
+ * if the index is not frozen or if a memory error occurs.
+ */
+DocSet *match_term(Index *index, const char *token, size_t len) {
+    int ordinal;
+
+    if (!index || !token || !index->terms) {
+        return NULL;
+    }
+    else if ((ordinal = dict_lookup(index->terms, token, len)) == -1) {
+        return docset_create();
+    }
+    return term_docs(index, ordinal);
+}
+
+/**
+ * Returns the documents of a frozen index that contain any token starting
+ * with the given prefix. The matching tokens are contiguous in the term
+ * dictionary, so their postings are merged directly, within the given
+ * limits (NULL for none). Returns NULL if the index is not frozen or if a
+ * memory error occurs.
+ */
+DocSet *match_prefix(Index *index, const char *prefix, size_t len,
+        LookupLimits *limits) {
+    int first, last;
+
+    if (!index || !prefix || !index->terms) {
+        return NULL;
+    }
+    prefix_bounds(index, prefix, len, &first, &last);
+    return union_terms(index, first, last, limits);
+}
+
+/**
+ * Returns the documents of a frozen index that contain any token between lo
+ * and hi, inclusive, within the given limits (NULL for none). Returns the
+ * empty set if lo sorts after hi, and NULL if the index is not frozen or if
+ * a memory error occurs.
+ */
+DocSet *match_range(Index *index, const char *lo, size_t lolen,
+        const char *hi, size_t hilen, LookupLimits *limits) {
+    int first, last;
+
+    if (!index || !lo || !hi || !index->terms) {
+        return NULL;
+    }
+    range_bounds(index, lo, lolen, hi, hilen, &first, &last);
+    return union_terms(index, first, last, limits);
+}
+
+/**
+ * Returns the documents of a frozen index that contain any token within the
+ * given edit distance of the given token. The matching tokens are found by
+ * running a Levenshtein automaton over the term dictionary, and their
+ * postings merged within the given limits (NULL for none). Returns NULL if
+ * the index is not frozen, the distance is out of range, or a memory error
+ * occurs.
+ */
+DocSet *match_fuzzy(Index *index, const char *token, size_t len,
+        int maxdist, LookupLimits *limits) {
+    LevAutomaton *lev;
+    DocSet *result;
+    int *ordinals, count;
+
+    if (!index || !token || !index->terms
+            || !(lev = lev_create(token, len, maxdist))) {
+        return NULL;
+    }
+    count = lev_intersect(lev, index->terms, &ordinals);
+    lev_destroy(lev);
+    if (count == -1) {
+        return NULL;
+    }
+    result = union_ordinals(index, ordinals, count, limits);
+    free(ordinals);
+    return result;
+}
+
 /**
  * Queries the inverted index for files containing the given token.
  * If the index is NULL, or if a memory error occurs, then this returns NULL.
@@ -84,16 +966,28 @@ void destroy_index(Index *index) {
  * this returns the empty set.
  */
 Set *query(Index *index, char *token) {
+    return token ? query_n(index, token, strlen(token)) : NULL;
+}
+
+/**
+ * Queries the inverted index for files containing the token given as a
+ * (pointer, length) view, which need not be null-terminated. The result is
+ * the same as query's.
+ */
+Set *query_n(Index *index, const char *token, size_t len) {
     Record *record;
     Set *result;
     SortedList *list;
     SortedListIterator *iterator;
     int h;
 
-    if (!index || !token || !(result = set_create(generic_strcmp))) {
+    if (index && token && index->terms) {
+        return docs_to_set(index, match_term(index, token, len));
+    }
+    else if (!index || !token || !(result = set_create(generic_strcmp))) {
         return NULL;
     }
-    else if ((h = hash(token)) == -1) {
+    else if (len == 0 || (h = hash(token)) == -1) {
         return result;
     }
 
@@ -106,17 +1000,50 @@ Set *query(Index *index, char *token) {
         }
         else {
             while((record = next_item(iterator)) != NULL) {
-                if (strcmp(token, record->token) != 0) {
+                if (strncmp(token, record->token, len) != 0
+                        || record->token[len] != '\0') {
                     continue;
                 }
                 else if (!set_add(result, record->filename)) {
                     // An error occurred while adding an item to the set.
+                    destroy_iter(iterator);
                     free(result);
                     return NULL;
                 }
             }
+            destroy_iter(iterator);
         }
     }
 
     return result;
 }
+
+/**
+ * Queries a frozen inverted index for files containing any token that starts
+ * with the given prefix. Returns NULL if the index is not frozen or if a
+ * memory error occurs.
+ */
+Set *query_prefix(Index *index, const char *prefix, size_t len) {
+    return docs_to_set(index, match_prefix(index, prefix, len, NULL));
+}
+
+/**
+ * Queries a frozen inverted index for files containing any token between lo
+ * and hi, inclusive. Returns NULL if the index is not frozen or if a memory
+ * error occurs.
+ */
+Set *query_range(Index *index, const char *lo, size_t lolen, const char *hi,
+        size_t hilen) {
+    return docs_to_set(index, match_range(index, lo, lolen, hi, hilen,
+                NULL));
+}
+
+/**
+ * Queries a frozen inverted index for files containing any token within the
+ * given edit distance of the given token. Returns NULL if the index is not
+ * frozen, the distance is out of range, or a memory error occurs.
+ */
+Set *query_fuzzy(Index *index, const char *token, size_t len, int maxdist) {
+    return docs_to_set(index, match_fuzzy(index, token, len, maxdist,
+                NULL));
+}
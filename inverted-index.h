@@ -1,20 +1,68 @@
 #ifndef INDEX_H
 #define INDEX_H
 
+#include "cold.h"
+#include "dict.h"
+#include "docset.h"
+#include "record.h"
 #include "set.h"
 #include "sorted-list.h"
 
+/*
+ * A term gets a prebuilt document set if it appears in at least one in this
+ * many documents.
+ */
+#define INDEX_DENSE_FRACTION 16
+
 /**
  * A hash function for hashing strings to integer values.
  */
 int hash(const char *);
 
 /**
- * A structure represented an inverted index. It's an array of sorted lists,
- * which stores information about tokens in sorted order.
+ * The precomputed intersection of the postings of two terms, identified by
+ * their ordinals with first < second.
+ */
+struct PairSet {
+    int first;
+    int second;
+    DocSet *docs;
+};
+
+typedef struct PairSet PairSet;
+
+/**
+ * A structure represented an inverted index. While it is being built, it's an
+ * array of sorted lists, which stores information about tokens in sorted
+ * order, and an array of the npending records loaded in bulk, in no order.
+ * Once frozen, both are replaced by a front-coded term dictionary,
+ * a table of filenames front-coded the same way (so a document ID is a
+ * filename's position in the table, and paths sharing directories share their
+ * bytes) and one postings list of document IDs per term. The postings of
+ * the term with ordinal t are postings[offsets[t]] to postings[offsets[t + 1]].
+ * Frequent terms also get a prebuilt document set in dense, which is NULL for
+ * every other term. A binary index loaded with a memory budget leaves its
+ * postings on disk in cold instead, with postings NULL; either way they are
+ * read through fetch_postings. A binary index built with hot pairs of terms
+ * also carries their intersections in pairs, sorted by ordinals. The Set
+ * queries, whose results point at whole filenames, expand the table into
+ * names the first time they run.
  */
 struct Index {
     SortedList *lists[36];
+    Record **pending;
+    size_t npending;
+    size_t pending_cap;
+    Dict *terms;
+    size_t *offsets;
+    unsigned int *postings;
+    Dict *docs;
+    char **names;
+    int ndocs;
+    DocSet **dense;
+    ColdPostings *cold;
+    PairSet *pairs;
+    int npairs;
 };
 
 typedef struct Index Index;
@@ -29,6 +77,106 @@ Index *create_index();
  */
 int put_record(Index *, const char *, const char *);
 
+/**
+ * Adds or updates another record for a token and filename given as
+ * (pointer, length) views, which need not be null-terminated.
+ */
+int put_record_n(Index *, const char *, size_t, const char *, size_t);
+
+/**
+ * Adds a record for a token and filename given as (pointer, length) views
+ * without keeping the records in order or merging repeated ones, which is
+ * left to freeze_index. Meant for loading a whole index at once: such records
+ * are not seen by queries before the index is frozen. Returns 1 on success
+ * and 0 if the token is invalid, the index is frozen or memory allocation
+ * fails.
+ */
+int append_record_n(Index *, const char *, size_t, const char *, size_t);
+
+/**
+ * Converts the index from its build-time form into its frozen, queryable form.
+ * No records can be added once the index is frozen.
+ */
+int freeze_index(Index *);
+
+/**
+ * Prebuilds the document sets of a frozen index's frequent terms. Returns 1
+ * on success and 0 if memory allocation fails.
+ */
+int build_dense_sets(Index *);
+
+/**
+ * Returns the postings of the term with the given ordinal in a frozen index,
+ * offsets[t + 1] - offsets[t] document IDs, reading them from disk if they
+ * are cold. They stay valid until release_postings is called. Returns NULL
+ * if the read fails.
+ */
+const unsigned int *fetch_postings(Index *, int);
+
+/**
+ * Releases postings returned by fetch_postings or fetch_postings_many.
+ */
+void release_postings(Index *, int);
+
+/**
+ * Stores the postings of the terms with the given ordinals in the given
+ * array, reading the cold ones from disk concurrently. Each stays valid
+ * until release_postings is called for it. Returns 1 on success and 0 if a
+ * read fails, in which case none needs releasing.
+ */
+int fetch_postings_many(Index *, const int *, int, const unsigned int **);
+
+/**
+ * Decodes the filename of the document with the given ID into the buffer,
+ * which must hold at least docs->maxlen + 1 bytes. Returns its length.
+ */
+size_t doc_name(Index *, unsigned int, char *);
+
+/**
+ * Returns the precomputed intersection of the terms with the two given
+ * ordinals, in either order, or NULL if the index does not have it.
+ */
+const DocSet *pair_docs(Index *, int, int);
+
+/**
+ * A growable list of term ordinals.
+ */
+struct OrdinalList {
+    int *ordinals;
+    int count;
+    int cap;
+};
+
+typedef struct OrdinalList OrdinalList;
+
+/**
+ * Appends the ordinal of the token given as a (pointer, length) view to the
+ * list, unless the token is missing or has a prebuilt set. Returns 1 on
+ * success and 0 if memory allocation fails.
+ */
+int collect_term(Index *, const char *, size_t, OrdinalList *);
+
+/**
+ * Appends the ordinals of the tokens with the given prefix to the list,
+ * except those with prebuilt sets. Returns 1 on success and 0 if memory
+ * allocation fails.
+ */
+int collect_prefix(Index *, const char *, size_t, OrdinalList *);
+
+/**
+ * Appends the ordinals of the tokens between the two given tokens,
+ * inclusive, to the list, except those with prebuilt sets. Returns 1 on
+ * success and 0 if memory allocation fails.
+ */
+int collect_range(Index *, const char *, size_t, const char *, size_t,
+        OrdinalList *);
+
+/*
+ * Type of the function deciding whether a load keeps a document, given its
+ * filename as a (pointer, length) view, which need not be null-terminated.
+ */
+typedef int (*DocFilter)(const char *, size_t, void *);
+
 /**
  * Frees all dynamic memory associated with the given index. Note that the
  * use of all iterators associated with the index after its destruction is
@@ -36,10 +184,86 @@ int put_record(Index *, const char *, const char *);
  */
 void destroy_index(Index *);
 
+/*
+ * Number of postings a bounded lookup merges between checks of its deadline.
+ */
+#define LOOKUP_CHECK_POSTINGS (1 << 16)
+
+/**
+ * Bounds on the postings read by the lookups of a query's prefix, range and
+ * fuzzy terms: the total number read (zero for no cap) and the stats_now
+ * time by which the lookups must stop (zero for none). Each lookup adds the
+ * postings it reads to spent, and sets stopped if it left tokens out to stay
+ * within the bounds.
+ */
+struct LookupLimits {
+    size_t budget;
+    double deadline;
+    size_t spent;
+    int stopped;
+};
+
+typedef struct LookupLimits LookupLimits;
+
+/**
+ * Returns the documents of a frozen index that contain the token given as a
+ * (pointer, length) view, or NULL if an error occurs.
+ */
+DocSet *match_term(Index *, const char *, size_t);
+
+/**
+ * Returns the documents of a frozen index that contain any token with the
+ * given prefix, within the given limits (NULL for none), or NULL if an error
+ * occurs.
+ */
+DocSet *match_prefix(Index *, const char *, size_t, LookupLimits *);
+
+/**
+ * Returns the documents of a frozen index that contain any token between the
+ * two given tokens, inclusive, within the given limits (NULL for none), or
+ * NULL if an error occurs.
+ */
+DocSet *match_range(Index *, const char *, size_t, const char *, size_t,
+        LookupLimits *);
+
+/**
+ * Returns the documents of a frozen index that contain any token within the
+ * given edit distance of the given token, within the given limits (NULL for
+ * none), or NULL if an error occurs.
+ */
+DocSet *match_fuzzy(Index *, const char *, size_t, int, LookupLimits *);
+
 /**
  * Queries the inverted index. This returns a set containing the names of files
  * that contain the given token.
  */
 Set *query(Index *, char *);
 
+/**
+ * Queries the inverted index for a token given as a (pointer, length) view.
+ * This returns a set containing the names of files that contain the token.
+ */
+Set *query_n(Index *, const char *, size_t);
+
+/**
+ * Queries a frozen inverted index for all tokens that start with the given
+ * prefix. This returns a set containing the names of files that contain any
+ * such token.
+ */
+Set *query_prefix(Index *, const char *, size_t);
+
+/**
+ * Queries a frozen inverted index for all tokens that lie lexicographically
+ * between the two tokens given as (pointer, length) views, inclusive. This
+ * returns a set containing the names of files that contain any such token.
+ */
+Set *query_range(Index *, const char *, size_t, const char *, size_t);
+
+/**
+ * Queries a frozen inverted index for all tokens within the given edit
+ * distance of the given token. This returns a set containing the names of
+ * files that contain any such token.
+ */
+Set *query_fuzzy(Index *, const char *, size_t, int);
+
 #endif
@@ -0,0 +1,206 @@
+#include "dict.h"
+#include "levenshtein.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * Creates an automaton for the given word and maximum edit distance. Returns
+ * a pointer to the new automaton, or NULL if the call fails or the distance is
+ * out of range.
+ */
+LevAutomaton *lev_create(const char *word, size_t len, int maxdist) {
+    LevAutomaton *lev;
+
+    if (!word || maxdist < 0 || maxdist > LEV_MAX_DISTANCE) {
+        return NULL;
+    }
+    else if (!(lev = (LevAutomaton *) malloc(sizeof(struct LevAutomaton)))) {
+        return NULL;
+    }
+    else if (!(lev->word = (char *) malloc(len + 1))) {
+        free(lev);
+        return NULL;
+    }
+    memcpy(lev->word, word, len);
+    lev->word[len] = '\0';
+    lev->len = (int) len;
+    lev->maxdist = maxdist;
+    return lev;
+}
+
+/**
+ * Destroys the automaton, freeing all associated memory.
+ */
+void lev_destroy(LevAutomaton *lev) {
+    if (lev) {
+        free(lev->word);
+        free(lev);
+    }
+}
+
+/**
+ * Stores the start state in the given row: reaching the first i characters of
+ * the word from the empty input takes i insertions.
+ */
+void lev_start(LevAutomaton *lev, int *row) {
+    int i;
+
+    for (i = 0; i <= lev->len; i++) {
+        row[i] = i <= lev->maxdist ? i : lev->maxdist + 1;
+    }
+}
+
+/**
+ * Computes the state reached from row on character c into next. Each entry is
+ * the cheapest of a deletion, an insertion, or a match or substitution, capped
+ * at maxdist + 1 since larger distances can never be accepted.
+ */
+void lev_step(LevAutomaton *lev, const int *row, char c, int *next) {
+    int i, cost, cap = lev->maxdist + 1;
+
+    next[0] = row[0] + 1 < cap ? row[0] + 1 : cap;
+    for (i = 1; i <= lev->len; i++) {
+        cost = row[i - 1] + (lev->word[i - 1] == c ? 0 : 1);
+        if (row[i] + 1 < cost) {
+            cost = row[i] + 1;
+        }
+        if (next[i - 1] + 1 < cost) {
+            cost = next[i - 1] + 1;
+        }
+        next[i] = cost < cap ? cost : cap;
+    }
+}
+
+/**
+ * Returns one if some continuation of the input can still be accepted from
+ * the given state. Distances never decrease as input is added, so this holds
+ * exactly when some entry is within the maximum distance.
+ */
+int lev_can_match(LevAutomaton *lev, const int *row) {
+    int i;
+
+    for (i = 0; i <= lev->len; i++) {
+        if (row[i] <= lev->maxdist) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Returns one if the given state accepts; zero otherwise.
+ */
+int lev_is_match(LevAutomaton *lev, const int *row) {
+    return row[lev->len] <= lev->maxdist;
+}
+
+/**
+ * Moves the iterator to the first string that does not start with the first
+ * len bytes of prefix, by seeking to the prefix with its last byte
+ * incremented. Trailing 0xff bytes can't be incremented and are dropped
+ * first. Returns the length of the prefix that was incremented, or zero if
+ * there is no such string.
+ */
+static size_t skip_prefix(Dict *dict, DictIterator *iterator, char *prefix,
+        size_t len) {
+    while (len > 0 && (unsigned char) prefix[len - 1] == 0xff) {
+        len--;
+    }
+    if (len == 0) {
+        return 0;
+    }
+    prefix[len - 1]++;
+    dict_iter_seek(iterator, dict_lower_bound(dict, prefix, len));
+    return len;
+}
+
+/**
+ * Finds every string of a sorted dictionary that the automaton accepts.
+ *
+ * The dictionary is walked in order, keeping the automaton state for every
+ * prefix of the current string, so a string only has to be stepped from where
+ * it stops sharing a prefix with the previous one. As soon as a prefix reaches
+ * a state that can no longer match, every string with that prefix is skipped
+ * with a single seek, so the walk only visits the parts of the dictionary the
+ * automaton can reach instead of comparing against every string.
+ *
+ * Stores a newly allocated array of the matching ordinals, in increasing
+ * order, and returns how many there are, or -1 if memory allocation fails.
+ */
+int lev_intersect(LevAutomaton *lev, Dict *dict, int **result) {
+    DictIterator *iterator;
+    const char *term;
+    char *prev;
+    int *rows, *matches, *grown;
+    size_t len, prevlen, depth, shared, i, width;
+    int count, cap, dead;
+
+    if (!lev || !dict || !result) {
+        return -1;
+    }
+    width = lev->len + 1;
+    cap = 16;
+    rows = (int *) malloc((dict->maxlen + 1) * width * sizeof(int));
+    prev = (char *) malloc(dict->maxlen + 1);
+    matches = (int *) malloc(cap * sizeof(int));
+    iterator = dict_iter_create(dict, 0);
+    if (!rows || !prev || !matches || !iterator) {
+        free(rows);
+        free(prev);
+        free(matches);
+        dict_iter_destroy(iterator);
+        return -1;
+    }
+
+    lev_start(lev, rows);
+    count = 0;
+    prevlen = depth = 0;
+    while ((term = dict_iter_next(iterator, &len)) != NULL) {
+        // Rows are valid up to depth for the previous string; reuse those of
+        // the prefix it shares with this one.
+        for (shared = 0; shared < len && shared < prevlen
+                && shared < depth && term[shared] == prev[shared]; shared++)
+            ;
+
+        dead = 0;
+        for (i = shared; i < len; i++) {
+            lev_step(lev, rows + i * width, term[i], rows + (i + 1) * width);
+            if (!lev_can_match(lev, rows + (i + 1) * width)) {
+                dead = 1;
+                break;
+            }
+        }
+        depth = dead ? i + 1 : len;
+        memcpy(prev, term, len);
+        prevlen = len;
+
+        if (dead) {
+            if ((depth = skip_prefix(dict, iterator, prev, depth)) == 0) {
+                break;
+            }
+            // skip_prefix changed the copy; keep only the untouched part.
+            prevlen = --depth;
+        }
+        else if (lev_is_match(lev, rows + len * width)) {
+            if (count == cap) {
+                if (!(grown = (int *) realloc(matches,
+                                2 * cap * sizeof(int)))) {
+                    free(rows);
+                    free(prev);
+                    free(matches);
+                    dict_iter_destroy(iterator);
+                    return -1;
+                }
+                matches = grown;
+                cap *= 2;
+            }
+            matches[count++] = iterator->ordinal;
+        }
+    }
+
+    free(rows);
+    free(prev);
+    dict_iter_destroy(iterator);
+    *result = matches;
+    return count;
+}
@@ -0,0 +1,67 @@
+#ifndef LEVENSHTEIN_H
+#define LEVENSHTEIN_H
+
+#include "dict.h"
+#include <stddef.h>
+
+/*
+ * Largest edit distance a fuzzy lookup may ask for.
+ */
+#define LEV_MAX_DISTANCE 2
+
+/**
+ * A Levenshtein automaton accepting every string within a given edit distance
+ * of a word. A state is one row of the edit-distance table between the word
+ * and the input read so far, with entries capped at maxdist + 1, so the
+ * automaton is stepped one character at a time without building the DFA.
+ */
+struct LevAutomaton {
+    char *word;
+    int len;
+    int maxdist;
+};
+
+typedef struct LevAutomaton LevAutomaton;
+
+/**
+ * Creates an automaton for the given word and maximum edit distance. Returns
+ * a pointer to the new automaton, or NULL if the call fails or the distance is
+ * out of range.
+ */
+LevAutomaton *lev_create(const char *, size_t, int);
+
+/**
+ * Destroys the automaton, freeing all associated memory.
+ */
+void lev_destroy(LevAutomaton *);
+
+/**
+ * Stores the start state in the given row, which must hold len + 1 entries.
+ */
+void lev_start(LevAutomaton *, int *);
+
+/**
+ * Computes the state reached from the first row on the given character into
+ * the second row.
+ */
+void lev_step(LevAutomaton *, const int *, char, int *);
+
+/**
+ * Returns one if some continuation of the input can still be accepted from
+ * the given state; zero otherwise.
+ */
+int lev_can_match(LevAutomaton *, const int *);
+
+/**
+ * Returns one if the given state accepts; zero otherwise.
+ */
+int lev_is_match(LevAutomaton *, const int *);
+
+/**
+ * Finds every string of a sorted dictionary that the automaton accepts.
+ * Stores a newly allocated array of their ordinals, in increasing order, and
+ * returns how many there are, or -1 if memory allocation fails.
+ */
+int lev_intersect(LevAutomaton *, Dict *, int **);
+
+#endif
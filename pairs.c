@@ -0,0 +1,289 @@
+#include "builder.h"
+#include "engine.h"
+#include "pairs.h"
+#include "tokenizer.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define PAIRS_LINE_SIZE 1024
+
+/**
+ * Creates an empty list. Returns a pointer to the new list, or NULL if
+ * memory allocation fails.
+ */
+static PairList *pairs_create(void) {
+    return (PairList *) calloc(1, sizeof(struct PairList));
+}
+
+/**
+ * Copies a (pointer, length) view into a new string, or returns NULL if
+ * memory allocation fails.
+ */
+static char *copy_slice(const char *s, size_t len) {
+    char *copy;
+
+    if ((copy = (char *) malloc(len + 1)) != NULL) {
+        memcpy(copy, s, len);
+        copy[len] = '\0';
+    }
+    return copy;
+}
+
+/**
+ * Appends the pair of terms given as (pointer, length) views to the list,
+ * ordering them, with the given count. A term paired with itself is skipped.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+static int pairs_add(PairList *list, const char *a, size_t alen,
+        const char *b, size_t blen, unsigned long count) {
+    TermPair *grown, *pair;
+    int order = termcmp(a, alen, b, blen);
+
+    if (order == 0) {
+        return 1;
+    }
+    else if (list->count == list->cap) {
+        list->cap = list->cap ? 2 * list->cap : 64;
+        if (!(grown = (TermPair *) realloc(list->pairs, list->cap
+                        * sizeof(TermPair)))) {
+            return 0;
+        }
+        list->pairs = grown;
+    }
+    pair = &list->pairs[list->count];
+    pair->first = order < 0 ? copy_slice(a, alen) : copy_slice(b, blen);
+    pair->second = order < 0 ? copy_slice(b, blen) : copy_slice(a, alen);
+    pair->count = count;
+    if (!pair->first || !pair->second) {
+        free(pair->first);
+        free(pair->second);
+        return 0;
+    }
+    list->count++;
+    return 1;
+}
+
+/**
+ * qsort comparison function ordering pairs by their terms.
+ */
+static int compare_terms(const void *p1, const void *p2) {
+    const TermPair *a = (const TermPair *) p1, *b = (const TermPair *) p2;
+    int result = strcmp(a->first, b->first);
+
+    return result != 0 ? result : strcmp(a->second, b->second);
+}
+
+/**
+ * qsort comparison function ordering pairs by decreasing count, then by
+ * their terms.
+ */
+static int compare_counts(const void *p1, const void *p2) {
+    const TermPair *a = (const TermPair *) p1, *b = (const TermPair *) p2;
+
+    if (a->count != b->count) {
+        return a->count > b->count ? -1 : 1;
+    }
+    return compare_terms(p1, p2);
+}
+
+/**
+ * Sorts the list by terms and merges repeated pairs, adding up their counts.
+ */
+static void merge_repeats(PairList *list) {
+    int i, n;
+
+    qsort(list->pairs, list->count, sizeof(TermPair), compare_terms);
+    for (i = 0, n = 0; i < list->count; i++) {
+        if (n > 0 && compare_terms(&list->pairs[n - 1], &list->pairs[i]) == 0) {
+            list->pairs[n - 1].count += list->pairs[i].count;
+            free(list->pairs[i].first);
+            free(list->pairs[i].second);
+        }
+        else {
+            list->pairs[n++] = list->pairs[i];
+        }
+    }
+    list->count = n;
+}
+
+/**
+ * Lowercases a line in place.
+ */
+static void lowercase(char *line) {
+    for (; *line; line++) {
+        *line = tolower((unsigned char) *line);
+    }
+}
+
+/**
+ * Reads a list of pairs, one pair of whitespace-separated terms per line.
+ * Returns a pointer to the new list, or NULL if the file cannot be read or
+ * memory allocation fails.
+ */
+PairList *pairs_read(const char *path) {
+    PairList *list;
+    TokenizerT tk;
+    FILE *file;
+    char line[PAIRS_LINE_SIZE];
+    const char *a, *b;
+    size_t alen, blen;
+    int ok;
+
+    if (!path || !(file = fopen(path, "r"))) {
+        return NULL;
+    }
+    else if (!(list = pairs_create())) {
+        fclose(file);
+        return NULL;
+    }
+    ok = 1;
+    while (ok && fgets(line, sizeof(line), file)) {
+        lowercase(line);
+        TKInit(&tk, " \t\r\n", line, strlen(line));
+        if (TKNextSlice(&tk, &a, &alen) && a[0] != '#'
+                && TKNextSlice(&tk, &b, &blen)) {
+            ok = pairs_add(list, a, alen, b, blen, 1);
+        }
+    }
+    ok = ok && !ferror(file);
+    fclose(file);
+    if (!ok) {
+        pairs_destroy(list);
+        return NULL;
+    }
+    merge_repeats(list);
+    return list;
+}
+
+/**
+ * Returns one if a query term, given as a (pointer, length) view, can only
+ * match a token exactly: it is made of letters and digits, like the tokens
+ * the indexer produces. Returns zero otherwise.
+ */
+static int is_exact(const char *term, size_t len) {
+    size_t i;
+
+    for (i = 0; i < len; i++) {
+        if (!isalnum((unsigned char) term[i])) {
+            return 0;
+        }
+    }
+    return len > 0;
+}
+
+/**
+ * Collects the distinct exact terms of a logged query line, up to
+ * PAIRS_MAX_QUERY_TERMS of them, as (pointer, length) views into the line.
+ * Lines that are not sa queries or have invalid flags yield none. Returns
+ * the number of terms.
+ */
+static int query_terms(char *line, const char **terms, size_t *lens) {
+    QueryPlan flags;
+    TokenizerT tk;
+    const char *term;
+    size_t len;
+    int n, i;
+
+    lowercase(line);
+    TKInit(&tk, " \t\r\n", line, strlen(line));
+    if (!TKNextSlice(&tk, &term, &len) || len != 2
+            || strncmp(term, "sa", 2) != 0) {
+        return 0;
+    }
+    memset(&flags, 0, sizeof(flags));
+    if (!plan_parse_flags(&flags, &tk, &term, &len)) {
+        return 0;
+    }
+    for (n = 0; term && n < PAIRS_MAX_QUERY_TERMS;) {
+        for (i = 0; i < n; i++) {
+            if (termcmp(terms[i], lens[i], term, len) == 0) {
+                break;
+            }
+        }
+        if (i == n && is_exact(term, len)) {
+            terms[n] = term;
+            lens[n++] = len;
+        }
+        if (!TKNextSlice(&tk, &term, &len)) {
+            term = NULL;
+        }
+    }
+    return n;
+}
+
+/**
+ * Mines a query log for the pairs of exact terms that appear together most
+ * often in sa queries. Every pair of distinct exact terms in a query counts
+ * once; the pairs are then merged and the most frequent max of them kept.
+ * Returns a pointer to the new list, or NULL if the file cannot be read or
+ * memory allocation fails.
+ */
+PairList *pairs_mine(const char *path, int max) {
+    PairList *list;
+    FILE *file;
+    char line[PAIRS_LINE_SIZE];
+    const char *terms[PAIRS_MAX_QUERY_TERMS];
+    size_t lens[PAIRS_MAX_QUERY_TERMS];
+    int i, j, n, ok, limit;
+
+    if (!path || !(file = fopen(path, "r"))) {
+        return NULL;
+    }
+    else if (!(list = pairs_create())) {
+        fclose(file);
+        return NULL;
+    }
+    ok = 1;
+    limit = 1 << 20;
+    while (ok && fgets(line, sizeof(line), file)) {
+        n = query_terms(line, terms, lens);
+        for (i = 0; ok && i < n; i++) {
+            for (j = i + 1; ok && j < n; j++) {
+                ok = pairs_add(list, terms[i], lens[i], terms[j], lens[j], 1);
+            }
+        }
+        if (ok && list->count >= limit) {
+            // Merge as we go so that long logs stay within memory.
+            merge_repeats(list);
+            limit = list->count > limit / 2 ? 2 * list->count : limit;
+        }
+    }
+    ok = ok && !ferror(file);
+    fclose(file);
+    if (!ok) {
+        pairs_destroy(list);
+        return NULL;
+    }
+
+    // Keep the most frequent pairs, then restore the order by terms.
+    merge_repeats(list);
+    qsort(list->pairs, list->count, sizeof(TermPair), compare_counts);
+    for (i = max > 0 ? max : 0; i < list->count; i++) {
+        free(list->pairs[i].first);
+        free(list->pairs[i].second);
+    }
+    if (list->count > max) {
+        list->count = max > 0 ? max : 0;
+    }
+    qsort(list->pairs, list->count, sizeof(TermPair), compare_terms);
+    return list;
+}
+
+/**
+ * Destroys the list, freeing all associated memory.
+ */
+void pairs_destroy(PairList *list) {
+    int i;
+
+    if (!list) {
+        return;
+    }
+    for (i = 0; i < list->count; i++) {
+        free(list->pairs[i].first);
+        free(list->pairs[i].second);
+    }
+    free(list->pairs);
+    free(list);
+}
@@ -0,0 +1,57 @@
+#ifndef PAIRS_H
+#define PAIRS_H
+
+/*
+ * Maximum number of pairs mined from a query log, and of distinct terms of
+ * a single logged query that are paired up.
+ */
+#define PAIRS_MAX_MINED 256
+#define PAIRS_MAX_QUERY_TERMS 16
+
+/**
+ * Two distinct terms queried together, with first sorting before second,
+ * and the number of logged queries they appeared in together (one for pairs
+ * read from a list).
+ */
+struct TermPair {
+    char *first;
+    char *second;
+    unsigned long count;
+};
+
+typedef struct TermPair TermPair;
+
+/**
+ * A list of term pairs whose intersections the indexer stores. The pairs are
+ * distinct and sorted by their first and then their second term.
+ */
+struct PairList {
+    TermPair *pairs;
+    int count;
+    int cap;
+};
+
+typedef struct PairList PairList;
+
+/**
+ * Reads a list of pairs from the given file, one pair of whitespace-separated
+ * terms per line. Terms are lowercased; blank lines, lines starting with '#'
+ * and pairs of a term with itself are skipped. Returns a pointer to the new
+ * list, or NULL if the file cannot be read or memory allocation fails.
+ */
+PairList *pairs_read(const char *);
+
+/**
+ * Mines the given query log, one query per line as it would be entered, for
+ * the pairs of exact terms that appear together most often in sa queries.
+ * At most the given number of pairs are kept. Returns a pointer to the new
+ * list, or NULL if the file cannot be read or memory allocation fails.
+ */
+PairList *pairs_mine(const char *, int);
+
+/**
+ * Destroys the list, freeing all associated memory.
+ */
+void pairs_destroy(PairList *);
+
+#endif
@@ -1,9 +1,33 @@
+#include "builder.h"
 #include "inverted-index.h"
 #include "parser.h"
+#include "segment.h"
+#include "stats.h"
+#include "stream.h"
+#include "tokenizer.h"
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#define PARSE_BLOCK_SIZE (1 << 20)
+
+/**
+ * The documents a partial load keeps: those the filter accepts. The
+ * filenames it drops are collected once each, without their postings, in a
+ * builder used as a hash set, so that the IDs the kept documents have in the
+ * whole index can be worked out. The flag is cleared if memory allocation
+ * fails.
+ */
+struct Part {
+    DocFilter keep;
+    void *arg;
+    Builder *dropped;
+    int ok;
+};
+
+typedef struct Part Part;
+
 /**
  * Returns a positive number if the filename is a readable file; zero otherwise.
  */
@@ -18,43 +42,326 @@ int is_file(const char *filename) {
     }
 }
 
+/**
+ * Loads a binary index written by the indexer, leaving its postings on disk
+ * if a memory budget is given. The file is already in frozen form, so its
+ * whole load time is counted as reading.
+ */
+static Index *load_binary(char *filename, size_t budget, LoadStats *stats) {
+    Index *index;
+    double begin;
+
+    begin = stats ? stats_now() : 0;
+    index = budget ? load_segment_cold(filename, budget)
+        : load_segment(filename);
+    if (!index) {
+        fprintf(stderr, "Could not load binary index '%s'.\n", filename);
+        return NULL;
+    }
+    if (stats) {
+        memset(stats, 0, sizeof(LoadStats));
+        stats->total = stats->io = stats_now() - begin;
+    }
+    return index;
+}
+
 /**
  * Parses the given file into an inverted-index in memory. Returns a pointer to
  * the new inverted index, or NULL if an error occurs.
  */
 Index *parse(char *filename) {
-    FILE *file;
+    return parse_with_stats(filename, NULL);
+}
+
+/**
+ * Loads the given file into an index in memory as parse_with_stats() does,
+ * except that a binary index keeps its postings on disk, caching at most
+ * about budget bytes of them. A text index is always loaded whole. A budget
+ * of zero loads everything.
+ */
+Index *parse_with_budget(char *filename, size_t budget, LoadStats *stats) {
+    if (budget && filename && is_file(filename) && is_segment(filename)) {
+        return load_binary(filename, budget, stats);
+    }
+    else if (budget) {
+        fprintf(stderr, "A memory budget needs a binary index; "
+                "loading '%s' whole.\n", filename ? filename : "");
+    }
+    return parse_with_stats(filename, stats);
+}
+
+/**
+ * Records a filename, given as a (pointer, length) view, that a partial load
+ * drops. The name is only copied the first time it is seen.
+ */
+static void drop_name(Part *part, const char *name, size_t len) {
+    if (!builder_add(part->dropped, name, len, 0)) {
+        part->ok = 0;
+    }
+}
+
+/**
+ * Adds the records described by one line of the index file to the index. The
+ * first field is the token, the second is skipped, and each remaining field is
+ * a filename. The line is split by the given tokenizer, whose delimiters are
+ * already set up, and fields are handed to the index as views into the line.
+ * In a partial load, filenames the part does not keep are recorded instead.
+ */
+static void parse_line(Index *index, TokenizerT *tk, const char *line,
+        const char *end, LoadStats *stats, Part *part) {
+    const char *tname, *token;
+    size_t tlen, len;
+    double t0, t1;
+    int found;
+
+    t0 = stats ? stats_now() : 0;
+    TKReset(tk, line, end - line);
+    if (!TKNextSlice(tk, &tname, &tlen) || !TKNextSlice(tk, &token, &len)) {
+        if (stats) {
+            stats->tokenize += stats_now() - t0;
+        }
+        return;
+    }
+    while (1) {
+        found = TKNextSlice(tk, &token, &len);
+        if (stats) {
+            t1 = stats_now();
+            stats->tokenize += t1 - t0;
+            t0 = t1;
+        }
+        if (!found) {
+            break;
+        }
+        if (!part || part->keep(token, len, part->arg)) {
+            append_record_n(index, tname, tlen, token, len);
+        }
+        else {
+            drop_name(part, token, len);
+        }
+        if (stats) {
+            t1 = stats_now();
+            stats->insert += t1 - t0;
+            t0 = t1;
+        }
+    }
+}
+
+/**
+ * Parses a text index file into an inverted-index in memory, keeping only
+ * the documents of the given part if it is not NULL. The index is frozen
+ * once the whole file has been read.
+ *
+ * The file is read through an input stream, so gzip and zstd files are
+ * decompressed on the fly by the stream's decoder thread while this thread
+ * builds the index. The data is read in large blocks and scanned in place:
+ * lines are found with memchr, split into fields by a single reusable
+ * tokenizer, and the fields are handed to the index as (pointer, length)
+ * views, which it copies into records appended in no order. Sorting them
+ * and merging repeats is left to freeze_index, so each posting costs an
+ * append rather than a walk of a sorted list. A partial line at the end of a
+ * block is carried over to the next read; the buffer grows only if a single
+ * line does not fit in it.
+ *
+ * If stats is not NULL, the time spent reading (including any wait for the
+ * decoder), splitting lines into fields, inserting records and freezing the
+ * index is accumulated into it. Timing is skipped entirely when no stats are
+ * requested.
+ */
+static Index *parse_text(char *filename, LoadStats *stats, Part *part) {
     Index *index;
-    char *tname, *token, *lineptr;
-    size_t len;
-    ssize_t read;
+    char *buffer, *grown;
+    const char *start, *end, *newline;
+    size_t cap, fill;
+    ssize_t nread;
+    double begin, t0;
+    InputStream *stream;
+    TokenizerT tk;
+    int ok;
 
-    if (!filename || !is_file(filename)) {
-        fprintf(stderr, "Not a valid filename.\n");
+    if (!(index = create_index())) {
+        fprintf(stderr, "An error occurred during memory allocation.\n");
+        return NULL;
+    }
+    else if (!(stream = stream_open(filename))) {
+        fprintf(stderr, errno == ENOTSUP ? "'%s' is compressed in a format "
+                "this build does not support.\n"
+                : "Could not open file '%s' for reading.\n", filename);
+        destroy_index(index);
         return NULL;
     }
-    else if (!(index = create_index())) {
+    cap = PARSE_BLOCK_SIZE;
+    if (!(buffer = (char *) malloc(cap))) {
         fprintf(stderr, "An error occurred during memory allocation.\n");
+        stream_close(stream);
+        destroy_index(index);
         return NULL;
     }
-    else if (!(file = fopen(filename, "r"))) {
-        fprintf(stderr, "Could not open file '%s' for writing.\n", filename);
+
+    if (stats) {
+        memset(stats, 0, sizeof(LoadStats));
+    }
+    begin = stats ? stats_now() : 0;
+    TKInit(&tk, " ", buffer, 0);
+    fill = 0;
+    ok = 0;
+
+    while (1) {
+        if (fill == cap) {
+            // A single line fills the whole buffer.
+            if (!(grown = (char *) realloc(buffer, cap * 2))) {
+                fprintf(stderr, "An error occurred during memory "
+                                "allocation.\n");
+                break;
+            }
+            buffer = grown;
+            cap *= 2;
+        }
+
+        t0 = stats ? stats_now() : 0;
+        nread = stream_read(stream, buffer + fill, cap - fill);
+        if (nread == -1) {
+            fprintf(stderr, "An error occurred while reading '%s'.\n",
+                    filename);
+            break;
+        }
+        if (stats) {
+            stats->io += stats_now() - t0;
+            stats->bytes += nread;
+        }
+        fill += nread;
+
+        start = buffer;
+        end = buffer + fill;
+        while ((newline = memchr(start, '\n', end - start)) != NULL) {
+            parse_line(index, &tk, start, newline, stats, part);
+            start = newline + 1;
+            if (stats) {
+                stats->lines++;
+            }
+        }
+
+        if (nread == 0) {
+            // End of file; the last line may not have a newline.
+            if (start < end) {
+                parse_line(index, &tk, start, end, stats, part);
+                if (stats) {
+                    stats->lines++;
+                }
+            }
+            ok = 1;
+            break;
+        }
+        fill = end - start;
+        memmove(buffer, start, fill);
+    }
+
+    free(buffer);
+    stream_close(stream);
+
+    t0 = stats ? stats_now() : 0;
+    if (ok && ((part && !part->ok) || !(ok = freeze_index(index)))) {
+        ok = 0;
+        fprintf(stderr, "An error occurred during memory allocation.\n");
+    }
+    if (!ok) {
         destroy_index(index);
         return NULL;
     }
+    if (stats) {
+        stats->freeze = stats_now() - t0;
+        stats->total = stats_now() - begin;
+    }
+    return index;
+}
 
-    lineptr = NULL;
-    len = 0;
+/**
+ * Parses the given file into an inverted-index in memory, as parse() does.
+ * A binary index is loaded as it is and a text index is parsed as above.
+ */
+Index *parse_with_stats(char *filename, LoadStats *stats) {
+    if (!filename || !is_file(filename)) {
+        fprintf(stderr, "Not a valid filename.\n");
+        return NULL;
+    }
+    else if (is_segment(filename)) {
+        return load_binary(filename, 0, stats);
+    }
+    return parse_text(filename, stats, NULL);
+}
+
+/**
+ * Works out the ID each document of a partial text index has in the whole
+ * index. The dropped filenames are sorted once, and since the document
+ * table is sorted as well, a document's ID is its own plus the number of
+ * dropped filenames ahead of it. Returns a new array of the IDs, or NULL if
+ * memory allocation fails.
+ */
+static unsigned int *global_ids(Index *index, Builder *dropped) {
+    DictIterator *names;
+    TermEntry **sorted;
+    unsigned int *global;
+    const char *name;
+    size_t ahead;
 
-    while ((read = getline(&lineptr, &len, file)) != -1) {
-        tname = strtok(lineptr, " \n");
-        strtok(NULL, " \n");
-        while ((token = strtok(NULL, " \n")) != NULL) {
-            put_record(index, tname, token);
+    global = (unsigned int *) malloc((index->ndocs ? index->ndocs : 1)
+            * sizeof(unsigned int));
+    names = dict_iter_create(index->docs, 0);
+    sorted = builder_sorted(dropped);
+    if (!global || !names || !sorted) {
+        free(global);
+        global = NULL;
+    }
+    ahead = 0;
+    while (global && (name = dict_iter_next(names, NULL)) != NULL) {
+        while (ahead < dropped->count
+                && strcmp(sorted[ahead]->term, name) < 0) {
+            ahead++;
         }
+        global[names->ordinal] = (unsigned int) (names->ordinal + ahead);
     }
-    free(lineptr);
+    free(sorted);
+    dict_iter_destroy(names);
+    return global;
+}
+
+/**
+ * Parses the part of the given file made of the documents whose filenames
+ * the filter accepts, as parse() does for the whole file. The documents are
+ * renumbered in their order, and the ID each has in the whole index is
+ * stored in a new array in global. The postings of the other documents are
+ * skipped as the file is read rather than loaded and dropped, so the part
+ * takes about as much memory as an index of its documents alone. Returns a
+ * pointer to the new index, or NULL if an error occurs.
+ */
+Index *parse_part(char *filename, DocFilter keep, void *arg,
+        unsigned int **global) {
+    Index *index;
+    Part part;
 
-    fclose(file);
+    *global = NULL;
+    if (!filename || !is_file(filename)) {
+        fprintf(stderr, "Not a valid filename.\n");
+        return NULL;
+    }
+    else if (is_segment(filename)) {
+        if (!(index = load_segment_part(filename, keep, arg, global))) {
+            fprintf(stderr, "Could not load binary index '%s'.\n", filename);
+        }
+        return index;
+    }
+    else if (!(part.dropped = builder_create())) {
+        fprintf(stderr, "An error occurred during memory allocation.\n");
+        return NULL;
+    }
+    part.keep = keep;
+    part.arg = arg;
+    part.ok = 1;
+    index = parse_text(filename, NULL, &part);
+    if (index && !(*global = global_ids(index, part.dropped))) {
+        fprintf(stderr, "An error occurred during memory allocation.\n");
+        destroy_index(index);
+        index = NULL;
+    }
+    builder_destroy(part.dropped);
     return index;
 }
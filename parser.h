@@ -2,6 +2,7 @@
 #define PARSER_H
 
 #include "inverted-index.h"
+#include "stats.h"
 #include <stdlib.h>
 
 /**
@@ -9,4 +10,24 @@
  */
 Index *parse(char *);
 
+/**
+ * Parses the given file into an index in memory, recording per-phase load
+ * timings into the given stats object if it is not NULL.
+ */
+Index *parse_with_stats(char *, LoadStats *);
+
+/**
+ * Loads the given file into an index in memory, leaving the postings of a
+ * binary index on disk and caching at most about the given number of bytes
+ * of them. Load timings are recorded as by parse_with_stats().
+ */
+Index *parse_with_budget(char *, size_t, LoadStats *);
+
+/**
+ * Parses the part of the given file made of the documents the given filter
+ * accepts into an index in memory, skipping the postings of the others, and
+ * stores the ID each kept document has in the whole index in a new array.
+ */
+Index *parse_part(char *, DocFilter, void *, unsigned int **);
+
 #endif
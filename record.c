@@ -15,21 +15,67 @@ int reccmp(Record *r1, Record *r2) {
     return result == 0 ? strcmp(rec1->filename, rec2->filename) : result;
 }
 
+/**
+ * Compares a string of the given length against a null-terminated string, with
+ * the same sign conventions as strcmp.
+ */
+static int slicecmp(const char *str, size_t len, const char *other) {
+    size_t i;
+
+    for (i = 0; i < len && other[i] != '\0'; i++) {
+        if (str[i] != other[i]) {
+            return (unsigned char) str[i] - (unsigned char) other[i];
+        }
+    }
+    if (i < len) {
+        return 1;
+    }
+    return other[i] == '\0' ? 0 : -1;
+}
+
+/**
+ * Compares a (token, filename) key against a record. Returns a negative number
+ * if the key sorts before the record, a positive number if it sorts after, and
+ * 0 if they are equal. The ordering is the same as reccmp's.
+ */
+int reckeycmp(const char *token, size_t toklen, const char *filename,
+        size_t fnamelen, Record *rec) {
+    int result;
+
+    result = slicecmp(token, toklen, rec->token);
+    return result == 0 ? slicecmp(filename, fnamelen, rec->filename) : result;
+}
+
 /**
  * Creates a new record. Returns a pointer to the new object, or NULL if the
  * call fails.
  */
 Record *create_record(const char *token, const char *filename, int hits) {
+    return create_record_n(token, strlen(token), filename, strlen(filename),
+            hits);
+}
+
+/**
+ * Creates a new record from a token and filename of the given lengths. This is
+ * the only place the strings are copied. Returns a pointer to the new object,
+ * or NULL if the call fails.
+ */
+Record *create_record_n(const char *token, size_t toklen, const char *filename,
+        size_t fnamelen, int hits) {
     Record *record = (Record *) malloc(sizeof(struct Record));
     if (record) {
-        record->token = (char *) malloc(strlen(token) + 1);
-        record->filename = (char *) malloc(strlen(filename) + 1);
+        record->token = (char *) malloc(toklen + 1);
+        record->filename = (char *) malloc(fnamelen + 1);
         if (!record->token || !record->filename) {
+            free(record->token);
+            free(record->filename);
             free(record);
         }
         else {
-            strcpy(record->filename, filename);
-            strcpy(record->token, token);
+            memcpy(record->token, token, toklen);
+            record->token[toklen] = '\0';
+            memcpy(record->filename, filename, fnamelen);
+            record->filename[fnamelen] = '\0';
             record->hits = hits;
             return record;
         }
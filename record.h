@@ -1,6 +1,8 @@
 #ifndef RECORD_H
 #define RECORD_H
 
+#include <stddef.h>
+
 /**
  * A basic type that stores indexer-related data.
  */
@@ -18,6 +20,13 @@ typedef struct Record Record;
  */
 Record *create_record(const char *, const char *, int);
 
+/**
+ * Creates a new record from a token and a filename given as (pointer, length)
+ * pairs, which need not be null-terminated. Returns a pointer to the new
+ * object, or NULL if the call fails.
+ */
+Record *create_record_n(const char *, size_t, const char *, size_t, int);
+
 /**
  * Destroys and frees all memory associated with the given record.
  */
@@ -29,4 +38,12 @@ void destroy_record(Record *);
  */
 int reccmp(Record *, Record *);
 
+/**
+ * Compares a (token, filename) key, given as (pointer, length) pairs, against a
+ * record using the same ordering as reccmp. Returns a negative number if the
+ * key sorts before the record, a positive number if it sorts after, and 0 if
+ * they are equal.
+ */
+int reckeycmp(const char *, size_t, const char *, size_t, Record *);
+
 #endif
@@ -0,0 +1,229 @@
+#include "reorder.h"
+#include "sort.h"
+#include <stdlib.h>
+#include <string.h>
+
+/**
+ * The state of a bisection: the terms of every document, as offsets into
+ * one array, and the number of documents containing each term on either
+ * side of the subproblem being split. The degrees are zero between splits.
+ */
+struct Bisection {
+    size_t *offsets;
+    unsigned int *terms;
+    unsigned int *left;
+    unsigned int *right;
+    double *logs;
+    struct Move *moves;
+};
+
+typedef struct Bisection Bisection;
+
+/**
+ * A document and the decrease in cost from moving it to the other side.
+ */
+struct Move {
+    double gain;
+    unsigned int doc;
+};
+
+typedef struct Move Move;
+
+/*
+ * Orders moves by decreasing gain, then by document, so that the result
+ * does not depend on the sort.
+ */
+#define MOVE_LESS(m1, m2) ((m1)->gain > (m2)->gain \
+        || ((m1)->gain == (m2)->gain && (m1)->doc < (m2)->doc))
+
+DEFINE_SORT(sort_moves, Move, MOVE_LESS)
+
+/**
+ * Returns the base 2 logarithm of a positive integer: its exponent, plus
+ * the logarithm of the remaining factor in [1, 2) from the series for
+ * 2 atanh(z) = ln((1 + z) / (1 - z)), which converges quickly there. This
+ * keeps the indexer free of a libm dependency.
+ */
+static double log2_of(unsigned int x) {
+    double m = x, z, power, sum = 0;
+    int e = 0, k;
+
+    while (m >= 2) {
+        m /= 2;
+        e++;
+    }
+    z = (m - 1) / (m + 1);
+    for (k = 1, power = z; k < 24; k += 2, power *= z * z) {
+        sum += power / k;
+    }
+    return e + 2 * sum / 0.69314718055994530942;
+}
+
+/**
+ * Returns the estimated number of bits needed for the gaps of a term that
+ * appears in d1 of the n1 documents on the left and d2 of the n2 on the
+ * right, with logs[i] holding log2(i).
+ */
+static double cost(const double *logs, unsigned int d1, unsigned int n1,
+        unsigned int d2, unsigned int n2) {
+    return d1 * (logs[n1] - logs[d1 + 1]) + d2 * (logs[n2] - logs[d2 + 1]);
+}
+
+/**
+ * Returns the decrease in cost from moving a document from the side with
+ * degrees from and size nfrom to the side with degrees to and size nto.
+ */
+static double gain(const Bisection *bp, unsigned int doc,
+        const unsigned int *from, unsigned int nfrom, const unsigned int *to,
+        unsigned int nto) {
+    double total = 0;
+    size_t i;
+    unsigned int t;
+
+    for (i = bp->offsets[doc]; i < bp->offsets[doc + 1]; i++) {
+        t = bp->terms[i];
+        total += cost(bp->logs, from[t], nfrom, to[t], nto)
+            - cost(bp->logs, from[t] - 1, nfrom, to[t] + 1, nto);
+    }
+    return total;
+}
+
+/**
+ * Adds delta to the degree of every term of a document on one side.
+ */
+static void count_terms(Bisection *bp, unsigned int doc, unsigned int *side,
+        int delta) {
+    size_t i;
+
+    for (i = bp->offsets[doc]; i < bp->offsets[doc + 1]; i++) {
+        side[bp->terms[i]] += delta;
+    }
+}
+
+/**
+ * Splits the documents in half, then repeatedly swaps the pairs of
+ * documents that reduce the cost of the split the most, until no swap helps
+ * or REORDER_ITERATIONS rounds have passed, and recurses into both halves.
+ */
+static void bisect(Bisection *bp, unsigned int *docs, unsigned int n) {
+    unsigned int half = n / 2, i, swaps;
+    Move *moves = bp->moves, held;
+    int round;
+
+    if (n <= REORDER_LEAF_SIZE) {
+        return;
+    }
+    for (i = 0; i < n; i++) {
+        count_terms(bp, docs[i], i < half ? bp->left : bp->right, 1);
+    }
+    for (round = 0; round < REORDER_ITERATIONS; round++) {
+        for (i = 0; i < n; i++) {
+            moves[i].doc = docs[i];
+            moves[i].gain = i < half
+                ? gain(bp, docs[i], bp->left, half, bp->right, n - half)
+                : gain(bp, docs[i], bp->right, n - half, bp->left, half);
+        }
+        sort_moves(moves, half);
+        sort_moves(moves + half, n - half);
+        for (swaps = 0; swaps < half && moves[swaps].gain
+                + moves[half + swaps].gain > 0; swaps++) {
+            count_terms(bp, moves[swaps].doc, bp->left, -1);
+            count_terms(bp, moves[swaps].doc, bp->right, 1);
+            count_terms(bp, moves[half + swaps].doc, bp->right, -1);
+            count_terms(bp, moves[half + swaps].doc, bp->left, 1);
+            held = moves[swaps];
+            moves[swaps] = moves[half + swaps];
+            moves[half + swaps] = held;
+        }
+        if (swaps == 0) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            docs[i] = moves[i].doc;
+        }
+    }
+    for (i = 0; i < n; i++) {
+        count_terms(bp, docs[i], i < half ? bp->left : bp->right, -1);
+    }
+    bisect(bp, docs, half);
+    bisect(bp, docs + half, n - half);
+}
+
+/**
+ * Builds the terms of every document from the documents of every term.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+static int invert(Bisection *bp, const size_t *offsets,
+        const unsigned int *docs, int nterms, unsigned int ndocs) {
+    size_t *next;
+    unsigned int d;
+    size_t i;
+    int t;
+
+    if (!(bp->offsets = (size_t *) calloc(ndocs + 1, sizeof(size_t)))
+            || !(bp->terms = (unsigned int *) malloc((offsets[nterms] + 1)
+                    * sizeof(unsigned int)))
+            || !(next = (size_t *) malloc((ndocs + 1) * sizeof(size_t)))) {
+        return 0;
+    }
+    for (i = 0; i < offsets[nterms]; i++) {
+        bp->offsets[docs[i] + 1]++;
+    }
+    for (d = 0; d < ndocs; d++) {
+        bp->offsets[d + 1] += bp->offsets[d];
+    }
+    memcpy(next, bp->offsets, (ndocs + 1) * sizeof(size_t));
+    for (t = 0; t < nterms; t++) {
+        for (i = offsets[t]; i < offsets[t + 1]; i++) {
+            bp->terms[next[docs[i]]++] = t;
+        }
+    }
+    free(next);
+    return 1;
+}
+
+/**
+ * Computes an order of the documents by recursive graph bisection. Starting
+ * from the current order, the documents are split in half so as to minimize
+ * the estimated size of the gaps between the documents of each term, as the
+ * log of the average gap on each side; each half is then split the same way
+ * down to REORDER_LEAF_SIZE documents. Returns a newly allocated array
+ * holding the new ID of every document, or NULL if memory allocation fails.
+ */
+unsigned int *reorder_docs(const size_t *offsets, const unsigned int *docs,
+        int nterms, unsigned int ndocs) {
+    Bisection bp;
+    unsigned int *order, *ids = NULL;
+    unsigned int d;
+
+    memset(&bp, 0, sizeof(bp));
+    order = (unsigned int *) malloc((ndocs + 1) * sizeof(unsigned int));
+    bp.left = (unsigned int *) calloc(nterms + 1, sizeof(unsigned int));
+    bp.right = (unsigned int *) calloc(nterms + 1, sizeof(unsigned int));
+    bp.logs = (double *) malloc((ndocs + 2) * sizeof(double));
+    bp.moves = (Move *) malloc((ndocs + 1) * sizeof(Move));
+    if (order && bp.left && bp.right && bp.logs && bp.moves
+            && invert(&bp, offsets, docs, nterms, ndocs)
+            && (ids = (unsigned int *) malloc((ndocs + 1)
+                    * sizeof(unsigned int)))) {
+        bp.logs[0] = 0;
+        for (d = 1; d < ndocs + 2; d++) {
+            bp.logs[d] = log2_of(d);
+        }
+        for (d = 0; d < ndocs; d++) {
+            order[d] = d;
+        }
+        bisect(&bp, order, ndocs);
+        for (d = 0; d < ndocs; d++) {
+            ids[order[d]] = d;
+        }
+    }
+    free(order);
+    free(bp.left);
+    free(bp.right);
+    free(bp.logs);
+    free(bp.moves);
+    free(bp.offsets);
+    free(bp.terms);
+    return ids;
+}
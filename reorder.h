@@ -0,0 +1,24 @@
+#ifndef REORDER_H
+#define REORDER_H
+
+#include <stddef.h>
+
+/*
+ * Subproblems of at most this many documents are left in their order, and
+ * each bisection makes at most this many rounds of swaps.
+ */
+#define REORDER_LEAF_SIZE 16
+#define REORDER_ITERATIONS 20
+
+/**
+ * Computes an order of the documents that gives similar documents nearby
+ * IDs, by recursive graph bisection over the documents and the terms they
+ * contain. The terms are given as the sorted document IDs of each:
+ * docs[offsets[t]] to docs[offsets[t + 1]] for the term with index t.
+ * Returns a newly allocated array holding the new ID of every document, or
+ * NULL if memory allocation fails.
+ */
+unsigned int *reorder_docs(const size_t *, const unsigned int *, int,
+        unsigned int);
+
+#endif
@@ -0,0 +1,141 @@
+#include "builder.h"
+#include "run.h"
+#include "segment.h"
+#include <stdio.h>
+#include <stdlib.h>
+
+/**
+ * Writes the value to the file as a variable-length integer, seven bits per
+ * byte.
+ */
+static void write_varint(FILE *file, unsigned long long value) {
+    while (value >= 0x80) {
+        putc((int) ((value & 0x7f) | 0x80), file);
+        value >>= 7;
+    }
+    putc((int) value, file);
+}
+
+/**
+ * Appends one term, given as a (pointer, length) view, and its postings,
+ * sorted by document ID, to the run in the given file.
+ */
+void run_write_term(FILE *file, const char *term, size_t len,
+        const Posting *postings, int count) {
+    unsigned int prev;
+    int i;
+
+    write_varint(file, len);
+    fwrite(term, 1, len, file);
+    write_varint(file, count);
+    prev = 0;
+    for (i = 0; i < count; i++) {
+        write_varint(file, postings[i].doc - prev);
+        write_varint(file, postings[i].hits);
+        prev = postings[i].doc;
+    }
+}
+
+/**
+ * Writes the builder's entries, sorted by term, as a run to the given file.
+ * Returns 1 on success and 0 on failure.
+ */
+int run_write(FILE *file, Builder *builder) {
+    TermEntry **entries;
+    size_t i;
+
+    if (!file || !(entries = builder_sorted(builder))) {
+        return 0;
+    }
+    for (i = 0; i < builder->count; i++) {
+        run_write_term(file, entries[i]->term, entries[i]->len,
+                entries[i]->postings, entries[i]->count);
+    }
+    free(entries);
+    return fflush(file) == 0 && !ferror(file);
+}
+
+/**
+ * Creates a reader for the run in the given file, which it rewinds. Returns a
+ * pointer to the new reader, or NULL if the call fails.
+ */
+RunReader *run_open(FILE *file) {
+    RunReader *reader;
+
+    if (!file || !(reader = (RunReader *) malloc(sizeof(struct RunReader)))) {
+        return NULL;
+    }
+    reader->cap = 64;
+    if (!(reader->term = (char *) malloc(reader->cap))) {
+        free(reader);
+        return NULL;
+    }
+    rewind(file);
+    reader->file = file;
+    reader->len = 0;
+    reader->remaining = 0;
+    reader->doc = 0;
+    return reader;
+}
+
+/**
+ * Advances to the next term, skipping any postings of the current one that
+ * were not read. Returns 1 if there is a next term and 0 at the end of the
+ * run or on a read error.
+ */
+int run_next_term(RunReader *reader) {
+    unsigned long long len, count;
+    Posting posting;
+    char *grown;
+
+    while (run_next_posting(reader, &posting))
+        ;
+    if (!read_varint(reader->file, &len)) {
+        return 0;
+    }
+    if (len + 1 > reader->cap) {
+        if (!(grown = (char *) realloc(reader->term, len + 1))) {
+            return 0;
+        }
+        reader->term = grown;
+        reader->cap = len + 1;
+    }
+    if (fread(reader->term, 1, len, reader->file) != len
+            || !read_varint(reader->file, &count)) {
+        return 0;
+    }
+    reader->term[len] = '\0';
+    reader->len = len;
+    reader->remaining = (unsigned int) count;
+    reader->doc = 0;
+    return 1;
+}
+
+/**
+ * Reads the next posting of the current term. Returns 1 on success and 0 once
+ * the term's postings are exhausted.
+ */
+int run_next_posting(RunReader *reader, Posting *posting) {
+    unsigned long long delta, hits;
+
+    if (reader->remaining == 0 || !read_varint(reader->file, &delta)
+            || !read_varint(reader->file, &hits)) {
+        reader->remaining = 0;
+        return 0;
+    }
+    reader->remaining--;
+    reader->doc += (unsigned int) delta;
+    posting->doc = reader->doc;
+    posting->hits = (unsigned int) hits;
+    return 1;
+}
+
+/**
+ * Destroys the reader, freeing all associated memory.
+ */
+void run_close(RunReader *reader) {
+    if (reader) {
+        free(reader->term);
+        free(reader);
+    }
+}
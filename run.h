@@ -0,0 +1,64 @@
+#ifndef RUN_H
+#define RUN_H
+
+#include "builder.h"
+#include <stdio.h>
+
+/**
+ * Reads back a sorted run: a builder's contents spilled to a temporary file
+ * when the indexer reaches its memory budget. A run holds each term once, in
+ * sorted order, as a varint length and bytes, a varint number of postings
+ * and then varint (document ID delta, hits) pairs. The reader exposes one
+ * term at a time and streams its postings, so only a small buffer is held in
+ * memory however large the run is.
+ */
+struct RunReader {
+    FILE *file;
+    char *term;
+    size_t len;
+    size_t cap;
+    unsigned int remaining;
+    unsigned int doc;
+};
+
+typedef struct RunReader RunReader;
+
+/**
+ * Appends one term, given as a (pointer, length) view, and its postings,
+ * sorted by document ID, to the run in the given file. Errors show in the
+ * file's error indicator.
+ */
+void run_write_term(FILE *, const char *, size_t, const Posting *, int);
+
+/**
+ * Writes the builder's entries, sorted by term, as a run to the given file.
+ * Returns 1 on success and 0 on failure.
+ */
+int run_write(FILE *, Builder *);
+
+/**
+ * Creates a reader for the run in the given file, which it rewinds. The file
+ * stays owned by the caller. Returns a pointer to the new reader, or NULL if
+ * the call fails.
+ */
+RunReader *run_open(FILE *);
+
+/**
+ * Advances to the next term, skipping any postings of the current one that
+ * were not read. Returns 1 if there is a next term and 0 at the end of the
+ * run or on a read error.
+ */
+int run_next_term(RunReader *);
+
+/**
+ * Reads the next posting of the current term. Returns 1 on success and 0 once
+ * the term's postings are exhausted.
+ */
+int run_next_posting(RunReader *, Posting *);
+
+/**
+ * Destroys the reader, freeing all associated memory.
+ */
+void run_close(RunReader *);
+
+#endif
@@ -1,12 +1,41 @@
+#include "batch.h"
+#include "engine.h"
+#include "epoch.h"
+#include "federation.h"
+#include "indexer.h"
 #include "parser.h"
 #include "set.h"
+#include "shard.h"
+#include "slowlog.h"
 #include "node.h"
+#include "stats.h"
+#include "tokenizer.h"
 #include <ctype.h>
+#include <errno.h>
+#include <limits.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
 #define MAXBUFSIZE 1024
+#define STATS_TOP_TERMS 10
+
+/**
+ * State for printing the results of a query as they are produced, with a
+ * buffer the filenames are decoded into. The index is NULL when the results
+ * come from shards as filenames. A query stopped by its deadline or budget
+ * is marked truncated.
+ */
+struct ResultPrinter {
+    Index *index;
+    char *name;
+    size_t namecap;
+    size_t printed;
+    int truncated;
+};
+
+typedef struct ResultPrinter ResultPrinter;
 
 /**
  * Prints the members of the set to standard out.
@@ -21,49 +50,428 @@ void set_print(Set *set) {
     }
 }
 
+/**
+ * Prints a resulting filename, preceded by the result header if it is the
+ * first one. The argument is a ResultPrinter.
+ */
+void print_name(const char *name, void *arg) {
+    ResultPrinter *printer = (ResultPrinter *) arg;
+
+    if (printer->printed++ == 0) {
+        printf("Your search returned: \n");
+    }
+    printf("'%s' ", name);
+}
+
+/**
+ * Prints the filename of a resulting document. The argument is a
+ * ResultPrinter.
+ */
+void print_doc(unsigned int doc, void *arg) {
+    ResultPrinter *printer = (ResultPrinter *) arg;
+
+    doc_name(printer->index, doc, printer->name);
+    print_name(printer->name, arg);
+}
+
+/**
+ * Grows the printer's name buffer to hold the longest filename of its index.
+ * Returns 1 on success and 0 if memory allocation fails.
+ */
+int reserve_name(ResultPrinter *printer) {
+    size_t size = printer->index->docs->maxlen + 1;
+    char *grown;
+
+    if (size <= printer->namecap) {
+        return 1;
+    }
+    else if (!(grown = (char *) realloc(printer->name, size))) {
+        return 0;
+    }
+    printer->name = grown;
+    printer->namecap = size;
+    return 1;
+}
+
+/**
+ * Prints the outcome of a query: the number of matching files for a query
+ * that only counts, or ends the line of printed filenames. A truncated
+ * query's count is a lower bound, and its files may not be all of them.
+ */
+void print_outcome(size_t count, int count_only, ResultPrinter *printer) {
+    if (count == (size_t) -1 || (count_only ? count : printer->printed) == 0) {
+        // Either an error occurred or there's no result.
+        printf(printer->truncated
+                ? "No hits found before the search was stopped.\n"
+                : "No hits found.\n");
+    }
+    else if (count_only) {
+        printf(printer->truncated
+                ? "Your search matched at least %lu files before it was "
+                "stopped.\n" : "Your search matched %lu files.\n",
+                (unsigned long) count);
+    }
+    else {
+        printf("\n");
+        if (printer->truncated) {
+            printf("The search was stopped early; more files may match.\n");
+        }
+    }
+}
+
 /**
  * Prints the expected program usage to standard out.
  */
 void show_usage(void) {
-    printf("Usage: search <inverted-index-file>\n");
+    printf("Usage: search [--stats] [--budget <MiB>] [--deadline <ms>] "
+            "[--max-cost <n>]\n");
+    printf("              [--slow-log <file> [--slow-ms <ms>] "
+            "[--sample <n>]]\n");
+    printf("              [--shards <n> | --batch <threads>] "
+            "<inverted-index-file>...\n");
+    printf("       search --index <directory> <index-file> [-j <threads>] "
+            "[-m <MiB>] [-r]\n");
+    printf("              [-p <pairs-file> | -q <query-log>]\n");
+    printf("  --stats    report load timings and index statistics\n");
+    printf("  --budget   keep a binary index's postings on disk, caching "
+            "this much\n");
+    printf("             (not with --shards)\n");
+    printf("  --deadline stop each query after ms, answering with what it "
+            "has\n");
+    printf("  --max-cost stop each query after an estimated n postings\n");
+    printf("  --slow-log append queries slower than --slow-ms (default %d) "
+            "and one in\n", SLOWLOG_DEFAULT_MS);
+    printf("             every --sample queries to a file that --batch can "
+            "replay\n");
+    printf("  --shards   split the files among n worker processes\n");
+    printf("  --batch    answer the queries on standard input with threads, "
+            "shedding\n");
+    printf("             those still waiting at their deadline\n");
+    printf("  several index files are loaded at once and searched as one\n");
+    printf("  --index    build a binary index of the files under a "
+            "directory\n");
+    printf("  -j         number of indexing threads (default: all "
+            "processors)\n");
+    printf("  -m         indexing memory budget; spills to temporary files\n");
+    printf("  -r         reorder the files so that similar ones get close "
+            "IDs\n");
+    printf("  -p         also store the intersections of the term pairs "
+            "listed in a file\n");
+    printf("  -q         likewise for the pairs most often searched together "
+            "in a query log\n");
+    printf("Queries: sa|so [-c] [-l <n>] [-o <n>] <term>...\n");
+    printf("  -c         only count the matching files\n");
+    printf("  -l, -o     print at most n files, after skipping the first n\n");
+    printf("  a term may be prefix*, lo..hi or fuzzy~N\n");
+    printf("Enter reload to load the index file again in the background.\n");
 }
 
 /**
- * Runs the searcher.
+ * Parses a size in MiB, which may be fractional, into bytes. Returns 1 on
+ * success and 0 if the text is not a non-negative number or the size does
+ * not fit in a size_t.
  */
-int main(int argc, char **argv) {
-    Index *index;
-    Set *result, *newresult, *temp;
-    SetIterator *iterator;
-    char *first, *token, *delims, *tempstr;
-    char buffer[MAXBUFSIZE];
-    int i;
-
-    if (argc != 2) {
-        // Unexpected number of arguments.
+int parse_mib(const char *text, size_t *bytes) {
+    char *end;
+    double mib = strtod(text, &end);
+
+    if (end == text || *end != '\0' || !(mib >= 0)
+            || mib >= (double) SIZE_MAX / (1 << 20)) {
+        return 0;
+    }
+    *bytes = (size_t) (mib * (1 << 20));
+    return 1;
+}
+
+/**
+ * Parses a whole non-negative decimal number no greater than max. Returns 1
+ * on success and 0 if the text is anything else.
+ */
+int parse_count(const char *text, unsigned long max, unsigned long *value) {
+    char *end;
+
+    if (!isdigit((unsigned char) text[0])) {
+        return 0;
+    }
+    errno = 0;
+    *value = strtoul(text, &end, 10);
+    return *end == '\0' && errno == 0 && *value <= max;
+}
+
+/**
+ * Runs the indexer for the arguments --index <directory> <index-file>
+ * [-j <threads>] [-m <MiB>] [-r] [-p <pairs-file> | -q <query-log>]. Returns
+ * the program's exit status.
+ */
+int run_indexer(int argc, char **argv) {
+    PairList *pairs = NULL;
+    const char *pairs_file = NULL, *query_log = NULL;
+    size_t budget = 0;
+    unsigned long value;
+    int i, ok, nthreads = 0, reordered = 0;
+
+    if (argc < 4) {
         fprintf(stderr, "search: Unexpected number of arguments.\n");
         show_usage();
         return 1;
     }
-    else if (strcmp(argv[1], "-h") == 0 || strcmp(argv[1], "--help") == 0) {
+    for (i = 4; i < argc; i++) {
+        if (strcmp(argv[i], "-r") == 0) {
+            reordered = 1;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-j") == 0) {
+            if (!parse_count(argv[++i], INT_MAX, &value)) {
+                fprintf(stderr, "search: -j takes a number of threads.\n");
+                return 1;
+            }
+            nthreads = (int) value;
+        }
+        else if (i + 1 < argc && strcmp(argv[i], "-m") == 0) {
+            if (!parse_mib(argv[++i], &budget)) {
+                fprintf(stderr, "search: -m takes a size in MiB.\n");
+                return 1;
+            }
+        }
+        else if (i + 1 < argc && !query_log && strcmp(argv[i], "-p") == 0) {
+            pairs_file = argv[++i];
+        }
+        else if (i + 1 < argc && !pairs_file && strcmp(argv[i], "-q") == 0) {
+            query_log = argv[++i];
+        }
+        else {
+            fprintf(stderr, "search: Unexpected argument '%s'.\n", argv[i]);
+            show_usage();
+            return 1;
+        }
+    }
+    if (pairs_file && !(pairs = pairs_read(pairs_file))) {
+        fprintf(stderr, "search: Could not read pairs from '%s'.\n",
+                pairs_file);
+        return 1;
+    }
+    else if (query_log && !(pairs = pairs_mine(query_log,
+                    PAIRS_MAX_MINED))) {
+        fprintf(stderr, "search: Could not read queries from '%s'.\n",
+                query_log);
+        return 1;
+    }
+    ok = build_index(argv[2], argv[3], nthreads, budget, pairs, reordered);
+    pairs_destroy(pairs);
+    return ok ? 0 : 1;
+}
+
+/**
+ * Runs the searcher.
+ */
+int main(int argc, char **argv) {
+    Index *index = NULL;
+    IndexHandle *handle = NULL;
+    ShardSet *shards = NULL;
+    Federation *fed = NULL;
+    ThreadPool *workers = NULL;
+    SlowLog *log = NULL;
+    QueryTrace trace;
+    LoadStats stats, *file_stats;
+    QueryPlan *plan;
+    ResultPrinter printer;
+    TokenizerT tk;
+    const char *first;
+    char buffer[MAXBUFSIZE], **files;
+    const char *log_path;
+    size_t len, count, budget, max_cost;
+    double slow_ms;
+    unsigned long sample, value;
+    char *end;
+    int i, show_stats, nshards, nbatch, nfiles, deadline, count_only;
+    int slot = 0;
+
+    if (argc >= 2 && strcmp(argv[1], "--index") == 0) {
+        return run_indexer(argc, argv);
+    }
+    else if (argc == 2 && (strcmp(argv[1], "-h") == 0
+                || strcmp(argv[1], "--help") == 0)) {
         // Invoking for help.
         show_usage();
         return 0;
     }
+    show_stats = 0;
+    budget = 0;
+    nshards = 0;
+    nbatch = 0;
+    deadline = 0;
+    max_cost = 0;
+    log_path = NULL;
+    slow_ms = SLOWLOG_DEFAULT_MS;
+    sample = 0;
+    for (i = 1; i < argc - 1; i++) {
+        if (strcmp(argv[i], "--stats") == 0) {
+            show_stats = 1;
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--budget") == 0) {
+            if (!parse_mib(argv[++i], &budget)) {
+                fprintf(stderr, "search: --budget takes a size in MiB.\n");
+                return 1;
+            }
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--shards") == 0) {
+            if (!parse_count(argv[++i], INT_MAX, &value)) {
+                fprintf(stderr, "search: --shards takes a number of "
+                        "processes.\n");
+                return 1;
+            }
+            nshards = (int) value;
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--deadline") == 0) {
+            if (!parse_count(argv[++i], INT_MAX, &value)) {
+                fprintf(stderr, "search: --deadline takes a number of "
+                        "milliseconds.\n");
+                return 1;
+            }
+            deadline = (int) value;
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--max-cost") == 0) {
+            if (!parse_count(argv[++i], SIZE_MAX, &value)) {
+                fprintf(stderr, "search: --max-cost takes a number of "
+                        "postings.\n");
+                return 1;
+            }
+            max_cost = (size_t) value;
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--batch") == 0) {
+            if (!parse_count(argv[++i], BATCH_MAX_WORKERS, &value)) {
+                fprintf(stderr, "search: --batch takes a number of threads, "
+                        "at most %d.\n", BATCH_MAX_WORKERS);
+                return 1;
+            }
+            nbatch = (int) value;
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--slow-log") == 0) {
+            log_path = argv[++i];
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--slow-ms") == 0) {
+            slow_ms = strtod(argv[++i], &end);
+            if (end == argv[i] || *end != '\0' || !(slow_ms >= 0)) {
+                fprintf(stderr, "search: --slow-ms takes a number of "
+                        "milliseconds.\n");
+                return 1;
+            }
+        }
+        else if (i + 2 < argc && strcmp(argv[i], "--sample") == 0) {
+            if (!parse_count(argv[++i], ULONG_MAX, &sample)) {
+                fprintf(stderr, "search: --sample takes a number of "
+                        "queries.\n");
+                return 1;
+            }
+        }
+        else {
+            break;
+        }
+    }
+    files = argv + i;
+    nfiles = argc - i;
+    if (argc < 2 || nfiles < 1 || nshards < 0 || deadline < 0
+            || nbatch < 0 || (nbatch > 0 && nshards > 0)) {
+        // Unexpected arguments.
+        fprintf(stderr, "search: Unexpected number of arguments.\n");
+        show_usage();
+        return 1;
+    }
+    else if (nfiles > 1 && (nshards > 0 || nbatch > 0)) {
+        fprintf(stderr, "search: --shards and --batch take a single index "
+                "file.\n");
+        return 1;
+    }
+    else if (nshards > 0 && budget > 0) {
+        fprintf(stderr, "search: --budget cannot be used with --shards, "
+                "whose workers each hold their part in memory.\n");
+        return 1;
+    }
 
-    index = parse(argv[1]);
-    if (!index) {
-        // Parsing failed.
+    if (log_path && !(log = slowlog_create(log_path, slow_ms, sample))) {
         return 1;
     }
+    if (nshards > 0) {
+        if (!(shards = shards_start(files[0], nshards, deadline))) {
+            return 1;
+        }
+        else if (show_stats) {
+            for (i = 0; i < shards->count; i++) {
+                printf("Shard %d: %lu files\n", i,
+                        (unsigned long) shards->shards[i].ndocs);
+            }
+        }
+    }
+    else if (nfiles > 1) {
+        // Load every file at once and search them as one index.
+        file_stats = show_stats ? (LoadStats *) malloc(nfiles
+                * sizeof(LoadStats)) : NULL;
+        stats.total = stats_now();
+        if ((show_stats && !file_stats) || !(fed = federation_load(files,
+                        nfiles, budget, file_stats))) {
+            free(file_stats);
+            return 1;
+        }
+        for (i = 0; show_stats && i < nfiles; i++) {
+            printf("Index '%s':\n", files[i]);
+            print_load_stats(stdout, &file_stats[i]);
+            print_index_stats(stdout, fed->indexes[i], STATS_TOP_TERMS);
+        }
+        if (show_stats) {
+            printf("Federation: %d indexes, %u files, loaded in %.3f s\n",
+                    fed->count, fed->ndocs, stats_now() - stats.total);
+        }
+        free(file_stats);
+        fed->budget = max_cost;
+    }
+    else {
+        index = parse_with_budget(files[0], budget,
+                show_stats ? &stats : NULL);
+        if (!index) {
+            // Parsing failed.
+            return 1;
+        }
+        else if (show_stats) {
+            print_load_stats(stdout, &stats);
+            print_index_stats(stdout, index, STATS_TOP_TERMS);
+        }
+        if (!(handle = handle_create(index, files[0], budget))) {
+            destroy_index(index);
+            return 1;
+        }
+        slot = handle_register(handle);
+    }
+
+    // The querying thread evaluates one partition of a large query itself,
+    // so the pool gets the other processors.
+    if (!shards && (i = pool_default_size()) > 1) {
+        workers = pool_create(i - 1);
+    }
+    if (fed) {
+        fed->pool = workers;
+    }
+
+    if (nbatch > 0) {
+        i = batch_run(handle, workers, log, stdin, nbatch, deadline,
+                max_cost);
+        slowlog_destroy(log);
+        handle_destroy(handle);
+        if (workers) {
+            pool_destroy(workers);
+        }
+        return i ? 0 : 1;
+    }
 
-    delims = " \n";
+    printer.name = NULL;
+    printer.namecap = 0;
     while(1) {
         // Main program loop.
-        result = set_create(generic_strcmp);
-
         printf("\nEnter a search query:\n");
-        fgets(buffer, MAXBUFSIZE, stdin);
+        if (!fgets(buffer, MAXBUFSIZE, stdin)) {
+            // End of input; treat it like a quit.
+            printf("Exiting. Goodbye!\n");
+            break;
+        }
+        trace.arrival = stats_now();
         for (i = 0; i < MAXBUFSIZE; i++) {
             if (buffer[i] == '\0') {
                 break;
@@ -74,65 +482,118 @@ int main(int argc, char **argv) {
         }
 
         // Tokenize the input line by spaces.
-        first = strtok(buffer, delims);
-        if (!first) {
+        plan = NULL;
+        TKInit(&tk, " \t\n", buffer, strlen(buffer));
+        if (!TKNextSlice(&tk, &first, &len)) {
             // Empty line or error
             printf("That's not a valid input. Try again.\n");
-            set_destroy(result);
             continue;
         }
-        else if (strcmp(first, "sa") == 0) {
-            // Logical AND
-            while ((token = strtok(NULL, delims)) != NULL) {
-                temp = query(index, token);
-                newresult = set_intersection(result, temp);
-                free(result);
-                free(temp);
-                result = newresult;
-            }
-        }
-        else if (strcmp(first, "so") == 0) {
-            // Logical OR
-            while ((token = strtok(NULL, delims)) != NULL) {
-                temp = query(index, token);
-                newresult = set_union(result, temp);
-                free(result);
-                free(temp);
-                result = newresult;
-            }
-        }
-        else if (strcmp(first, "q") == 0) {
+        else if (len == 1 && first[0] == 'q') {
             // Quit
             printf("Exiting. Goodbye!\n");
-            set_destroy(result);
             break;
         }
-        else {
+        else if (len == 6 && strncmp(first, "reload", len) == 0) {
+            // Load a new index while queries keep using the current one.
+            if (shards) {
+                printf("Reloading is not supported with shards.\n");
+            }
+            else if (fed) {
+                printf("Reloading is not supported with several index "
+                        "files.\n");
+            }
+            else if (handle_reload(handle)) {
+                printf("Reloading the index in the background.\n");
+            }
+            else {
+                printf("A reload is already in progress.\n");
+            }
+            continue;
+        }
+        else if (len != 2 || first[0] != 's'
+                || (first[1] != 'a' && first[1] != 'o')) {
             // Invalid input
             printf("That's not a valid input. Try again.\n");
-            set_destroy(result);
             continue;
         }
+        printer.index = NULL;
+        printer.printed = 0;
+        printer.truncated = 0;
+
+        if (shards || fed) {
+            // Send the query to every shard or index and merge their
+            // results.
+            trace.planned = stats_now();
+            count = shards ? shards_query(shards, buffer, &count_only,
+                    print_name, &printer) : federation_query(fed, buffer,
+                    deadline > 0 ? trace.arrival + deadline / 1000.0 : 0,
+                    &count_only, &printer.truncated, print_name, &printer);
+            trace.finished = stats_now();
+            trace.results = count == (size_t) -1 ? 0 : count;
+            slowlog_note(log, buffer, NULL, &trace);
+            if (count == (size_t) -1 && printer.printed == 0) {
+                printf("That's not a valid input. Try again.\n");
+            }
+            else {
+                print_outcome(count, count_only, &printer);
+            }
+            continue;
+        }
+
+        // Pin the current index for the rest of the query. Logical AND
+        // for sa, logical OR for so.
+        printer.index = index = handle_pin(handle, slot);
+        plan = plan_create(index, &tk, first[1] == 'a', max_cost,
+                deadline > 0 ? trace.arrival + deadline / 1000.0 : 0);
+        trace.planned = stats_now();
+        if (plan) {
+            plan->pool = workers;
+        }
 
         // Finally, print the result to standard out
-        if (result == NULL || set_isempty(result) == 1) {
-            // Either an error occurred or there's no result.
-            printf("No hits found.\n");
+        if (!plan) {
+            // Bad flags or an error while looking up the terms.
+            printf("That's not a valid input. Try again.\n");
+        }
+        else if (plan->count_only) {
+            count = plan_count(plan);
+            printer.truncated = plan->truncated;
+            print_outcome(count, 1, &printer);
+        }
+        else if (!reserve_name(&printer)) {
+            count = (size_t) -1;
+            print_outcome(count, 0, &printer);
         }
         else {
-            // Go through the set and print out all the hits.
-            printf("Your search returned: \n");
-            iterator = setiterator_create(result);
-            while ((tempstr = setiterator_next(iterator)) != NULL) {
-                printf("'%s' ", tempstr);
-            }
-            printf("\n");
-            setiterator_destroy(iterator);
+            count = plan_run(plan, print_doc, &printer);
+            printer.truncated = plan->truncated;
+            print_outcome(count, 0, &printer);
+        }
+        if (plan) {
+            trace.finished = stats_now();
+            trace.results = count == (size_t) -1 ? 0 : count;
+            slowlog_note(log, buffer, plan, &trace);
         }
-        set_destroy(result);
+        plan_destroy(plan);
+        handle_unpin(handle, slot);
+        handle_reclaim(handle);
     }
 
     // Clean up.
-    destroy_index(index);
+    slowlog_destroy(log);
+    if (shards) {
+        shards_stop(shards);
+    }
+    else if (fed) {
+        federation_destroy(fed);
+    }
+    else {
+        handle_destroy(handle);
+    }
+    if (workers) {
+        pool_destroy(workers);
+    }
+    free(printer.name);
     return 0;
 }
@@ -0,0 +1,944 @@
+#include "builder.h"
+#include "dict.h"
+#include "inverted-index.h"
+#include "segment.h"
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#define SEGMENT_IO_BUFFER (1 << 20)
+
+/**
+ * Writes the value as a variable-length integer, seven bits per byte, and
+ * returns the number of bytes written.
+ */
+static size_t encode_varint(unsigned char *out, unsigned long long value) {
+    size_t n = 0;
+
+    while (value >= 0x80) {
+        out[n++] = (unsigned char) (value | 0x80);
+        value >>= 7;
+    }
+    out[n++] = (unsigned char) value;
+    return n;
+}
+
+/**
+ * Reads a variable-length integer from the file. Returns 1 on success and 0
+ * at the end of the file or on a malformed value.
+ */
+int read_varint(FILE *file, unsigned long long *value) {
+    int c, shift;
+
+    *value = 0;
+    for (shift = 0; shift < 64; shift += 7) {
+        if ((c = getc(file)) == EOF) {
+            return 0;
+        }
+        *value |= (unsigned long long) (c & 0x7f) << shift;
+        if (!(c & 0x80)) {
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/**
+ * Stores a little-endian integer of the given width.
+ */
+static void put_le(unsigned char *out, unsigned long long value, int width) {
+    int i;
+
+    for (i = 0; i < width; i++) {
+        out[i] = (unsigned char) (value >> (8 * i));
+    }
+}
+
+/**
+ * Loads a little-endian integer of the given width.
+ */
+static unsigned long long get_le(const unsigned char *in, int width) {
+    unsigned long long value = 0;
+    int i;
+
+    for (i = width - 1; i >= 0; i--) {
+        value = (value << 8) | in[i];
+    }
+    return value;
+}
+
+/**
+ * Creates a writer for a new binary index at the given path. A blank header
+ * is written first and filled in when the writer finishes. Returns a pointer
+ * to the new writer, or NULL if the call fails.
+ */
+SegmentWriter *segment_create(const char *path) {
+    SegmentWriter *writer;
+    unsigned char header[SEGMENT_HEADER_SIZE];
+
+    if (!path || !(writer = (SegmentWriter *) calloc(1,
+                    sizeof(struct SegmentWriter)))) {
+        return NULL;
+    }
+    writer->cap = 4096;
+    writer->buffer = (unsigned char *) malloc(writer->cap);
+    writer->path = (char *) malloc(strlen(path) + 1);
+    writer->file = fopen(path, "wb");
+    writer->terms = tmpfile();
+    if (!writer->buffer || !writer->path || !writer->file || !writer->terms) {
+        if (writer->path && writer->file) {
+            strcpy(writer->path, path);
+        }
+        else {
+            free(writer->path);
+            writer->path = NULL;
+        }
+        segment_abort(writer);
+        return NULL;
+    }
+    strcpy(writer->path, path);
+    memset(header, 0, sizeof(header));
+    fwrite(header, 1, sizeof(header), writer->file);
+    writer->postings_offset = SEGMENT_HEADER_SIZE;
+    return writer;
+}
+
+/**
+ * Appends a filename to the document table. Returns 1 on success and 0 if
+ * terms have already been added or a write fails.
+ */
+int segment_add_doc(SegmentWriter *writer, const char *name, size_t len) {
+    unsigned char prefix[10];
+    size_t n;
+
+    if (!writer || writer->nterms > 0 || writer->count > 0) {
+        return 0;
+    }
+    n = encode_varint(prefix, len);
+    fwrite(prefix, 1, n, writer->file);
+    fwrite(name, 1, len, writer->file);
+    writer->postings_offset += n + len;
+    writer->ndocs++;
+    return !ferror(writer->file);
+}
+
+/**
+ * qsort comparison function for an array of string pointers.
+ */
+static int compare_strings(const void *s1, const void *s2) {
+    return strcmp(*(const char **) s1, *(const char **) s2);
+}
+
+/**
+ * Sets the pairs whose intersections are stored with the index, collecting
+ * their distinct terms in sorted order so that each term's postings can be
+ * kept as the terms go by. Returns 1 on success and 0 if terms have already
+ * been added or memory allocation fails.
+ */
+int segment_set_pairs(SegmentWriter *writer, const PairList *pairs) {
+    const char **terms;
+    int i, n;
+
+    if (!writer || !pairs || writer->nterms > 0 || writer->count > 0
+            || writer->pairs) {
+        return 0;
+    }
+    else if (!(terms = (const char **) malloc((2 * pairs->count + 1)
+                    * sizeof(char *)))) {
+        return 0;
+    }
+    for (i = 0; i < pairs->count; i++) {
+        terms[2 * i] = pairs->pairs[i].first;
+        terms[2 * i + 1] = pairs->pairs[i].second;
+    }
+    qsort(terms, 2 * pairs->count, sizeof(char *), compare_strings);
+    for (i = 0, n = 0; i < 2 * pairs->count; i++) {
+        if (n == 0 || strcmp(terms[n - 1], terms[i]) != 0) {
+            terms[n++] = terms[i];
+        }
+    }
+    writer->pair_docs = (unsigned int **) calloc(n + 1,
+            sizeof(unsigned int *));
+    writer->pair_counts = (size_t *) calloc(n + 1, sizeof(size_t));
+    if (!writer->pair_docs || !writer->pair_counts) {
+        free(writer->pair_docs);
+        free(writer->pair_counts);
+        writer->pair_docs = NULL;
+        writer->pair_counts = NULL;
+        free(terms);
+        return 0;
+    }
+    writer->pairs = pairs;
+    writer->pair_terms = terms;
+    writer->npair_terms = n;
+    return 1;
+}
+
+/**
+ * Appends a posting to the term being written. Postings must be added in
+ * increasing order of document ID. While pairs are set, the document IDs are
+ * also kept until the term ends, in case it belongs to a pair. Returns 1 on
+ * success and 0 on failure.
+ */
+int segment_add_posting(SegmentWriter *writer, unsigned int doc,
+        unsigned int hits) {
+    unsigned char entry[20];
+    unsigned int *grown;
+    size_t n;
+
+    if (!writer || (writer->count > 0 && doc <= writer->prev)) {
+        return 0;
+    }
+    else if (writer->pairs && writer->count == writer->pending_cap) {
+        n = writer->pending_cap ? 2 * writer->pending_cap : 1024;
+        if (!(grown = (unsigned int *) realloc(writer->pending, n
+                        * sizeof(unsigned int)))) {
+            return 0;
+        }
+        writer->pending = grown;
+        writer->pending_cap = n;
+    }
+    if (writer->pairs) {
+        writer->pending[writer->count] = doc;
+    }
+    n = encode_varint(entry, doc - writer->prev);
+    n += encode_varint(entry + n, hits);
+    fwrite(entry, 1, n, writer->file);
+    writer->prev = doc;
+    writer->count++;
+    writer->size += n;
+    return 1;
+}
+
+/**
+ * Keeps a copy of the postings of the term being written if it belongs to
+ * one of the pairs. Since terms arrive in sorted order, the pairs' terms are
+ * walked alongside them. Returns 1 on success and 0 if memory allocation
+ * fails.
+ */
+static int keep_pair_term(SegmentWriter *writer, const char *term,
+        size_t len) {
+    unsigned int *docs;
+    int i, order = 1;
+
+    while ((i = writer->next_pair_term) < writer->npair_terms
+            && (order = termcmp(writer->pair_terms[i],
+                    strlen(writer->pair_terms[i]), term, len)) < 0) {
+        writer->next_pair_term++;
+    }
+    if (i >= writer->npair_terms || order != 0) {
+        return 1;
+    }
+    else if (!(docs = (unsigned int *) malloc((writer->count ? writer->count
+                        : 1) * sizeof(unsigned int)))) {
+        return 0;
+    }
+    memcpy(docs, writer->pending, writer->count * sizeof(unsigned int));
+    writer->pair_docs[i] = docs;
+    writer->pair_counts[i] = writer->count;
+    writer->next_pair_term++;
+    return 1;
+}
+
+/**
+ * Completes the term being written, whose postings have all been added, by
+ * staging its dictionary entry. Returns 1 on success and 0 on failure.
+ */
+int segment_end_term(SegmentWriter *writer, const char *term, size_t len) {
+    unsigned char entry[30];
+    size_t n;
+
+    if (!writer || (writer->pairs && !keep_pair_term(writer, term, len))) {
+        return 0;
+    }
+    n = encode_varint(entry, len);
+    fwrite(entry, 1, n, writer->terms);
+    fwrite(term, 1, len, writer->terms);
+    n = encode_varint(entry, writer->count);
+    n += encode_varint(entry + n, writer->size);
+    fwrite(entry, 1, n, writer->terms);
+    writer->nterms++;
+    writer->prev = 0;
+    writer->count = 0;
+    writer->size = 0;
+    return !ferror(writer->file) && !ferror(writer->terms);
+}
+
+/**
+ * Appends a term and its postings, which must be sorted by document ID.
+ * Returns 1 on success and 0 on failure.
+ */
+int segment_add_term(SegmentWriter *writer, const char *term, size_t len,
+        const Posting *postings, int count) {
+    int i;
+
+    for (i = 0; i < count; i++) {
+        if (!segment_add_posting(writer, postings[i].doc, postings[i].hits)) {
+            return 0;
+        }
+    }
+    return segment_end_term(writer, term, len);
+}
+
+/**
+ * Frees the writer's memory and closes its files.
+ */
+static void free_writer(SegmentWriter *writer) {
+    int i;
+
+    if (writer->file) {
+        fclose(writer->file);
+    }
+    if (writer->terms) {
+        fclose(writer->terms);
+    }
+    for (i = 0; writer->pair_docs && i < writer->npair_terms; i++) {
+        free(writer->pair_docs[i]);
+    }
+    free(writer->pair_terms);
+    free(writer->pair_docs);
+    free(writer->pair_counts);
+    free(writer->pending);
+    free(writer->buffer);
+    free(writer->path);
+    free(writer);
+}
+
+/**
+ * Returns the position of a pair's term among the writer's pair terms.
+ */
+static int find_pair_term(SegmentWriter *writer, const char *term) {
+    const char **found = (const char **) bsearch(&term, writer->pair_terms,
+            writer->npair_terms, sizeof(char *), compare_strings);
+
+    return (int) (found - writer->pair_terms);
+}
+
+/**
+ * Writes a varint length and the bytes of a string.
+ */
+static void write_string(FILE *file, const char *s) {
+    unsigned char prefix[10];
+    size_t len = strlen(s);
+
+    fwrite(prefix, 1, encode_varint(prefix, len), file);
+    fwrite(s, 1, len, file);
+}
+
+/**
+ * Appends the pairs section: the intersection of the postings of each pair
+ * whose terms are both in the index, merged from the postings kept as the
+ * terms were written. Returns 1 on success and 0 on failure.
+ */
+static int write_pairs(SegmentWriter *writer) {
+    const TermPair *pair;
+    const unsigned int *a, *b;
+    unsigned int *both, prev;
+    unsigned char entry[10];
+    size_t na, nb, i, j, n;
+    int p, first, second, npairs;
+
+    for (p = 0, npairs = 0; p < writer->pairs->count; p++) {
+        pair = &writer->pairs->pairs[p];
+        npairs += writer->pair_docs[find_pair_term(writer, pair->first)]
+            && writer->pair_docs[find_pair_term(writer, pair->second)];
+    }
+    fwrite(SEGMENT_PAIRS_TAG, 1, SEGMENT_PAIRS_TAG_SIZE, writer->file);
+    fwrite(entry, 1, encode_varint(entry, npairs), writer->file);
+
+    for (p = 0; p < writer->pairs->count; p++) {
+        pair = &writer->pairs->pairs[p];
+        first = find_pair_term(writer, pair->first);
+        second = find_pair_term(writer, pair->second);
+        if (!(a = writer->pair_docs[first])
+                || !(b = writer->pair_docs[second])) {
+            continue;
+        }
+        na = writer->pair_counts[first];
+        nb = writer->pair_counts[second];
+        n = na < nb ? na : nb;
+        if (!(both = (unsigned int *) malloc((n ? n : 1)
+                        * sizeof(unsigned int)))) {
+            return 0;
+        }
+        for (i = 0, j = 0, n = 0; i < na && j < nb;) {
+            if (a[i] < b[j]) {
+                i++;
+            }
+            else if (a[i] > b[j]) {
+                j++;
+            }
+            else {
+                both[n++] = a[i];
+                i++;
+                j++;
+            }
+        }
+        write_string(writer->file, pair->first);
+        write_string(writer->file, pair->second);
+        fwrite(entry, 1, encode_varint(entry, n), writer->file);
+        for (i = 0, prev = 0; i < n; prev = both[i++]) {
+            fwrite(entry, 1, encode_varint(entry, both[i] - prev),
+                    writer->file);
+        }
+        free(both);
+    }
+    return !ferror(writer->file);
+}
+
+/**
+ * Completes the file: appends the staged dictionary and the pairs, if any,
+ * and fills in the header. Returns 1 on success and 0 on failure, in which
+ * case the file is removed. The writer is freed either way.
+ */
+int segment_finish(SegmentWriter *writer) {
+    unsigned char header[SEGMENT_HEADER_SIZE];
+    long long dict_offset;
+    size_t n;
+    int ok;
+
+    if (!writer) {
+        return 0;
+    }
+    dict_offset = ftello(writer->file);
+
+    rewind(writer->terms);
+    while ((n = fread(writer->buffer, 1, writer->cap, writer->terms)) > 0) {
+        fwrite(writer->buffer, 1, n, writer->file);
+    }
+    ok = !writer->pairs || write_pairs(writer);
+
+    memcpy(header, SEGMENT_MAGIC, SEGMENT_MAGIC_SIZE);
+    put_le(header + 8, writer->ndocs, 4);
+    put_le(header + 12, writer->nterms, 4);
+    put_le(header + 16, writer->postings_offset, 8);
+    put_le(header + 24, dict_offset, 8);
+    fseeko(writer->file, 0, SEEK_SET);
+    fwrite(header, 1, sizeof(header), writer->file);
+
+    ok = ok && !ferror(writer->file) && !ferror(writer->terms);
+    ok = fclose(writer->file) == 0 && ok;
+    writer->file = NULL;
+    if (!ok) {
+        unlink(writer->path);
+    }
+    free_writer(writer);
+    return ok;
+}
+
+/**
+ * Abandons the file, removing it, and frees the writer.
+ */
+void segment_abort(SegmentWriter *writer) {
+    if (!writer) {
+        return;
+    }
+    if (writer->file) {
+        fclose(writer->file);
+        writer->file = NULL;
+        if (writer->path) {
+            unlink(writer->path);
+        }
+    }
+    free_writer(writer);
+}
+
+/**
+ * Returns one if the given file starts with the binary index magic bytes;
+ * zero otherwise.
+ */
+int is_segment(const char *path) {
+    char magic[SEGMENT_MAGIC_SIZE];
+    FILE *file;
+    int result;
+
+    if (!path || !(file = fopen(path, "rb"))) {
+        return 0;
+    }
+    result = fread(magic, 1, sizeof(magic), file) == sizeof(magic)
+        && memcmp(magic, SEGMENT_MAGIC, SEGMENT_MAGIC_SIZE) == 0;
+    fclose(file);
+    return result;
+}
+
+/**
+ * Reads the dictionary section into the index: builds the term dictionary and
+ * the postings offsets. If positions is not NULL, it also receives the file
+ * offset of each term's postings, starting from the given one, and of their
+ * end. Returns 1 on success and 0 on failure.
+ */
+static int load_terms(Index *index, FILE *file, unsigned int nterms,
+        unsigned long long *positions, unsigned long long start) {
+    unsigned long long len, count, size;
+    char **terms;
+    unsigned int t, loaded;
+    int ok;
+
+    terms = (char **) malloc((nterms ? nterms : 1) * sizeof(char *));
+    index->offsets = (size_t *) malloc((nterms + 1) * sizeof(size_t));
+    if (!terms || !index->offsets) {
+        free(terms);
+        return 0;
+    }
+
+    ok = 1;
+    index->offsets[0] = 0;
+    if (positions) {
+        positions[0] = start;
+    }
+    for (loaded = 0; ok && loaded < nterms;) {
+        if (!read_varint(file, &len) || len > (1 << 20)
+                || !(terms[loaded] = (char *) malloc(len + 1))) {
+            ok = 0;
+            break;
+        }
+        terms[loaded][len] = '\0';
+        ok = fread(terms[loaded], 1, len, file) == len
+            && read_varint(file, &count) && read_varint(file, &size);
+        loaded++;
+        if (ok) {
+            index->offsets[loaded] = index->offsets[loaded - 1] + count;
+        }
+        if (ok && positions) {
+            positions[loaded] = positions[loaded - 1] + size;
+        }
+    }
+    if (ok) {
+        ok = (index->terms = dict_create(terms, nterms)) != NULL;
+    }
+
+    for (t = 0; t < loaded; t++) {
+        free(terms[t]);
+    }
+    free(terms);
+    return ok;
+}
+
+/**
+ * Reads a varint length and the bytes of a string into a new buffer, which
+ * is stored in the given pointer. Returns 1 on success and 0 on failure.
+ */
+static int read_string(FILE *file, char **s, size_t *len) {
+    unsigned long long n;
+
+    *s = NULL;
+    if (!read_varint(file, &n) || n > (1 << 20)
+            || !(*s = (char *) malloc(n + 1))) {
+        return 0;
+    }
+    (*s)[n] = '\0';
+    *len = (size_t) n;
+    return fread(*s, 1, n, file) == n;
+}
+
+/**
+ * Reads one pair of the pairs section into the next slot of the index's
+ * pairs, or skips it if either term is not in the dictionary. If ids is not
+ * NULL, it holds the new ID of each document, or -1 if it was dropped, and
+ * the pair's documents are renumbered. Returns 1 on success and 0 on
+ * failure, if a document ID is out of range or if the pair is out of order.
+ */
+static int load_pair(Index *index, FILE *file, unsigned int ndocs,
+        const unsigned int *ids, unsigned int *docs) {
+    unsigned long long count, delta;
+    char *first, *second;
+    size_t flen, slen, i, n;
+    unsigned int doc;
+    PairSet *pair;
+    int ok;
+
+    ok = read_string(file, &first, &flen) && read_string(file, &second, &slen)
+        && read_varint(file, &count) && count <= ndocs;
+    for (i = 0, n = 0, doc = 0; ok && i < count; i++) {
+        ok = read_varint(file, &delta) && (i == 0 || delta > 0)
+            && delta < ndocs - doc;
+        doc += (unsigned int) delta;
+        if (!ids) {
+            docs[n++] = doc;
+        }
+        else if (ok && ids[doc] != (unsigned int) -1) {
+            docs[n++] = ids[doc];
+        }
+    }
+    pair = &index->pairs[index->npairs];
+    if (ok && (pair->first = dict_lookup(index->terms, first, flen)) >= 0
+            && (pair->second = dict_lookup(index->terms, second, slen)) >= 0) {
+        ok = pair->first < pair->second && (index->npairs == 0
+                || pair[-1].first < pair->first || (pair[-1].first
+                    == pair->first && pair[-1].second < pair->second))
+            && (pair->docs = docset_from_sorted(docs, n)) != NULL;
+        index->npairs += ok;
+    }
+    free(first);
+    free(second);
+    return ok;
+}
+
+/**
+ * Reads the optional pairs section that follows the dictionary into the
+ * index, renumbering the documents by ids as load_pair does unless it is
+ * NULL. A file that ends with the dictionary has no pairs. Returns 1 on
+ * success and 0 on failure.
+ */
+static int load_pairs(Index *index, FILE *file, unsigned int ndocs,
+        const unsigned int *ids) {
+    char tag[SEGMENT_PAIRS_TAG_SIZE];
+    unsigned long long count, i;
+    unsigned int *docs;
+    int ok;
+
+    if (fread(tag, 1, sizeof(tag), file) != sizeof(tag)
+            || memcmp(tag, SEGMENT_PAIRS_TAG, SEGMENT_PAIRS_TAG_SIZE) != 0) {
+        return !ferror(file);
+    }
+    else if (!read_varint(file, &count) || count > (1 << 24)) {
+        return 0;
+    }
+    index->pairs = (PairSet *) malloc((count ? count : 1) * sizeof(PairSet));
+    docs = (unsigned int *) malloc((ndocs ? ndocs : 1) * sizeof(unsigned int));
+    ok = index->pairs && docs;
+    for (i = 0; ok && i < count; i++) {
+        ok = load_pair(index, file, ndocs, ids, docs);
+    }
+    free(docs);
+    return ok;
+}
+
+/**
+ * Reads the document table into the index, front-coding the filenames as
+ * they are kept. If a filter is given, only the documents it accepts are
+ * kept, renumbered in their order: the new ID of each document, or -1 if it
+ * was dropped, is stored in ids and the old ID of each kept one in global.
+ * Returns 1 on success and 0 on failure.
+ */
+static int load_docs(Index *index, FILE *file, unsigned int ndocs,
+        DocFilter keep, void *arg, unsigned int *ids, unsigned int *global) {
+    unsigned long long len;
+    char **names;
+    unsigned int d, n, i;
+    int ok;
+
+    if (!(names = (char **) malloc((ndocs ? ndocs : 1) * sizeof(char *)))) {
+        return 0;
+    }
+    ok = 1;
+    for (d = 0, n = 0; ok && d < ndocs; d++) {
+        ok = read_varint(file, &len) && len <= (1 << 20)
+            && (names[n] = (char *) malloc(len + 1)) != NULL;
+        if (!ok) {
+            break;
+        }
+        names[n][len] = '\0';
+        ok = fread(names[n], 1, len, file) == len;
+        if (ok && keep && !keep(names[n], (size_t) len, arg)) {
+            free(names[n]);
+            ids[d] = (unsigned int) -1;
+            continue;
+        }
+        else if (keep) {
+            ids[d] = n;
+            global[n] = d;
+        }
+        n++;
+    }
+    if (ok && (index->docs = dict_create(names, (int) n)) != NULL) {
+        index->ndocs = (int) n;
+    }
+    for (i = 0; i < n; i++) {
+        free(names[i]);
+    }
+    free(names);
+    return index->docs != NULL;
+}
+
+/**
+ * Reads the postings section into the index, dropping the hit counts. Returns
+ * 1 on success and 0 on failure or if a document ID is out of range.
+ */
+static int load_postings(Index *index, FILE *file) {
+    unsigned long long delta, hits;
+    unsigned int doc;
+    size_t total, i;
+    int t;
+
+    total = index->offsets[index->terms->count];
+    if (!(index->postings = (unsigned int *) malloc((total ? total : 1)
+                    * sizeof(unsigned int)))) {
+        return 0;
+    }
+    for (t = 0; t < index->terms->count; t++) {
+        doc = 0;
+        for (i = index->offsets[t]; i < index->offsets[t + 1]; i++) {
+            if (!read_varint(file, &delta) || !read_varint(file, &hits)) {
+                return 0;
+            }
+            doc += (unsigned int) delta;
+            if (doc >= (unsigned int) index->ndocs) {
+                return 0;
+            }
+            index->postings[i] = doc;
+        }
+    }
+    return 1;
+}
+
+/**
+ * Reads the postings section into the index as load_postings does, keeping
+ * only the documents that have a new ID in ids, which they are renumbered
+ * to. The postings array grows as they are kept, so that its size follows
+ * the kept documents rather than the whole file, and the offsets are
+ * rewritten to match. Returns 1 on success and 0 on failure or if a
+ * document ID is out of range.
+ */
+static int load_postings_part(Index *index, FILE *file, unsigned int ndocs,
+        const unsigned int *ids) {
+    unsigned long long delta, hits;
+    unsigned int doc, *grown;
+    size_t cap, n, len, end, i;
+    int t;
+
+    cap = SEGMENT_IO_BUFFER / sizeof(unsigned int);
+    if (!(index->postings = (unsigned int *) malloc(cap
+                    * sizeof(unsigned int)))) {
+        return 0;
+    }
+    n = 0;
+    end = 0;
+    for (t = 0; t < index->terms->count; t++) {
+        len = index->offsets[t + 1] - end;
+        end = index->offsets[t + 1];
+        for (i = 0, doc = 0; i < len; i++) {
+            if (!read_varint(file, &delta) || !read_varint(file, &hits)) {
+                return 0;
+            }
+            doc += (unsigned int) delta;
+            if (doc >= ndocs) {
+                return 0;
+            }
+            else if (ids[doc] == (unsigned int) -1) {
+                continue;
+            }
+            else if (n == cap) {
+                if (!(grown = (unsigned int *) realloc(index->postings,
+                                cap * 2 * sizeof(unsigned int)))) {
+                    return 0;
+                }
+                index->postings = grown;
+                cap *= 2;
+            }
+            index->postings[n++] = ids[doc];
+        }
+        index->offsets[t + 1] = n;
+    }
+    if (n && (grown = (unsigned int *) realloc(index->postings,
+                    n * sizeof(unsigned int)))) {
+        index->postings = grown;
+    }
+    return 1;
+}
+
+/**
+ * Removes the terms left without postings from the dictionary of an index
+ * loaded in part, moving the offsets of the others down. Returns 1 on
+ * success and 0 if memory allocation fails.
+ */
+static int drop_empty_terms(Index *index) {
+    DictIterator *iterator;
+    Dict *terms = NULL;
+    char **kept;
+    const char *term;
+    size_t len;
+    int t, n, i, ok;
+
+    kept = (char **) malloc((index->terms->count ? index->terms->count : 1)
+            * sizeof(char *));
+    iterator = dict_iter_create(index->terms, 0);
+    ok = kept && iterator;
+    n = 0;
+    while (ok && (term = dict_iter_next(iterator, &len)) != NULL) {
+        t = iterator->ordinal;
+        if (index->offsets[t + 1] == index->offsets[t]) {
+            continue;
+        }
+        else if (!(kept[n] = (char *) malloc(len + 1))) {
+            ok = 0;
+            break;
+        }
+        memcpy(kept[n], term, len + 1);
+        index->offsets[++n] = index->offsets[t + 1];
+    }
+    if (ok && (terms = dict_create(kept, n)) != NULL) {
+        dict_destroy(index->terms);
+        index->terms = terms;
+    }
+    for (i = 0; i < n; i++) {
+        free(kept[i]);
+    }
+    free(kept);
+    dict_iter_destroy(iterator);
+    return terms != NULL;
+}
+
+/**
+ * Opens a binary index and reads its header into the given buffer. Returns
+ * the open file, or NULL if it cannot be read, is not a binary index or
+ * holds more terms than a dictionary can number.
+ */
+static FILE *open_segment(const char *path, unsigned char *header) {
+    FILE *file;
+
+    if (!path || !(file = fopen(path, "rb"))) {
+        return NULL;
+    }
+    setvbuf(file, NULL, _IOFBF, SEGMENT_IO_BUFFER);
+    if (fread(header, 1, SEGMENT_HEADER_SIZE, file) != SEGMENT_HEADER_SIZE
+            || memcmp(header, SEGMENT_MAGIC, SEGMENT_MAGIC_SIZE) != 0
+            || get_le(header + 12, 4) > INT_MAX) {
+        fclose(file);
+        return NULL;
+    }
+    return file;
+}
+
+/**
+ * Loads a binary index into a frozen inverted index. The dictionary is read
+ * first, since it holds the length of every postings list, along with the
+ * pair intersections that follow it, then the document table and the
+ * postings. With a budget, the postings are left on disk behind a cache of
+ * that many bytes instead, and only the prebuilt sets of frequent terms and
+ * the pair intersections are read. Returns a pointer to the new index, or
+ * NULL if the file cannot be read or is malformed.
+ */
+static Index *load(const char *path, int cold, size_t budget) {
+    unsigned char header[SEGMENT_HEADER_SIZE];
+    unsigned long long *positions = NULL;
+    unsigned int ndocs, nterms;
+    long long postings_offset, dict_offset;
+    Index *index;
+    FILE *file;
+    int ok;
+
+    if (!(file = open_segment(path, header))) {
+        return NULL;
+    }
+    else if (!(index = create_index())) {
+        fclose(file);
+        return NULL;
+    }
+    ndocs = (unsigned int) get_le(header + 8, 4);
+    nterms = (unsigned int) get_le(header + 12, 4);
+    postings_offset = (long long) get_le(header + 16, 8);
+    dict_offset = (long long) get_le(header + 24, 8);
+    if (cold && !(positions = (unsigned long long *) malloc((nterms + 1)
+                    * sizeof(unsigned long long)))) {
+        fclose(file);
+        destroy_index(index);
+        return NULL;
+    }
+
+    ok = fseeko(file, dict_offset, SEEK_SET) == 0
+        && load_terms(index, file, nterms, positions,
+                (unsigned long long) postings_offset)
+        && load_pairs(index, file, ndocs, NULL)
+        && fseeko(file, SEGMENT_HEADER_SIZE, SEEK_SET) == 0
+        && load_docs(index, file, ndocs, NULL, NULL, NULL, NULL);
+    if (ok && cold && positions[nterms] <= (unsigned long long) dict_offset) {
+        // The store takes over the positions.
+        index->cold = cold_open(path, positions, nterms, ndocs, budget);
+        positions = NULL;
+        ok = index->cold != NULL;
+    }
+    else if (cold) {
+        ok = 0;
+    }
+    else if (ok) {
+        ok = fseeko(file, postings_offset, SEEK_SET) == 0
+            && load_postings(index, file);
+    }
+    fclose(file);
+    free(positions);
+    if (!ok || !build_dense_sets(index)) {
+        destroy_index(index);
+        return NULL;
+    }
+    return index;
+}
+
+/**
+ * Loads a binary index into a frozen inverted index in memory. Returns a
+ * pointer to the new index, or NULL if the file cannot be read or is
+ * malformed.
+ */
+Index *load_segment(const char *path) {
+    return load(path, 0, 0);
+}
+
+/**
+ * Loads a binary index keeping its postings on disk, with at most about the
+ * given number of bytes of them cached in memory. Returns a pointer to the
+ * new index, or NULL if the file cannot be read or is malformed.
+ */
+Index *load_segment_cold(const char *path, size_t budget) {
+    return load(path, 1, budget);
+}
+
+/**
+ * Loads the part of a binary index made of the documents the filter accepts
+ * into a frozen inverted index in memory. The document table is read first;
+ * only the postings of the kept documents are then read in, renumbered in
+ * their order, and terms left without postings are dropped, so the part
+ * takes about as much memory as an index built from its documents alone.
+ * The ID each kept document has in the whole index is stored in a new array
+ * in global. Returns a pointer to the new index, or NULL if the file cannot
+ * be read or is malformed.
+ */
+Index *load_segment_part(const char *path, DocFilter keep, void *arg,
+        unsigned int **global) {
+    unsigned char header[SEGMENT_HEADER_SIZE];
+    unsigned int ndocs, nterms, *ids;
+    long long postings_offset, dict_offset;
+    off_t pairs_offset = 0;
+    Index *index;
+    FILE *file;
+    int ok;
+
+    *global = NULL;
+    if (!(file = open_segment(path, header))) {
+        return NULL;
+    }
+    ndocs = (unsigned int) get_le(header + 8, 4);
+    nterms = (unsigned int) get_le(header + 12, 4);
+    postings_offset = (long long) get_le(header + 16, 8);
+    dict_offset = (long long) get_le(header + 24, 8);
+    ids = (unsigned int *) malloc((ndocs ? ndocs : 1) * sizeof(unsigned int));
+    *global = (unsigned int *) malloc((ndocs ? ndocs : 1)
+            * sizeof(unsigned int));
+    index = create_index();
+
+    // The pairs follow the dictionary but are read once terms are dropped.
+    ok = ids && *global && index
+        && fseeko(file, SEGMENT_HEADER_SIZE, SEEK_SET) == 0
+        && load_docs(index, file, ndocs, keep, arg, ids, *global)
+        && fseeko(file, dict_offset, SEEK_SET) == 0
+        && load_terms(index, file, nterms, NULL, 0)
+        && (pairs_offset = ftello(file)) >= 0
+        && fseeko(file, postings_offset, SEEK_SET) == 0
+        && load_postings_part(index, file, ndocs, ids)
+        && drop_empty_terms(index)
+        && fseeko(file, pairs_offset, SEEK_SET) == 0
+        && load_pairs(index, file, ndocs, ids)
+        && build_dense_sets(index);
+    fclose(file);
+    free(ids);
+    if (!ok) {
+        if (index) {
+            destroy_index(index);
+        }
+        free(*global);
+        *global = NULL;
+        return NULL;
+    }
+    return index;
+}
@@ -0,0 +1,151 @@
+#ifndef SEGMENT_H
+#define SEGMENT_H
+
+#include "builder.h"
+#include "inverted-index.h"
+#include "pairs.h"
+#include <stdio.h>
+
+/*
+ * Magic bytes at the start of every binary index file.
+ */
+#define SEGMENT_MAGIC "SRCHIDX1"
+#define SEGMENT_MAGIC_SIZE 8
+#define SEGMENT_HEADER_SIZE 32
+
+/*
+ * Tag of the optional section of precomputed pair intersections.
+ */
+#define SEGMENT_PAIRS_TAG "PAIR"
+#define SEGMENT_PAIRS_TAG_SIZE 4
+
+/**
+ * Writes a binary index file. The file starts with a fixed-size header,
+ * followed by the document table, the postings of every term and finally the
+ * term dictionary:
+ *
+ *   header:     magic, u32 ndocs, u32 nterms, u64 postings and dictionary
+ *               offsets, all little-endian
+ *   documents:  varint length and bytes of each filename, in ID order
+ *   postings:   for each term, varint (document ID delta, hits) pairs
+ *   dictionary: for each term in sorted order, varint length and bytes,
+ *               varint number of postings and varint size of its postings
+ *   pairs:      optionally, the tag, a varint number of pairs and, for each
+ *               pair in sorted order, the varint length and bytes of both
+ *               terms, a varint number of documents and varint document ID
+ *               deltas of the documents containing both
+ *
+ * Documents must all be added before the first term. Postings are written as
+ * they are added, either a whole term at a time or one posting at a time
+ * followed by the term itself; the dictionary is staged in a temporary file
+ * and appended when the writer finishes, so the writer's memory use does not
+ * grow with the index. If pairs are set, only the postings of their terms
+ * are kept until the intersections are written at the end.
+ */
+struct SegmentWriter {
+    FILE *file;
+    FILE *terms;
+    char *path;
+    unsigned int ndocs;
+    unsigned int nterms;
+    long long postings_offset;
+    unsigned int prev;
+    unsigned int count;
+    unsigned long long size;
+    unsigned char *buffer;
+    size_t cap;
+    const PairList *pairs;
+    const char **pair_terms;
+    unsigned int **pair_docs;
+    size_t *pair_counts;
+    int npair_terms;
+    int next_pair_term;
+    unsigned int *pending;
+    size_t pending_cap;
+};
+
+typedef struct SegmentWriter SegmentWriter;
+
+/**
+ * Creates a writer for a new binary index at the given path. Returns a
+ * pointer to the new writer, or NULL if the call fails.
+ */
+SegmentWriter *segment_create(const char *);
+
+/**
+ * Appends a filename, given as a (pointer, length) view, to the document
+ * table. Returns 1 on success and 0 on failure.
+ */
+int segment_add_doc(SegmentWriter *, const char *, size_t);
+
+/**
+ * Sets the pairs of terms whose intersections are stored with the index. The
+ * list must outlive the writer. Must be called before the first term is
+ * added. Returns 1 on success and 0 on failure.
+ */
+int segment_set_pairs(SegmentWriter *, const PairList *);
+
+/**
+ * Appends a term, given as a (pointer, length) view, and its postings. Terms
+ * must be added in sorted order. Returns 1 on success and 0 on failure.
+ */
+int segment_add_term(SegmentWriter *, const char *, size_t, const Posting *,
+        int);
+
+/**
+ * Appends a posting (document ID and hits) to the term being written. Postings
+ * must be added in increasing order of document ID. Returns 1 on success and
+ * 0 on failure.
+ */
+int segment_add_posting(SegmentWriter *, unsigned int, unsigned int);
+
+/**
+ * Completes the term being written, given as a (pointer, length) view, once
+ * all its postings have been added. Returns 1 on success and 0 on failure.
+ */
+int segment_end_term(SegmentWriter *, const char *, size_t);
+
+/**
+ * Completes the file and frees the writer. Returns 1 on success and 0 on
+ * failure, in which case the file is removed.
+ */
+int segment_finish(SegmentWriter *);
+
+/**
+ * Abandons the file, removing it, and frees the writer.
+ */
+void segment_abort(SegmentWriter *);
+
+/**
+ * Reads a variable-length integer, seven bits per byte, from the file.
+ * Returns 1 on success and 0 at the end of the file or on a malformed value.
+ */
+int read_varint(FILE *, unsigned long long *);
+
+/**
+ * Returns one if the given file is a binary index; zero otherwise.
+ */
+int is_segment(const char *);
+
+/**
+ * Loads a binary index into a frozen inverted index in memory. Returns a
+ * pointer to the new index, or NULL if an error occurs.
+ */
+Index *load_segment(const char *);
+
+/**
+ * Loads a binary index, leaving its postings on disk and caching at most
+ * about the given number of bytes of them in memory. Returns a pointer to
+ * the new index, or NULL if an error occurs.
+ */
+Index *load_segment_cold(const char *, size_t);
+
+/**
+ * Loads the part of a binary index made of the documents whose filenames the
+ * given filter accepts, renumbered in their order, storing the ID each has
+ * in the whole index in a new array. Only their postings are read into
+ * memory. Returns a pointer to the new index, or NULL if an error occurs.
+ */
+Index *load_segment_part(const char *, DocFilter, void *, unsigned int **);
+
+#endif
@@ -11,6 +11,102 @@ int generic_strcmp(void *str1, void *str2) {
     return strcmp((char *) str1, (char *) str2);
 }
 
+/**
+ * Defines the list walks behind set_add, set_contains and set_intersection
+ * for one kind of set, with COMPARE(set, a, b) comparing two items. Sets of
+ * strings compared by generic_strcmp get a copy that calls strcmp directly,
+ * which the compiler can inline; every other set gets one that calls its
+ * comparison function. The walks are:
+ *
+ * add_suffix: adds the item, maintaining the invariant that there are no
+ * duplicates. Returns 0 if a memory error occurs, and 1 otherwise - even if
+ * the insertion was skipped because the item already exists.
+ *
+ * contains_suffix: returns one if the set contains the item; zero otherwise.
+ *
+ * intersect_suffix: adds the items common to two lists to the result.
+ */
+#define DEFINE_SET_KERNELS(suffix, COMPARE)                                 \
+static int add_##suffix(Set *set, void *item) {                             \
+    Node *new, *ptr, *prev;                                                 \
+    int c;                                                                  \
+                                                                            \
+    if (!(new = create_node(item, NULL))) {                                 \
+        return 0;                                                           \
+    }                                                                       \
+    else if (!set->head) {                                                  \
+        /* First item added to the set. */                                  \
+        set->head = new;                                                    \
+        return 1;                                                           \
+    }                                                                       \
+    else if ((c = COMPARE(set, item, set->head->data)) <= 0) {              \
+        if (c < 0) {                                                        \
+            /* Belongs at the head of the set */                            \
+            new->next = set->head;                                          \
+            set->head = new;                                                \
+        }                                                                   \
+        else {                                                              \
+            free(new);                                                      \
+        }                                                                   \
+        return 1;                                                           \
+    }                                                                       \
+                                                                            \
+    /* Find a match or a place to insert */                                 \
+    prev = set->head;                                                       \
+    for (ptr = prev->next; ptr; prev = ptr, ptr = ptr->next) {              \
+        c = COMPARE(set, item, ptr->data);                                  \
+        if (c == 0) {                                                       \
+            free(new);                                                      \
+            return 1;                                                       \
+        }                                                                   \
+        else if (c < 0) {                                                   \
+            break;                                                          \
+        }                                                                   \
+    }                                                                       \
+    new->next = ptr;                                                        \
+    prev->next = new;                                                       \
+    return 1;                                                               \
+}                                                                           \
+                                                                            \
+static int contains_##suffix(Set *set, void *item) {                        \
+    Node *ptr;                                                              \
+                                                                            \
+    for (ptr = set->head; ptr != NULL; ptr = ptr->next) {                   \
+        if (COMPARE(set, item, ptr->data) == 0) {                           \
+            return 1;                                                       \
+        }                                                                   \
+    }                                                                       \
+    return 0;                                                               \
+}                                                                           \
+                                                                            \
+static void intersect_##suffix(Set *result, Node *p1, Node *p2) {           \
+    int c;                                                                  \
+                                                                            \
+    while (p1 != NULL && p2 != NULL) {                                      \
+        c = COMPARE(result, p1->data, p2->data);                            \
+        if (c < 0) {                                                        \
+            p1 = p1->next;                                                  \
+        }                                                                   \
+        else if (c > 0) {                                                   \
+            p2 = p2->next;                                                  \
+        }                                                                   \
+        else {                                                              \
+            if (add_##suffix(result, p1->data) == 0) {                      \
+                fprintf(stderr, "Warning: an error occurred during the set" \
+                                "intersection.\n");                         \
+            }                                                               \
+            p1 = p1->next;                                                  \
+            p2 = p2->next;                                                  \
+        }                                                                   \
+    }                                                                       \
+}
+
+#define GENERIC_COMPARE(set, a, b) ((set)->compare((a), (b)))
+#define STRING_COMPARE(set, a, b) strcmp((char *) (a), (char *) (b))
+
+DEFINE_SET_KERNELS(generic, GENERIC_COMPARE)
+DEFINE_SET_KERNELS(string, STRING_COMPARE)
+
 /**
  * Adds the given item to the set, maintaining the invariant that there are no
  * duplicates contained within.
@@ -18,73 +114,22 @@ int generic_strcmp(void *str1, void *str2) {
  * even if the insertion was skipped because the item already exists.
  */
 int set_add(Set *set, void *item) {
-    Node *new, *ptr, *prev;
-    int c, retval;
-
-    if (!set || !(new = create_node(item, NULL))) {
-        retval = 0;
-    }
-    else if (!set->head) {
-        // First item added to the set. Create a new node
-        set->head = new;
-        retval = 1;
-    }
-    else if ((c = set->compare(item, set->head->data)) <= 0) {
-        if (c < 0) {
-            // Belongs at the head of the set
-            new->next = set->head;
-            set->head = new;
-        }
-        else {
-            // Duplicate
-            printf("Found duplicate at head\n");
-            free(new);
-            new = NULL;
-        }
-        retval = 1;
-    }
-    else {
-        // Find a match or a place to insert
-        ptr = set->head;
-        prev = NULL;
-        for (; ptr; prev = ptr, ptr = ptr->next) {
-            c = set->compare(item, ptr->data);
-            if (c == 0) {
-                // Duplicate.
-            printf("Found duplicate\n");
-                free(new);
-                new = NULL;
-                return 1;
-            }
-            else if (c < 0) {
-                // Node should be inserted in here.
-                new->next = ptr;
-                prev->next = new;
-                return 1;
-            }
-        }
-
-        // The item belongs at the end of the set.
-        prev->next = new;
-        retval = 1;
+    if (!set) {
+        return 0;
     }
-    return retval;
+    return set->compare == generic_strcmp ? add_string(set, item)
+        : add_generic(set, item);
 }
 
 /**
  * Returns one if the set contains the item; zero otherwise.
  */
 int set_contains(Set *set, void *item) {
-    Node *ptr;
     if (!set) {
         return 0;
     }
-    for (ptr = set->head; ptr != NULL; ptr = ptr->next) {
-        if (set->compare(item, ptr->data) == 0) {
-            return 1;
-        }
-    }
-    return 0;
+    return set->compare == generic_strcmp ? contains_string(set, item)
+        : contains_generic(set, item);
 }
 
 /**
@@ -154,9 +199,7 @@ void set_destroy(Set *set) {
  * the other set.
  */
 Set *set_intersection(Set *s1, Set *s2) {
-    Node *p1, *p2;
     Set *result;
-    int c;
 
     if (!s1 || set_isempty(s1)) {
         return set_copy(s2);
@@ -168,26 +211,11 @@ Set *set_intersection(Set *s1, Set *s2) {
         return NULL;
     }
 
-    p1 = s1->head;
-    p2 = s2->head;
-
-    while(p1 != NULL && p2 != NULL) {
-        c = result->compare(p1->data, p2->data);
-        if (c < 0) {
-            p1 = p1->next;
-        }
-        else if (c > 0) {
-            p2 = p2->next;
-        }
-        else {
-            c = set_add(result, p1->data);
-            if (c == 0) {
-                fprintf(stderr, "Warning: an error occurred during the set"
-                                "intersection.\n");
-            }
-            p1 = p1->next;
-            p2 = p2->next;
-        }
+    if (result->compare == generic_strcmp) {
+        intersect_string(result, s1->head, s2->head);
+    }
+    else {
+        intersect_generic(result, s1->head, s2->head);
     }
     return result;
 }
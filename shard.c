@@ -0,0 +1,655 @@
+#include "shard.h"
+#include "engine.h"
+#include "inverted-index.h"
+#include "parser.h"
+#include "stats.h"
+#include "tokenizer.h"
+#include <errno.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Frames are a 4-byte payload length followed by the payload. A request's
+ * payload is a 4-byte sequence number and the query line; a reply's is the
+ * sequence number, a 4-byte status, an 8-byte count and, for queries that
+ * list files, each file's 4-byte document ID in the whole index followed by
+ * its NUL-terminated filename, in order of those IDs.
+ */
+#define FRAME_HEADER 4
+#define REQUEST_HEADER 4
+#define REPLY_HEADER 16
+#define DOC_ID 4
+
+#define SHARD_OK 0
+#define SHARD_INVALID 1
+#define SHARD_FAILED 2
+
+/**
+ * A growable byte buffer holding a frame being built.
+ */
+struct Buffer {
+    unsigned char *data;
+    size_t len;
+    size_t cap;
+};
+
+typedef struct Buffer Buffer;
+
+/**
+ * Grows the buffer to hold at least the given number of bytes. Returns 1 on
+ * success and 0 if memory allocation fails.
+ */
+static int reserve(unsigned char **data, size_t *cap, size_t size) {
+    unsigned char *grown;
+    size_t n = *cap ? *cap : 256;
+
+    if (size <= *cap) {
+        return 1;
+    }
+    while (n < size) {
+        n *= 2;
+    }
+    if (!(grown = (unsigned char *) realloc(*data, n))) {
+        return 0;
+    }
+    *data = grown;
+    *cap = n;
+    return 1;
+}
+
+/**
+ * Appends bytes to the buffer. Returns 1 on success and 0 if memory
+ * allocation fails.
+ */
+static int append(Buffer *buffer, const void *bytes, size_t len) {
+    if (!reserve(&buffer->data, &buffer->cap, buffer->len + len)) {
+        return 0;
+    }
+    memcpy(buffer->data + buffer->len, bytes, len);
+    buffer->len += len;
+    return 1;
+}
+
+/**
+ * Returns the 32-bit FNV-1a hash of the string given as a (pointer, length)
+ * view.
+ */
+static unsigned int hash_name(const char *name, size_t len) {
+    unsigned int h = 2166136261u;
+
+    while (len-- > 0) {
+        h = (h ^ (unsigned char) *name++) * 16777619u;
+    }
+    return h;
+}
+
+/**
+ * The partition a worker serves: the documents whose filenames hash to its
+ * shard out of count.
+ */
+struct Partition {
+    unsigned int shard;
+    unsigned int count;
+};
+
+typedef struct Partition Partition;
+
+/**
+ * Returns one if the filename, given as a (pointer, length) view, belongs
+ * to the partition; zero otherwise. The argument is a Partition.
+ */
+static int owns_doc(const char *name, size_t len, void *arg) {
+    Partition *partition = (Partition *) arg;
+
+    return hash_name(name, len) % partition->count == partition->shard;
+}
+
+/**
+ * Writes all of the given bytes to the socket, without raising SIGPIPE if
+ * the other end has gone away. Returns 1 on success and 0 on failure.
+ */
+static int write_all(int fd, const unsigned char *data, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = send(fd, data, len, MSG_NOSIGNAL);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return 1;
+}
+
+/**
+ * Reads exactly the given number of bytes from the socket. Returns 1 on
+ * success and 0 at end of file or on failure.
+ */
+static int read_all(int fd, unsigned char *data, size_t len) {
+    ssize_t n;
+
+    while (len > 0) {
+        n = read(fd, data, len);
+        if (n < 0 && errno == EINTR) {
+            continue;
+        }
+        else if (n <= 0) {
+            return 0;
+        }
+        data += n;
+        len -= (size_t) n;
+    }
+    return 1;
+}
+
+/**
+ * Reads one whole frame's payload from the socket into the buffer. Returns 1
+ * on success and 0 at end of file or on failure.
+ */
+static int read_frame(int fd, Buffer *buffer) {
+    unsigned int len;
+
+    if (!read_all(fd, (unsigned char *) &len, FRAME_HEADER)
+            || !reserve(&buffer->data, &buffer->cap, len ? len : 1)) {
+        return 0;
+    }
+    buffer->len = len;
+    return read_all(fd, buffer->data, len);
+}
+
+/**
+ * Starts a reply frame in the buffer, leaving its length to be filled in.
+ */
+static int begin_reply(Buffer *buffer, unsigned int seq, unsigned int status,
+        unsigned long long count) {
+    unsigned int len = 0;
+
+    buffer->len = 0;
+    return append(buffer, &len, sizeof(len))
+        && append(buffer, &seq, sizeof(seq))
+        && append(buffer, &status, sizeof(status))
+        && append(buffer, &count, sizeof(count));
+}
+
+/**
+ * Fills in the length of the frame in the buffer and sends it. Returns 1 on
+ * success and 0 on failure.
+ */
+static int send_frame(int fd, Buffer *buffer) {
+    unsigned int len = (unsigned int) (buffer->len - FRAME_HEADER);
+
+    memcpy(buffer->data, &len, sizeof(len));
+    return write_all(fd, buffer->data, buffer->len);
+}
+
+/**
+ * State for collecting a worker's resulting filenames into its reply, with
+ * the document ID each of the worker's documents has in the whole index and
+ * a buffer the filenames are decoded into.
+ */
+struct Collector {
+    Index *index;
+    const unsigned int *global;
+    char *name;
+    Buffer *reply;
+    int ok;
+};
+
+typedef struct Collector Collector;
+
+/**
+ * Appends the global document ID and the filename of a resulting document to
+ * the reply. The argument is a Collector.
+ */
+static void collect_doc(unsigned int doc, void *arg) {
+    Collector *collector = (Collector *) arg;
+    size_t len;
+
+    if (collector->ok) {
+        len = doc_name(collector->index, doc, collector->name);
+        collector->ok = append(collector->reply, &collector->global[doc],
+                DOC_ID) && append(collector->reply, collector->name, len + 1);
+    }
+}
+
+/**
+ * Answers one query line against the worker's partition, building the reply
+ * in the buffer. A shard cannot know how many of its files the others put
+ * ahead of the offset, so it returns its first offset + limit files and
+ * leaves skipping to the coordinator. Returns 1 on success and 0 if memory
+ * allocation fails.
+ */
+static int answer(Index *index, const unsigned int *global, const char *line,
+        size_t len, unsigned int seq, Buffer *reply) {
+    QueryPlan *plan = NULL;
+    Collector collector;
+    TokenizerT tk;
+    const char *first;
+    unsigned long long total;
+    size_t flen, count;
+
+    TKInit(&tk, " \t\n", line, len);
+    if (TKNextSlice(&tk, &first, &flen) && flen == 2 && first[0] == 's'
+            && (first[1] == 'a' || first[1] == 'o')) {
+        plan = plan_create(index, &tk, first[1] == 'a', 0, 0);
+    }
+    if (!plan) {
+        return begin_reply(reply, seq, SHARD_INVALID, 0);
+    }
+    if (plan->count_only) {
+        count = plan_count(plan);
+        plan_destroy(plan);
+        return begin_reply(reply, seq,
+                count == (size_t) -1 ? SHARD_FAILED : SHARD_OK, count);
+    }
+    if (plan->limit) {
+        plan->limit += plan->offset;
+    }
+    plan->offset = 0;
+
+    if (!begin_reply(reply, seq, SHARD_OK, 0)) {
+        plan_destroy(plan);
+        return 0;
+    }
+    collector.index = index;
+    collector.global = global;
+    collector.name = (char *) malloc(index->docs->maxlen + 1);
+    collector.reply = reply;
+    collector.ok = collector.name != NULL;
+    count = collector.ok ? plan_run(plan, collect_doc, &collector) : 0;
+    plan_destroy(plan);
+    free(collector.name);
+    if (count == (size_t) -1 || !collector.ok) {
+        return begin_reply(reply, seq, SHARD_FAILED, 0);
+    }
+    total = count;
+    memcpy(reply->data + FRAME_HEADER + 8, &total, sizeof(total));
+    return 1;
+}
+
+/**
+ * Body of a worker process: loads the documents of the index hashing to the
+ * given shard, skipping the postings of all others as the file is read,
+ * reports that it is ready and answers queries until the coordinator closes
+ * the socket. The kept documents' IDs in the whole index are recorded by the
+ * load, so that replies can be merged in the index's order, which need not
+ * be the order of the filenames. Returns the process's exit status.
+ */
+static int worker_main(char *path, int shard, int count, int fd) {
+    Index *index;
+    Partition partition;
+    Buffer request = {NULL, 0, 0}, reply = {NULL, 0, 0};
+    unsigned int seq, *global;
+    int ok;
+
+    partition.shard = (unsigned int) shard;
+    partition.count = (unsigned int) count;
+    index = parse_part(path, owns_doc, &partition, &global);
+    ok = index != NULL;
+    if (!begin_reply(&reply, 0, ok ? SHARD_OK : SHARD_FAILED,
+                ok ? (unsigned long long) index->ndocs : 0)
+            || !send_frame(fd, &reply) || !ok) {
+        if (index) {
+            destroy_index(index);
+        }
+        free(global);
+        free(reply.data);
+        return 1;
+    }
+
+    while (read_frame(fd, &request) && request.len >= REQUEST_HEADER) {
+        memcpy(&seq, request.data, sizeof(seq));
+        if (!answer(index, global, (const char *) request.data + REQUEST_HEADER,
+                    request.len - REQUEST_HEADER, seq, &reply)
+                || !send_frame(fd, &reply)) {
+            break;
+        }
+    }
+    destroy_index(index);
+    free(global);
+    free(request.data);
+    free(reply.data);
+    return 0;
+}
+
+/**
+ * Starts the given number of worker processes over the given index file and
+ * waits until each has loaded its partition. Returns a pointer to the new
+ * set, or NULL if any worker fails to start.
+ */
+ShardSet *shards_start(char *path, int count, int deadline_ms) {
+    ShardSet *set;
+    Buffer ready = {NULL, 0, 0};
+    unsigned int status;
+    unsigned long long ndocs;
+    int fds[2];
+    int i, j, ok;
+
+    if (count <= 0 || !(set = (ShardSet *) malloc(sizeof(ShardSet)))) {
+        return NULL;
+    }
+    else if (!(set->shards = (Shard *) calloc(count, sizeof(Shard)))) {
+        free(set);
+        return NULL;
+    }
+    set->count = 0;
+    set->deadline_ms = deadline_ms;
+    set->seq = 0;
+
+    // Flush so that the children do not repeat buffered output.
+    fflush(NULL);
+    for (i = 0; i < count; i++) {
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0) {
+            fprintf(stderr, "search: Could not create a shard socket.\n");
+            shards_stop(set);
+            return NULL;
+        }
+        set->shards[i].pid = fork();
+        if (set->shards[i].pid == 0) {
+            close(fds[0]);
+            for (j = 0; j < i; j++) {
+                close(set->shards[j].fd);
+            }
+            _exit(worker_main(path, i, count, fds[1]));
+        }
+        close(fds[1]);
+        if (set->shards[i].pid < 0) {
+            close(fds[0]);
+            fprintf(stderr, "search: Could not start shard %d.\n", i);
+            shards_stop(set);
+            return NULL;
+        }
+        set->shards[i].fd = fds[0];
+        set->count++;
+    }
+
+    // Wait for every worker to report its partition.
+    ok = 1;
+    for (i = 0; ok && i < count; i++) {
+        ok = read_frame(set->shards[i].fd, &ready)
+            && ready.len >= REPLY_HEADER;
+        if (ok) {
+            memcpy(&status, ready.data + 4, sizeof(status));
+            memcpy(&ndocs, ready.data + 8, sizeof(ndocs));
+            ok = status == SHARD_OK;
+            set->shards[i].ndocs = (size_t) ndocs;
+        }
+        if (!ok) {
+            fprintf(stderr, "search: Shard %d failed to load the index.\n", i);
+        }
+    }
+    free(ready.data);
+    if (!ok) {
+        shards_stop(set);
+        return NULL;
+    }
+    return set;
+}
+
+/**
+ * Stops the workers by closing their sockets, waits for them to exit and
+ * frees all associated memory.
+ */
+void shards_stop(ShardSet *set) {
+    int i;
+
+    if (!set) {
+        return;
+    }
+    for (i = 0; i < set->count; i++) {
+        if (set->shards[i].fd >= 0) {
+            close(set->shards[i].fd);
+        }
+    }
+    for (i = 0; i < set->count; i++) {
+        waitpid(set->shards[i].pid, NULL, 0);
+        free(set->shards[i].buffer);
+    }
+    free(set->shards);
+    free(set);
+}
+
+/**
+ * Closes the socket of a shard that has gone away, so it is no longer
+ * queried.
+ */
+static void drop_shard(ShardSet *set, int i) {
+    fprintf(stderr, "search: Shard %d stopped responding.\n", i);
+    close(set->shards[i].fd);
+    set->shards[i].fd = -1;
+}
+
+/**
+ * Returns the payload length of the whole frame at the start of the shard's
+ * buffer, or (size_t) -1 if it has not fully arrived yet.
+ */
+static size_t frame_ready(Shard *shard) {
+    unsigned int len;
+
+    if (shard->len < FRAME_HEADER) {
+        return (size_t) -1;
+    }
+    memcpy(&len, shard->buffer, sizeof(len));
+    return shard->len - FRAME_HEADER >= len ? len : (size_t) -1;
+}
+
+/**
+ * Removes the frame at the start of the shard's buffer.
+ */
+static void consume_frame(Shard *shard, size_t len) {
+    size_t n = FRAME_HEADER + len;
+
+    memmove(shard->buffer, shard->buffer + n, shard->len - n);
+    shard->len -= n;
+}
+
+/**
+ * Reads what has arrived on a shard's socket and checks whether the reply to
+ * the current query is complete, discarding replies to earlier queries that
+ * missed their deadline. Returns 1 on success and 0 if the shard is gone.
+ */
+static int receive(ShardSet *set, int i) {
+    Shard *shard = &set->shards[i];
+    unsigned int seq;
+    size_t len;
+    ssize_t n;
+
+    if (!reserve(&shard->buffer, &shard->cap, shard->len + 65536)) {
+        return 0;
+    }
+    n = read(shard->fd, shard->buffer + shard->len, shard->cap - shard->len);
+    if (n < 0 && errno == EINTR) {
+        return 1;
+    }
+    else if (n <= 0) {
+        return 0;
+    }
+    shard->len += (size_t) n;
+
+    while ((len = frame_ready(shard)) != (size_t) -1) {
+        if (len < REPLY_HEADER) {
+            return 0;
+        }
+        memcpy(&seq, shard->buffer + FRAME_HEADER, sizeof(seq));
+        if (seq == set->seq) {
+            shard->done = 1;
+            break;
+        }
+        consume_frame(shard, len);
+    }
+    return 1;
+}
+
+/**
+ * Sends the query to every live shard and collects their replies until all
+ * have answered or the deadline passes, warning about the shards that did
+ * not. Returns 1 on success and 0 if memory allocation fails.
+ */
+static int scatter(ShardSet *set, const char *line, size_t len) {
+    struct pollfd *fds;
+    unsigned char *request;
+    int *which;
+    unsigned int flen = (unsigned int) (REQUEST_HEADER + len);
+    double deadline;
+    int i, n, timeout;
+
+    fds = (struct pollfd *) malloc(set->count * sizeof(struct pollfd));
+    which = (int *) malloc(set->count * sizeof(int));
+    request = (unsigned char *) malloc(FRAME_HEADER + flen);
+    if (!fds || !which || !request) {
+        free(fds);
+        free(which);
+        free(request);
+        return 0;
+    }
+    set->seq++;
+    memcpy(request, &flen, sizeof(flen));
+    memcpy(request + FRAME_HEADER, &set->seq, sizeof(set->seq));
+    memcpy(request + FRAME_HEADER + REQUEST_HEADER, line, len);
+    for (i = 0; i < set->count; i++) {
+        set->shards[i].done = 0;
+        if (set->shards[i].fd >= 0 && !write_all(set->shards[i].fd, request,
+                    FRAME_HEADER + flen)) {
+            drop_shard(set, i);
+        }
+    }
+    free(request);
+
+    deadline = stats_now() + set->deadline_ms / 1000.0;
+    while (1) {
+        for (i = 0, n = 0; i < set->count; i++) {
+            if (set->shards[i].fd >= 0 && !set->shards[i].done) {
+                fds[n].fd = set->shards[i].fd;
+                fds[n].events = POLLIN;
+                fds[n].revents = 0;
+                which[n++] = i;
+            }
+        }
+        timeout = set->deadline_ms > 0
+            ? (int) ((deadline - stats_now()) * 1000.0 + 0.5) : -1;
+        if (n == 0 || (set->deadline_ms > 0 && timeout <= 0)) {
+            break;
+        }
+        else if (poll(fds, n, timeout) < 0 && errno != EINTR) {
+            break;
+        }
+        for (i = 0; i < n; i++) {
+            if (fds[i].revents && !receive(set, which[i])) {
+                drop_shard(set, which[i]);
+            }
+        }
+    }
+    free(fds);
+    free(which);
+
+    for (i = 0; i < set->count; i++) {
+        if (set->shards[i].fd >= 0 && !set->shards[i].done) {
+            fprintf(stderr, "search: Shard %d missed the deadline; "
+                    "the results are partial.\n", i);
+        }
+    }
+    return 1;
+}
+
+/**
+ * Sends a query line to every shard and merges the replies: counts are
+ * summed, and the filenames, which each shard returns in order of document
+ * ID, are merged by repeatedly taking the head with the smallest ID. Returns
+ * the number of matching documents or of filenames passed, or (size_t) -1
+ * if the query is invalid or an error occurs.
+ */
+size_t shards_query(ShardSet *set, const char *line, int *count_only,
+        NameFunc func, void *arg) {
+    QueryPlan flags;
+    TokenizerT tk;
+    const char *token, **names, **ends;
+    unsigned int status, id, best_id;
+    unsigned long long count;
+    size_t len, total, skipped, passed;
+    int i, best, ok;
+
+    if (!set || !line || !count_only) {
+        return (size_t) -1;
+    }
+
+    // Parse the flags here too, since the offset and limit apply to the
+    // merged result.
+    memset(&flags, 0, sizeof(flags));
+    TKInit(&tk, " \t\n", line, strlen(line));
+    if (!TKNextSlice(&tk, &token, &len) || len != 2 || token[0] != 's'
+            || (token[1] != 'a' && token[1] != 'o')
+            || !plan_parse_flags(&flags, &tk, &token, &len)) {
+        return (size_t) -1;
+    }
+    *count_only = flags.count_only;
+
+    names = (const char **) malloc(set->count * sizeof(const char *));
+    ends = (const char **) malloc(set->count * sizeof(const char *));
+    ok = names && ends && scatter(set, line, strlen(line));
+
+    // Check the replies and total their counts.
+    total = 0;
+    for (i = 0; ok && i < set->count; i++) {
+        names[i] = ends[i] = NULL;
+        if (!set->shards[i].done) {
+            continue;
+        }
+        memcpy(&status, set->shards[i].buffer + FRAME_HEADER + 4,
+                sizeof(status));
+        memcpy(&count, set->shards[i].buffer + FRAME_HEADER + 8,
+                sizeof(count));
+        ok = status == SHARD_OK;
+        total += (size_t) count;
+        names[i] = (const char *) set->shards[i].buffer + FRAME_HEADER
+            + REPLY_HEADER;
+        ends[i] = (const char *) set->shards[i].buffer + FRAME_HEADER
+            + frame_ready(&set->shards[i]);
+    }
+
+    // Merge the shards' sorted filenames, applying the offset and limit.
+    passed = 0;
+    if (ok && !flags.count_only) {
+        for (skipped = 0, best_id = 0; !flags.limit || passed < flags.limit; ) {
+            for (i = 0, best = -1; i < set->count; i++) {
+                if (names[i] && names[i] < ends[i]) {
+                    memcpy(&id, names[i], DOC_ID);
+                    if (best < 0 || id < best_id) {
+                        best = i;
+                        best_id = id;
+                    }
+                }
+            }
+            if (best < 0) {
+                break;
+            }
+            names[best] += DOC_ID;
+            if (skipped < flags.offset) {
+                skipped++;
+            }
+            else {
+                func(names[best], arg);
+                passed++;
+            }
+            names[best] += strlen(names[best]) + 1;
+        }
+        total = passed;
+    }
+
+    for (i = 0; i < set->count; i++) {
+        if (set->shards[i].done) {
+            consume_frame(&set->shards[i], frame_ready(&set->shards[i]));
+        }
+    }
+    free(names);
+    free(ends);
+    return ok ? total : (size_t) -1;
+}
@@ -0,0 +1,68 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <stddef.h>
+#include <sys/types.h>
+
+/**
+ * A worker process serving one partition of the documents, and the
+ * coordinator's end of the socket it is reached through. Replies are read
+ * into the buffer until a whole frame has arrived.
+ */
+struct Shard {
+    pid_t pid;
+    int fd;
+    size_t ndocs;
+    unsigned char *buffer;
+    size_t len;
+    size_t cap;
+    int done;
+};
+
+typedef struct Shard Shard;
+
+/**
+ * A set of shard workers queried together. Each query is tagged with a
+ * sequence number so that replies arriving after their deadline can be told
+ * apart from the reply to the current query. A deadline of zero waits for
+ * every shard.
+ */
+struct ShardSet {
+    Shard *shards;
+    int count;
+    int deadline_ms;
+    unsigned int seq;
+};
+
+typedef struct ShardSet ShardSet;
+
+/*
+ * Type of the function the coordinator passes each resulting filename to.
+ */
+typedef void (*NameFunc)(const char *, void *);
+
+/**
+ * Starts the given number of worker processes over the given index file.
+ * Each loads only the documents whose filenames hash to it, skipping the
+ * postings of the others. Returns a pointer to the new set once every
+ * worker is ready, or NULL if any of them fails to start.
+ */
+ShardSet *shards_start(char *, int, int);
+
+/**
+ * Stops the workers and frees all associated memory.
+ */
+void shards_stop(ShardSet *);
+
+/**
+ * Sends a query line (sa or so, flags and terms) to every shard and merges
+ * the replies. If the query only counts, the total is stored and the flag
+ * set; otherwise the resulting filenames, in order and after applying the
+ * query's offset and limit, are passed to the given function. Returns the
+ * number of matching documents or of filenames passed, or (size_t) -1 if the
+ * query is invalid or an error occurs. Shards missing the deadline are left
+ * out of the result with a warning.
+ */
+size_t shards_query(ShardSet *, const char *, int *, NameFunc, void *);
+
+#endif
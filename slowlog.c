@@ -0,0 +1,249 @@
+#include "slowlog.h"
+#include <errno.h>
+#include <stdarg.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/**
+ * Appends formatted text to a record, truncating it at the given capacity.
+ */
+static void append(char *text, size_t cap, size_t *len, const char *format,
+        ...) {
+    va_list args;
+    int n;
+
+    if (*len >= cap) {
+        return;
+    }
+    va_start(args, format);
+    n = vsnprintf(text + *len, cap - *len, format, args);
+    va_end(args);
+    if (n > 0) {
+        *len += (size_t) n < cap - *len ? (size_t) n : cap - *len - 1;
+    }
+}
+
+/**
+ * Formats a query's record into an entry: a comment line with its latency
+ * split into stages and its result size, one with its plan's cost and the
+ * postings size of each term in query order, then the query line. The
+ * comments are cut short, never the line, if the entry runs out of room.
+ */
+static void format_record(SlowEntry *entry, const char *line,
+        const QueryPlan *plan, const QueryTrace *trace, int slow) {
+    size_t linelen = strcspn(line, "\n"), cap;
+    int i;
+
+    linelen = linelen < SLOWLOG_ENTRY_SIZE / 2 ? linelen
+        : SLOWLOG_ENTRY_SIZE / 2;
+    cap = SLOWLOG_ENTRY_SIZE - linelen - 2;
+    entry->len = 0;
+    append(entry->text, cap, &entry->len, "# %s query at %ld: %.3f ms "
+            "(plan %.3f ms, evaluation %.3f ms), %lu results%s\n",
+            slow ? "slow" : "sampled", (long) time(NULL),
+            (trace->finished - trace->arrival) * 1e3,
+            (trace->planned - trace->arrival) * 1e3,
+            (trace->finished - trace->planned) * 1e3,
+            (unsigned long) trace->results,
+            plan && plan->truncated ? ", stopped early" : "");
+    if (plan) {
+        append(entry->text, cap, &entry->len, "# %d terms in %d sets, "
+                "estimated cost %lu, postings:", plan->nterms, plan->nsets,
+                (unsigned long) plan_cost(plan));
+        for (i = 0; i < plan->nterms; i++) {
+            append(entry->text, cap, &entry->len, " %lu",
+                    (unsigned long) plan->sizes[i]);
+        }
+        if (entry->len == cap - 1) {
+            entry->text[entry->len - 1] = '\n';
+        }
+        else {
+            append(entry->text, cap, &entry->len, "\n");
+        }
+    }
+    memcpy(entry->text + entry->len, line, linelen);
+    entry->len += linelen;
+    entry->text[entry->len++] = '\n';
+}
+
+/**
+ * Moves the full log file aside to <file>.1, replacing any older one, and
+ * starts a new one. Logging stops if the new file cannot be opened.
+ */
+static void rotate(SlowLog *log) {
+    char *rotated;
+
+    fclose(log->file);
+    if ((rotated = (char *) malloc(strlen(log->path) + 3)) != NULL) {
+        sprintf(rotated, "%s.1", log->path);
+        rename(log->path, rotated);
+        free(rotated);
+    }
+    if (!(log->file = fopen(log->path, "a"))) {
+        fprintf(stderr, "search: Could not reopen slow-query log '%s'.\n",
+                log->path);
+    }
+    log->written = 0;
+}
+
+/**
+ * Runs the writer: each time a record is published, appends every ready
+ * record to the file in ring order and hands its slot back to the
+ * producers, then flushes. Exits once the log is stopping and the ring has
+ * been drained. The argument is the SlowLog.
+ */
+static void *write_records(void *arg) {
+    SlowLog *log = (SlowLog *) arg;
+    SlowEntry *entry;
+
+    while (1) {
+        while (sem_wait(&log->ready) != 0 && errno == EINTR)
+            ;
+        while (1) {
+            entry = &log->ring[log->tail & (SLOWLOG_RING_SIZE - 1)];
+            if (atomic_load_explicit(&entry->sequence, memory_order_acquire)
+                    != log->tail + 1) {
+                break;
+            }
+            if (log->file && log->written > 0
+                    && log->written + (long) entry->len > SLOWLOG_MAX_BYTES) {
+                rotate(log);
+            }
+            if (log->file) {
+                fwrite(entry->text, 1, entry->len, log->file);
+                log->written += (long) entry->len;
+            }
+            atomic_store_explicit(&entry->sequence,
+                    log->tail + SLOWLOG_RING_SIZE, memory_order_release);
+            log->tail++;
+        }
+        if (log->file) {
+            fflush(log->file);
+        }
+        if (atomic_load(&log->stopping)) {
+            return NULL;
+        }
+    }
+}
+
+/**
+ * Creates a log appending to the given file and starts its writer. Returns
+ * a pointer to the new log, or NULL if the file cannot be opened or the
+ * writer started.
+ */
+SlowLog *slowlog_create(const char *path, double threshold_ms,
+        unsigned long sample) {
+    SlowLog *log;
+    size_t i;
+
+    if (!path || !(log = (SlowLog *) calloc(1, sizeof(SlowLog)))) {
+        return NULL;
+    }
+    log->ring = (SlowEntry *) malloc(SLOWLOG_RING_SIZE * sizeof(SlowEntry));
+    log->path = (char *) malloc(strlen(path) + 1);
+    if (!log->ring || !log->path || !(log->file = fopen(path, "a"))) {
+        fprintf(stderr, "search: Could not open slow-query log '%s'.\n", path);
+        free(log->ring);
+        free(log->path);
+        free(log);
+        return NULL;
+    }
+    strcpy(log->path, path);
+    fseek(log->file, 0, SEEK_END);
+    log->written = ftell(log->file);
+    for (i = 0; i < SLOWLOG_RING_SIZE; i++) {
+        atomic_init(&log->ring[i].sequence, i);
+    }
+    atomic_init(&log->head, 0);
+    atomic_init(&log->stopping, 0);
+    atomic_init(&log->seen, 0);
+    atomic_init(&log->dropped, 0);
+    log->threshold = threshold_ms / 1e3;
+    log->sample = sample;
+    sem_init(&log->ready, 0, 0);
+    if (pthread_create(&log->writer, NULL, write_records, log) != 0) {
+        fprintf(stderr, "search: Could not start the slow-query log.\n");
+        sem_destroy(&log->ready);
+        fclose(log->file);
+        free(log->ring);
+        free(log->path);
+        free(log);
+        return NULL;
+    }
+    return log;
+}
+
+/**
+ * Stops the writer once it has drained the ring, reports any dropped
+ * records on standard error and destroys the log.
+ */
+void slowlog_destroy(SlowLog *log) {
+    if (!log) {
+        return;
+    }
+    atomic_store(&log->stopping, 1);
+    sem_post(&log->ready);
+    pthread_join(log->writer, NULL);
+    if (atomic_load(&log->dropped) > 0) {
+        fprintf(stderr, "Slow-query log: dropped %lu records.\n",
+                atomic_load(&log->dropped));
+    }
+    if (log->file) {
+        fclose(log->file);
+    }
+    sem_destroy(&log->ready);
+    free(log->ring);
+    free(log->path);
+    free(log);
+}
+
+/**
+ * Records a query if it is slow or sampled. A producer claims the slot at
+ * the write position by advancing it with a compare-and-swap, formats the
+ * record in place, publishes it by bumping the slot's sequence number and
+ * wakes the writer. If the writer has not yet freed the slot, the ring is
+ * full and the record is dropped. Returns 1 if the query was recorded and 0
+ * otherwise.
+ */
+int slowlog_note(SlowLog *log, const char *line, const QueryPlan *plan,
+        const QueryTrace *trace) {
+    SlowEntry *entry;
+    size_t pos, sequence;
+    unsigned long n;
+    int slow;
+
+    if (!log || !line || !trace) {
+        return 0;
+    }
+    n = atomic_fetch_add(&log->seen, 1) + 1;
+    slow = trace->finished - trace->arrival >= log->threshold;
+    if (!slow && (log->sample == 0 || n % log->sample != 0)) {
+        return 0;
+    }
+
+    pos = atomic_load_explicit(&log->head, memory_order_relaxed);
+    while (1) {
+        entry = &log->ring[pos & (SLOWLOG_RING_SIZE - 1)];
+        sequence = atomic_load_explicit(&entry->sequence,
+                memory_order_acquire);
+        if (sequence == pos) {
+            if (atomic_compare_exchange_weak_explicit(&log->head, &pos,
+                        pos + 1, memory_order_relaxed,
+                        memory_order_relaxed)) {
+                break;
+            }
+        }
+        else if (sequence < pos) {
+            atomic_fetch_add(&log->dropped, 1);
+            return 0;
+        }
+        else {
+            pos = atomic_load_explicit(&log->head, memory_order_relaxed);
+        }
+    }
+    format_record(entry, line, plan, trace, slow);
+    atomic_store_explicit(&entry->sequence, pos + 1, memory_order_release);
+    sem_post(&log->ready);
+    return 1;
+}
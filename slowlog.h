@@ -0,0 +1,99 @@
+#ifndef SLOWLOG_H
+#define SLOWLOG_H
+
+#include "engine.h"
+#include <pthread.h>
+#include <semaphore.h>
+#include <stdatomic.h>
+#include <stdio.h>
+
+/*
+ * Number of entries in the ring between the querying threads and the
+ * writer (a power of two), and the most bytes one entry holds.
+ */
+#define SLOWLOG_RING_SIZE 256
+#define SLOWLOG_ENTRY_SIZE 2048
+
+/*
+ * Size at which the log file is rotated to <file>.1, and the latency
+ * threshold used when none is given.
+ */
+#define SLOWLOG_MAX_BYTES (16L << 20)
+#define SLOWLOG_DEFAULT_MS 100
+
+/**
+ * One formatted record in the ring. Its sequence number says whose turn it
+ * is: it equals the write position when the slot is free for a producer,
+ * and one more than that once the record is ready for the writer.
+ */
+struct SlowEntry {
+    atomic_size_t sequence;
+    size_t len;
+    char text[SLOWLOG_ENTRY_SIZE];
+};
+
+typedef struct SlowEntry SlowEntry;
+
+/**
+ * The timings and size of one query, all times in stats_now seconds: when
+ * its line was read, when its plan was built and when it was answered.
+ */
+struct QueryTrace {
+    double arrival;
+    double planned;
+    double finished;
+    size_t results;
+};
+
+typedef struct QueryTrace QueryTrace;
+
+/**
+ * A slow-query log. Querying threads format the records of queries over the
+ * latency threshold, and every sampled query, into a bounded ring without
+ * taking a lock, and a writer thread appends them to the log file, so a
+ * query never waits on I/O. When the ring is full a record is dropped
+ * rather than waited for. Each record is comment lines starting with '#'
+ * followed by the query line itself, so a log can be replayed as the input
+ * of batch mode.
+ */
+struct SlowLog {
+    SlowEntry *ring;
+    atomic_size_t head;
+    size_t tail;
+    sem_t ready;
+    atomic_int stopping;
+    pthread_t writer;
+    FILE *file;
+    char *path;
+    long written;
+    double threshold;
+    unsigned long sample;
+    atomic_ulong seen;
+    atomic_ulong dropped;
+};
+
+typedef struct SlowLog SlowLog;
+
+/**
+ * Creates a log appending to the given file the queries slower than the
+ * given number of milliseconds, plus one in every sample queries (zero for
+ * none), and starts its writer. Returns a pointer to the new log, or NULL
+ * if the call fails.
+ */
+SlowLog *slowlog_create(const char *, double, unsigned long);
+
+/**
+ * Writes out the records still in the ring, stops the writer and destroys
+ * the log, freeing all associated memory.
+ */
+void slowlog_destroy(SlowLog *);
+
+/**
+ * Records a query, given by its line, its plan (NULL if it had none) and
+ * its trace, if it is slow or sampled. Never blocks. Returns 1 if the query
+ * was recorded and 0 otherwise.
+ */
+int slowlog_note(SlowLog *, const char *, const QueryPlan *,
+        const QueryTrace *);
+
+#endif
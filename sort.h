@@ -0,0 +1,129 @@
+#ifndef SORT_H
+#define SORT_H
+
+#include <stddef.h>
+
+/*
+ * Ranges of at most this many elements are finished by insertion sort.
+ */
+#define SORT_INSERTION_SIZE 16
+
+/**
+ * Defines static void name(T *items, size_t n), which sorts an array of n
+ * elements of type T in increasing order. LESS(a, b) is an expression or
+ * macro taking two pointers to elements and returning nonzero if the first
+ * sorts strictly before the second; it is expanded in place, so unlike
+ * qsort's comparator it costs no indirect call and can be inlined. The sort
+ * is an introsort: quicksort with a median-of-three pivot and Hoare
+ * partitioning, switching to heapsort past a depth of twice the log of n, and
+ * insertion sort on short ranges. It is not stable. The helpers it defines
+ * are named name_insertion, name_swap, name_sift, name_heap and
+ * name_intro.
+ */
+#define DEFINE_SORT(name, T, LESS)                                          \
+static void name##_insertion(T *items, size_t n) {                          \
+    size_t i, j;                                                            \
+    T item;                                                                 \
+                                                                            \
+    for (i = 1; i < n; i++) {                                               \
+        item = items[i];                                                    \
+        for (j = i; j > 0 && LESS(&item, &items[j - 1]); j--) {             \
+            items[j] = items[j - 1];                                        \
+        }                                                                   \
+        items[j] = item;                                                    \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static void name##_swap(T *items, size_t a, size_t b) {                     \
+    T item = items[a];                                                      \
+                                                                            \
+    items[a] = items[b];                                                    \
+    items[b] = item;                                                        \
+}                                                                           \
+                                                                            \
+static void name##_sift(T *items, size_t n, size_t i) {                     \
+    size_t child;                                                           \
+    T item = items[i];                                                      \
+                                                                            \
+    while ((child = 2 * i + 1) < n) {                                       \
+        if (child + 1 < n && LESS(&items[child], &items[child + 1])) {      \
+            child++;                                                        \
+        }                                                                   \
+        if (!LESS(&item, &items[child])) {                                  \
+            break;                                                          \
+        }                                                                   \
+        items[i] = items[child];                                            \
+        i = child;                                                          \
+    }                                                                       \
+    items[i] = item;                                                        \
+}                                                                           \
+                                                                            \
+static void name##_heap(T *items, size_t n) {                               \
+    size_t i;                                                               \
+                                                                            \
+    for (i = n / 2; i > 0; i--) {                                           \
+        name##_sift(items, n, i - 1);                                       \
+    }                                                                       \
+    for (i = n; i > 1; i--) {                                               \
+        name##_swap(items, 0, i - 1);                                       \
+        name##_sift(items, i - 1, 0);                                       \
+    }                                                                       \
+}                                                                           \
+                                                                            \
+static void name##_intro(T *items, size_t n, int depth) {                   \
+    size_t i, j, mid;                                                       \
+    T pivot;                                                                \
+                                                                            \
+    while (n > SORT_INSERTION_SIZE) {                                       \
+        if (depth-- == 0) {                                                 \
+            name##_heap(items, n);                                          \
+            return;                                                         \
+        }                                                                   \
+        mid = n / 2;                                                        \
+        if (LESS(&items[mid], &items[0])) {                                 \
+            name##_swap(items, 0, mid);                                     \
+        }                                                                   \
+        if (LESS(&items[n - 1], &items[mid])) {                             \
+            name##_swap(items, mid, n - 1);                                 \
+            if (LESS(&items[mid], &items[0])) {                             \
+                name##_swap(items, 0, mid);                                 \
+            }                                                               \
+        }                                                                   \
+        pivot = items[mid];                                                 \
+        for (i = 0, j = n - 1; ; i++, j--) {                                \
+            while (LESS(&items[i], &pivot)) {                               \
+                i++;                                                        \
+            }                                                               \
+            while (LESS(&pivot, &items[j])) {                               \
+                j--;                                                        \
+            }                                                               \
+            if (i >= j) {                                                   \
+                break;                                                      \
+            }                                                               \
+            name##_swap(items, i, j);                                       \
+        }                                                                   \
+        /* Recurse into the smaller side and loop on the larger. */         \
+        if (j + 1 < n - j - 1) {                                            \
+            name##_intro(items, j + 1, depth);                              \
+            items += j + 1;                                                 \
+            n -= j + 1;                                                     \
+        }                                                                   \
+        else {                                                              \
+            name##_intro(items + j + 1, n - j - 1, depth);                  \
+            n = j + 1;                                                      \
+        }                                                                   \
+    }                                                                       \
+    name##_insertion(items, n);                                             \
+}                                                                           \
+                                                                            \
+static void name(T *items, size_t n) {                                      \
+    size_t m;                                                               \
+    int depth = 0;                                                          \
+                                                                            \
+    for (m = n; m > 1; m >>= 1) {                                           \
+        depth += 2;                                                         \
+    }                                                                       \
+    name##_intro(items, n, depth);                                          \
+}
+
+#endif
@@ -2,6 +2,7 @@
 #include "record.h"
 #include "sorted-list.h"
 #include <stdlib.h>
+#include <string.h>
 
 /*
  * Creates a new sorted list of size zero. Returns a new sorted list object on
@@ -48,99 +49,56 @@ void sl_destroy(SortedList *list) {
  * then it returns 0.
  */
 int sl_putrecord(SortedList *list, const char *token, const char *filename) {
+    return sl_putrecord_n(list, token, strlen(token), filename,
+            strlen(filename));
+}
+
+/*
+ * Inserts a (token, filename) pair given as (pointer, length) views. If a
+ * record for the pair already exists its hit count is incremented; otherwise a
+ * new record is created in sorted position. The key is compared in place, so
+ * nothing is copied unless a new record is needed. The list must be ordered by
+ * reccmp. Returns 1 on success and 0 on failure or if the list pointer is NULL.
+ */
+int sl_putrecord_n(SortedList *list, const char *token, size_t toklen,
+        const char *filename, size_t fnamelen) {
     Node *new, *ptr, *prev;
-    Record *record, *temp;
-    int c, retval;
+    Record *record;
+    int c;
 
-    temp = create_record(token, filename, 1);
-    if (!list || !temp) {
-        retval = 0;
+    if (!list) {
+        return 0;
     }
-    else if (!list->head) {
-        // First item added to the list. Create a new node
-        record = create_record(token, filename, 1);
-        new = create_node(record, NULL);
-        if (record && new) {
-            list->head = new;
-            retval = 1;
+
+    // Find a match or a place to insert
+    prev = NULL;
+    for (ptr = list->head; ptr; prev = ptr, ptr = ptr->next) {
+        c = reckeycmp(token, toklen, filename, fnamelen, (Record *) ptr->data);
+        if (c == 0) {
+            // Match - update record!
+            ((Record *) ptr->data)->hits++;
+            return 1;
         }
-        else {
-            free(temp);
-            free(record);
-            free(new);
-            retval = 0;
+        else if (c < 0) {
+            // Node should be inserted in here.
+            break;
         }
     }
-    else if ((c = list->compare(temp, (Record *) list->head->data)) <= 0) {
-        if (c < 0) {
-            // Belongs at the head of the list
-            record = create_record(token, filename, 1);
-            new = create_node(record, list->head);
-            if (record && new) {
-                list->head = new;
-                retval = 1;
-            }
-            else {
-                free(temp);
-                free(record);
-                free(new);
-                retval = 0;
-            }
-        }
-        else {
-            // Match - update record!
-            free(temp);
-            temp = (Record *) list->head->data;
-            temp->hits++;
-            retval = 1;
-        }
+
+    record = create_record_n(token, toklen, filename, fnamelen, 1);
+    new = create_node(record, ptr);
+    if (!record || !new) {
+        destroy_record(record);
+        free(new);
+        return 0;
+    }
+    else if (prev) {
+        prev->next = new;
     }
     else {
-        // Find a match or a place to insert
-        ptr = list->head;
-        prev = NULL;
-        for (; ptr; prev = ptr, ptr = ptr->next) {
-            c = list->compare(temp, ptr->data);
-            if (c == 0) {
-                // Update this node and we're done.
-                free(temp);
-                temp = (Record *) ptr->data;
-                temp->hits++;
-                return 1;
-            }
-            else if (c < 0) {
-                // Node should be inserted in here.
-                record = create_record(token, filename, 1);
-                new = create_node(record, ptr);
-                if (record && new) {
-                    prev->next = new;
-                    return 1;
-                }
-                else {
-                    free(temp);
-                    free(record);
-                    free(new);
-                    return 0;
-                }
-            }
-        }
-
-        // The item belongs at the end of the list.
-        record = create_record(token, filename, 1);
-        new = create_node(record, NULL);
-        if (record && new) {
-            prev->next = new;
-            retval = 1;
-        }
-        else {
-            free(temp);
-            free(record);
-            free(new);
-            retval = 0;
-        }
+        list->head = new;
     }
-
-    return retval;
+    return 1;
 }
 
 /*
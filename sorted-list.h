@@ -38,6 +38,12 @@ void sl_destroy(SortedList *);
  */
 int sl_putrecord(SortedList *, const char *, const char *);
 
+/**
+ * Inserts a record for a token and filename given as (pointer, length) views,
+ * which need not be null-terminated, maintaining sorted order.
+ */
+int sl_putrecord_n(SortedList *, const char *, size_t, const char *, size_t);
+
 /*
  * Iterator type for user to "walk" through the list item by item, from
  * beginning to end.
@@ -0,0 +1,282 @@
+#include "dict.h"
+#include "docset.h"
+#include "inverted-index.h"
+#include "record.h"
+#include "sorted-list.h"
+#include "stats.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#define HISTOGRAM_SIZE 24
+
+/**
+ * A term together with the length of its postings list.
+ */
+struct TermCount {
+    char *token;
+    long count;
+};
+
+typedef struct TermCount TermCount;
+
+/**
+ * Returns the current value of a monotonic clock, in seconds.
+ */
+double stats_now(void) {
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec / 1e9;
+}
+
+/**
+ * Prints the per-phase load timings to the given stream. Whatever part of the
+ * total is not attributed to a phase is reported as "other".
+ */
+void print_load_stats(FILE *out, LoadStats *stats) {
+    double other;
+
+    if (!stats) {
+        return;
+    }
+    other = stats->total - stats->io - stats->tokenize - stats->insert
+        - stats->freeze;
+    fprintf(out, "Load time:      %.3f s (%ld lines, %ld bytes)\n",
+            stats->total, stats->lines, stats->bytes);
+    fprintf(out, "  I/O:          %.3f s\n", stats->io);
+    fprintf(out, "  tokenize:     %.3f s\n", stats->tokenize);
+    fprintf(out, "  insert:       %.3f s\n", stats->insert);
+    fprintf(out, "  freeze:       %.3f s\n", stats->freeze);
+    fprintf(out, "  other:        %.3f s\n", other > 0 ? other : 0.0);
+    if (stats->total > 0) {
+        fprintf(out, "  throughput:   %.1f MB/s\n",
+                stats->bytes / stats->total / 1e6);
+    }
+}
+
+/**
+ * Totals gathered while walking the postings lists of an index.
+ */
+struct Summary {
+    long terms;
+    long postings;
+    long buckets[36][2];
+    long histogram[HISTOGRAM_SIZE];
+    TermCount *top;
+    int topn;
+};
+
+typedef struct Summary Summary;
+
+/**
+ * Returns the histogram slot for a postings list of the given length: slot k
+ * holds lengths in [2^k, 2^(k+1)).
+ */
+static int histogram_slot(long count) {
+    int slot = 0;
+
+    while (count > 1 && slot < HISTOGRAM_SIZE - 1) {
+        count >>= 1;
+        slot++;
+    }
+    return slot;
+}
+
+/**
+ * Records one postings list of the given length: its bucket, its histogram
+ * slot and, if it is among the largest seen so far, its place in the top-N
+ * table, which is kept sorted by descending count and owns copies of its
+ * tokens.
+ */
+static void summarize_list(Summary *summary, const char *token, long count) {
+    TermCount *top = summary->top;
+    char *copy;
+    int i, h, n = summary->topn;
+
+    summary->terms++;
+    summary->postings += count;
+    summary->histogram[histogram_slot(count)]++;
+    if ((h = hash(token)) != -1) {
+        summary->buckets[h][0]++;
+        summary->buckets[h][1] += count;
+    }
+
+    if (n <= 0 || count <= top[n - 1].count
+            || !(copy = (char *) malloc(strlen(token) + 1))) {
+        return;
+    }
+    strcpy(copy, token);
+    free(top[n - 1].token);
+    for (i = n - 1; i > 0 && top[i - 1].count < count; i--) {
+        top[i] = top[i - 1];
+    }
+    top[i].token = copy;
+    top[i].count = count;
+}
+
+/**
+ * Walks an index that is still in its build-time form. Records are sorted by
+ * token, so each run of equal tokens is one postings list. Returns the
+ * estimated number of bytes used by the lists.
+ */
+static long summarize_lists(Summary *summary, Index *index) {
+    SortedListIterator *iterator;
+    Record *record;
+    const char *current;
+    long run, bytes;
+    int i;
+
+    bytes = 0;
+    for (i = 0; i < 36; i++) {
+        if (!index->lists[i] || !(iterator = create_iter(index->lists[i]))) {
+            continue;
+        }
+        current = NULL;
+        run = 0;
+        while ((record = next_item(iterator)) != NULL) {
+            if (current && strcmp(current, record->token) != 0) {
+                summarize_list(summary, current, run);
+                run = 0;
+            }
+            current = record->token;
+            run++;
+            bytes += sizeof(Node) + sizeof(Record)
+                + strlen(record->token) + 1 + strlen(record->filename) + 1;
+        }
+        if (current) {
+            summarize_list(summary, current, run);
+        }
+        destroy_iter(iterator);
+    }
+    return bytes;
+}
+
+/**
+ * Walks a frozen index through its term dictionary, printing how its memory
+ * is split between the dictionary, the postings, the prebuilt sets and the
+ * document table.
+ * Returns the total number of bytes.
+ */
+static long summarize_frozen(FILE *out, Summary *summary, Index *index) {
+    DictIterator *iterator;
+    const char *term;
+    long term_bytes, postings_bytes, doc_bytes, dense_bytes, pair_bytes;
+    int i, ndense;
+
+    if ((iterator = dict_iter_create(index->terms, 0)) != NULL) {
+        while ((term = dict_iter_next(iterator, NULL)) != NULL) {
+            i = iterator->ordinal;
+            summarize_list(summary, term,
+                    index->offsets[i + 1] - index->offsets[i]);
+        }
+        dict_iter_destroy(iterator);
+    }
+
+    term_bytes = (long) dict_bytes(index->terms);
+    postings_bytes = (index->terms->count + 1) * sizeof(size_t);
+    if (index->cold) {
+        postings_bytes += index->cold->resident + index->terms->count
+            * (sizeof(ColdEntry) + sizeof(unsigned long long));
+    }
+    else {
+        postings_bytes += summary->postings * sizeof(unsigned int);
+    }
+    dense_bytes = ndense = 0;
+    for (i = 0; index->dense && i < index->terms->count; i++) {
+        if (index->dense[i]) {
+            dense_bytes += docset_bytes(index->dense[i]);
+            ndense++;
+        }
+    }
+    pair_bytes = index->npairs * sizeof(PairSet);
+    for (i = 0; i < index->npairs; i++) {
+        pair_bytes += docset_bytes(index->pairs[i].docs);
+    }
+    doc_bytes = (long) dict_bytes(index->docs);
+    for (i = 0; index->names && i < index->ndocs; i++) {
+        doc_bytes += sizeof(char *) + strlen(index->names[i]) + 1;
+    }
+    fprintf(out, "Documents:      %d\n", index->ndocs);
+    fprintf(out, "Dictionary:     %ld bytes (%.1f bytes/term)\n", term_bytes,
+            summary->terms > 0 ? (double) term_bytes / summary->terms : 0.0);
+    fprintf(out, "  term filter:  %lu bytes\n",
+            (unsigned long) bloom_bytes(index->terms->filter));
+    fprintf(out, "Postings data:  %ld bytes\n", postings_bytes);
+    if (index->cold) {
+        fprintf(out, "Cold postings:  %lu of %lu bytes cached, %lu hits, "
+                "%lu misses, %lu evictions\n",
+                (unsigned long) index->cold->resident,
+                (unsigned long) index->cold->budget, index->cold->hits,
+                index->cold->misses, index->cold->evictions);
+    }
+    fprintf(out, "Dense sets:     %ld bytes (%d terms)\n", dense_bytes, ndense);
+    if (index->npairs > 0) {
+        fprintf(out, "Pair sets:      %ld bytes (%d pairs)\n", pair_bytes,
+                index->npairs);
+    }
+    fprintf(out, "Document table: %ld bytes (%.1f bytes/file)\n", doc_bytes,
+            index->ndocs > 0 ? (double) doc_bytes / index->ndocs : 0.0);
+    return term_bytes + postings_bytes + dense_bytes + pair_bytes + doc_bytes;
+}
+
+/**
+ * Walks the index and prints term, postings and memory statistics to the
+ * given stream. Memory is estimated from the structures the index allocates,
+ * not counting allocator overhead.
+ */
+void print_index_stats(FILE *out, Index *index, int topn) {
+    Summary summary;
+    long bytes;
+    int i;
+
+    if (!index) {
+        return;
+    }
+    memset(&summary, 0, sizeof(summary));
+    summary.topn = topn > 0 ? topn : 0;
+    summary.top = (TermCount *) calloc(summary.topn + 1, sizeof(TermCount));
+    if (!summary.top) {
+        fprintf(stderr, "An error occurred during memory allocation.\n");
+        return;
+    }
+
+    if (index->terms) {
+        bytes = summarize_frozen(out, &summary, index);
+    }
+    else {
+        bytes = summarize_lists(&summary, index);
+    }
+
+    fprintf(out, "Bucket distribution (terms / postings):\n");
+    for (i = 0; i < 36; i++) {
+        fprintf(out, "  %c: %8ld / %ld\n", i < 26 ? 'a' + i : '0' + i - 26,
+                summary.buckets[i][0], summary.buckets[i][1]);
+    }
+
+    fprintf(out, "Distinct terms: %ld\n", summary.terms);
+    fprintf(out, "Postings:       %ld\n", summary.postings);
+    fprintf(out, "Memory:         %ld bytes (%.1f bytes/posting)\n", bytes,
+            summary.postings > 0 ? (double) bytes / summary.postings : 0.0);
+
+    fprintf(out, "Postings list lengths:\n");
+    for (i = 0; i < HISTOGRAM_SIZE; i++) {
+        if (summary.histogram[i] > 0) {
+            fprintf(out, "  [%ld, %ld): %ld\n", 1L << i, 1L << (i + 1),
+                    summary.histogram[i]);
+        }
+    }
+
+    if (summary.topn > 0 && summary.top[0].token) {
+        fprintf(out, "Largest postings lists:\n");
+        for (i = 0; i < summary.topn && summary.top[i].token; i++) {
+            fprintf(out, "  %-24s %ld\n", summary.top[i].token,
+                    summary.top[i].count);
+        }
+    }
+    for (i = 0; i < summary.topn; i++) {
+        free(summary.top[i].token);
+    }
+    free(summary.top);
+}
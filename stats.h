@@ -0,0 +1,39 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include "inverted-index.h"
+#include <stdio.h>
+
+/**
+ * Timings and counters collected while loading an index. All times are in
+ * seconds.
+ */
+struct LoadStats {
+    double io;
+    double tokenize;
+    double insert;
+    double freeze;
+    double total;
+    long lines;
+    long bytes;
+};
+
+typedef struct LoadStats LoadStats;
+
+/**
+ * Returns the current value of a monotonic clock, in seconds.
+ */
+double stats_now(void);
+
+/**
+ * Prints the per-phase load timings to the given stream.
+ */
+void print_load_stats(FILE *, LoadStats *);
+
+/**
+ * Walks the index and prints term, postings and memory statistics to the
+ * given stream, including the given number of largest postings lists.
+ */
+void print_index_stats(FILE *, Index *, int);
+
+#endif
@@ -0,0 +1,389 @@
+#include "stream.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_ZSTD
+#include <zstd.h>
+#endif
+
+#define STREAM_BLOCK_SIZE (1 << 20)
+#define STREAM_INPUT_SIZE (1 << 18)
+
+/**
+ * Reads from a file descriptor, retrying if the call is interrupted.
+ */
+static ssize_t read_fully(int fd, void *buf, size_t len) {
+    ssize_t nread;
+
+    do {
+        nread = read(fd, buf, len);
+    } while (nread == -1 && errno == EINTR);
+    return nread;
+}
+
+/**
+ * Returns the format indicated by the first bytes of a file.
+ */
+static int detect_format(const unsigned char *magic, ssize_t len) {
+    if (len >= 2 && magic[0] == 0x1f && magic[1] == 0x8b) {
+        return STREAM_GZIP;
+    }
+    else if (len >= 4 && magic[0] == 0x28 && magic[1] == 0xb5
+            && magic[2] == 0x2f && magic[3] == 0xfd) {
+        return STREAM_ZSTD;
+    }
+    else {
+        return STREAM_PLAIN;
+    }
+}
+
+#if defined(HAVE_ZLIB) || defined(HAVE_ZSTD)
+/**
+ * Returns the buffer of the next free block in the queue, waiting until the
+ * reader has made room. Returns NULL if the stream is being closed.
+ */
+static char *acquire_block(InputStream *stream) {
+    char *data = NULL;
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->count == STREAM_QUEUE_DEPTH && !stream->closing) {
+        pthread_cond_wait(&stream->not_full, &stream->lock);
+    }
+    if (!stream->closing) {
+        data = stream->blocks[(stream->head + stream->count)
+            % STREAM_QUEUE_DEPTH].data;
+    }
+    pthread_mutex_unlock(&stream->lock);
+    return data;
+}
+
+/**
+ * Hands the block most recently returned by acquire_block to the reader. Empty
+ * blocks are never published, since the reader treats them as end of stream.
+ */
+static void publish_block(InputStream *stream, size_t len) {
+    if (len == 0) {
+        return;
+    }
+    pthread_mutex_lock(&stream->lock);
+    stream->blocks[(stream->head + stream->count) % STREAM_QUEUE_DEPTH].len =
+        len;
+    stream->count++;
+    pthread_cond_signal(&stream->not_empty);
+    pthread_mutex_unlock(&stream->lock);
+}
+#endif
+
+#ifdef HAVE_ZLIB
+/**
+ * Decodes a gzip file, including files of several concatenated members, into
+ * the block queue. Returns 1 on success and 0 on error.
+ */
+static int decode_gzip(InputStream *stream) {
+    z_stream z;
+    unsigned char *in;
+    char *out;
+    ssize_t nread;
+    int ret, in_member, ok;
+
+    memset(&z, 0, sizeof(z));
+    if (!(in = (unsigned char *) malloc(STREAM_INPUT_SIZE))) {
+        return 0;
+    }
+    else if (inflateInit2(&z, 15 + 32) != Z_OK) {
+        free(in);
+        return 0;
+    }
+
+    ok = 1;
+    in_member = 0;
+    if ((out = acquire_block(stream)) != NULL) {
+        z.next_out = (unsigned char *) out;
+        z.avail_out = STREAM_BLOCK_SIZE;
+    }
+    while (out) {
+        if (z.avail_in == 0) {
+            if ((nread = read_fully(stream->fd, in, STREAM_INPUT_SIZE)) <= 0) {
+                ok = nread == 0 && !in_member;
+                break;
+            }
+            z.next_in = in;
+            z.avail_in = nread;
+        }
+
+        ret = inflate(&z, Z_NO_FLUSH);
+        if (ret == Z_STREAM_END) {
+            // Another member may follow this one.
+            in_member = 0;
+            inflateReset(&z);
+        }
+        else if (ret == Z_OK || ret == Z_BUF_ERROR) {
+            in_member = 1;
+        }
+        else {
+            ok = 0;
+            break;
+        }
+
+        if (z.avail_out == 0) {
+            publish_block(stream, STREAM_BLOCK_SIZE);
+            if ((out = acquire_block(stream)) != NULL) {
+                z.next_out = (unsigned char *) out;
+                z.avail_out = STREAM_BLOCK_SIZE;
+            }
+        }
+    }
+    if (out && ok) {
+        publish_block(stream, STREAM_BLOCK_SIZE - z.avail_out);
+    }
+
+    inflateEnd(&z);
+    free(in);
+    return ok;
+}
+#endif
+
+#ifdef HAVE_ZSTD
+/**
+ * Decodes a zstd file, including files of several frames, into the block
+ * queue. Returns 1 on success and 0 on error.
+ */
+static int decode_zstd(InputStream *stream) {
+    ZSTD_DStream *z;
+    ZSTD_inBuffer input;
+    ZSTD_outBuffer output;
+    void *in;
+    ssize_t nread;
+    size_t ret;
+    int in_frame, ok;
+
+    if (!(in = malloc(STREAM_INPUT_SIZE))) {
+        return 0;
+    }
+    else if (!(z = ZSTD_createDStream())) {
+        free(in);
+        return 0;
+    }
+    ZSTD_initDStream(z);
+
+    ok = 1;
+    in_frame = 0;
+    input.src = in;
+    input.size = input.pos = 0;
+    output.size = STREAM_BLOCK_SIZE;
+    output.pos = 0;
+    output.dst = acquire_block(stream);
+    while (output.dst) {
+        if (input.pos == input.size) {
+            if ((nread = read_fully(stream->fd, in, STREAM_INPUT_SIZE)) <= 0) {
+                ok = nread == 0 && !in_frame;
+                break;
+            }
+            input.size = nread;
+            input.pos = 0;
+        }
+
+        ret = ZSTD_decompressStream(z, &output, &input);
+        if (ZSTD_isError(ret)) {
+            ok = 0;
+            break;
+        }
+        in_frame = ret != 0;
+
+        if (output.pos == output.size) {
+            publish_block(stream, output.pos);
+            output.dst = acquire_block(stream);
+            output.pos = 0;
+        }
+    }
+    if (output.dst && ok) {
+        publish_block(stream, output.pos);
+    }
+
+    ZSTD_freeDStream(z);
+    free(in);
+    return ok;
+}
+#endif
+
+/**
+ * Entry point of the decoder thread. Decodes the whole file into the block
+ * queue, then marks the stream as finished.
+ */
+static void *decoder_main(void *arg) {
+    InputStream *stream = (InputStream *) arg;
+    int ok = 0;
+
+#ifdef HAVE_ZLIB
+    if (stream->format == STREAM_GZIP) {
+        ok = decode_gzip(stream);
+    }
+#endif
+#ifdef HAVE_ZSTD
+    if (stream->format == STREAM_ZSTD) {
+        ok = decode_zstd(stream);
+    }
+#endif
+
+    pthread_mutex_lock(&stream->lock);
+    stream->done = 1;
+    stream->error = !ok && !stream->closing;
+    pthread_cond_broadcast(&stream->not_empty);
+    pthread_mutex_unlock(&stream->lock);
+    return NULL;
+}
+
+/**
+ * Returns one if this build can decode the given format; zero otherwise.
+ */
+static int format_supported(int format) {
+    switch (format) {
+        case STREAM_PLAIN:
+            return 1;
+#ifdef HAVE_ZLIB
+        case STREAM_GZIP:
+            return 1;
+#endif
+#ifdef HAVE_ZSTD
+        case STREAM_ZSTD:
+            return 1;
+#endif
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Opens the given file for reading. The format is detected from the file's
+ * first bytes; for compressed files a decoder thread is started, which stays
+ * at most STREAM_QUEUE_DEPTH blocks ahead of the reader. Returns a pointer to
+ * a new stream, or NULL if the file cannot be opened, its format is not
+ * supported by this build, or memory allocation fails. Nothing is reported
+ * here; in the unsupported case errno is set to ENOTSUP so that the caller
+ * can say so.
+ */
+InputStream *stream_open(const char *filename) {
+    InputStream *stream;
+    unsigned char magic[4];
+    ssize_t len;
+    int i;
+
+    if (!(stream = (InputStream *) calloc(1, sizeof(struct InputStream)))) {
+        return NULL;
+    }
+    else if ((stream->fd = open(filename, O_RDONLY)) == -1) {
+        free(stream);
+        return NULL;
+    }
+
+    len = pread(stream->fd, magic, sizeof(magic), 0);
+    stream->format = detect_format(magic, len);
+    if (!format_supported(stream->format)) {
+        close(stream->fd);
+        free(stream);
+        errno = ENOTSUP;
+        return NULL;
+    }
+    else if (stream->format == STREAM_PLAIN) {
+        return stream;
+    }
+
+    for (i = 0; i < STREAM_QUEUE_DEPTH; i++) {
+        if (!(stream->blocks[i].data = (char *) malloc(STREAM_BLOCK_SIZE))) {
+            stream_close(stream);
+            return NULL;
+        }
+    }
+    pthread_mutex_init(&stream->lock, NULL);
+    pthread_cond_init(&stream->not_empty, NULL);
+    pthread_cond_init(&stream->not_full, NULL);
+    stream->running = 1;
+    if (pthread_create(&stream->decoder, NULL, decoder_main, stream) != 0) {
+        stream->running = 0;
+        stream_close(stream);
+        return NULL;
+    }
+    return stream;
+}
+
+/**
+ * Reads up to len decompressed bytes into the buffer. Plain files are read
+ * directly; compressed files are served from the decoder's block queue,
+ * waiting for the decoder if the queue is empty. Returns the number of bytes
+ * read, 0 at the end of the stream, or -1 on error.
+ */
+ssize_t stream_read(InputStream *stream, char *buf, size_t len) {
+    StreamBlock *block;
+    size_t copy;
+
+    if (!stream) {
+        return -1;
+    }
+    else if (stream->format == STREAM_PLAIN) {
+        return read_fully(stream->fd, buf, len);
+    }
+
+    pthread_mutex_lock(&stream->lock);
+    while (stream->count == 0 && !stream->done) {
+        pthread_cond_wait(&stream->not_empty, &stream->lock);
+    }
+    if (stream->count == 0) {
+        copy = stream->error;
+        pthread_mutex_unlock(&stream->lock);
+        return copy ? -1 : 0;
+    }
+    block = &stream->blocks[stream->head];
+    pthread_mutex_unlock(&stream->lock);
+
+    // The head block belongs to the reader until it is released below.
+    copy = block->len - stream->offset;
+    if (copy > len) {
+        copy = len;
+    }
+    memcpy(buf, block->data + stream->offset, copy);
+    stream->offset += copy;
+
+    if (stream->offset == block->len) {
+        pthread_mutex_lock(&stream->lock);
+        stream->head = (stream->head + 1) % STREAM_QUEUE_DEPTH;
+        stream->count--;
+        stream->offset = 0;
+        pthread_cond_signal(&stream->not_full);
+        pthread_mutex_unlock(&stream->lock);
+    }
+    return copy;
+}
+
+/**
+ * Closes the stream, stopping its decoder thread and freeing all associated
+ * memory.
+ */
+void stream_close(InputStream *stream) {
+    int i;
+
+    if (!stream) {
+        return;
+    }
+    if (stream->running) {
+        pthread_mutex_lock(&stream->lock);
+        stream->closing = 1;
+        pthread_cond_broadcast(&stream->not_full);
+        pthread_mutex_unlock(&stream->lock);
+        pthread_join(stream->decoder, NULL);
+        pthread_mutex_destroy(&stream->lock);
+        pthread_cond_destroy(&stream->not_empty);
+        pthread_cond_destroy(&stream->not_full);
+    }
+    for (i = 0; i < STREAM_QUEUE_DEPTH; i++) {
+        free(stream->blocks[i].data);
+    }
+    close(stream->fd);
+    free(stream);
+}
@@ -0,0 +1,69 @@
+#ifndef STREAM_H
+#define STREAM_H
+
+#include <pthread.h>
+#include <sys/types.h>
+
+#define STREAM_QUEUE_DEPTH 4
+
+/*
+ * Formats recognized by stream_open, detected from the file's magic bytes.
+ */
+#define STREAM_PLAIN 0
+#define STREAM_GZIP 1
+#define STREAM_ZSTD 2
+
+/**
+ * A block of decompressed data handed from the decoder thread to the reader.
+ */
+struct StreamBlock {
+    char *data;
+    size_t len;
+};
+
+typedef struct StreamBlock StreamBlock;
+
+/**
+ * A sequential input stream over a file that may be compressed. Compressed
+ * files are decoded on a separate thread into a bounded queue of blocks, so
+ * decompression overlaps with whatever the reader does with the data.
+ */
+struct InputStream {
+    int fd;
+    int format;
+    int running;
+    pthread_t decoder;
+    pthread_mutex_t lock;
+    pthread_cond_t not_empty;
+    pthread_cond_t not_full;
+    StreamBlock blocks[STREAM_QUEUE_DEPTH];
+    int head;
+    int count;
+    int done;
+    int error;
+    int closing;
+    size_t offset;
+};
+
+typedef struct InputStream InputStream;
+
+/**
+ * Opens the given file for reading, detecting gzip and zstd compression.
+ * Returns a pointer to a new stream, or NULL if the file cannot be opened or
+ * its format is not supported by this build, in which case errno is ENOTSUP.
+ */
+InputStream *stream_open(const char *);
+
+/**
+ * Reads up to the given number of decompressed bytes into the buffer. Returns
+ * the number of bytes read, 0 at the end of the stream, or -1 on error.
+ */
+ssize_t stream_read(InputStream *, char *, size_t);
+
+/**
+ * Closes the stream, stopping its decoder thread and freeing all associated
+ * memory.
+ */
+void stream_close(InputStream *);
+
+#endif
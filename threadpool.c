@@ -0,0 +1,147 @@
+#include "threadpool.h"
+#include <pthread.h>
+#include <stdlib.h>
+#include <unistd.h>
+
+/**
+ * Returns the number of online processors, or 1 if it cannot be determined.
+ */
+int pool_default_size(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int) n : 1;
+}
+
+/**
+ * Body of each worker thread: takes tasks off the queue and runs them until
+ * the pool is stopped and the queue is empty.
+ */
+static void *worker_main(void *arg) {
+    ThreadPool *pool = (ThreadPool *) arg;
+    Task *task;
+
+    pthread_mutex_lock(&pool->lock);
+    while (1) {
+        while (!pool->head && !pool->stopping) {
+            pthread_cond_wait(&pool->work, &pool->lock);
+        }
+        if (!pool->head) {
+            break;
+        }
+        task = pool->head;
+        pool->head = task->next;
+        if (!pool->head) {
+            pool->tail = NULL;
+        }
+        pthread_mutex_unlock(&pool->lock);
+
+        task->func(task->arg);
+        free(task);
+
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->pending == 0) {
+            pthread_cond_broadcast(&pool->idle);
+        }
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+/**
+ * Creates a pool with the given number of worker threads. Returns a pointer
+ * to the new pool, or NULL if memory allocation or thread creation fails.
+ */
+ThreadPool *pool_create(int nthreads) {
+    ThreadPool *pool;
+    int i;
+
+    if (nthreads <= 0 || !(pool = (ThreadPool *) malloc(sizeof(ThreadPool)))) {
+        return NULL;
+    }
+    else if (!(pool->threads = (pthread_t *) malloc(nthreads
+                    * sizeof(pthread_t)))) {
+        free(pool);
+        return NULL;
+    }
+    pool->nthreads = 0;
+    pool->head = pool->tail = NULL;
+    pool->pending = 0;
+    pool->stopping = 0;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->idle, NULL);
+
+    for (i = 0; i < nthreads; i++) {
+        if (pthread_create(&pool->threads[i], NULL, worker_main, pool) != 0) {
+            pool_destroy(pool);
+            return NULL;
+        }
+        pool->nthreads++;
+    }
+    return pool;
+}
+
+/**
+ * Queues a task to be run by one of the pool's threads. Returns 1 on success
+ * and 0 if memory allocation fails or the pool is NULL.
+ */
+int pool_submit(ThreadPool *pool, TaskFunc func, void *arg) {
+    Task *task;
+
+    if (!pool || !func || !(task = (Task *) malloc(sizeof(Task)))) {
+        return 0;
+    }
+    task->func = func;
+    task->arg = arg;
+    task->next = NULL;
+
+    pthread_mutex_lock(&pool->lock);
+    if (pool->tail) {
+        pool->tail->next = task;
+    }
+    else {
+        pool->head = task;
+    }
+    pool->tail = task;
+    pool->pending++;
+    pthread_cond_signal(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    return 1;
+}
+
+/**
+ * Waits until every task submitted so far has finished.
+ */
+void pool_wait(ThreadPool *pool) {
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    while (pool->pending > 0) {
+        pthread_cond_wait(&pool->idle, &pool->lock);
+    }
+    pthread_mutex_unlock(&pool->lock);
+}
+
+/**
+ * Waits for all queued tasks to finish, stops the worker threads and frees all
+ * associated memory.
+ */
+void pool_destroy(ThreadPool *pool) {
+    int i;
+
+    if (!pool) {
+        return;
+    }
+    pthread_mutex_lock(&pool->lock);
+    pool->stopping = 1;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+    for (i = 0; i < pool->nthreads; i++) {
+        pthread_join(pool->threads[i], NULL);
+    }
+    pthread_mutex_destroy(&pool->lock);
+    pthread_cond_destroy(&pool->work);
+    pthread_cond_destroy(&pool->idle);
+    free(pool->threads);
+    free(pool);
+}
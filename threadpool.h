@@ -0,0 +1,67 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+
+#include <pthread.h>
+
+/*
+ * Type of a task run by the pool.
+ */
+typedef void (*TaskFunc)(void *);
+
+/**
+ * A queued task: a function and its argument.
+ */
+struct Task {
+    TaskFunc func;
+    void *arg;
+    struct Task *next;
+};
+
+typedef struct Task Task;
+
+/**
+ * A fixed-size pool of worker threads that run tasks from a shared FIFO queue.
+ */
+struct ThreadPool {
+    pthread_t *threads;
+    int nthreads;
+    Task *head;
+    Task *tail;
+    int pending;
+    int stopping;
+    pthread_mutex_t lock;
+    pthread_cond_t work;
+    pthread_cond_t idle;
+};
+
+typedef struct ThreadPool ThreadPool;
+
+/**
+ * Returns the number of online processors, or 1 if it cannot be determined.
+ */
+int pool_default_size(void);
+
+/**
+ * Creates a pool with the given number of worker threads. Returns a pointer
+ * to the new pool, or NULL if the call fails.
+ */
+ThreadPool *pool_create(int);
+
+/**
+ * Queues a task to be run by one of the pool's threads. Returns 1 on success
+ * and 0 if memory allocation fails.
+ */
+int pool_submit(ThreadPool *, TaskFunc, void *);
+
+/**
+ * Waits until every task submitted so far has finished.
+ */
+void pool_wait(ThreadPool *);
+
+/**
+ * Waits for all queued tasks to finish, stops the worker threads and frees all
+ * associated memory.
+ */
+void pool_destroy(ThreadPool *);
+
+#endif
@@ -1,26 +1,18 @@
 /*
  * tokenizer.c
  */
+#include "tokenizer.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
 
 #define MAX_HEX_CHARS 2
 #define MAX_OCT_CHARS 3
 
-/*
- * Tokenizer type.  You need to fill in the type as part of your implementation.
- */
-
-struct TokenizerT_ {
-	char* copied_string;
-	char* delimiters;		
-	char* current_position;
-};
-
-typedef struct TokenizerT_ TokenizerT;
-
 char is_escape_character(char character) {
 	
 	/*
@@ -33,15 +25,13 @@ char is_escape_character(char character) {
 
 	char* escape_sequence = "ntvbrfa\\?'\"";
 	char* escape_characters = "\n\t\v\b\r\f\a\\\?\'\"";
-	int offset = 0;
+	char* match = NULL;
 	
-	for(offset = 0; offset < strlen(escape_sequence); offset++) {
-		if(*(escape_sequence + offset) == character) {
-			return *(escape_characters + offset);
-		}
+	if(character == '\0' || (match = strchr(escape_sequence, character)) == NULL) {
+		return 0;
 	}
 	
-	return 0;
+	return *(escape_characters + (match - escape_sequence));
 }
  
 int char_to_hex(char character) {
@@ -104,12 +94,17 @@ char* unescape_string(char* string) {
 	 * 
 	 */
 
-	char* unescaped_string = (char*)malloc(strlen(string) * sizeof(char) + 1);
-	int current_position = 0;
-	int unescaped_string_position = 0;
+	size_t length = strlen(string);
+	char* unescaped_string = (char*)malloc(length * sizeof(char) + 1);
+	size_t current_position = 0;
+	size_t unescaped_string_position = 0;
 	unsigned char escape_character = 0;	
 	
-	for(current_position = 0; current_position < strlen(string); current_position++) {	
+	if(unescaped_string == NULL) {
+		return NULL;
+	}
+	
+	for(current_position = 0; current_position < length; current_position++) {	
 			escape_character = *(string + current_position);
 			if(*(string + current_position) == '\\') {
 				if(*(string + current_position + 1) == 'x') {
@@ -157,18 +152,145 @@ char* unescape_string(char* string) {
 
 
 
+/*
+ * TKInit sets up a tokenizer in caller-provided storage for a given set of
+ * separator characters (given as a string, taken literally) and a buffer of
+ * the given length, which need not be null-terminated. Nothing is copied or
+ * allocated: the tokenizer refers to the caller's buffer, which must outlive
+ * it.
+ */
+
+void TKInit(TokenizerT *tk, const char *separators, const char *buffer, size_t length) {
+	
+	/*
+	 * Description: builds the delimiter lookup table and points the tokenizer at the buffer
+	 * Parameters: tokenizer to initialize, set of delimiters, buffer to tokenize, length of the buffer
+	 * Modifies: tokenizer: all fields
+	 * Returns: nothing
+	 */
+	
+	const unsigned char* current = NULL;
+	
+	memset(tk->delimiters, 0, sizeof(tk->delimiters));
+	tk->simd_count = 0;
+	for(current = (const unsigned char*) separators; *current != '\0'; current++) {
+		if(!tk->delimiters[*current]) {
+			tk->delimiters[*current] = 1;
+			if(tk->simd_count >= 0 && tk->simd_count < TK_SIMD_MAX_DELIMITERS) {
+				tk->simd_delimiters[tk->simd_count++] = *current;
+			} else {
+				// Too many delimiters to compare against in parallel.
+				tk->simd_count = -1;
+			}
+		}
+	}
+	
+	tk->copied_string = NULL;
+	TKReset(tk, buffer, length);
+}
+
+/*
+ * TKReset points an initialized tokenizer at a new buffer, keeping its
+ * delimiters. This lets one tokenizer be reused across many lines without
+ * rebuilding its lookup table.
+ */
+
+void TKReset(TokenizerT *tk, const char *buffer, size_t length) {
+	tk->current_position = buffer;
+	tk->end = buffer + length;
+}
+
+int is_delimiter(const TokenizerT *tk, char character) {
+	
+	/*
+	 * Description: determines if a particular character is a member of the set of delimiters
+	 * Parameters: tokenizer holding the delimiter table, character to be looked up
+	 * Modifies: Nothing
+	 * Returns: 1 if character is a delimiter, 0 if it is not
+	 */
+	
+	return tk->delimiters[(unsigned char) character];
+}
+
+static const char *find_delimiter(const TokenizerT *tk, const char *position) {
+	
+	/*
+	 * Description: finds the first delimiter at or after a position, 16 bytes at a time with SSE2
+	 * when the delimiter set is small enough and one byte at a time through the table otherwise
+	 * Parameters: tokenizer, position to start scanning from
+	 * Modifies: nothing
+	 * Returns: position of the first delimiter, or the end of the buffer if there is none
+	 */
+	
+#ifdef __SSE2__
+	__m128i chunk, hits;
+	int mask, i;
+	
+	if(tk->simd_count > 0) {
+		while(tk->end - position >= 16) {
+			chunk = _mm_loadu_si128((const __m128i*) position);
+			hits = _mm_cmpeq_epi8(chunk, _mm_set1_epi8((char) tk->simd_delimiters[0]));
+			for(i = 1; i < tk->simd_count; i++) {
+				hits = _mm_or_si128(hits, _mm_cmpeq_epi8(chunk, _mm_set1_epi8((char) tk->simd_delimiters[i])));
+			}
+			if((mask = _mm_movemask_epi8(hits)) != 0) {
+				return position + __builtin_ctz(mask);
+			}
+			position += 16;
+		}
+	}
+#endif
+	
+	while(position < tk->end && !is_delimiter(tk, *position)) {
+		position++;
+	}
+	return position;
+}
+
+/*
+ * TKNextSlice finds the next token in the tokenizer's buffer. The token is
+ * returned as a pointer into the buffer and a length; it is not
+ * null-terminated and nothing is allocated.
+ *
+ * If there is another token, it returns 1 and fills in the slice. Else it
+ * returns 0.
+ */
+
+int TKNextSlice(TokenizerT *tk, const char **token, size_t *length) {
+	
+	/*
+	 * Description: skips leading delimiters, then scans to the end of the token
+	 * Parameters: tokenizer from which to extract token, slice to fill in
+	 * Modifies: tokenizer->current_position: identifies starting point of next token
+	 * Returns: 1 if a token was found, 0 at the end of the buffer
+	 */
+	
+	const char* token_start = tk->current_position;
+	
+	while(token_start < tk->end && is_delimiter(tk, *token_start)) {
+		token_start++;
+	}
+	if(token_start == tk->end) {
+		tk->current_position = tk->end;
+		return 0;
+	}
+	
+	tk->current_position = find_delimiter(tk, token_start);
+	*token = token_start;
+	*length = tk->current_position - token_start;
+	return 1;
+}
+
 /*
  * TKCreate creates a new TokenizerT object for a given set of separator
  * characters (given as a string) and a token stream (given as a string).
- * 
- * TKCreate should copy the two arguments so that it is not dependent on
- * them staying immutable after returning.  (In the future, this may change
- * to increase efficiency.)
+ * Escape sequences in both are expanded.
+ *
+ * TKCreate copies the token stream so that it is not dependent on it staying
+ * immutable after returning. Use TKInit to tokenize a buffer in place.
  *
  * If the function succeeds, it returns a non-NULL TokenizerT.
  * Else it returns NULL.
- *
- * You need to fill in this function as part of your implementation.
  */
 
 TokenizerT *TKCreate(char *separators, char *ts) {
@@ -181,28 +303,37 @@ TokenizerT *TKCreate(char *separators, char *ts) {
 	 * 
 	 */
 	 
+	char* delimiters = NULL;
+	TokenizerT* tokenizer = NULL;
+	
 	if(separators == NULL || ts == NULL){
 		return NULL;
 	}
 	
-	TokenizerT* tokenizer = (TokenizerT*)malloc(sizeof(TokenizerT));
+	tokenizer = (TokenizerT*)malloc(sizeof(TokenizerT));
+	delimiters = unescape_string(separators);
 	
-	if(tokenizer == NULL){
+	if(tokenizer == NULL || delimiters == NULL){
+		free(tokenizer);
+		free(delimiters);
 		return NULL;
 	}
 	
-	tokenizer->delimiters = unescape_string(separators);
-	tokenizer->copied_string = unescape_string(ts);
-	tokenizer->current_position = tokenizer->copied_string;
+	TKInit(tokenizer, delimiters, "", 0);
+	free(delimiters);
+	
+	if((tokenizer->copied_string = unescape_string(ts)) == NULL) {
+		free(tokenizer);
+		return NULL;
+	}
+	TKReset(tokenizer, tokenizer->copied_string, strlen(tokenizer->copied_string));
 	
 	return tokenizer;
 }
 
 /*
- * TKDestroy destroys a TokenizerT object.  It should free all dynamically
- * allocated memory that is part of the object being destroyed.
- *
- * You need to fill in this function as part of your implementation.
+ * TKDestroy destroys a TokenizerT object created by TKCreate. It frees all
+ * dynamically allocated memory that is part of the object being destroyed.
  */
 
 void TKDestroy(TokenizerT *tk) {	
@@ -214,44 +345,23 @@ void TKDestroy(TokenizerT *tk) {
 	 * Returns: nothing 
 	 */
 	 
+	if(tk == NULL) {
+		return;
+	}
 	free(tk->copied_string);
-	free(tk->delimiters);
 	free(tk);
 	
 	return;
 }
 
-
-char is_delimiter(char character, char* delimiters) {
-	
-	/*
-	 * Description: determines if a particular character is a member of the set of delimiters
-	 * Parameters: character to be compared, string of delimiters
-	 * Modifies: Nothing
-	 * Returns: 1 if character is a delimiter, 0 if it is not
-	 */
-	
-	char* current = NULL;
-	
-	for(current = delimiters; current - delimiters < strlen(delimiters); current++) {
-		if(character == *current) {
-			return 1;
-		}
-	}
-	return 0;
-}
-
-
 /*
  * TKGetNextToken returns the next token from the token stream as a
- * character string.  Space for the returned token should be dynamically
+ * character string.  Space for the returned token is dynamically
  * allocated.  The caller is responsible for freeing the space once it is
- * no longer needed.
+ * no longer needed. Use TKNextSlice to avoid the allocation.
  *
  * If the function succeeds, it returns a C string (delimited by '\0')
  * containing the token.  Else it returns 0.
- *
- * You need to fill in this function as part of your implementation.
  */
 
 char *TKGetNextToken(TokenizerT *tk) {
@@ -264,30 +374,18 @@ char *TKGetNextToken(TokenizerT *tk) {
 	 */
 	
 	char* token = NULL;
-	char* token_start = NULL;
+	const char* token_start = NULL;
+	size_t length = 0;
 
-	while(tk->current_position - tk->copied_string < strlen(tk->copied_string)) {
-		if(!is_delimiter(*tk->current_position, tk->delimiters)) {
-		
-			token_start = tk->current_position;
-			break;
-		}
-		tk->current_position++;
-	}
-	
-	if(token_start == NULL) {
+	if(!TKNextSlice(tk, &token_start, &length)) {
 		return NULL;
 	}
-	
-	while(tk->current_position - tk->copied_string < strlen(tk->copied_string)) {
-		if(is_delimiter(*tk->current_position, tk->delimiters)) {
-			break;
-		}
-		tk->current_position++;
-	}	
 
-	token = (char*)malloc(sizeof(char) * (tk->current_position - token_start + 1));
-	strncpy(token, token_start, tk->current_position - token_start);
-	token[(tk->current_position - token_start)] = '\0';
+	token = (char*)malloc(sizeof(char) * (length + 1));
+	if(token == NULL) {
+		return NULL;
+	}
+	memcpy(token, token_start, length);
+	token[length] = '\0';
 	return token;
 }
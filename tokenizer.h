@@ -1,20 +1,40 @@
 #ifndef TOKENIZER_H
 #define TOKENIZER_H
 
+#include <stddef.h>
+
+#define TK_SIMD_MAX_DELIMITERS 4
+
+/*
+ * Tokenizer type. The delimiters are kept as a 256-entry lookup table; when
+ * there are only a few of them they are also kept as a list, so that the
+ * tokenizer can scan 16 bytes at a time with SSE2. Tokens are returned as
+ * (pointer, length) slices of the input, so a tokenizer never allocates once
+ * it is set up and any number of them can be used concurrently.
+ */
 struct TokenizerT_ {
 	char* copied_string;
-	char* current_position;
+	const char* current_position;
+	const char* end;
+	unsigned char delimiters[256];
+	unsigned char simd_delimiters[TK_SIMD_MAX_DELIMITERS];
+	int simd_count;
 };
 
 typedef struct TokenizerT_ TokenizerT;
 
 // Helper functions
 char *unescape_string(char *);
-char is_delimiter(char);
 char is_escape_character(char);
+int is_delimiter(const TokenizerT *, char);
 int char_to_hex(char);
 int char_to_oct(char);
 
+// Allocation-free tokenizer methods
+void TKInit(TokenizerT *, const char *, const char *, size_t);
+void TKReset(TokenizerT *, const char *, size_t);
+int TKNextSlice(TokenizerT *, const char **, size_t *);
+
 // Tokenizer methods
 TokenizerT *TKCreate(char *, char *);
 char *TKGetNextToken(TokenizerT *);